@@ -3,6 +3,16 @@
 #include <stdarg.h>
 #include <assert.h>
 
+#include <string.h>
+
+#include <new>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+
+#include "log.h"
+
 #define YELLOW "<font color=Gold>"
 #define RED    "<font color=DarkRed>"
 #define ORANGE "<font color=DarkOrange>"
@@ -14,78 +24,180 @@
 
 #define LOG_FILE "log.html"
 
-/*________________________________USER_FUNCTION_DECLARATIONS_________________________________*/
+/*______________________________ADDITIONAL_FUNCTION_DECLARATIONS_____________________________*/
 
 /**
-*   @brief Prints message in LOG_FILE.
-*
-*   @param fmt [in] - printf format
+*   @brief Opens log-file. Ckecks if opening is OK and in this case prints message in the log-file.
+*   @brief Uses atexit() to call LOG_STREAM_CLOSE() after program end.
 *
-*   @return nothing
+*   @return 1 if checking is OK. Does abort() if an ERROR found.
 */
-void log_message       (const char *fmt, ...);
+static int LOG_STREAM_OPEN  ();
 
 /**
-*   @brief Prints error-message in LOG_FILE. Before the message prints "ERROR: ".
-*
-*   @param fmt [in] - printf format
+*   @brief Closes log-file. Called by using atexit().
 *
-*   @return nothing
+*   @return 1 if closing is OK. Does abort() if an ERROR found.
 */
-void log_error         (const char *fmt, ...);
+static void LOG_STREAM_CLOSE ();
 
-/**
-*   @brief Prints warning-message in LOG_FILE. Before the message prints "WARNING: ".
-*
-*   @param fmt [in] - printf format
-*
-*   @return nothing
-*/
-void log_warning       (const char *fmt, ...);
+/*___________________________________________________________________________________________*/
 
-void log_header        (const char *fmt, ...);
+/*___________________________________________LOG_RING______________________________________*/
 
 /**
-*   @brief Prints string in LOG_FILE even if it is "nullptr" or "poison".
+*   log_message() and the others format the message in the records of the ring buffer and return. The thread
+*   LOG_WRITER writes the records in order in LOG_FILE. Producers take records by one compare-exchange, so the ring
+*   buffer is lock-free for them. If the ring is full, the producer waits for the writer.
 *
-*   @param str_name [in] - name of string to print
-*   @param str      [in] - pointer to the first byte of string to print
-*   @param len      [in] - minimal length of segment occupied by string
+*   A message longer than a record takes several consecutive records, the writer prints them as one text. Messages
+*   longer than RECORD_CHAIN records are cut and end with TRUNCATED_MARK.
 *
-*   @return nothing
+*   LOG_STREAM_CLOSE() sets LOG_CLOSED and waits until the producers that have not seen it finish their records,
+*   so the ring is not freed under them. Messages logged after that are dropped.
 */
-void log_char_ptr      (const char *str_name, const char *str);
 
-void log_param_place   (const char   *file,
-                        const char   *func,
-                        const int     line);
+enum LOG_KIND
+{
+    KIND_MESSAGE    ,
+    KIND_ERROR      ,
+    KIND_WARNING    ,
+    KIND_HEADER     ,
+};
 
-void *log_calloc(size_t number, size_t size);
-void  log_free  (void *ptr);
-void log_end_header();
-/*______________________________ADDITIONAL_FUNCTION_DECLARATIONS_____________________________*/
+static const int RECORD_TEXT  =  240;
+static const int RECORD_CHAIN =   64;   // records of one message at most
+static const int RING_SIZE    = 4096;   // power of 2
 
-/**
-*   @brief Opens log-file. Ckecks if opening is OK and in this case prints message in the log-file.
-*   @brief Uses atexit() to call LOG_STREAM_CLOSE() after program end.
-*
-*   @return 1 if checking is OK. Does abort() if an ERROR found.
-*/
-static int LOG_STREAM_OPEN  ();
+static const char TRUNCATED_MARK[] = " [truncated]\n";
 
-/**
-*   @brief Closes log-file. Called by using atexit().
-*
-*   @return 1 if closing is OK. Does abort() if an ERROR found.
-*/
-static void LOG_STREAM_CLOSE ();
+struct Log_record
+{
+    std::atomic<unsigned long> seq;
+
+    LOG_KIND            kind;
+    int                 size;
+    bool                is_first;       // kind_before[] is printed before the record
+    bool                is_last;        // kind_after [] is printed after  the record
+
+    char                text[RECORD_TEXT];
+};
+
+static const char *kind_before[] =
+{
+    ""                  , // KIND_MESSAGE
+    RED    "ERROR: "    , // KIND_ERROR
+    ORANGE "WARNING: "  , // KIND_WARNING
+    "<h2>\n"            , // KIND_HEADER
+};
+
+static const char *kind_after[] =
+{
+    ""                  , // KIND_MESSAGE
+    CANCEL              , // KIND_ERROR
+    CANCEL              , // KIND_WARNING
+    "</h2>\n"           , // KIND_HEADER
+};
+
+static Log_record                *LOG_RING    = nullptr;
+static std::thread               *LOG_WRITER  = nullptr;
+static std::atomic<unsigned long> RING_TAIL(0);             // next record for producers
+static std::atomic<unsigned long> RING_HEAD(0);             // next record for the writer
+static std::atomic<unsigned long> RING_WRITTEN(0);          // records before it are written and flushed
+static std::atomic<bool>          WRITER_STOP(false);
+static std::atomic<bool>          LOG_CLOSED(false);        // set by LOG_STREAM_CLOSE(), nothing is logged after it
+static std::atomic<int>           LOG_WRITING(0);           // threads inside log_write()
+static std::mutex                 SYNC_LOCK;                // used if the writer thread can't be started
+
+static void         log_write       (LOG_KIND kind, const char *fmt, va_list ap);
+static void         ring_push       (LOG_KIND kind, const char *fmt, va_list ap);
+static void         ring_put        (LOG_KIND kind, const char *text, const int size);
+static unsigned long ring_reserve   (const int records);
+static void         ring_writer     ();
+static bool         ring_write_one  ();
 
 /*___________________________________________________________________________________________*/
 
 static FILE *LOG_STREAM            = nullptr;
 static int  _OPEN_CLOSE_LOG_STREAM = LOG_STREAM_OPEN();
-static int   DYNAMIC_MEMORY        = 0;
-void          *STORE_MEMORY[1000]  = {};
+
+std::atomic<int>      LOG_RUNTIME_LEVEL      (LOG_LVL_DEBUG);
+std::atomic<unsigned> LOG_RUNTIME_CATEGORIES (LOG_CAT_ALL);
+
+/*___________________________________MEMORY_ACCOUNTING_______________________________________*/
+
+/**
+*   Every thread counts its allocations in its own Thread_memory, so log_calloc() and log_free() don't share
+*   any cache line. The readers sum the counters of the alive threads and the counters left by the finished ones.
+*   The live size is the only global value: a thread adds its changes to it by portions of LIVE_BATCH bytes.
+*   So the peak is exact for one thread and may be overestimated up to LIVE_BATCH bytes per other thread.
+*
+*   The counters of a thread cover only the sites it has used, rounded up to SITE_CHUNK. The array grows under
+*   MEMORY_LOCK, so the readers, which hold it too, never see the freed one.
+*/
+
+typedef std::atomic<long long> Counter;
+
+struct Site_counters
+{
+    Counter alloc_calls;
+    Counter alloc_bytes;
+    Counter  free_calls;
+    Counter  free_bytes;
+
+    Counter hist[LOG_HIST_SIZE];
+};
+
+struct Thread_memory
+{
+    Site_counters *sites;
+    int            sites_num;
+    Counter        live_delta;
+    Counter        peak_delta;  // maximum of live_delta since the last transfer to LIVE_BYTES
+
+    Thread_memory *next;
+    Thread_memory *prev;
+};
+
+struct Thread_memory_holder
+{
+    Thread_memory *memory;
+    ~Thread_memory_holder();
+};
+
+struct Block_header     // stored before each block of log_calloc(), keeps 16-byte alignment
+{
+    size_t  size;
+    int     site;
+    int     pad;
+};
+
+static const long long LIVE_BATCH = 1 << 16;
+static const int       SITE_CHUNK = 16;
+
+static Thread_memory          *THREAD_MEMORY_LIST = nullptr;
+static Thread_memory           RETIRED_MEMORY     = {};
+static std::mutex              MEMORY_LOCK;
+
+static const char             *SITE_FILE[LOG_MAX_SITES] = {"unregistered"};
+static int                     SITE_LINE[LOG_MAX_SITES] = {};
+static int                     SITE_NUMBER              =  1;
+
+static Counter                 LIVE_BYTES(0);
+static Counter                 PEAK_BYTES(0);
+
+static thread_local Thread_memory_holder THREAD_MEMORY   = {};
+static thread_local bool                 THREAD_FINISHED = false;
+
+static Thread_memory *get_thread_memory();
+static Site_counters *get_site         (Thread_memory *memory, int site);
+static bool           sites_reserve    (Thread_memory *memory, int sites_num);
+static void           add_counter      (Counter *counter, long long value);
+static void           add_live_bytes   (Thread_memory *memory, long long bytes);
+static void           merge_site       (Site_counters *to, Site_counters *from);
+static int            hist_bucket      (size_t size);
+
+/*___________________________________________________________________________________________*/
 
 static int LOG_STREAM_OPEN()
 {
@@ -97,8 +209,23 @@ static int LOG_STREAM_OPEN()
         return 0;
     }
 
-    setvbuf(LOG_STREAM,   nullptr, _IONBF, 0);
     fprintf(LOG_STREAM, "<pre>\n""\"%s\" OPENING IS OK\n\n", LOG_FILE);
+    fflush (LOG_STREAM);
+
+    LOG_RING = (Log_record *) calloc(RING_SIZE, sizeof(Log_record));
+    if (LOG_RING != nullptr)
+    {
+        for (unsigned long i = 0; i < RING_SIZE; ++i) LOG_RING[i].seq.store(i, std::memory_order_relaxed);
+
+        LOG_WRITER = new (std::nothrow) std::thread(ring_writer);
+    }
+    if (LOG_WRITER == nullptr)
+    {
+        free(LOG_RING);
+        LOG_RING = nullptr;
+
+        fprintf(LOG_STREAM, "Can't start the log writer. The log is synchronous.\n");
+    }
 
     atexit(LOG_STREAM_CLOSE);
     return 1;
@@ -108,11 +235,33 @@ static void LOG_STREAM_CLOSE()
 {
     assert (LOG_STREAM != nullptr);
 
-    fprintf(LOG_STREAM, "\n");
-    
-    if (DYNAMIC_MEMORY == 0) log_message(GREEN "DYNAMIC_MEMORY = 0. \n" CANCEL                );
-    else                     log_message(RED   "DYNAMIC_MEMORY = %d.\n" CANCEL, DYNAMIC_MEMORY);
+    log_message_write("\n");
     
+    Log_memory_stats stats = {};
+    log_memory_stats(&stats);
+
+    long long dynamic_memory = stats.alloc_calls - stats.free_calls;
+
+    if (dynamic_memory == 0) log_message_write(GREEN "DYNAMIC_MEMORY = 0. \n" CANCEL                );
+    else                     log_message_write(RED   "DYNAMIC_MEMORY = %lld.\n" CANCEL, dynamic_memory);
+
+    log_memory_dump();
+
+    LOG_CLOSED.store(true);
+    while (LOG_WRITING.load() > 0) std::this_thread::yield();
+
+    if (LOG_WRITER != nullptr)
+    {
+        WRITER_STOP.store(true, std::memory_order_release);
+        LOG_WRITER->join();
+
+        delete LOG_WRITER;
+        LOG_WRITER = nullptr;
+
+        free(LOG_RING);
+        LOG_RING = nullptr;
+    }
+
     fprintf(LOG_STREAM, "\n\n\"%s\" CLOSING IS OK\n\n", LOG_FILE);
     fclose (LOG_STREAM);
 }
@@ -132,32 +281,43 @@ void log_param_place(const char   *file,
                 "    LINE: %d\n", file, func, line);
 }
 
-void log_message(const char *fmt, ...)
-{
-    if (_OPEN_CLOSE_LOG_STREAM == 0) return;
+/**
+*   @brief Prints message in LOG_FILE.
+*
+*   @param fmt [in] - printf format
+*
+*   @return nothing
+*/
 
-    va_list  ap;
+void log_message_write(const char *fmt, ...)
+{
+    va_list ap;
     va_start(ap, fmt);
 
-    vfprintf(LOG_STREAM, fmt, ap);
+    log_write(KIND_MESSAGE, fmt, ap);
 
     va_end(ap);
 }
 
-void log_header(const char *fmt, ...)
+void log_header_write(const char *fmt, ...)
 {
-    if (_OPEN_CLOSE_LOG_STREAM == 0) return;
-
     va_list ap;
     va_start(ap, fmt);
 
-    fprintf (LOG_STREAM, "<h2>\n");
-    vfprintf(LOG_STREAM, fmt, ap);
-    fprintf (LOG_STREAM, "</h2>\n");
+    log_write(KIND_HEADER, fmt, ap);
 
     va_end(ap);
 }
 
+/**
+*   @brief Prints string in LOG_FILE even if it is "nullptr" or "poison".
+*
+*   @param str_name [in] - name of string to print
+*   @param str      [in] - pointer to the first byte of string to print
+*
+*   @return nothing
+*/
+
 void log_char_ptr(const char *str_name, const char *str)
 {
     assert(str_name != nullptr);
@@ -166,54 +326,581 @@ void log_char_ptr(const char *str_name, const char *str)
     else                    log_message("%s: " USUAL "\"%s\"\n"  CANCEL, str_name, str);
 }
 
-void log_error(const char *fmt, ...)
-{
-    if (_OPEN_CLOSE_LOG_STREAM == 0) return;
+/**
+*   @brief Prints error-message in LOG_FILE. Before the message prints "ERROR: ".
+*
+*   @param fmt [in] - printf format
+*
+*   @return nothing
+*/
 
+void log_error_write(const char *fmt, ...)
+{
     va_list ap;
     va_start(ap, fmt);
 
-    fprintf (LOG_STREAM, RED "ERROR: ");
-    vfprintf(LOG_STREAM, fmt, ap);
-    fprintf (LOG_STREAM, CANCEL);
+    log_write(KIND_ERROR, fmt, ap);
 
     va_end(ap);
 }
 
-void log_warning(const char *fmt, ...)
-{
-    if (_OPEN_CLOSE_LOG_STREAM == 0) return;
+/**
+*   @brief Prints warning-message in LOG_FILE. Before the message prints "WARNING: ".
+*
+*   @param fmt [in] - printf format
+*
+*   @return nothing
+*/
 
+void log_warning_write(const char *fmt, ...)
+{
     va_list ap;
     va_start(ap, fmt);
 
-    fprintf (LOG_STREAM, ORANGE "WARNING: ");
-    vfprintf(LOG_STREAM, fmt, ap);
-    fprintf (LOG_STREAM, CANCEL);
+    log_write(KIND_WARNING, fmt, ap);
 
     va_end(ap);
 }
 
-void *log_calloc(size_t number, size_t size)
+/**
+*   @brief Sets the maximal level of the messages to print. Levels above LOG_LEVEL are not compiled anyway.
+*/
+
+void log_set_level(int level)
+{
+    LOG_RUNTIME_LEVEL.store(level, std::memory_order_relaxed);
+}
+
+/**
+*   @brief Sets the categories of the messages to print. The other threads see the change on their next calls.
+*/
+
+void log_set_categories(unsigned categories)
+{
+    LOG_RUNTIME_CATEGORIES.store(categories, std::memory_order_relaxed);
+}
+
+/**
+*   @brief Waits until all records logged before are written in LOG_FILE. Call it before abort().
+*/
+
+void log_flush()
+{
+    if (_OPEN_CLOSE_LOG_STREAM == 0) return;
+
+    LOG_WRITING.fetch_add(1);
+    bool is_open = !LOG_CLOSED.load();
+
+    if (is_open && LOG_WRITER == nullptr)
+    {
+        std::lock_guard<std::mutex> guard(SYNC_LOCK);
+        fflush(LOG_STREAM);
+    }
+    else if (is_open)
+    {
+        unsigned long tail = RING_TAIL.load(std::memory_order_acquire);
+
+        while (RING_WRITTEN.load(std::memory_order_acquire) < tail) std::this_thread::yield();
+    }
+
+    LOG_WRITING.fetch_sub(1);
+}
+
+/*___________________________________________________________________________________________*/
+
+static void log_write(LOG_KIND kind, const char *fmt, va_list ap)
+{
+    if (_OPEN_CLOSE_LOG_STREAM == 0 || fmt == nullptr) return;
+
+    LOG_WRITING.fetch_add(1);
+
+    if (LOG_CLOSED.load())
+    {
+        LOG_WRITING.fetch_sub(1);
+        return;
+    }
+
+    if (LOG_WRITER != nullptr) ring_push(kind, fmt, ap);
+    else
+    {
+        std::lock_guard<std::mutex> guard(SYNC_LOCK);
+
+        fputs   (kind_before[kind], LOG_STREAM);
+        vfprintf(LOG_STREAM, fmt, ap);
+        fputs   (kind_after [kind], LOG_STREAM);
+    }
+
+    LOG_WRITING.fetch_sub(1);
+}
+
+/**
+*   @brief Formats the message and puts it in the ring. Short messages are formatted once on the stack,
+*          the longer ones are formatted again in the heap.
+*/
+
+static void ring_push(LOG_KIND kind, const char *fmt, va_list ap)
+{
+    char text[RECORD_TEXT] = "";
+
+    va_list ap_copy;
+    va_copy(ap_copy, ap);
+
+    int size = vsnprintf(text, RECORD_TEXT, fmt, ap_copy);
+    va_end(ap_copy);
+
+    if (size < 0) return;
+    if (size < RECORD_TEXT)
+    {
+        ring_put(kind, text, size);
+        return;
+    }
+
+    const int max_size = RECORD_CHAIN * RECORD_TEXT;
+    bool   is_cut      = (size >= max_size);
+    if    (is_cut) size = max_size - 1;
+
+    char *long_text = (char *) calloc((size_t) size + 1, sizeof(char));
+    if   (long_text == nullptr)
+    {
+        size   = RECORD_TEXT - 1;
+        is_cut = true;
+    }
+    else vsnprintf(long_text, (size_t) size + 1, fmt, ap);
+
+    if (is_cut)
+    {
+        char *end = (long_text == nullptr) ? text : long_text;
+        memcpy(end + size - (sizeof(TRUNCATED_MARK) - 1), TRUNCATED_MARK, sizeof(TRUNCATED_MARK) - 1);
+    }
+
+    ring_put(kind, (long_text == nullptr) ? text : long_text, size);
+    free(long_text);
+}
+
+/**
+*   @brief Copies the text of "size" chars in consecutive records and publishes them in order.
+*/
+
+static void ring_put(LOG_KIND kind, const char *text, const int size)
+{
+    assert(text != nullptr);
+
+    int           records = (size == 0) ? 1 : (size + RECORD_TEXT - 1) / RECORD_TEXT;
+    unsigned long pos     = ring_reserve(records);
+
+    for (int i = 0; i < records; ++i)
+    {
+        Log_record *record = &LOG_RING[(pos + (unsigned long) i) & (RING_SIZE - 1)];
+        int         part   = (i == records - 1) ? size - i * RECORD_TEXT : RECORD_TEXT;
+
+        record->kind     = kind;
+        record->size     = part;
+        record->is_first = (i == 0);
+        record->is_last  = (i == records - 1);
+        memcpy(record->text, text + i * RECORD_TEXT, (size_t) part);
+
+        record->seq.store(pos + (unsigned long) i + 1, std::memory_order_release);
+    }
+}
+
+/**
+*   @brief Takes "records" consecutive records. The writer frees the records in order, so they are all free
+*          when the last one is.
+*
+*   @return position of the first record
+*/
+
+static unsigned long ring_reserve(const int records)
+{
+    unsigned long pos = RING_TAIL.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+        unsigned long last = pos + (unsigned long) records - 1;
+
+        unsigned long seq  = LOG_RING[last & (RING_SIZE - 1)].seq.load(std::memory_order_acquire);
+        long          diff = (long) seq - (long) last;
+
+        if      (diff == 0) { if (RING_TAIL.compare_exchange_weak(pos, pos + (unsigned long) records,
+                                                                std::memory_order_relaxed)) return pos; }
+        else if (diff <  0) { std::this_thread::yield(); pos = RING_TAIL.load(std::memory_order_relaxed); }
+        else                {                            pos = RING_TAIL.load(std::memory_order_relaxed); }
+    }
+}
+
+/*___________________________________________________________________________________________*/
+
+static void ring_writer()
+{
+    while (true)
+    {
+        bool stop = WRITER_STOP.load(std::memory_order_acquire);
+
+        if (ring_write_one()) continue;
+
+        fflush(LOG_STREAM);
+        RING_WRITTEN.store(RING_HEAD.load(std::memory_order_relaxed), std::memory_order_release);
+
+        if (stop) return;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+static bool ring_write_one()
+{
+    unsigned long pos    = RING_HEAD.load(std::memory_order_relaxed);
+    Log_record   *record = &LOG_RING[pos & (RING_SIZE - 1)];
+
+    if (record->seq.load(std::memory_order_acquire) != pos + 1) return false;
+
+    if (record->is_first) fputs(kind_before[record->kind], LOG_STREAM);
+    fwrite(record->text, sizeof(char), (size_t) record->size, LOG_STREAM);
+    if (record->is_last)  fputs(kind_after [record->kind], LOG_STREAM);
+
+    record->seq.store(pos + RING_SIZE, std::memory_order_release);
+    RING_HEAD  .store(pos + 1        , std::memory_order_relaxed);
+
+    return true;
+}
+
+/*___________________________________________________________________________________________*/
+
+/**
+*   @brief Allocates zeroed memory and counts it in the statistics of the call site. Use log_calloc() macro instead.
+*
+*   @param number [in] - number of elements
+*   @param size   [in] - size of one element
+*   @param site   [in] - call site returned by log_alloc_site_register()
+*
+*   @return pointer to the memory and nullptr in case of error or zero size
+*/
+
+void *log_calloc_site(size_t number, size_t size, int site)
 {
     if ((number * size) == 0) return nullptr;
+    if (size > (((size_t) -1) - sizeof(Block_header)) / number) return nullptr;
 
-    void *ret = calloc(number, size);
+    size_t      bytes = number * size;
+    Block_header *ret = (Block_header *) calloc(1, bytes + sizeof(Block_header));
     if   (ret == nullptr) return nullptr;
 
-    ++DYNAMIC_MEMORY;
-    return ret;
+    if (site < 0 || site >= LOG_MAX_SITES) site = 0;
+
+    ret->size = bytes;
+    ret->site = site;
+
+    Thread_memory *memory   = get_thread_memory();
+    Site_counters *counters = get_site(memory, site);
+    if (counters != nullptr)
+    {
+        add_counter(&counters->alloc_calls, 1);
+        add_counter(&counters->alloc_bytes, (long long) bytes);
+        add_counter(&counters->hist[hist_bucket(bytes)], 1);
+
+        add_live_bytes(memory, (long long) bytes);
+    }
+
+    return ret + 1;
 }
 
+/**
+*   @brief Frees memory allocated by log_calloc(). Does nothing with nullptr.
+*/
+
 void log_free(void *ptr)
 {
     if (ptr == nullptr) return;
 
-    --DYNAMIC_MEMORY;
-    free(ptr);
+    Block_header *header = (Block_header *) ptr - 1;
+
+    Thread_memory *memory   = get_thread_memory();
+    Site_counters *counters = get_site(memory, header->site);
+    if (counters != nullptr)
+    {
+        add_counter(&counters->free_calls, 1);
+        add_counter(&counters->free_bytes, (long long) header->size);
+
+        add_live_bytes(memory, -(long long) header->size);
+    }
+
+    free(header);
+}
+
+/**
+*   @brief Gives the number for the call site of log_calloc(). Called once for each site.
+*/
+
+int log_alloc_site_register(const char *file, int line)
+{
+    std::lock_guard<std::mutex> guard(MEMORY_LOCK);
+
+    if (SITE_NUMBER == LOG_MAX_SITES) return 0;
+
+    SITE_FILE[SITE_NUMBER] = file;
+    SITE_LINE[SITE_NUMBER] = line;
+
+    return SITE_NUMBER++;
+}
+
+/**
+*   @brief Merges memory counters of all threads.
+*
+*   @param stats [out] - total statistics
+*/
+
+void log_memory_stats(Log_memory_stats *stats)
+{
+    assert(stats != nullptr);
+
+    *stats = {};
+
+    for (int site = 0; log_memory_site(site, nullptr); ++site)
+    {
+        Log_site_stats site_stats = {};
+        log_memory_site(site, &site_stats);
+
+        stats->alloc_calls += site_stats.alloc_calls;
+        stats->alloc_bytes += site_stats.alloc_bytes;
+        stats-> free_calls += site_stats. free_calls;
+        stats-> free_bytes += site_stats. free_bytes;
+        stats->      sites += 1;
+    }
+
+    std::lock_guard<std::mutex> guard(MEMORY_LOCK);
+
+    long long live = LIVE_BYTES.load(std::memory_order_relaxed) + RETIRED_MEMORY.live_delta.load(std::memory_order_relaxed);
+    long long peak = live;
+
+    for (Thread_memory *cur = THREAD_MEMORY_LIST; cur != nullptr; cur = cur->next)
+    {
+        stats->live_bytes += cur->live_delta.load(std::memory_order_relaxed);
+        peak              += cur->peak_delta.load(std::memory_order_relaxed);
+    }
+
+    stats->live_bytes += live;
+    stats->peak_bytes  = PEAK_BYTES.load(std::memory_order_relaxed);
+
+    if (stats->peak_bytes < peak) stats->peak_bytes = peak;
+}
+
+/**
+*   @brief Merges memory counters of all threads for one call site.
+*
+*   @return false if the site is not registered
+*/
+
+bool log_memory_site(int site, Log_site_stats *stats)
+{
+    std::lock_guard<std::mutex> guard(MEMORY_LOCK);
+
+    if (site < 0 || site >= SITE_NUMBER) return false;
+    if (stats == nullptr)                return true;
+
+    Site_counters total = {};
+    if (site < RETIRED_MEMORY.sites_num) merge_site(&total, &RETIRED_MEMORY.sites[site]);
+
+    for (Thread_memory *cur = THREAD_MEMORY_LIST; cur != nullptr; cur = cur->next)
+    {
+        if (site < cur->sites_num) merge_site(&total, &cur->sites[site]);
+    }
+
+    stats->file        = SITE_FILE[site];
+    stats->line        = SITE_LINE[site];
+    stats->alloc_calls = total.alloc_calls.load(std::memory_order_relaxed);
+    stats->alloc_bytes = total.alloc_bytes.load(std::memory_order_relaxed);
+    stats-> free_calls = total. free_calls.load(std::memory_order_relaxed);
+    stats-> free_bytes = total. free_bytes.load(std::memory_order_relaxed);
+
+    for (int i = 0; i < LOG_HIST_SIZE; ++i) stats->hist[i] = total.hist[i].load(std::memory_order_relaxed);
+
+    return true;
+}
+
+/**
+*   @return number of log_calloc() calls made by the current thread since its start
+*/
+
+long long log_memory_thread_calls()
+{
+    Thread_memory *memory = get_thread_memory();
+    if (memory == nullptr) return 0;
+
+    long long calls = 0;
+    for (int site = 0; site < memory->sites_num; ++site) calls += memory->sites[site].alloc_calls.load(std::memory_order_relaxed);
+
+    return calls;
+}
+
+/**
+*   @brief Prints the memory statistics and the table of call sites in LOG_FILE.
+*/
+
+void log_memory_dump()
+{
+    Log_memory_stats stats = {};
+    log_memory_stats(&stats);
+
+    log_message_write("\n"
+                "MEMORY: %lld allocations (%lld bytes), %lld frees (%lld bytes), live = %lld bytes, peak = %lld bytes\n",
+                stats.alloc_calls, stats.alloc_bytes, stats.free_calls, stats.free_bytes, stats.live_bytes, stats.peak_bytes);
+
+    for (int site = 0; site < stats.sites; ++site)
+    {
+        Log_site_stats site_stats = {};
+        log_memory_site(site, &site_stats);
+
+        if (site_stats.alloc_calls == 0) continue;
+
+        log_message_write("%s:%d: calls = %lld, bytes = %lld, not freed = %lld, sizes:",
+                    site_stats.file, site_stats.line, site_stats.alloc_calls, site_stats.alloc_bytes,
+                                                      site_stats.alloc_calls - site_stats.free_calls);
+
+        for (int i = 0; i < LOG_HIST_SIZE; ++i)
+        {
+            if (site_stats.hist[i] != 0) log_message_write(" [%lld, %lld) x %lld", 1LL << i, 1LL << (i + 1), site_stats.hist[i]);
+        }
+        log_message_write("\n");
+    }
+}
+
+/*___________________________________________________________________________________________*/
+
+static Thread_memory *get_thread_memory()
+{
+    if (THREAD_MEMORY.memory != nullptr) return THREAD_MEMORY.memory;
+    if (THREAD_FINISHED)                 return nullptr;
+
+    Thread_memory *memory = (Thread_memory *) calloc(1, sizeof(Thread_memory));
+    if (memory == nullptr) return nullptr;
+
+    std::lock_guard<std::mutex> guard(MEMORY_LOCK);
+
+    memory->next = THREAD_MEMORY_LIST;
+    if (THREAD_MEMORY_LIST != nullptr) THREAD_MEMORY_LIST->prev = memory;
+    THREAD_MEMORY_LIST = memory;
+
+    THREAD_MEMORY.memory = memory;
+    return memory;
+}
+
+/**
+*   @return counters of the site in the memory of the current thread, nullptr if they can't be allocated
+*/
+
+static Site_counters *get_site(Thread_memory *memory, int site)
+{
+    if (memory == nullptr) return nullptr;
+    if (site < memory->sites_num) return &memory->sites[site];
+
+    std::lock_guard<std::mutex> guard(MEMORY_LOCK);
+
+    if (!sites_reserve(memory, site + 1)) return nullptr;
+    return &memory->sites[site];
+}
+
+/**
+*   @brief Grows the counters of the memory to at least "sites_num" sites. Call it under MEMORY_LOCK.
+*/
+
+static bool sites_reserve(Thread_memory *memory, int sites_num)
+{
+    assert(memory != nullptr);
+
+    if (sites_num <= memory->sites_num) return true;
+
+    int            size  = (sites_num + SITE_CHUNK - 1) / SITE_CHUNK * SITE_CHUNK;
+    Site_counters *sites = (Site_counters *) calloc((size_t) size, sizeof(Site_counters));
+    if (sites == nullptr) return false;
+
+    for (int site = 0; site < memory->sites_num; ++site) merge_site(&sites[site], &memory->sites[site]);
+
+    free(memory->sites);
+    memory->sites     = sites;
+    memory->sites_num = size;
+
+    return true;
+}
+
+Thread_memory_holder::~Thread_memory_holder()
+{
+    if (memory == nullptr) return;
+
+    std::lock_guard<std::mutex> guard(MEMORY_LOCK);
+
+    if (sites_reserve(&RETIRED_MEMORY, memory->sites_num))
+    {
+        for (int site = 0; site < memory->sites_num; ++site) merge_site(&RETIRED_MEMORY.sites[site], &memory->sites[site]);
+    }
+    long long live = LIVE_BYTES.load(std::memory_order_relaxed) + RETIRED_MEMORY.live_delta.load(std::memory_order_relaxed)
+                                                                 + memory->peak_delta.load(std::memory_order_relaxed);
+    if (PEAK_BYTES.load(std::memory_order_relaxed) < live) PEAK_BYTES.store(live, std::memory_order_relaxed);
+
+    add_counter(&RETIRED_MEMORY.live_delta, memory->live_delta.load(std::memory_order_relaxed));
+
+    if (memory->prev != nullptr) memory->prev->next = memory->next;
+    else                         THREAD_MEMORY_LIST = memory->next;
+    if (memory->next != nullptr) memory->next->prev = memory->prev;
+
+    free(memory->sites);
+    free(memory);
+    memory = nullptr;
+
+    THREAD_FINISHED = true;
+}
+
+/**
+*   @brief Adds the value to the counter, which only the current thread changes. It is cheaper than fetch_add().
+*/
+
+static void add_counter(Counter *counter, long long value)
+{
+    counter->store(counter->load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+static void add_live_bytes(Thread_memory *memory, long long bytes)
+{
+    long long delta      = memory->live_delta.load(std::memory_order_relaxed) + bytes;
+    long long peak_delta = memory->peak_delta.load(std::memory_order_relaxed);
+
+    if (delta > peak_delta) peak_delta = delta;
+
+    if (delta < LIVE_BATCH && delta > -LIVE_BATCH)
+    {
+        memory->live_delta.store(delta     , std::memory_order_relaxed);
+        memory->peak_delta.store(peak_delta, std::memory_order_relaxed);
+        return;
+    }
+    memory->live_delta.store(0, std::memory_order_relaxed);
+    memory->peak_delta.store(0, std::memory_order_relaxed);
+
+    long long live = LIVE_BYTES.fetch_add(delta, std::memory_order_relaxed) + peak_delta;
+    long long peak = PEAK_BYTES.load(std::memory_order_relaxed);
+
+    while (live > peak && !PEAK_BYTES.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+}
+
+static void merge_site(Site_counters *to, Site_counters *from)
+{
+    assert(to   != nullptr);
+    assert(from != nullptr);
+
+    add_counter(&to->alloc_calls, from->alloc_calls.load(std::memory_order_relaxed));
+    add_counter(&to->alloc_bytes, from->alloc_bytes.load(std::memory_order_relaxed));
+    add_counter(&to-> free_calls, from-> free_calls.load(std::memory_order_relaxed));
+    add_counter(&to-> free_bytes, from-> free_bytes.load(std::memory_order_relaxed));
+
+    for (int i = 0; i < LOG_HIST_SIZE; ++i) add_counter(&to->hist[i], from->hist[i].load(std::memory_order_relaxed));
+}
+
+static int hist_bucket(size_t size)
+{
+    int bucket = 63 - __builtin_clzll((unsigned long long) size);
+
+    if (bucket >= LOG_HIST_SIZE) return LOG_HIST_SIZE - 1;
+    return bucket;
 }
 
-void log_end_header()
+void log_end_header_write()
 {
-    log_message("<hr>\n");
+    log_message_write("<hr>\n");
 }
\ No newline at end of file
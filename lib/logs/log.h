@@ -1,6 +1,8 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include <atomic>
+
 #define YELLOW "<font color=Gold>"
 #define RED    "<font color=DarkRed>"
 #define ORANGE "<font color=DarkOrange>"
@@ -10,6 +12,56 @@
 #define USUAL  "<font color=Black>"
 #define CANCEL "</font>"
 
+/*_____________________________________LOG_LEVELS__________________________________________*/
+
+/**
+*   Each log function has a level, each part of the program has a category. A call is compiled only if its level
+*   is not greater than LOG_LEVEL and its category is in LOG_CATEGORIES, otherwise it is a constant false condition
+*   and its arguments are not even evaluated. The compiled calls are filtered by log_set_level() and
+*   log_set_categories() at runtime.
+*
+*   LOG_LEVEL and LOG_CATEGORIES may be given by -D. By default debug builds log everything and other builds
+*   log only errors. A source file sets LOG_CATEGORY before its parts to choose the category of their calls.
+*/
+
+#define LOG_LVL_NONE        0
+#define LOG_LVL_ERROR       1   // log_error()
+#define LOG_LVL_WARNING     2   // log_warning()
+#define LOG_LVL_INFO        3   // log_header(), log_end_header()
+#define LOG_LVL_DEBUG       4   // log_message() and the others
+
+#define LOG_CAT_GENERAL     (1 << 0)
+#define LOG_CAT_PARSER      (1 << 1)
+#define LOG_CAT_OPTIMIZER   (1 << 2)
+#define LOG_CAT_DIFF        (1 << 3)
+#define LOG_CAT_DUMP        (1 << 4)
+#define LOG_CAT_ALL         (LOG_CAT_GENERAL | LOG_CAT_PARSER | LOG_CAT_OPTIMIZER | LOG_CAT_DIFF | LOG_CAT_DUMP)
+
+#ifndef LOG_LEVEL
+#ifdef _DEBUG
+#define LOG_LEVEL           LOG_LVL_DEBUG
+#else
+#define LOG_LEVEL           LOG_LVL_ERROR
+#endif
+#endif
+
+#ifndef LOG_CATEGORIES
+#define LOG_CATEGORIES      LOG_CAT_ALL
+#endif
+
+#ifndef LOG_CATEGORY
+#define LOG_CATEGORY        LOG_CAT_GENERAL
+#endif
+
+#define LOG_COMPILED(level, category) ((level) <= LOG_LEVEL && ((category) & (LOG_CATEGORIES)) != 0)
+#define LOG_ON(level, category)       (LOG_COMPILED(level, category) && log_enabled(level, category))
+
+#define log_message(...)    (LOG_ON(LOG_LVL_DEBUG  , LOG_CATEGORY) ? log_message_write(__VA_ARGS__) : (void) 0)
+#define log_error(...)      (LOG_ON(LOG_LVL_ERROR  , LOG_CATEGORY) ? log_error_write  (__VA_ARGS__) : (void) 0)
+#define log_warning(...)    (LOG_ON(LOG_LVL_WARNING, LOG_CATEGORY) ? log_warning_write(__VA_ARGS__) : (void) 0)
+#define log_header(...)     (LOG_ON(LOG_LVL_INFO   , LOG_CATEGORY) ? log_header_write (__VA_ARGS__) : (void) 0)
+#define log_end_header()    (LOG_ON(LOG_LVL_INFO   , LOG_CATEGORY) ? log_end_header_write()         : (void) 0)
+
 /*__________________________________USER_MACRO_DEFINITIONS___________________________________*/
 
 #define log_place()                                                                     \
@@ -21,24 +73,71 @@
 #define log_assert(condition)                                                           \
         if (!(condition))                                                               \
         {                                                                               \
-			log_message(RED "ASSERT FAILED: %s\n"                           \
+			log_message_write(RED "ASSERT FAILED: %s\n"                     \
 					"         FILE: %s\n"                           \
 					"     FUNCTION: %s\n"                           \
-					"         LINE: %s\n"           ,               \
+					"         LINE: %d\n"           ,               \
 				                #condition              ,               \
 						__FILE__		,               \
 						__PRETTY_FUNCTION__	,               \
 						__LINE__		);              \
+			log_flush();                                                    \
 			abort();                                                        \
         }
 
+/**
+*   log_calloc() remembers the place of the call, so the memory statistics are collected for each call site.
+*   The site is registered once, on the first call.
+*/
+#define log_calloc(number, size)                                                        \
+        log_calloc_site(number, size, [] ()                                             \
+                                      {                                                 \
+                                          static const int site =                       \
+                                          log_alloc_site_register(__FILE__, __LINE__);  \
+                                          return site;                                  \
+                                      } ())
+
+/*_________________________________USER_STRUCT_DEFINITIONS__________________________________*/
+
+const int LOG_MAX_SITES = 256;  // call sites of log_calloc(), the last ones share the site 0
+const int LOG_HIST_SIZE =  32;  // histogram bucket "i" counts blocks of [2^i, 2^(i+1)) bytes
+
+struct Log_memory_stats
+{
+    long long alloc_calls;
+    long long alloc_bytes;
+    long long  free_calls;
+    long long  free_bytes;
+
+    long long  live_bytes;
+    long long  peak_bytes;
+    int             sites;
+};
+
+struct Log_site_stats
+{
+    const char *file;
+    int         line;
+
+    long long alloc_calls;
+    long long alloc_bytes;
+    long long  free_calls;
+    long long  free_bytes;
+
+    long long hist[LOG_HIST_SIZE];
+};
+
 /*________________________________USER_FUNCTION_DECLARATIONS_________________________________*/
 
-void    log_message     (const char *fmt, ...);
-void    log_error       (const char *fmt, ...);
-void    log_warning     (const char *fmt, ...);
-void    log_header      (const char *fmt, ...);
-void    log_end_header  ();
+void    log_message_write       (const char *fmt, ...);
+void    log_error_write         (const char *fmt, ...);
+void    log_warning_write       (const char *fmt, ...);
+void    log_header_write        (const char *fmt, ...);
+void    log_end_header_write    ();
+void    log_flush               ();
+
+void    log_set_level           (int      level);
+void    log_set_categories      (unsigned categories);
 
 void    log_char_ptr    (const char *str_name, const char *str);
 
@@ -46,8 +145,25 @@ void    log_param_place (const char   *file,
                         const char   *func,
                         const int     line);
 
-void   *log_calloc      (size_t number, size_t size);
-void    log_free        (void *ptr);
+void   *log_calloc_site         (size_t number, size_t size, int site);
+void    log_free                (void *ptr);
+int     log_alloc_site_register (const char *file, int line);
+
+void      log_memory_stats      (Log_memory_stats *stats);
+bool      log_memory_site       (int site, Log_site_stats *stats);
+long long log_memory_thread_calls();
+void      log_memory_dump       ();
+/*___________________________________________________________________________________________*/
+
+extern std::atomic<int>      LOG_RUNTIME_LEVEL;         // set by log_set_level() from any thread
+extern std::atomic<unsigned> LOG_RUNTIME_CATEGORIES;    // set by log_set_categories()
+
+inline bool log_enabled(int level, unsigned category)
+{
+    return level <= LOG_RUNTIME_LEVEL.load(std::memory_order_relaxed) &&
+           (category & LOG_RUNTIME_CATEGORIES.load(std::memory_order_relaxed)) != 0;
+}
+
 /*___________________________________________________________________________________________*/
 
 #endif //LOG_H
\ No newline at end of file
@@ -3,6 +3,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <assert.h>
 
 #include "read_write.h"
@@ -69,4 +72,82 @@ int get_file_size(const char *file_name)
     if (StatRet == -1) return -1;
 
     return (int) BuffSize.st_size;
+}
+
+/**
+*   @brief Maps the file "file_name" in memory for reading. The data is not copied
+*          and doesn't end by '\0'.
+*
+*   @param file_name  [in]  - name of the file to map
+*   @param map        [out] - mapping, the data of the empty file is nullptr
+*   @param sequential [in]  - the data is read once from the beginning, otherwise it is read many times
+*                             in any order and the kernel is asked to load it at once
+*
+*   @return false in case of error
+*/
+
+bool map_file(const char *file_name, File_map *map, const bool sequential)
+{
+    assert(file_name != nullptr);
+    assert(map       != nullptr);
+
+    *map = {};
+
+    int fd = open(file_name, O_RDONLY);
+    if (fd == -1) return false;
+
+    struct stat file_stat = {};
+    if (fstat(fd, &file_stat) == -1)
+    {
+        close(fd);
+        return false;
+    }
+
+    map->size = (size_t) file_stat.st_size;
+    if (map->size == 0)
+    {
+        close(fd);
+        return true;
+    }
+
+    void *data = mmap(nullptr, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        map->size = 0;
+        return false;
+    }
+
+    madvise(data, map->size, sequential ? MADV_SEQUENTIAL : MADV_WILLNEED);
+    map->data = (const char *) data;
+    map->addr = data;
+
+    return true;
+}
+
+/**
+*   @brief Gives the pages of the mapping before "offset" back to the kernel, so the resident memory
+*          of a long sequential reading doesn't grow. The data before "offset" must not be used anymore.
+*/
+
+void map_file_release(File_map *map, size_t offset)
+{
+    assert(map != nullptr);
+
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+
+    offset = offset / page * page;
+    if (map->data == nullptr || offset <= map->released) return;
+
+    madvise((char *) map->addr + map->released, offset - map->released, MADV_DONTNEED);
+    map->released = offset;
+}
+
+void unmap_file(File_map *map)
+{
+    assert(map != nullptr);
+
+    if (map->addr != nullptr) munmap(map->addr, map->size);
+    *map = {};
 }
\ No newline at end of file
@@ -1,9 +1,23 @@
 #ifndef READ_WRITE
 #define READ_WRITE
 
+#include <stddef.h>
+
+struct File_map
+{
+    const char *data;
+    void       *addr;       // the same mapping for madvise() and munmap()
+    size_t      size;
+    size_t      released;   // pages before this offset were given back to the kernel
+};
+
 void     *read_file   (const char *file_name, int *const size_ptr);
 bool     write_file   (const char *file_name, void *data, const int data_size);
 
 int get_file_size(const char *file_name);
 
+bool     map_file         (const char *file_name, File_map *map, const bool sequential = true);
+void     map_file_release (File_map *map, size_t offset);
+void     unmap_file       (File_map *map);
+
 #endif //READ_WRITE
\ No newline at end of file
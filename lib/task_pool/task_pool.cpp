@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include <new>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "task_pool.h"
+#include "../logs/log.h"
+
+/*__________________________________________STRUCT_DEFINITIONS__________________________________________*/
+
+static const int DEQUE_CAPACITY = 4096;
+static const int MAX_THREADS    =  256;
+
+struct Task_deque
+{
+    std::mutex   lock  = {};
+
+    Task       **data  = nullptr;       // ring of DEQUE_CAPACITY tasks
+    long         begin = 0;             // thieves take tasks from here
+    long         end   = 0;             // the owner pushes and pops here
+
+    Task_deque              ()                    = default;
+    Task_deque              (const Task_deque &)  = delete;
+    Task_deque &operator=   (const Task_deque &)  = delete;
+};
+
+struct Task_pool
+{
+    int                      size       = 0;        // number of deques: the external one (index 0) and one per worker
+    Task_deque              *deques     = nullptr;
+    std::thread             *workers    = nullptr;
+
+    std::atomic<bool>        stop       = false;
+    std::atomic<int>         pending    = 0;
+    std::atomic<int>         sleepers   = 0;        // threads waiting for "wake", see pool_sleep()
+
+    std::mutex               sleep_lock = {};
+    std::condition_variable  wake       = {};
+
+    Task_pool               ()                    = default;
+    Task_pool               (const Task_pool &)   = delete;
+    Task_pool  &operator=   (const Task_pool &)   = delete;
+};
+
+/*______________________STATIC_FUNCTION_______________________*/
+
+static void     worker_loop         (Task_pool *pool, int self);
+static bool     task_run_one        (Task_pool *pool, int self);
+static int      task_self           (Task_pool *pool);
+static void     pool_sleep          (Task_pool *pool, const Task *task);
+static void     pool_wake           (Task_pool *pool, const bool all);
+static void     pool_free           (Task_pool *pool);
+
+static bool     deque_push          (Task_deque *deque, Task *task);
+static Task    *deque_pop           (Task_deque *deque);
+static Task    *deque_steal         (Task_deque *deque);
+
+/*____________________________________________________________*/
+
+static thread_local Task_pool *CUR_POOL   = nullptr;
+static thread_local int        CUR_WORKER =       0;
+
+/*____________________________________________________________*/
+
+/**
+*   @brief Creates the pool of "threads" - 1 worker threads. A thread outside the pool works as one more worker
+*          while it waits for a task.
+*
+*   @param threads [in] - total number of threads, hardware concurrency if it is not positive
+*
+*   @return pointer to the pool and nullptr in case of error
+*/
+
+Task_pool *task_pool_new(int threads)
+{
+    if (threads <= 0)          threads = (int) std::thread::hardware_concurrency();
+    if (threads <= 0)          threads = 1;
+    if (threads >  MAX_THREADS) threads = MAX_THREADS;
+
+    Task_pool *pool = new (std::nothrow) Task_pool();
+    if        (pool == nullptr) return nullptr;
+
+    pool->size    = threads;
+    pool->deques  = new (std::nothrow) Task_deque [threads]();
+    pool->workers = new (std::nothrow) std::thread[threads]();
+
+    bool is_ok = (pool->deques != nullptr && pool->workers != nullptr);
+    for (int i = 0; is_ok && i < threads; ++i)
+    {
+        pool->deques[i].data = new (std::nothrow) Task *[DEQUE_CAPACITY]();
+        is_ok                = (pool->deques[i].data != nullptr);
+    }
+    if (!is_ok)
+    {
+        log_error("Can't allocate task pool of %d threads.\n", threads);
+
+        pool_free(pool);
+        return nullptr;
+    }
+
+    for (int i = 1; i < threads; ++i) pool->workers[i] = std::thread(worker_loop, pool, i);
+
+    return pool;
+}
+
+void task_pool_delete(Task_pool *pool)
+{
+    if (pool == nullptr) return;
+
+    {
+        std::lock_guard<std::mutex> guard(pool->sleep_lock);
+        pool->stop = true;
+    }
+    pool->wake.notify_all();
+
+    for (int i = 1; i < pool->size; ++i) pool->workers[i].join();
+
+    pool_free(pool);
+}
+
+static void pool_free(Task_pool *pool)
+{
+    assert(pool != nullptr);
+
+    for (int i = 0; pool->deques != nullptr && i < pool->size; ++i) delete [] pool->deques[i].data;
+
+    delete [] pool->deques;
+    delete [] pool->workers;
+    delete    pool;
+}
+
+int task_pool_size(const Task_pool *pool)
+{
+    assert(pool != nullptr);
+
+    return pool->size;
+}
+
+/*____________________________________________________________*/
+
+/**
+*   @brief Pushes the task in the deque of the current thread. Runs the task at once if the deque is full.
+*
+*   @param pool [in]  - pool to run the task in
+*   @param task [out] - task to initialize, it must live until task_wait() returns
+*   @param func [in]  - function to call
+*   @param arg  [in]  - argument of the function
+*/
+
+void task_spawn(Task_pool *pool, Task *task, void (*func)(void *arg), void *arg)
+{
+    assert(pool != nullptr);
+    assert(task != nullptr);
+    assert(func != nullptr);
+
+    task->func = func;
+    task->arg  = arg;
+    task->done.store(false, std::memory_order_relaxed);
+
+    if (!deque_push(&pool->deques[task_self(pool)], task))
+    {
+        func(arg);
+        task->done.store(true, std::memory_order_release);
+        return;
+    }
+
+    pool->pending.fetch_add(1);
+    pool_wake(pool, false);
+}
+
+/**
+*   @brief Waits for the task. The thread executes its own and stolen tasks while waiting and sleeps when there
+*          are none.
+*/
+
+void task_wait(Task_pool *pool, Task *task)
+{
+    assert(pool != nullptr);
+    assert(task != nullptr);
+
+    int self = task_self(pool);
+
+    while (!task->done.load(std::memory_order_acquire))
+    {
+        if (!task_run_one(pool, self)) pool_sleep(pool, task);
+    }
+}
+
+/*____________________________________________________________*/
+
+static int task_self(Task_pool *pool)
+{
+    if (CUR_POOL == pool) return CUR_WORKER;
+    return 0;
+}
+
+static void worker_loop(Task_pool *pool, int self)
+{
+    CUR_POOL   = pool;
+    CUR_WORKER = self;
+
+    while (!pool->stop.load(std::memory_order_acquire))
+    {
+        if (!task_run_one(pool, self)) pool_sleep(pool, nullptr);
+    }
+}
+
+/**
+*   @brief Sleeps until a task is pushed, "task" is done or the pool stops. "sleepers" is incremented before
+*          the conditions are checked and pool_wake() changes them before it reads "sleepers" (all of them are
+*          sequentially consistent), so either the sleeper sees the change or the waker sees the sleeper.
+*/
+
+static void pool_sleep(Task_pool *pool, const Task *task)
+{
+    assert(pool != nullptr);
+
+    std::unique_lock<std::mutex> lock(pool->sleep_lock);
+    pool->sleepers.fetch_add(1);
+
+    pool->wake.wait(lock, [pool, task]
+    {
+        return pool->stop.load() || pool->pending.load() > 0 || (task != nullptr && task->done.load());
+    });
+
+    pool->sleepers.fetch_sub(1);
+}
+
+/**
+*   @brief Wakes the sleepers after a push ("all" is false, any thread may take the task) or after a task is done.
+*          Taking the lock orders the notification after the check of a sleeper that has not started to wait yet.
+*/
+
+static void pool_wake(Task_pool *pool, const bool all)
+{
+    assert(pool != nullptr);
+
+    if (pool->sleepers.load() == 0) return;
+
+    {
+        std::lock_guard<std::mutex> guard(pool->sleep_lock);
+    }
+
+    if (all) pool->wake.notify_all();
+    else     pool->wake.notify_one();
+}
+
+static bool task_run_one(Task_pool *pool, int self)
+{
+    Task *task = deque_pop(&pool->deques[self]);
+
+    for (int shift = 1; task == nullptr && shift < pool->size; ++shift)
+    {
+        task = deque_steal(&pool->deques[(self + shift) % pool->size]);
+    }
+    if (task == nullptr) return false;
+
+    pool->pending.fetch_sub(1, std::memory_order_relaxed);
+
+    task->func(task->arg);
+    task->done.store(true);
+
+    pool_wake(pool, true);
+    return true;
+}
+
+/*____________________________________________________________*/
+
+static bool deque_push(Task_deque *deque, Task *task)
+{
+    std::lock_guard<std::mutex> guard(deque->lock);
+
+    if (deque->end - deque->begin == DEQUE_CAPACITY) return false;
+
+    deque->data[deque->end % DEQUE_CAPACITY] = task;
+    deque->end++;
+
+    return true;
+}
+
+static Task *deque_pop(Task_deque *deque)
+{
+    std::lock_guard<std::mutex> guard(deque->lock);
+
+    if (deque->end == deque->begin) return nullptr;
+
+    deque->end--;
+    return deque->data[deque->end % DEQUE_CAPACITY];
+}
+
+static Task *deque_steal(Task_deque *deque)
+{
+    std::lock_guard<std::mutex> guard(deque->lock);
+
+    if (deque->end == deque->begin) return nullptr;
+
+    Task *task = deque->data[deque->begin % DEQUE_CAPACITY];
+    deque->begin++;
+
+    return task;
+}
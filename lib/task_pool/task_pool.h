@@ -0,0 +1,29 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <atomic>
+
+/*___________________________________________STRUCT_DEFINITIONS__________________________________________*/
+
+struct Task
+{
+    void            (*func)(void *arg);
+    void             *arg;
+
+    std::atomic<bool> done;
+};
+
+struct Task_pool;
+
+/*_________________________________________FUNCTION_DECLARATIONS_________________________________________*/
+
+Task_pool  *task_pool_new           (int threads = 0);
+void        task_pool_delete        (Task_pool *pool);
+int         task_pool_size          (const Task_pool *pool);
+
+void        task_spawn              (Task_pool *pool, Task *task, void (*func)(void *arg), void *arg);
+void        task_wait               (Task_pool *pool, Task *task);
+
+/*_______________________________________________________________________________________________________*/
+
+#endif //TASK_POOL_H
@@ -0,0 +1,573 @@
+// The kernels of vec_math.cpp on the vectors of VEC_WIDTH doubles. The file is included once per instruction
+// set inside its own namespace and "#pragma GCC target", so the same code is compiled to SSE2, AVX2 and AVX-512.
+// VEC_SQRT is the intrinsic of the square root of the vector, VEC_FMS of a * b - c is defined only with FMA.
+
+typedef double Vec  __attribute__((vector_size(VEC_WIDTH * sizeof(double))));
+typedef decltype(Vec{} < Vec{}) Mask; // the lanes are 0 or -1, the bits of a lane are the bits of a double
+typedef unsigned long long Bits __attribute__((vector_size(VEC_WIDTH * sizeof(double)))); // wraps instead of overflow
+
+/*______________________STATIC_FUNCTION_______________________*/
+
+static inline Vec   vec_load        (const double *src);
+static inline void  vec_store       (double *dst, const Vec val);
+static inline bool  vec_any         (const Mask mask);
+static inline Vec   vec_abs         (const Vec x);
+static inline Vec   vec_sign        (const Vec x);
+static inline Vec   vec_round       (const Vec x, Mask *int_val);
+static inline Vec   vec_root        (const Vec x);
+template <size_t N>
+static inline Vec   vec_poly        (const Vec x, const double (&coef)[N]);
+static inline void  vec_two_prod    (const Vec a, const Vec b, Vec *hi, Vec *lo);
+static inline void  vec_two_sum     (const Vec a, const Vec b, Vec *hi, Vec *lo);
+
+static inline Vec   exp_reduced     (const Vec hi, const Vec lo);
+static inline Vec   log_split       (const Vec x, Vec *exp);
+static inline Vec   trig_reduce     (const Vec x, Mask *quadrant, Vec *lo);
+static inline Vec   trig_sin        (const Vec r, const Vec lo);
+static inline Vec   trig_cos        (const Vec r, const Vec lo);
+static inline Vec   asin_reduced    (const Vec ax, const Mask big, Vec *s, Vec *z);
+
+static inline Vec   kern_sin        (Vec x, Mask *special);
+static inline Vec   kern_cos        (Vec x, Mask *special);
+static inline Vec   kern_tan        (Vec x, Mask *special);
+static inline Vec   kern_log        (Vec x, Mask *special);
+static inline Vec   kern_sqrt       (Vec x, Mask *special);
+static inline Vec   kern_sinh       (Vec x, Mask *special);
+static inline Vec   kern_cosh       (Vec x, Mask *special);
+static inline Vec   kern_asin       (Vec x, Mask *special);
+static inline Vec   kern_acos       (Vec x, Mask *special);
+static inline Vec   kern_atan       (Vec x, Mask *special);
+static inline Vec   kern_pow        (Vec x, Vec y, Mask *special);
+
+template <Vec (*KERNEL)(Vec, Mask *), double (*SCALAR)(double)>
+static void         vec_unary       (double *vals, const int count);
+static void         vec_pow_loop    (double *base, const double *exp, const int count);
+
+/*____________________________________________________________*/
+
+static const Vec_funcs FUNCS =
+{
+    vec_unary<kern_sin , sin >,
+    vec_unary<kern_cos , cos >,
+    vec_unary<kern_tan , tan >,
+    vec_unary<kern_log , log >,
+    vec_unary<kern_sqrt, sqrt>,
+    vec_unary<kern_sinh, sinh>,
+    vec_unary<kern_cosh, cosh>,
+    vec_unary<kern_asin, asin>,
+    vec_unary<kern_acos, acos>,
+    vec_unary<kern_atan, atan>,
+    vec_pow_loop,
+};
+
+/*____________________________________________________________*/
+
+/**
+*   @brief Computes the function in the full vectors by KERNEL and in the rest of the values by SCALAR.
+*          The lanes out of the domain of KERNEL (see "special" of the kernels) are recomputed by SCALAR,
+*          so the special values (NAN, infinities, errors of the domain) are the ones of libm.
+*/
+
+template <Vec (*KERNEL)(Vec, Mask *), double (*SCALAR)(double)>
+static void vec_unary(double *vals, const int count)
+{
+    assert(vals != nullptr || count == 0);
+
+    int i = 0;
+    for (; i + VEC_WIDTH <= count; i += VEC_WIDTH)
+    {
+        Mask special = {};
+        Vec  x       = vec_load(vals + i);
+
+        vec_store(vals + i, KERNEL(x, &special));
+
+        if (!vec_any(special)) continue;
+
+        for (int lane = 0; lane < VEC_WIDTH; ++lane)
+        {
+            if (special[lane]) vals[i + lane] = SCALAR(x[lane]);
+        }
+    }
+
+    for (; i < count; ++i) vals[i] = SCALAR(vals[i]);
+}
+
+static void vec_pow_loop(double *base, const double *exp, const int count)
+{
+    assert(base != nullptr || count == 0);
+    assert(exp  != nullptr || count == 0);
+
+    int i = 0;
+    for (; i + VEC_WIDTH <= count; i += VEC_WIDTH)
+    {
+        Mask special = {};
+        Vec  x       = vec_load(base + i);
+        Vec  y       = vec_load(exp  + i);
+
+        vec_store(base + i, kern_pow(x, y, &special));
+
+        if (!vec_any(special)) continue;
+
+        for (int lane = 0; lane < VEC_WIDTH; ++lane)
+        {
+            if (special[lane]) base[i + lane] = pow(x[lane], y[lane]);
+        }
+    }
+
+    for (; i < count; ++i) base[i] = pow(base[i], exp[i]);
+}
+
+//--------------------------------------------------------------------------------------------------------------------
+
+static inline Vec vec_load(const double *src)
+{
+    Vec val = {};
+    memcpy(&val, src, sizeof(Vec));
+
+    return val;
+}
+
+static inline void vec_store(double *dst, const Vec val)
+{
+    memcpy(dst, &val, sizeof(Vec));
+}
+
+static inline bool vec_any(const Mask mask)
+{
+    long long any = 0;
+    for (int lane = 0; lane < VEC_WIDTH; ++lane) any |= mask[lane];
+
+    return any != 0;
+}
+
+static inline Vec vec_abs(const Vec x)
+{
+    return (Vec) ((Mask) x & ~SIGN_BIT);
+}
+
+/**
+*   @brief The sign bit of "x", it is put to a non-negative result by "|".
+*/
+
+static inline Vec vec_sign(const Vec x)
+{
+    return (Vec) ((Mask) x & SIGN_BIT);
+}
+
+/**
+*   @brief Rounds "x" to the nearest integer, |x| < 2^51. The integer is also in "int_val".
+*/
+
+static inline Vec vec_round(const Vec x, Mask *int_val)
+{
+    Vec shifted = x + ROUND;
+
+    *int_val = (Mask) ((Bits) shifted - (unsigned long long) ROUND_BITS); // garbage of the special lanes wraps
+    return shifted - ROUND;
+}
+
+static inline Vec vec_root(const Vec x)
+{
+#ifdef VEC_SQRT
+    return VEC_SQRT(x);
+#else
+    Vec root = x;
+    for (int lane = 0; lane < VEC_WIDTH; ++lane) root[lane] = sqrt(x[lane]);
+
+    return root;
+#endif
+}
+
+/**
+*   @brief Horner's scheme, coef[0] is the coefficient of the highest power.
+*/
+
+template <size_t N>
+static inline Vec vec_poly(const Vec x, const double (&coef)[N])
+{
+    Vec val = Vec{} + coef[0];
+    for (size_t i = 1; i < N; ++i) val = val * x + coef[i];
+
+    return val;
+}
+
+/**
+*   @brief hi + lo = a * b exactly: lo is the FMA of a * b - hi or Dekker's product with Veltkamp's splitting.
+*          The splitting is only compiled without FMA, as the contraction of a * SPLITTER - a breaks it.
+*/
+
+static inline void vec_two_prod(const Vec a, const Vec b, Vec *hi, Vec *lo)
+{
+    *hi = a * b;
+
+#ifdef VEC_FMS
+    *lo = VEC_FMS(a, b, *hi);
+#else
+    Vec a_split = a * SPLITTER;
+    Vec b_split = b * SPLITTER;
+
+    Vec a_hi = a_split - (a_split - a);
+    Vec b_hi = b_split - (b_split - b);
+    Vec a_lo = a - a_hi;
+    Vec b_lo = b - b_hi;
+
+    *lo = ((a_hi * b_hi - *hi) + a_hi * b_lo + a_lo * b_hi) + a_lo * b_lo;
+#endif
+}
+
+/**
+*   @brief hi + lo = a + b exactly (Knuth's sum, any order of magnitudes).
+*/
+
+static inline void vec_two_sum(const Vec a, const Vec b, Vec *hi, Vec *lo)
+{
+    Vec sum = a + b;
+    Vec b_v = sum - a;
+
+    *hi = sum;
+    *lo = (a - (sum - b_v)) + (b - b_v);
+}
+
+//--------------------------------------------------------------------------------------------------------------------
+
+/**
+*   @brief e^(hi + lo) for |hi| <= EXP_MAX and |lo| <= ulp(hi): hi = k * ln2 + r, e^r by the Taylor series
+*          in |r| <= ln2 / 2, 2^k by the bits of the exponent. The result is normal.
+*/
+
+static inline Vec exp_reduced(const Vec hi, const Vec lo)
+{
+    Mask k_int = {};
+    Vec  k     = vec_round(hi * INV_LN2, &k_int);
+
+    Vec r   = (hi - k * LN2_HI) + (lo - k * LN2_LO);
+    Vec e_r = 1 + (r + r * r * vec_poly(r, EXP_COEF));
+
+    return e_r * (Vec) ((k_int + 1023) << 52);
+}
+
+/**
+*   @brief Splits the normal positive "x" to 2^exp * (1 + f), sqrt(1/2) <= 1 + f < sqrt(2), and returns f.
+*/
+
+static inline Vec log_split(const Vec x, Vec *exp)
+{
+    Mask bits  = (Mask) x;
+    Mask exp_i = (bits - SQRT_HALF_BITS) >> 52;
+
+    *exp = (Vec) (exp_i + ROUND_BITS) - ROUND;
+    return (Vec) (bits - (exp_i << 52)) - 1;
+}
+
+/**
+*   @brief x = k * pi/2 + (result + lo), |result| <= pi/4 for |x| <= TRIG_MAX. The pieces of pi/2 are short,
+*          so k * PIO2_1..3 are exact and so is x - k * PIO2_1 (Cody and Waite), the rest is a double-double.
+*/
+
+static inline Vec trig_reduce(const Vec x, Mask *quadrant, Vec *lo)
+{
+    Vec k = vec_round(x * TWO_PI, quadrant);
+
+    Vec hi  = {};
+    Vec err = {};
+
+    vec_two_sum(x - k * PIO2_1, -(k * PIO2_2), &hi, &err);
+    vec_two_sum(hi, err - (k * PIO2_3 + k * PIO2_4), &hi, lo);
+
+    return hi;
+}
+
+/**
+*   @brief sin(r + lo) = sin(r) + lo * cos(r) for |lo| <= ulp(r).
+*/
+
+static inline Vec trig_sin(const Vec r, const Vec lo)
+{
+    Vec z = r * r;
+
+    return r + (r * z * vec_poly(z, SIN_COEF) + lo * (1 - z * 0.5));
+}
+
+/**
+*   @brief cos(r + lo) = cos(r) - lo * sin(r), the rounding error of 1 - r^2/2 is added back (fdlibm).
+*/
+
+static inline Vec trig_cos(const Vec r, const Vec lo)
+{
+    Vec z  = r * r;
+    Vec hz = z * 0.5;
+    Vec w  = 1 - hz;
+
+    return w + (((1 - w) - hz) + (z * z * vec_poly(z, COS_COEF) - r * lo));
+}
+
+/**
+*   @brief asin(s) = s + s * result for s = "big" ? sqrt((1 - ax) / 2) : ax, so s <= 1/2 and the polynomial
+*          is only in [0, 1/4]. For the big ax asin(ax) = pi/2 - 2 asin(s) and acos(ax) = 2 asin(s).
+*
+*   @param z [out] - s^2
+*/
+
+static inline Vec asin_reduced(const Vec ax, const Mask big, Vec *s, Vec *z)
+{
+    *z = big ? (1 - ax) * 0.5 : ax * ax;
+    *s = big ? vec_root(*z)    : ax;
+
+    return *z * vec_poly(*z, ASIN_COEF);
+}
+
+//--------------------------------------------------------------------------------------------------------------------
+
+static inline Vec kern_sin(Vec x, Mask *special)
+{
+    *special = !(vec_abs(x) <= TRIG_MAX);
+    x        = *special ? 0 : x;
+
+    Mask quadrant = {};
+    Vec  lo       = {};
+    Vec  r        = trig_reduce(x, &quadrant, &lo);
+
+    Vec val = ((quadrant & 1) != 0) ? trig_cos(r, lo) : trig_sin(r, lo);
+    val     = ((quadrant & 2) != 0) ? -val            : val;
+
+    return (x == 0) ? x : val; // sin(-0) = -0
+}
+
+static inline Vec kern_cos(Vec x, Mask *special)
+{
+    *special = !(vec_abs(x) <= TRIG_MAX);
+    x        = *special ? 0 : x;
+
+    Mask quadrant = {};
+    Vec  lo       = {};
+    Vec  r        = trig_reduce(x, &quadrant, &lo);
+
+    quadrant += 1; // cos(x) = sin(x + pi/2)
+
+    Vec val = ((quadrant & 1) != 0) ? trig_cos(r, lo) : trig_sin(r, lo);
+    return    ((quadrant & 2) != 0) ? -val            : val;
+}
+
+static inline Vec kern_tan(Vec x, Mask *special)
+{
+    *special = !(vec_abs(x) <= TRIG_MAX);
+    x        = *special ? 0 : x;
+
+    Mask quadrant = {};
+    Vec  lo       = {};
+    Vec  r        = trig_reduce(x, &quadrant, &lo);
+
+    Vec s = trig_sin(r, lo);
+    Vec c = trig_cos(r, lo);
+
+    Vec val = ((quadrant & 1) != 0) ? -c / s : s / c;
+
+    return (x == 0) ? x : val;
+}
+
+/**
+*   @brief log(x) = exp * ln2 + log(1 + f), log(1 + f) = 2s + 2s^3/3 + 2s^5/5 + ..., s = f / (2 + f),
+*          the sum is rearranged to keep the error of f - f^2/2 small (fdlibm).
+*/
+
+static inline Vec kern_log(Vec x, Mask *special)
+{
+    *special = !(x >= DBL_MIN && x <= DBL_MAX);
+    x        = *special ? 1 : x;
+
+    Vec exp = {};
+    Vec f   = log_split(x, &exp);
+
+    Vec s    = f / (2 + f);
+    Vec z    = s * s;
+    Vec r    = z * (TWO_THIRDS + z * vec_poly(z, LOG_COEF));
+    Vec hfsq = f * f * 0.5;
+
+    return exp * LN2_HI - ((hfsq - (s * (hfsq + r) + exp * LN2_LO)) - f);
+}
+
+static inline Vec kern_sqrt(Vec x, Mask *special)
+{
+    *special = !(x >= 0);
+    x        = *special ? 0 : x;
+
+    return vec_root(x);
+}
+
+static inline Vec kern_sinh(Vec x, Mask *special)
+{
+    Vec ax   = vec_abs(x);
+    *special = !(ax <= EXP_MAX);
+    ax       = *special ? 0 : ax;
+
+    Vec z     = ax * ax;
+    Vec small = ax + ax * z * vec_poly(z, SINH_COEF);
+
+    Vec e     = exp_reduced(ax, Vec{});
+    Vec big   = e * 0.5 - 0.5 / e;
+
+    return (Vec) ((Mask) ((ax < 1) ? small : big) | (Mask) vec_sign(x));
+}
+
+static inline Vec kern_cosh(Vec x, Mask *special)
+{
+    Vec ax   = vec_abs(x);
+    *special = !(ax <= EXP_MAX);
+    ax       = *special ? 0 : ax;
+
+    Vec e = exp_reduced(ax, Vec{});
+
+    return e * 0.5 + 0.5 / e;
+}
+
+/**
+*   @brief For the big |x| s = s_hi + c, s_hi is the high word of s, so s_hi^2 is exact and pi/2 - 2 s_hi
+*          loses nothing (fdlibm).
+*/
+
+static inline Vec kern_asin(Vec x, Mask *special)
+{
+    Vec ax   = vec_abs(x);
+    *special = !(ax <= 1);
+    ax       = *special ? 0 : ax;
+
+    Mask big = ax > 0.5;
+    Vec  s   = {};
+    Vec  z   = {};
+    Vec  r   = asin_reduced(ax, big, &s, &z);
+
+    Vec s_hi    = (Vec) ((Mask) s & HIGH_WORD);
+    Vec c       = (z - s_hi * s_hi) / ((s > 0) ? s + s_hi : 1); // s = 0 for |x| = 1
+    Vec big_val = PI_4_HI - ((2 * s * r - (PI_2_LO - 2 * c)) - (PI_4_HI - 2 * s_hi));
+
+    Vec val = big ? big_val : s + s * r;
+    return (Vec) ((Mask) val | (Mask) vec_sign(x));
+}
+
+static inline Vec kern_acos(Vec x, Mask *special)
+{
+    Vec ax   = vec_abs(x);
+    *special = !(ax <= 1);
+    ax       = *special ? 0 : ax;
+    x        = *special ? 0 : x;
+
+    Mask big = ax > 0.5;
+    Vec  s   = {};
+    Vec  z   = {};
+    Vec  r   = asin_reduced(ax, big, &s, &z);
+
+    Vec s_hi    = (Vec) ((Mask) s & HIGH_WORD);
+    Vec c       = (z - s_hi * s_hi) / ((s > 0) ? s + s_hi : 1);
+
+    Vec small_val = PI_2_HI - (x - (PI_2_LO - x * r));  // pi/2 - asin(x)
+    Vec pos_val   = 2 * (s_hi + (s * r + c));           // 2 asin(s)
+    Vec neg_val   = PI_HI - 2 * (s + (s * r - PI_2_LO)); // pi - 2 asin(s)
+
+    return big ? ((x > 0) ? pos_val : neg_val) : small_val;
+}
+
+/**
+*   @brief atan(t) = atan(c) + atan((t - c) / (1 + c t)) for c of the interval of t, the argument of the
+*          polynomial is |u| <= 7/16 (fdlibm).
+*/
+
+static inline Vec kern_atan(Vec x, Mask *special)
+{
+    Vec ax   = vec_abs(x);
+    *special = !(ax <= DBL_MAX);
+    ax       = *special ? 0 : ax;
+
+    const Atan_interval *first = ATAN_INTERVALS;
+
+    Vec num_k = Vec{} + first->num_k, num_b   = Vec{} + first->num_b;
+    Vec den_k = Vec{} + first->den_k, den_b   = Vec{} + first->den_b;
+    Vec atan_hi = Vec{} + first->atan_hi, atan_lo = Vec{} + first->atan_lo;
+
+    for (size_t i = 1; i < sizeof(ATAN_INTERVALS) / sizeof(ATAN_INTERVALS[0]); ++i)
+    {
+        const Atan_interval *cur = ATAN_INTERVALS + i;
+        Mask in = ax >= cur->from;
+
+        num_k   = in ? cur->num_k   : num_k;
+        num_b   = in ? cur->num_b   : num_b;
+        den_k   = in ? cur->den_k   : den_k;
+        den_b   = in ? cur->den_b   : den_b;
+        atan_hi = in ? cur->atan_hi : atan_hi;
+        atan_lo = in ? cur->atan_lo : atan_lo;
+    }
+
+    Vec u   = (num_k * ax + num_b) / (den_k * ax + den_b);
+    Vec z   = u * u;
+    Vec val = atan_hi + ((u * z * vec_poly(z, ATAN_COEF) + atan_lo) + u);
+
+    return (Vec) ((Mask) val | (Mask) vec_sign(x));
+}
+
+/**
+*   @brief x^y = e^(y * log|x|), log|x| is a double-double: s = f / (2 + f) is corrected by the remainder
+*          of the division, 2s^3/3 and the exponent are added exactly, so the error of y * log|x| is small
+*          even if the result is far from 1. The negative x is only for the integer y, the sign is the parity of y.
+*/
+
+static inline Vec kern_pow(Vec x, Vec y, Mask *special)
+{
+    Vec ax = vec_abs(x);
+    Vec ay = vec_abs(y);
+
+    Mask y_int = {};
+    Vec  y_rnd = vec_round(y, &y_int);
+
+    Mask is_int = (y_rnd == y);
+    *special    = !(ax >= DBL_MIN && ax <= DBL_MAX && ay <= POW_Y_MAX) || (x < 0 && !is_int);
+
+    ax = *special ? 1 : ax;
+    y  = *special ? 0 : y;
+
+    Vec exp = {};
+    Vec f   = log_split(ax, &exp);
+
+    Vec d_hi = 2 + f;
+    Vec d_lo = f - (d_hi - 2);
+
+    Vec p_hi = {}, p_lo = {};
+    Vec s_hi = f / d_hi;
+
+    vec_two_prod(s_hi, d_hi, &p_hi, &p_lo);
+    Vec s_lo = (((f - p_hi) - p_lo) - s_hi * d_lo) / d_hi;
+
+    Vec z_hi = {}, z_lo = {};
+    Vec c_hi = {}, c_lo = {};
+    Vec t_hi = {}, t_lo = {};
+
+    vec_two_prod(s_hi, s_hi, &z_hi, &z_lo);
+    vec_two_prod(s_hi, z_hi, &c_hi, &c_lo);             // s^3
+    c_lo += s_hi * z_lo + 3 * z_hi * s_lo;
+
+    vec_two_prod(c_hi, Vec{} + TWO_THIRDS, &t_hi, &t_lo);       // 2s^3/3 + 2s^5/5 + ...
+    t_lo += c_lo * TWO_THIRDS + c_hi * (TWO_THIRDS_LO + z_hi * vec_poly(z_hi, LOG_COEF));
+
+    Vec log_hi = {}, log_lo = {};
+    Vec err    = {};
+
+    vec_two_sum(exp * LN2_HI, 2 * s_hi, &log_hi, &log_lo);
+    vec_two_sum(log_hi, t_hi, &log_hi, &err);
+    log_lo += err + (t_lo + 2 * s_lo + exp * LN2_LO);
+
+    Vec sum = log_hi + log_lo;
+    log_lo  = log_lo - (sum - log_hi);
+    log_hi  = sum;
+
+    Vec arg_hi = {}, arg_lo = {};
+
+    vec_two_prod(y, log_hi, &arg_hi, &arg_lo);
+    arg_lo += y * log_lo;
+
+    *special |= !(vec_abs(arg_hi) <= EXP_MAX);
+    arg_hi    = *special ? 0 : arg_hi;
+    arg_lo    = *special ? 0 : arg_lo;
+
+    Vec  val = exp_reduced(arg_hi, arg_lo);
+    Mask odd = (x < 0) & ((y_int & 1) != 0);
+
+    return odd ? -val : val;
+}
@@ -0,0 +1,421 @@
+/** @file */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+
+#include <atomic>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "vec_math.h"
+
+// Error of the kernels in ulps against the exactly rounded result, measured on 10^7 random points of each range,
+// with the points near the multiples of pi/2 (sin, cos, tan) and near 1 (log, pow). The error of glibc is
+// 0.5 ulp except 1.8 of sinh and 1.0 of cosh.
+//
+//  function    range of the kernel                 max ulps
+//  sin, cos    |x| <= 2^20                         0.8
+//  tan         |x| <= 2^20                         2.3
+//  log         [DBL_MIN, DBL_MAX]                  0.9
+//  sqrt        [0, inf]                            0.5 (the instruction)
+//  sinh, cosh  |x| <= 708                          1.7
+//  asin, acos  [-1, 1]                             0.9
+//  atan        finite                              0.9
+//  pow         |x| in [DBL_MIN, DBL_MAX],          1.1 for |y| <= 512, 1.4 for the rest
+//              |y| <= POW_Y_MAX, |y log|x|| <= 708
+//
+// The other arguments (NAN, infinities, zeros and subnormals of log and pow, huge arguments of sin) are
+// computed by libm, so the special values and the errors of the domain are the ones of libm.
+//
+// float is widened to double, computed by these kernels and rounded, so its error is the rounding and the error
+// of double in float ulps, 0.5 + 2.3 * 2^-29 at most. Measured on 4 * 10^6 random floats of each range:
+//
+//  function    range of float                      max ulps of float
+//  sin, cos    |x| <= 2^20                         0.500
+//  tan         |x| <= 2^20                         0.500
+//  log         [FLT_MIN, FLT_MAX]                  0.500
+//  sqrt        [0, inf]                            0.500
+//  sinh, cosh  |x| <= 89                           0.500
+//  asin, acos  [-1, 1]                             0.500
+//  atan        finite                              0.500
+//  pow         |x| in [2^-20, 2^20], |y| <= 20     0.500
+
+/*__________________________________________STRUCT_DEFINITIONS__________________________________________*/
+
+struct Vec_funcs
+{
+    void (*sin )(double *vals, const int count);
+    void (*cos )(double *vals, const int count);
+    void (*tan )(double *vals, const int count);
+    void (*log )(double *vals, const int count);
+    void (*sqrt)(double *vals, const int count);
+    void (*sinh)(double *vals, const int count);
+    void (*cosh)(double *vals, const int count);
+    void (*asin)(double *vals, const int count);
+    void (*acos)(double *vals, const int count);
+    void (*atan)(double *vals, const int count);
+    void (*pow )(double *base, const double *exp, const int count);
+};
+
+struct Atan_interval
+{
+    double from;
+    double num_k;
+    double num_b;
+    double den_k;
+    double den_b;
+    double atan_hi;
+    double atan_lo;
+};
+
+/*______________________STATIC_FUNCTION_______________________*/
+
+template <double (*FUNC)(double)>
+static void         scalar_unary        (double *vals, const int count);
+static void         scalar_pow          (double *base, const double *exp, const int count);
+
+static void         float_unary         (void (*func)(double *, const int), float *vals, const int count);
+
+static VEC_LEVEL    vec_level_max       ();
+static const Vec_funcs *vec_funcs       ();
+
+/*____________________________________________________________*/
+
+static const int       FLOAT_CHUNK    = 64;                 // floats widened to double at once
+
+static const double    ROUND          = 0x1.8p52;           // x + ROUND - ROUND rounds x to an integer
+static const long long ROUND_BITS     = 0x4338000000000000; // bits of ROUND
+static const long long SIGN_BIT       = LLONG_MIN;
+static const long long SQRT_HALF_BITS = 0x3fe6a09e667f3bcd; // bits of sqrt(1/2)
+static const long long HIGH_WORD      = ~0xffffffffLL;      // sign, exponent and 20 bits of the mantissa
+static const double    SPLITTER       = 0x1p27 + 1;
+
+static const double    TRIG_MAX       = 0x1p20;
+static const double    EXP_MAX        = 708;
+static const double    POW_Y_MAX      = 0x1p50;
+
+static const double    TWO_PI         = 0x1.45f306dc9c883p-1;   // 2/pi
+static const double    PIO2_1         = 0x1.921fb544p+0;        // pi/2 = PIO2_1 + PIO2_2 + PIO2_3 + PIO2_4,
+static const double    PIO2_2         = 0x1.0b4611a6p-34;       // the first three have 33 bits
+static const double    PIO2_3         = 0x1.3198a2ep-69;
+static const double    PIO2_4         = 0x1.b839a252049c1p-104;
+
+static const double    PI_HI          = 0x1.921fb54442d18p+1;
+static const double    PI_2_HI        = 0x1.921fb54442d18p+0;
+static const double    PI_2_LO        = 0x1.1a62633145c07p-54;
+static const double    PI_4_HI        = 0x1.921fb54442d18p-1;
+
+static const double    INV_LN2        = 0x1.71547652b82fep+0;
+static const double    LN2_HI         = 0x1.62e42feep-1;        // 32 bits, k * LN2_HI is exact for |k| < 2^21
+static const double    LN2_LO         = 0x1.a39ef35793c76p-33;
+static const double    TWO_THIRDS     = 0x1.5555555555555p-1;
+static const double    TWO_THIRDS_LO  = 0x1.5555555555555p-55;
+
+// Taylor series: 1/n! of e^r (n = 13..2), (-1)^n / (2n+1)! of sin (n = 9..1), (-1)^n / (2n)! of cos
+// (n = 9..2), 1 / (2n+1)! of sinh (n = 9..1) and 2 / (2n+1) of log (n = 12..2, the last one is TWO_THIRDS)
+
+static const double EXP_COEF[] =
+{
+    0x1.6124613a86d09p-33, 0x1.1eed8eff8d898p-29, 0x1.ae64567f544e4p-26, 0x1.27e4fb7789f5cp-22,
+    0x1.71de3a556c734p-19, 0x1.a01a01a01a01ap-16, 0x1.a01a01a01a01ap-13, 0x1.6c16c16c16c17p-10,
+    0x1.1111111111111p-7 , 0x1.5555555555555p-5 , 0x1.5555555555555p-3 , 0x1p-1               ,
+};
+
+static const double SIN_COEF[] =
+{
+   -0x1.2f49b46814157p-57, 0x1.952c77030ad4ap-49,-0x1.ae7f3e733b81fp-41, 0x1.6124613a86d09p-33,
+   -0x1.ae64567f544e4p-26, 0x1.71de3a556c734p-19,-0x1.a01a01a01a01ap-13, 0x1.1111111111111p-7 ,
+   -0x1.5555555555555p-3 ,
+};
+
+static const double COS_COEF[] =
+{
+   -0x1.6827863b97d97p-53, 0x1.ae7f3e733b81fp-45,-0x1.93974a8c07c9dp-37, 0x1.1eed8eff8d898p-29,
+   -0x1.27e4fb7789f5cp-22, 0x1.a01a01a01a01ap-16,-0x1.6c16c16c16c17p-10, 0x1.5555555555555p-5 ,
+};
+
+static const double SINH_COEF[] =
+{
+    0x1.2f49b46814157p-57, 0x1.952c77030ad4ap-49, 0x1.ae7f3e733b81fp-41, 0x1.6124613a86d09p-33,
+    0x1.ae64567f544e4p-26, 0x1.71de3a556c734p-19, 0x1.a01a01a01a01ap-13, 0x1.1111111111111p-7 ,
+    0x1.5555555555555p-3 ,
+};
+
+static const double LOG_COEF[] =
+{
+    0x1.47ae147ae147bp-4 , 0x1.642c8590b2164p-4 , 0x1.8618618618618p-4 , 0x1.af286bca1af28p-4 ,
+    0x1.e1e1e1e1e1e1ep-4 , 0x1.1111111111111p-3 , 0x1.3b13b13b13b14p-3 , 0x1.745d1745d1746p-3 ,
+    0x1.c71c71c71c71cp-3 , 0x1.2492492492492p-2 , 0x1.999999999999ap-2 ,
+};
+
+// Polynomials of the least relative error: atan(u) = u + u^3 ATAN(u^2), u^2 <= (7/16)^2, and
+// asin(s) = s + s^3 ASIN(s^2), s^2 <= 1/4, the error of both is < 2^-58
+
+static const double ATAN_COEF[] =
+{
+    0x1.c0dae06acb016p-7 ,-0x1.0581b57c8ceebp-5 , 0x1.6b2c7d33ea236p-5 ,-0x1.a9ff7baa9a301p-5 ,
+    0x1.e13359e4148f2p-5 ,-0x1.1109119540d6ap-4 , 0x1.3b13303a7638dp-4 ,-0x1.745d11d3b2c26p-4 ,
+    0x1.c71c71a186541p-4 ,-0x1.24924924461dap-3 , 0x1.9999999998fe9p-3 ,-0x1.5555555555552p-2 ,
+};
+
+// atan(t) = atan_hi + atan_lo + atan(u), u = (num_k t + num_b) / (den_k t + den_b) for t >= from,
+// the points of the intervals are 1/2, 1, 3/2 and infinity
+
+static const Atan_interval ATAN_INTERVALS[] =
+{
+    {0      , 1,  0  , 0  , 1, 0                    , 0                    },
+    {7.0/16 , 2, -1  , 1  , 2, 0x1.dac670561bb4fp-2 , 0x1.a2b7f222f65e2p-56},
+    {11.0/16, 1, -1  , 1  , 1, 0x1.921fb54442d18p-1 , 0x1.1a62633145c07p-55},
+    {19.0/16, 1, -1.5, 1.5, 1, 0x1.f730bd281f69bp-1 , 0x1.007887af0cbbdp-56},
+    {39.0/16, 0, -1  , 1  , 0, 0x1.921fb54442d18p+0 , 0x1.1a62633145c07p-54},
+};
+
+static const double ASIN_COEF[] =
+{
+    0x1.0bb05a477b6fp-5  ,-0x1.5954695255269p-6 , 0x1.6492a013fe693p-6 , 0x1.e2beb32d5e805p-9 ,
+    0x1.6173f22452fc8p-7 , 0x1.757b7a2d948d1p-7 , 0x1.ca20ce0f6b423p-7 , 0x1.1c49e2bb430fep-6 ,
+    0x1.6e8bdfa67380dp-6 , 0x1.f1c71a8dc2f9bp-6 , 0x1.6db6db72260cfp-5 , 0x1.333333332df7ep-4 ,
+    0x1.5555555555578p-3 ,
+};
+
+/*____________________________________________________________*/
+
+static const Vec_funcs SCALAR_FUNCS =
+{
+    scalar_unary<sin >,
+    scalar_unary<cos >,
+    scalar_unary<tan >,
+    scalar_unary<log >,
+    scalar_unary<sqrt>,
+    scalar_unary<sinh>,
+    scalar_unary<cosh>,
+    scalar_unary<asin>,
+    scalar_unary<acos>,
+    scalar_unary<atan>,
+    scalar_pow,
+};
+
+#if defined(__x86_64__)
+
+namespace vec_sse2
+{
+    #define VEC_WIDTH 2
+    #define VEC_SQRT  _mm_sqrt_pd
+    #ifdef __FMA__                  // -march with FMA, the compiler contracts the splitting of vec_two_prod()
+    #define VEC_FMS   _mm_fmsub_pd
+    #endif
+    #include "vec_kernels.h"
+    #undef  VEC_WIDTH
+    #undef  VEC_SQRT
+    #undef  VEC_FMS
+}
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+
+namespace vec_avx2
+{
+    #define VEC_WIDTH 4
+    #define VEC_SQRT  _mm256_sqrt_pd
+    #define VEC_FMS   _mm256_fmsub_pd
+    #include "vec_kernels.h"
+    #undef  VEC_WIDTH
+    #undef  VEC_SQRT
+    #undef  VEC_FMS
+}
+
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512dq,avx512vl,fma")
+
+namespace vec_avx512
+{
+    #define VEC_WIDTH 8
+    #define VEC_SQRT  _mm512_sqrt_pd
+    #define VEC_FMS   _mm512_fmsub_pd
+    #include "vec_kernels.h"
+    #undef  VEC_WIDTH
+    #undef  VEC_SQRT
+    #undef  VEC_FMS
+}
+
+#pragma GCC pop_options
+
+static const Vec_funcs *const LEVEL_FUNCS[] = {&SCALAR_FUNCS, &vec_sse2::FUNCS, &vec_avx2::FUNCS, &vec_avx512::FUNCS};
+
+#else
+
+static const Vec_funcs *const LEVEL_FUNCS[] = {&SCALAR_FUNCS};
+
+#endif
+
+static std::atomic<int> LEVEL = -1; // the level in use, -1 until the first call
+
+/*____________________________________________________________*/
+
+/**
+*   @brief Returns the instruction set of the kernels in use. It is the best one of the processor unless
+*          vec_level_set() has been called.
+*/
+
+VEC_LEVEL vec_level()
+{
+    int level = LEVEL.load(std::memory_order_relaxed);
+    if (level >= 0) return (VEC_LEVEL) level;
+
+    level = vec_level_max();
+    LEVEL.store(level, std::memory_order_relaxed);
+
+    return (VEC_LEVEL) level;
+}
+
+/**
+*   @brief Uses the best instruction set of the processor which is not above "max_level", VEC_SCALAR gives
+*          exactly the values of libm. The level is common for all threads.
+*
+*   @return the level in use
+*/
+
+VEC_LEVEL vec_level_set(const VEC_LEVEL max_level)
+{
+    int level = vec_level_max();
+    if (level > max_level) level = max_level;
+
+    LEVEL.store(level, std::memory_order_relaxed);
+    return (VEC_LEVEL) level;
+}
+
+/**
+*   @brief The best level which is compiled and supported by the processor.
+*/
+
+static VEC_LEVEL vec_level_max()
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") &&
+        __builtin_cpu_supports("avx512vl"))                                          return VEC_AVX512;
+    if (__builtin_cpu_supports("avx2")    && __builtin_cpu_supports("fma"))          return VEC_AVX2;
+
+    return VEC_SSE2;
+#else
+    return VEC_SCALAR;
+#endif
+}
+
+static const Vec_funcs *vec_funcs()
+{
+    return LEVEL_FUNCS[vec_level()];
+}
+
+//--------------------------------------------------------------------------------------------------------------------
+
+void vec_sin (double *vals, const int count) { vec_funcs()->sin (vals, count); }
+void vec_cos (double *vals, const int count) { vec_funcs()->cos (vals, count); }
+void vec_tan (double *vals, const int count) { vec_funcs()->tan (vals, count); }
+void vec_log (double *vals, const int count) { vec_funcs()->log (vals, count); }
+void vec_sqrt(double *vals, const int count) { vec_funcs()->sqrt(vals, count); }
+void vec_sinh(double *vals, const int count) { vec_funcs()->sinh(vals, count); }
+void vec_cosh(double *vals, const int count) { vec_funcs()->cosh(vals, count); }
+void vec_asin(double *vals, const int count) { vec_funcs()->asin(vals, count); }
+void vec_acos(double *vals, const int count) { vec_funcs()->acos(vals, count); }
+void vec_atan(double *vals, const int count) { vec_funcs()->atan(vals, count); }
+
+/**
+*   @brief base[i] = pow(base[i], exp[i]) for i < count.
+*/
+
+void vec_pow(double *base, const double *exp, const int count)
+{
+    vec_funcs()->pow(base, exp, count);
+}
+
+//--------------------------------------------------------------------------------------------------------------------
+
+void vec_sin (float *vals, const int count) { float_unary(vec_funcs()->sin , vals, count); }
+void vec_cos (float *vals, const int count) { float_unary(vec_funcs()->cos , vals, count); }
+void vec_tan (float *vals, const int count) { float_unary(vec_funcs()->tan , vals, count); }
+void vec_log (float *vals, const int count) { float_unary(vec_funcs()->log , vals, count); }
+void vec_sqrt(float *vals, const int count) { float_unary(vec_funcs()->sqrt, vals, count); }
+void vec_sinh(float *vals, const int count) { float_unary(vec_funcs()->sinh, vals, count); }
+void vec_cosh(float *vals, const int count) { float_unary(vec_funcs()->cosh, vals, count); }
+void vec_asin(float *vals, const int count) { float_unary(vec_funcs()->asin, vals, count); }
+void vec_acos(float *vals, const int count) { float_unary(vec_funcs()->acos, vals, count); }
+void vec_atan(float *vals, const int count) { float_unary(vec_funcs()->atan, vals, count); }
+
+/**
+*   @brief base[i] = pow(base[i], exp[i]) for i < count in double, rounded to float.
+*/
+
+void vec_pow(float *base, const float *exp, const int count)
+{
+    assert(base != nullptr || count == 0);
+    assert(exp  != nullptr || count == 0);
+
+    const Vec_funcs *funcs = vec_funcs();
+
+    double wide_base[FLOAT_CHUNK] = {};
+    double wide_exp [FLOAT_CHUNK] = {};
+
+    for (int first = 0; first < count; first += FLOAT_CHUNK)
+    {
+        int size = (count - first < FLOAT_CHUNK) ? count - first : FLOAT_CHUNK;
+
+        for (int i = 0; i < size; ++i) wide_base[i] = base[first + i];
+        for (int i = 0; i < size; ++i) wide_exp [i] = exp [first + i];
+
+        funcs->pow(wide_base, wide_exp, size);
+
+        for (int i = 0; i < size; ++i) base[first + i] = (float) wide_base[i];
+    }
+}
+
+/**
+*   @brief Widens the floats to double by FLOAT_CHUNK of them, computes "func" and rounds the values back.
+*          The conversions are vectorized, so float costs about as much as double.
+*/
+
+static void float_unary(void (*func)(double *, const int), float *vals, const int count)
+{
+    assert(func != nullptr);
+    assert(vals != nullptr || count == 0);
+
+    double wide[FLOAT_CHUNK] = {};
+
+    for (int first = 0; first < count; first += FLOAT_CHUNK)
+    {
+        int size = (count - first < FLOAT_CHUNK) ? count - first : FLOAT_CHUNK;
+
+        for (int i = 0; i < size; ++i) wide[i] = vals[first + i];
+
+        func(wide, size);
+
+        for (int i = 0; i < size; ++i) vals[first + i] = (float) wide[i];
+    }
+}
+
+//--------------------------------------------------------------------------------------------------------------------
+
+template <double (*FUNC)(double)>
+static void scalar_unary(double *vals, const int count)
+{
+    assert(vals != nullptr || count == 0);
+
+    for (int i = 0; i < count; ++i) vals[i] = FUNC(vals[i]);
+}
+
+static void scalar_pow(double *base, const double *exp, const int count)
+{
+    assert(base != nullptr || count == 0);
+    assert(exp  != nullptr || count == 0);
+
+    for (int i = 0; i < count; ++i) base[i] = pow(base[i], exp[i]);
+}
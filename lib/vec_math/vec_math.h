@@ -0,0 +1,47 @@
+#ifndef VEC_MATH_H
+#define VEC_MATH_H
+
+/*___________________________________________STRUCT_DEFINITIONS__________________________________________*/
+
+// Instruction sets of the kernels, each one is 2x wider than the previous one. VEC_SCALAR is the loop of libm.
+enum VEC_LEVEL
+{
+    VEC_SCALAR  ,
+    VEC_SSE2    ,   // 2 doubles
+    VEC_AVX2    ,   // 4 doubles, with FMA
+    VEC_AVX512  ,   // 8 doubles
+};
+
+/*_________________________________________FUNCTION_DECLARATIONS_________________________________________*/
+
+VEC_LEVEL   vec_level               ();
+VEC_LEVEL   vec_level_set           (const VEC_LEVEL max_level);
+
+void        vec_sin                 (double *vals, const int count);
+void        vec_cos                 (double *vals, const int count);
+void        vec_tan                 (double *vals, const int count);
+void        vec_log                 (double *vals, const int count);
+void        vec_sqrt                (double *vals, const int count);
+void        vec_sinh                (double *vals, const int count);
+void        vec_cosh                (double *vals, const int count);
+void        vec_asin                (double *vals, const int count);
+void        vec_acos                (double *vals, const int count);
+void        vec_atan                (double *vals, const int count);
+void        vec_pow                 (double *base, const double *exp, const int count);
+
+// float is computed by the kernels of double and rounded back, see the ulps of float in vec_math.cpp
+void        vec_sin                 (float  *vals, const int count);
+void        vec_cos                 (float  *vals, const int count);
+void        vec_tan                 (float  *vals, const int count);
+void        vec_log                 (float  *vals, const int count);
+void        vec_sqrt                (float  *vals, const int count);
+void        vec_sinh                (float  *vals, const int count);
+void        vec_cosh                (float  *vals, const int count);
+void        vec_asin                (float  *vals, const int count);
+void        vec_acos                (float  *vals, const int count);
+void        vec_atan                (float  *vals, const int count);
+void        vec_pow                 (float  *base, const float  *exp, const int count);
+
+/*_______________________________________________________________________________________________________*/
+
+#endif //VEC_MATH_H
@@ -0,0 +1,610 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <math.h>
+
+#include "diff.h"
+#include "../lib/logs/log.h"
+#include "../lib/read_write/read_write.h"
+#include "../lib/vec_math/vec_math.h"
+
+static const int   SYS_SIZE     =        100;
+static const int   BRACKET_SIZE =    1 << 24;
+static const int   EVAL_POINTS  =         64;
+
+static const int   WARMUP       =          2;
+static const int   RUNS         =         10;
+static const int   LEVELS       =          6;
+static const int   MAX_RUNS     =        100;
+
+static const char *CORPUS       = "base/corpus.txt";
+static const char *FUNC         = "F(x)=";
+
+/*___________________________STRUCT_DEFINITIONS________________________*/
+
+enum STAGE
+{
+    STAGE_PARSE         ,
+    STAGE_OPTIMIZE      ,
+    STAGE_OPTIMIZE_VAR  ,
+    STAGE_DIFF_X        ,
+    STAGE_DIFF_Y        ,
+    STAGE_DIFF_Z        ,
+    STAGE_DIFF_A        ,
+    STAGE_EVALUATE      ,
+    STAGE_BATCH_FLOAT   ,
+    STAGE_BATCH_DOUBLE  ,
+    STAGE_BATCH_LIBM    ,
+    STAGE_BATCH_LONG    ,
+    STAGE_GRADIENT      ,
+    STAGE_BRACKET_FMT   ,
+    STAGE_TEX           ,
+
+    STAGE_NUM           ,
+};
+
+static const char *STAGE_NAMES[] =
+{
+    "parse"         ,
+    "optimize"      ,
+    "optimize_var"  ,
+    "diff_x"        ,
+    "diff_y"        ,
+    "diff_z"        ,
+    "diff_a"        ,
+    "evaluate"      ,
+    "batch_float"   ,
+    "batch_double"  ,
+    "batch_libm"    ,
+    "batch_long"    ,
+    "gradient"      ,
+    "bracket_fmt"   ,
+    "tex"           ,
+};
+
+struct Bench_case
+{
+    char       *text;                       // expression ending by '\n'
+    Tree_node  *tree;
+    Tree_node  *system_vars[SYS_SIZE];
+    Tree_minimizer *min;                    // f and its gradient of the "gradient" stage
+    Tree_tape  *tape;                       // f of the "batch_*" stages
+};
+
+struct Bench_level
+{
+    Bench_case *cases;
+    int         cases_num;
+    long long   nodes;                      // total number of nodes in the parsed and optimized trees
+};
+
+struct Stage_result
+{
+    double      time  [MAX_RUNS];           // seconds of each measured run
+    long long   allocs;                     // log_calloc() calls per run
+    long long   nodes;                      // processed nodes per run
+    long long   bytes;                      // parsed bytes per run, only for parsing
+};
+
+struct Bench_env
+{
+    char       *bracket_buff;
+    FILE       *null_stream;
+    double      checksum;                   // keeps the compiler from throwing the evaluation away
+};
+
+/*___________________________STATIC_FUNCTION___________________________*/
+
+static char   *corpus_read      (const char *file, int *const lines);
+static char  **corpus_split     (char *data, const int lines);
+
+static bool    level_ctor       (Bench_level *level, char *const *lines, const int lines_num, const int depth);
+static void    level_dtor       (Bench_level *level);
+static char   *case_compose     (char *const *lines, const int lines_num, const int first, const int depth);
+
+static void    stage_measure    (STAGE stage, Bench_level *level, Bench_env *env, const int runs, Stage_result *res);
+static double  stage_once       (STAGE stage, Bench_level *level, Bench_env *env, long long *const allocs,
+                                                                                  long long *const nodes);
+static void    case_prepare     (STAGE stage, Bench_case *bc);
+static void    case_run         (STAGE stage, Bench_case *bc, Bench_env *env, long long *const nodes);
+static void    case_clear       (Bench_case *bc);
+template <typename T>
+static void    case_batch       (Bench_case *bc, Bench_env *env);
+
+static void    result_print     (STAGE stage, const Stage_result *res, const int runs);
+static int     cmp_double       (const void *a, const void *b);
+static long long tree_size      (const Tree_node *node);
+static double  get_time         ();
+
+/*_____________________________________________________________________*/
+
+/**
+*   Times each stage of the pipeline separately over the corpus composed into levels of increasing size and depth.
+*   The level "k" joins 2^k lines of the corpus and wraps the result in "k" nested functions.
+*
+*   Usage: bench [corpus] [runs] [levels].
+*   The last line is "TOTAL <seconds>": the sum of the mean times of all stages, which is used by "make bench".
+*/
+
+int main(int argc, const char *argv[])
+{
+    const char *corpus = (argc > 1) ?      argv[1]  : CORPUS;
+    int         runs   = (argc > 2) ? atoi(argv[2]) : RUNS;
+    int         levels = (argc > 3) ? atoi(argv[3]) : LEVELS;
+
+    if (runs   <= 0 || runs > MAX_RUNS) runs   = RUNS;
+    if (levels <= 0)                    levels = LEVELS;
+
+    int    lines_num = 0;
+    char  *data      = corpus_read(corpus, &lines_num);
+    if    (data == nullptr || lines_num == 0)
+    {
+        fprintf(stderr, "Can't read the corpus \"%s\"\n", corpus);
+        log_free(data);
+        return 1;
+    }
+    char **lines = corpus_split(data, lines_num);
+
+    Bench_env env    = {};
+    env.bracket_buff = (char *) log_calloc(BRACKET_SIZE, sizeof(char));
+    env.null_stream  = fopen("/dev/null", "w");
+
+    if (lines == nullptr || env.bracket_buff == nullptr || env.null_stream == nullptr)
+    {
+        fprintf(stderr, "Can't initialize the benchmark\n");
+        return 1;
+    }
+
+    printf("corpus = %s (%d lines), warmup = %d, runs = %d\n", corpus, lines_num, WARMUP, runs);
+
+    double total = 0;
+
+    for (int depth = 0; depth < levels; ++depth)
+    {
+        Bench_level level = {};
+        if (!level_ctor(&level, lines, lines_num, depth)) continue;
+
+        printf("\nlevel %d: %d expressions, %lld nodes\n", depth, level.cases_num, level.nodes);
+        printf("%-14s %12s %10s %10s %10s %10s %12s %12s %10s\n", "stage", "nodes", "mean,ms", "stddev,ms", "min,ms",
+                                                                  "median,ms", "Mnodes/s", "allocs", "MB/s");
+
+        for (int stage = 0; stage < STAGE_NUM; ++stage)
+        {
+            Stage_result res = {};
+            stage_measure((STAGE) stage, &level, &env, runs, &res);
+            result_print ((STAGE) stage, &res, runs);
+
+            for (int i = 0; i < runs; ++i) total += res.time[i] / runs;
+        }
+
+        level_dtor(&level);
+    }
+
+    printf("\nchecksum = %lg\n", env.checksum);
+    printf("TOTAL %lf\n", total);
+
+    fclose  (env.null_stream);
+    log_free(env.bracket_buff);
+    log_free(lines);
+    log_free(data);
+    return 0;
+}
+
+/*_____________________________________________________________________*/
+
+static void stage_measure(STAGE stage, Bench_level *level, Bench_env *env, const int runs, Stage_result *res)
+{
+    assert(level != nullptr);
+    assert(env   != nullptr);
+    assert(res   != nullptr);
+
+    long long allocs = 0;
+    long long nodes  = 0;
+
+    for (int i = 0; i < WARMUP; ++i) stage_once(stage, level, env, &allocs, &nodes);
+
+    for (int i = 0; i < runs; ++i)
+    {
+        res->time[i] = stage_once(stage, level, env, &allocs, &nodes);
+    }
+
+    res->allocs = allocs;
+    res->nodes  = nodes;
+
+    if (stage == STAGE_PARSE)
+    {
+        for (int i = 0; i < level->cases_num; ++i) res->bytes += (long long) strlen(level->cases[i].text);
+    }
+}
+
+/**
+*   @brief Runs the stage once for each case of the level. Only the stage itself is timed,
+*          the preparation of the trees and their destruction are not.
+*
+*   @return elapsed time in seconds
+*/
+
+static double stage_once(STAGE stage, Bench_level *level, Bench_env *env, long long *const allocs,
+                                                                          long long *const nodes)
+{
+    assert(level  != nullptr);
+    assert(env    != nullptr);
+    assert(allocs != nullptr);
+    assert(nodes  != nullptr);
+
+    double    elapsed = 0;
+    long long calls   = 0;
+
+    *nodes = 0;
+
+    for (int i = 0; i < level->cases_num; ++i)
+    {
+        Bench_case *bc = level->cases + i;
+
+        case_prepare(stage, bc);
+
+        long long calls_begin = log_memory_thread_calls();
+        double     time_begin = get_time();
+
+        case_run(stage, bc, env, nodes);
+
+        elapsed += get_time() - time_begin;
+        calls   += log_memory_thread_calls() - calls_begin;
+
+        case_clear(bc);
+    }
+
+    *allocs = calls;
+    return elapsed;
+}
+
+static void case_prepare(STAGE stage, Bench_case *bc)
+{
+    assert(bc != nullptr);
+
+    if (stage == STAGE_PARSE) return;
+
+    bc->tree = Tree_parsing_buff(bc->text);
+    if (bc->tree == nullptr) return;
+
+    if (stage == STAGE_OPTIMIZE || stage == STAGE_OPTIMIZE_VAR) return;
+
+    Tree_optimize_main(&bc->tree);
+
+    if (stage == STAGE_GRADIENT) bc->min = Tree_minimizer_new(&bc->tree, bc->system_vars, SYS_SIZE);
+
+    if (stage == STAGE_BATCH_FLOAT || stage == STAGE_BATCH_DOUBLE || stage == STAGE_BATCH_LIBM ||
+        stage == STAGE_BATCH_LONG)
+    {
+        bc->tape = Tree_tape_compile(&bc->tree, 1, bc->system_vars, SYS_SIZE);
+    }
+}
+
+static void case_run(STAGE stage, Bench_case *bc, Bench_env *env, long long *const nodes)
+{
+    assert(bc    != nullptr);
+    assert(env   != nullptr);
+    assert(nodes != nullptr);
+
+    if (stage != STAGE_PARSE && bc->tree == nullptr) return;
+
+    Tree_node *res  = nullptr;
+    long long  size = (stage == STAGE_PARSE) ? 0 : tree_size(bc->tree);
+
+    switch (stage)
+    {
+        case STAGE_PARSE        : bc->tree = Tree_parsing_buff(bc->text);
+                                  size     = tree_size(bc->tree);
+                                  break;
+
+        case STAGE_OPTIMIZE     : Tree_optimize_main    (&bc->tree);                              break;
+        case STAGE_OPTIMIZE_VAR : Tree_optimize_var_main(&bc->tree, bc->system_vars, SYS_SIZE);   break;
+
+        case STAGE_DIFF_X       : res = diff_main(&bc->tree, bc->system_vars, "x");               break;
+        case STAGE_DIFF_Y       : res = diff_main(&bc->tree, bc->system_vars, "y");               break;
+        case STAGE_DIFF_Z       : res = diff_main(&bc->tree, bc->system_vars, "z");               break;
+        case STAGE_DIFF_A       : res = diff_main(&bc->tree, bc->system_vars, "a");               break;
+
+        case STAGE_EVALUATE     : for (int i = 0; i < EVAL_POINTS; ++i)
+                                  {
+                                      double val = Tree_get_value_in_point(bc->tree, bc->system_vars, 0.1 * i + 0.05,
+                                                                                                      0.2 * i + 1,
+                                                                                                      0.3 * i + 2);
+                                      if (isfinite(val)) env->checksum += val;
+                                  }
+                                  size *= EVAL_POINTS;
+                                  break;
+
+        case STAGE_BATCH_FLOAT  : case_batch<float      >(bc, env);
+                                  size *= EVAL_POINTS;
+                                  break;
+        case STAGE_BATCH_DOUBLE : case_batch<double     >(bc, env);
+                                  size *= EVAL_POINTS;
+                                  break;
+        case STAGE_BATCH_LIBM   : {
+                                      VEC_LEVEL level = vec_level();   // batch_double without the SIMD kernels
+
+                                      vec_level_set(VEC_SCALAR);
+                                      case_batch<double>(bc, env);
+                                      vec_level_set(level);
+                                  }
+                                  size *= EVAL_POINTS;
+                                  break;
+        case STAGE_BATCH_LONG   : case_batch<long double>(bc, env);
+                                  size *= EVAL_POINTS;
+                                  break;
+
+        case STAGE_GRADIENT     : if (bc->min == nullptr) break;
+
+                                  for (int i = 0; i < EVAL_POINTS; ++i)
+                                  {
+                                      double point[3] = {0.1 * i + 0.05, 0.2 * i + 1, 0.3 * i + 2};
+                                      double grad [3] = {};
+                                      double val      = 0;
+
+                                      Tree_minimizer_value(bc->min, point, &val, grad);
+                                      if (isfinite(val)) env->checksum += val;
+                                  }
+                                  size *= EVAL_POINTS;
+                                  break;
+
+        case STAGE_BRACKET_FMT  : Tree_get_bracket_fmt(bc->tree, bc->system_vars, env->bracket_buff);
+                                  env->checksum += (double) env->bracket_buff[0];
+                                  break;
+
+        case STAGE_TEX          : Tex_tree(bc->tree, env->null_stream);                           break;
+
+        case STAGE_NUM          :
+        default                 : break;
+    }
+
+    *nodes += size;
+    if (res != nullptr) Tree_dtor(res);
+}
+
+static void case_clear(Bench_case *bc)
+{
+    assert(bc != nullptr);
+
+    if (bc->tree != nullptr) Tree_dtor(bc->tree);
+    bc->tree = nullptr;
+
+    Tree_minimizer_delete(bc->min);
+    bc->min = nullptr;
+
+    Tree_tape_delete(bc->tape);
+    bc->tape = nullptr;
+
+    for (int i = 0; i < SYS_SIZE && bc->system_vars[i] != nullptr; ++i)
+    {
+        Tree_dtor(bc->system_vars[i]);
+        bc->system_vars[i] = nullptr;
+    }
+}
+
+/**
+*   @brief Evaluates the tape in the points of the "evaluate" stage by Tree_tape_values() in the precision T.
+*/
+
+template <typename T>
+static void case_batch(Bench_case *bc, Bench_env *env)
+{
+    assert(bc  != nullptr);
+    assert(env != nullptr);
+
+    if (bc->tape == nullptr) return;
+
+    T x_vals[EVAL_POINTS] = {};
+    T y_vals[EVAL_POINTS] = {};
+    T z_vals[EVAL_POINTS] = {};
+    T values[EVAL_POINTS] = {};
+
+    for (int i = 0; i < EVAL_POINTS; ++i)
+    {
+        x_vals[i] = (T) (0.1 * i + 0.05);
+        y_vals[i] = (T) (0.2 * i + 1);
+        z_vals[i] = (T) (0.3 * i + 2);
+    }
+
+    if (!Tree_tape_values(bc->tape, values, x_vals, y_vals, z_vals, EVAL_POINTS)) return;
+
+    for (int i = 0; i < EVAL_POINTS; ++i)
+    {
+        if (isfinite(values[i])) env->checksum += (double) values[i];
+    }
+}
+
+/*_____________________________________________________________________*/
+
+static void result_print(STAGE stage, const Stage_result *res, const int runs)
+{
+    assert(res != nullptr);
+
+    double sorted[MAX_RUNS] = {};
+    memcpy(sorted, res->time, (size_t) runs * sizeof(double));
+    qsort (sorted, (size_t) runs, sizeof(double), cmp_double);
+
+    double mean = 0;
+    for (int i = 0; i < runs; ++i) mean += sorted[i];
+    mean /= runs;
+
+    double var = 0;
+    for (int i = 0; i < runs; ++i) var += (sorted[i] - mean) * (sorted[i] - mean);
+    var = (runs > 1) ? var / (runs - 1) : 0;
+
+    double median = (runs % 2) ? sorted[runs / 2] : (sorted[runs / 2 - 1] + sorted[runs / 2]) / 2;
+    double speed  = (mean > 0) ? (double) res->nodes / mean * 1e-6 : 0;
+
+    printf("%-14s %12lld %10.3lf %10.3lf %10.3lf %10.3lf %12.2lf %12lld", STAGE_NAMES[stage], res->nodes,
+                                                                         mean      * 1e3,
+                                                                         sqrt(var) * 1e3,
+                                                                         sorted[0] * 1e3,
+                                                                         median    * 1e3, speed, res->allocs);
+
+    if (res->bytes > 0 && mean > 0) printf(" %10.2lf\n", (double) res->bytes / mean * 1e-6);
+    else                            printf(" %10s\n", "-");
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double lhs = *(const double *) a;
+    double rhs = *(const double *) b;
+
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static long long tree_size(const Tree_node *node)
+{
+    if (node == nullptr) return 0;
+
+    return 1 + tree_size(node->left) + tree_size(node->right);
+}
+
+/*_____________________________________________________________________*/
+
+/**
+*   @brief Composes the expressions of the level and counts the nodes of their optimized trees.
+*          The expressions which can't be parsed are skipped.
+*/
+
+static bool level_ctor(Bench_level *level, char *const *lines, const int lines_num, const int depth)
+{
+    assert(level != nullptr);
+    assert(lines != nullptr);
+
+    level->cases = (Bench_case *) log_calloc((size_t) lines_num, sizeof(Bench_case));
+    if (level->cases == nullptr) return false;
+
+    for (int i = 0; i < lines_num; ++i)
+    {
+        char *text = case_compose(lines, lines_num, i, depth);
+        if  (text == nullptr) continue;
+
+        Tree_node *tree = Tree_parsing_buff(text);
+        if        (tree == nullptr) { log_free(text); continue; }
+
+        Tree_optimize_main(&tree);
+        level->nodes += tree_size(tree);
+        Tree_dtor(tree);
+
+        level->cases[level->cases_num++].text = text;
+    }
+
+    if (level->cases_num == 0) { level_dtor(level); return false; }
+    return true;
+}
+
+static void level_dtor(Bench_level *level)
+{
+    assert(level != nullptr);
+
+    for (int i = 0; i < level->cases_num; ++i) log_free(level->cases[i].text);
+    log_free(level->cases);
+
+    *level = {};
+}
+
+/**
+*   @brief Joins 2^depth lines beginning with "first" by '+' and '*' in turn and wraps the result in "depth" sines:
+*          sin(sin((A)+(B)*(C)...)).
+*
+*   @return the expression ending by '\n' and '\0'
+*/
+
+static char *case_compose(char *const *lines, const int lines_num, const int first, const int depth)
+{
+    assert(lines != nullptr);
+
+    const int parts = 1 << depth;
+
+    size_t len = 0;
+    for (int i = 0; i < parts; ++i) len += strlen(lines[(first + i) % lines_num]) + 3;
+    len += (size_t) depth * 5 + 2;
+
+    char *text = (char *) log_calloc(len, sizeof(char));
+    if   (text == nullptr) return nullptr;
+
+    char *pos = text;
+    for (int i = 0; i < depth; ++i) pos += sprintf(pos, "sin(");
+
+    for (int i = 0; i < parts; ++i)
+    {
+        if (i != 0) *pos++ = (i % 2) ? '+' : '*';
+
+        pos += sprintf(pos, "(%s)", lines[(first + i) % lines_num]);
+    }
+
+    for (int i = 0; i < depth; ++i) *pos++ = ')';
+    *pos++ = '\n';
+    *pos   = '\0';
+
+    return text;
+}
+
+/*_____________________________________________________________________*/
+
+/**
+*   @brief Reads the corpus and makes each line end by '\n'. The data ends by '\0'.
+*
+*   @param file  [in]  - name of the corpus file
+*   @param lines [out] - number of lines
+*/
+
+static char *corpus_read(const char *file, int *const lines)
+{
+    assert(file  != nullptr);
+    assert(lines != nullptr);
+
+    int   size = 0;
+    char *data = (char *) read_file(file, &size);
+    if   (data == nullptr) return nullptr;
+
+    char *corpus = (char *) log_calloc((size_t) size + 2, sizeof(char));
+    if   (corpus == nullptr) { log_free(data); return nullptr; }
+
+    memcpy(corpus, data, (size_t) size);
+    log_free(data);
+
+    if (size > 0 && corpus[size - 1] != '\n') corpus[size++] = '\n';
+    corpus[size] = '\0';
+
+    *lines = 0;
+    for (int i = 0; i < size; ++i) if (corpus[i] == '\n') *lines += 1;
+
+    return corpus;
+}
+
+/**
+*   @brief Cuts the corpus into lines without '\n'. The "F(x)=" prefix of the task format is skipped.
+*/
+
+static char **corpus_split(char *data, const int lines)
+{
+    assert(data != nullptr);
+
+    char **ret = (char **) log_calloc((size_t) lines, sizeof(char *));
+    if    (ret == nullptr) return nullptr;
+
+    for (int i = 0; i < lines; ++i)
+    {
+        char *end = strchr(data, '\n');
+        *end      = '\0';
+
+        if (!strncmp(data, FUNC, strlen(FUNC))) data += strlen(FUNC);
+
+        ret[i] = data;
+        data   = end + 1;
+    }
+
+    return ret;
+}
+
+static double get_time()
+{
+    timespec cur = {};
+    clock_gettime(CLOCK_MONOTONIC, &cur);
+
+    return (double) cur.tv_sec + (double) cur.tv_nsec * 1e-9;
+}
@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+static const char *func   = "F(x)=";
+
+static const char *unary_names[] =
+{
+    #define UNARY(str, n, op_val) str,
+
+    #include "diff_gen.h"
+
+    #undef UNARY
+};
+
+static const int UNARY_NUM = (int) (sizeof(unary_names) / sizeof(unary_names[0]));
+
+/*___________________________STRUCT_DEFINITIONS________________________*/
+
+enum PREC
+{
+    PREC_ADD    = 1,    // + -
+    PREC_MUL    = 2,    // * /
+    PREC_POW    = 3,    // ^
+    PREC_PRIM   = 4,    // number, variable, function or expression in brackets
+};
+
+struct Gen_param
+{
+    long long   count;          // number of expressions
+    long long   size;           // nodes in each expression
+    int         depth;          // max depth of the tree
+    unsigned long long seed;
+
+    const char *ops;            // binary operators, repeated ones are chosen more often
+    const char *vars;           // leaves: 'x', 'y', 'z' and 'e'
+    int         unary;          // percent of unary functions among the operators
+    int         num;            // percent of numbers among the leaves
+
+    bool        plain;          // expression only, without "F(x)="
+    const char *out;
+};
+
+/*___________________________STATIC_FUNCTION___________________________*/
+
+static bool                 param_parse (Gen_param *param, int argc, const char *argv[]);
+static void                 usage       ();
+
+static void                 gen_expr    (FILE *stream, long long size, int depth, PREC min_prec, const Gen_param *param);
+static void                 gen_leaf    (FILE *stream,                                           const Gen_param *param);
+static PREC                 op_prec     (char op);
+
+static unsigned long long   rand_next   ();
+static long long            rand_range  (long long max);
+
+/*_____________________________________________________________________*/
+
+static unsigned long long RAND_STATE = 0;
+
+/**
+*   Generates random expressions in the grammar of Tree_parsing_buff(): one expression in each line,
+*   in the "F(x)=" task format of tex_generate.cpp or without it if "-plain" is given.
+*   The same seed and parameters always give the same output.
+*/
+
+int main(int argc, const char *argv[])
+{
+    Gen_param param =
+    {
+        .count = 10     ,
+        .size  = 100    ,
+        .depth = 100    ,
+        .seed  = 1      ,
+
+        .ops   = "+-*/^",
+        .vars  = "xyz"  ,
+        .unary = 20     ,
+        .num   = 30     ,
+
+        .plain = false  ,
+        .out   = nullptr,
+    };
+
+    if (!param_parse(&param, argc, argv))
+    {
+        usage();
+        return 1;
+    }
+
+    FILE *stream = (param.out == nullptr) ? stdout : fopen(param.out, "w");
+    if   (stream == nullptr)
+    {
+        fprintf(stderr, "Can't open \"%s\"\n", param.out);
+        return 1;
+    }
+
+    RAND_STATE = param.seed;
+
+    for (long long i = 0; i < param.count; ++i)
+    {
+        if (!param.plain) fputs(func, stream);
+
+        gen_expr(stream, param.size, param.depth, PREC_ADD, &param);
+        fputc   ('\n', stream);
+    }
+
+    if (stream != stdout) fclose(stream);
+    return 0;
+}
+
+/*_____________________________________________________________________*/
+
+static bool param_parse(Gen_param *param, int argc, const char *argv[])
+{
+    assert(param != nullptr);
+    assert(argv  != nullptr);
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *key = argv[i];
+
+        if (!strcmp(key, "-plain")) { param->plain = true; continue; }
+        if (i + 1 == argc)          return false;
+
+        const char *val = argv[++i];
+
+        if      (!strcmp(key, "-n"    )) param->count = atoll  (val);
+        else if (!strcmp(key, "-size" )) param->size  = atoll  (val);
+        else if (!strcmp(key, "-depth")) param->depth = atoi   (val);
+        else if (!strcmp(key, "-seed" )) param->seed  = strtoull(val, nullptr, 10);
+        else if (!strcmp(key, "-ops"  )) param->ops   = val;
+        else if (!strcmp(key, "-vars" )) param->vars  = val;
+        else if (!strcmp(key, "-unary")) param->unary = atoi   (val);
+        else if (!strcmp(key, "-num"  )) param->num   = atoi   (val);
+        else if (!strcmp(key, "-o"    )) param->out   = val;
+        else                             return false;
+    }
+
+    if (param->count < 0 || param->size < 1 || param->depth < 0) return false;
+    if (param->unary < 0 || param->unary > 100)                  return false;
+    if (param->num   < 0 || param->num   > 100)                  return false;
+
+    if (param->ops [strspn(param->ops , "+-*/^")] != '\0') return false;
+    if (param->vars[strspn(param->vars, "xyze" )] != '\0') return false;
+
+    if (*param->vars == '\0') param->num = 100;
+    if (*param->ops  == '\0' && param->unary == 0) param->depth = 0;
+
+    return true;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: corpus_gen [-n count] [-size nodes] [-depth max_depth] [-seed seed]\n"
+                    "                  [-ops \"+-*/^\"] [-vars \"xyze\"] [-unary percent] [-num percent]\n"
+                    "                  [-plain] [-o file]\n");
+}
+
+/*_____________________________________________________________________*/
+
+/**
+*   @brief Writes an expression of about "size" nodes. A unary function takes two nodes (see the parser),
+*          so the size is not exact when the depth is exhausted.
+*
+*   @param min_prec [in] - the expression is put in brackets if its precedence is lower
+*/
+
+static void gen_expr(FILE *stream, long long size, int depth, PREC min_prec, const Gen_param *param)
+{
+    assert(stream != nullptr);
+    assert(param  != nullptr);
+
+    if (depth == 0 || size < 3)
+    {
+        gen_leaf(stream, param);
+        return;
+    }
+
+    if (*param->ops == '\0' || rand_range(100) < param->unary)
+    {
+        fputs   (unary_names[rand_range(UNARY_NUM)], stream);
+        gen_expr(stream, size - 2, depth - 1, PREC_ADD, param);
+        fputc   (')', stream);
+        return;
+    }
+
+    char op   = param->ops[rand_range((long long) strlen(param->ops))];
+    PREC prec = op_prec(op);
+
+    long long left  = 1 + rand_range(size - 2);
+    long long right = size - 1 - left;
+
+    if (prec < min_prec) fputc('(', stream);
+
+    gen_expr(stream, left , depth - 1, (prec == PREC_POW) ? PREC_PRIM : prec                , param);
+    fputc   (op, stream);
+    gen_expr(stream, right, depth - 1, (prec == PREC_POW) ? PREC_PRIM : (PREC) (prec + 1)  , param);
+
+    if (prec < min_prec) fputc(')', stream);
+}
+
+static void gen_leaf(FILE *stream, const Gen_param *param)
+{
+    assert(stream != nullptr);
+    assert(param  != nullptr);
+
+    if (rand_range(100) < param->num)
+    {
+        if (rand_range(2)) fprintf(stream, "%lld"     , 1 + rand_range(9));
+        else               fprintf(stream, "%lld.%02lld", rand_range(10), rand_range(100));
+        return;
+    }
+
+    fputc(param->vars[rand_range((long long) strlen(param->vars))], stream);
+}
+
+static PREC op_prec(char op)
+{
+    switch (op)
+    {
+        case '+':
+        case '-': return PREC_ADD;
+        case '*':
+        case '/': return PREC_MUL;
+        case '^': return PREC_POW;
+        default : assert(false && "default case in op_prec()");
+                  return PREC_PRIM;
+    }
+}
+
+/*_____________________________________________________________________*/
+
+/**
+*   @brief splitmix64, so that the output doesn't depend on the rand() of the platform.
+*/
+
+static unsigned long long rand_next()
+{
+    unsigned long long z = (RAND_STATE += 0x9E3779B97F4A7C15ULL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+    return z ^ (z >> 31);
+}
+
+static long long rand_range(long long max)
+{
+    assert(max > 0);
+
+    return (long long) (rand_next() % (unsigned long long) max);
+}
@@ -5,18 +5,380 @@
 #include <ctype.h>
 #include <stdarg.h>
 #include <math.h>
+#include <time.h>
+#include <limits.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <new>
+#include <atomic>
+#include <mutex>
+#include <type_traits>
 
 #include "diff.h"
-#include "dsl.h"
+#include "tape.h"
 
 #include "../lib/logs/log.h"
 #include "../lib/read_write/read_write.h"
 #include "../lib/algorithm/algorithm.h"
 #include "../lib/graph_dump/graph_dump.h"
+#include "../lib/task_pool/task_pool.h"
+#include "../lib/vec_math/vec_math.h"
+
+#include "dsl.h"
+
+/*___________________________STATIC_STRUCT_____________________________*/
+
+struct Diff_context
+{
+    Task_pool          *pool;
+    int                 threshold;
+
+    const Tree_node   **big;        // nodes of at least "threshold" nodes sorted by address, see diff_big_collect()
+    long long           big_num;
+    long long           big_cap;
+};
+
+const int DIFF_POOLS = 8; // pools of different sizes kept by diff_main_parallel()
+
+struct Diff_pool
+{
+    int                 threads;    // the argument of task_pool_new(), 0 for all the hardware threads
+    Task_pool          *pool;
+};
+
+struct Diff_task
+{
+    Task                task;
+
+    Tree_node          *node;
+    Tree_node         **system_vars;
+    VAR                 var;
+    bool                d_mode;
+    const Diff_context *ctx;
+
+    Tree_node          *result;
+};
+
+enum PARSE_ITEM
+{
+    PARSE_BIN   ,   // binary operator
+    PARSE_GROUP ,   // '('
+    PARSE_FUNC  ,   // unary function with its opening bracket
+};
+
+struct Parse_op
+{
+    PARSE_ITEM  item;
+    TYPE_OP     op;
+};
+
+const int PARSE_INLINE = 64; // stacks of small expressions don't allocate memory
+
+struct Parse_stack
+{
+    Tree_node **vals;
+    int         vals_size;
+    int         vals_cap;
+
+    Parse_op   *ops;
+    int         ops_size;
+    int         ops_cap;
+
+    Tree_node  *vals_inline[PARSE_INLINE];
+    Parse_op    ops_inline [PARSE_INLINE];
+
+    const char *err;                        // message of the syntax error, nullptr if memory is out
+};
+
+const size_t STREAM_RELEASE_STEP = 64 << 20; // the stream gives the read pages back by such parts
+
+struct Tree_stream
+{
+    File_map    map;
+    size_t      pos;
+    int         line;
+    char       *tail;   // copy of the last line with '\n' if the file doesn't end by it
+};
+
+const int BATCH_CHUNKS_PER_THREAD = 4; // more chunks than threads, so the slow ones are shared
+
+struct Batch_chunk
+{
+    Task                task;
+
+    const char         *begin;
+    const char         *end;
+
+    int                 newlines;
+    int                 first_line;
+    long long           size;       // lines with expressions
+    Tree_batch_line    *lines;      // place of the chunk in the result
+
+    bool                is_ok;
+};
+
+struct Parse_func
+{
+    const char *name;
+    int         len;
+    TYPE_OP     op;
+};
+
+enum TOKEN_TYPE
+{
+    TOKEN_NUM   ,
+    TOKEN_VAR   ,
+    TOKEN_FUNC  ,   // function name with the opening bracket
+    TOKEN_OPEN  ,
+    TOKEN_CLOSE ,
+    TOKEN_OP    ,   // binary operator
+    TOKEN_END   ,   // '\n'
+};
+
+struct Token
+{
+    TOKEN_TYPE  type;
+    const char *pos;
+    const char *err;    // message if the token is wrong
+
+    union
+    {
+        double  dbl;
+        VAR     var;
+        TYPE_OP op;
+    }
+    value;
+};
+
+const int FUNC_HASH_SIZE = 32;
+
+struct Func_hash
+{
+    bool        found;
+    unsigned    seed;
+    signed char index[FUNC_HASH_SIZE];  // index in parse_funcs[] or -1
+};
+
+const char     BIN_MAGIC[4] = {'D', 'T', 'R', 'E'};
+const unsigned BIN_VERSION  = 1;
+
+enum BIN_TAG    // the first byte of a node in the binary format
+{
+    BIN_NUM     =  0,   // 8 bytes of the double follow, little-endian
+    BIN_SYS     =  1,   // varint index in system_vars follows
+    BIN_UNDEF   =  2,
+    BIN_VAR     =  8,   // BIN_VAR + VAR
+    BIN_OP      = 16,   // BIN_OP  + TYPE_OP, the left and the right subtrees follow
+};
+
+const int WALK_INLINE = 64; // walks of small trees don't allocate memory
+
+struct Node_walk                // pre-order walk by an explicit stack, so deep trees don't overflow the call stack
+{
+    const Tree_node   **stk;
+    int                 size;
+    int                 cap;
+    bool                is_ok;
+
+    const Tree_node    *stk_inline[WALK_INLINE];
+};
+
+struct Bin_frame                // operator read by bin_read_tree() which waits for its subtrees
+{
+    TYPE_OP             op;
+    Tree_node          *left;   // nullptr until the left subtree is read
+};
+
+struct Bin_writer
+{
+    unsigned char  *data;
+    size_t          size;
+    size_t          cap;
+    bool            is_ok;
+};
+
+struct Bin_reader
+{
+    const unsigned char *data;
+    size_t               size;
+    size_t               pos;
+
+    long long            nodes;     // nodes left to read by the header
+    int                  sys_num;   // system_vars the current tree may refer to
+};
+
+const char     IMAGE_MAGIC[4] = {'D', 'T', 'I', 'M'};
+const unsigned IMAGE_VERSION  = 1;
+const unsigned IMAGE_ORDER    = 0x01020304; // the image is in the byte order of the machine that wrote it
+
+struct Image_header
+{
+    char        magic[4];
+    unsigned    version;
+    unsigned    order;
+    unsigned    nodes;
+    unsigned    sys_num;
+    unsigned    root;
+};
+
+/**
+*   Node of the image. The children are indices in the node array instead of pointers,
+*   so the image is used right from the mapped file.
+*/
+
+struct Image_node
+{
+    unsigned char   type;       // TYPE_NODE
+    unsigned char   op;         // TYPE_OP of NODE_OP or VAR of NODE_VAR
+    unsigned short  reserved;
+    unsigned        left;
+
+    union
+    {
+        double      dbl;
+        unsigned    right;
+        unsigned    sys;
+    }
+    value;
+};
+
+static_assert(sizeof(Image_node) == 16, "Image_node is written in files");
+
+struct Tree_image
+{
+    File_map            map;
+
+    const Image_node   *nodes;
+    const unsigned     *sys_roots;
+    unsigned            root;
+};
+
+struct Image_writer
+{
+    Image_node *nodes;
+    unsigned    size;
+    bool        is_ok;
+};
+
+struct Image_slot               // node waiting for image_write_tree() and the place of its index
+{
+    const Tree_node    *node;
+    unsigned           *index;
+};
+
+enum IMAGE_STEP                 // steps of image_value()
+{
+    IMAGE_VISIT,                // push the value of the node
+    IMAGE_APPLY,                // replace the values of both children by the value of the operator
+    IMAGE_STORE,                // memorize the value of the system variable
+};
+
+struct Image_frame
+{
+    unsigned            index;  // node of IMAGE_VISIT and IMAGE_APPLY, system variable of IMAGE_STORE
+    IMAGE_STEP          step;
+};
+
+const char     CACHE_MAGIC[4] = {'D', 'T', 'C', 'E'};
+const unsigned CACHE_VERSION  = 1;  // change it if the cached pipeline changes: diff_main() and Tree_optimize_main()
+
+struct Tree_cache
+{
+    char       *dir;
+    long long   max_bytes;
+};
+
+struct Cache_file
+{
+    char        name[32];
+    long long   mtime;      // nanoseconds
+    long long   size;
+};
+
+struct Eval_entry
+{
+    unsigned long long  expr;       // Tree_hash() of the expression
+    const Tree_node    *node;       // the expression itself, so the trees of equal hashes are never confused
+    Tree_node * const  *system_vars;
+    double              x_val;
+    double              y_val;
+    double              z_val;
+    double              value;
+
+    int                 lru_prev;   // the more recently used entry, -1 for the head
+    int                 lru_next;
+    int                 chain;      // next entry of the bucket, -1 for the last one
+};
+
+struct Eval_shard
+{
+    std::mutex          lock        = {};
+
+    Eval_entry         *entries     = nullptr;
+    int                 size        = 0;
+    int                 cap         = 0;
+
+    int                *buckets     = nullptr;  // the first entry of each bucket or -1
+    int                 bucket_mask = 0;
+
+    int                 lru_head    = -1;
+    int                 lru_tail    = -1;
+
+    long long           hits        = 0;
+    long long           misses      = 0;
+
+    Eval_shard              ()                    = default;
+    Eval_shard              (const Eval_shard &)  = delete;
+    Eval_shard &operator=   (const Eval_shard &)  = delete;
+};
+
+struct Eval_key                 // the expression in the point
+{
+    unsigned long long  expr;
+    const Tree_node    *node;
+    Tree_node * const  *system_vars;
+    double              x_val;
+    double              y_val;
+    double              z_val;
+};
+
+const int SYS_MEMO_INLINE = 64; // system variables of most trees are memoized without allocation
+
+struct Sys_memo     // values of the system variables in the current point
+{
+    double     *vals;
+    bool       *done;
+    int         cap;
+
+    double      vals_inline[SYS_MEMO_INLINE];
+    bool        done_inline[SYS_MEMO_INLINE];
+};
+
+struct Eval_point
+{
+    Tree_node **system_vars;
+    double      x_val;
+    double      y_val;
+    double      z_val;
+
+    Sys_memo    memo;
+};
+
+struct Tree_eval_cache
+{
+    Eval_shard         *shards;
+    int                 shards_num; // power of 2
+};
 
 /*___________________________STATIC_FUNCTION___________________________*/
 
-static bool         Tree_verify             (                           Tree_node *const root);
+static void         verify_stamp            (const Tree_node *root);
+static bool         verify_stamp_find       (const Tree_node *root);
 static void         Tree_verify_dfs         (unsigned int *const err,   Tree_node *const root,
                                                                         Tree_node *const node);
 static void         print_error_messages    (unsigned int        err);
@@ -26,12 +388,34 @@ static void         dfs_dtor                (Tree_node *const node);
 static bool         Tree_parsing_execute    (Tree_node *const root, const char *data     ,
                                                                     const int   data_size,
                                                                     int *const  data_pos );
-static Tree_node   *parse_general           (const char **data);
-static Tree_node   *parse_op_add_sub        (const char **data);
-static Tree_node   *parse_op_mul_div        (const char **data);
-static Tree_node   *parse_op_pow            (const char **data);
-static Tree_node   *parse_expretion         (const char **data);
-static Tree_node   *parse_dbl               (const char **data);
+static void         batch_split             (const File_map *map, Batch_chunk *chunk, const int chunks);
+static void         batch_run               (Task_pool *pool, Batch_chunk *chunk, const int chunks,
+                                                                                  void (*func)(void *chunk));
+static bool         batch_place             (Tree_batch *batch, Batch_chunk *chunk, const int chunks);
+static void         batch_count_task        (void *arg);
+static void         batch_parse_task        (void *arg);
+static Tree_node   *parse_line              (const char  *data, const int line, int *const col);
+static Tree_node   *parse_general           (const char **data, const char **err);
+static bool         parse_operand           (const char **data, Parse_stack *stk, bool *const after_pow,
+                                                                                  bool *const expect_operand);
+static bool         parse_operator          (const char **data, Parse_stack *stk, bool *const after_pow,
+                                                                                  bool *const expect_operand,
+                                                                                  bool *const is_end);
+static bool         parse_close             (Parse_stack *stk,                    bool *const after_pow);
+static bool         parse_end               (Parse_stack *stk);
+static bool         parse_push_primary      (Parse_stack *stk, Tree_node *val,    bool *const after_pow);
+static bool         parse_reduce            (Parse_stack *stk);
+static bool         parse_push_val          (Parse_stack *stk, Tree_node *val);
+static bool         parse_push_op           (Parse_stack *stk, PARSE_ITEM item, TYPE_OP op);
+static void        *stack_grow              (void *data, int *const cap, const size_t elem_size, const void *inline_data);
+static void         parse_stack_dtor        (Parse_stack *stk);
+static bool         lex_operand             (const char **data, Token *const tok);
+static bool         lex_operator            (const char **data, Token *const tok);
+static int          lex_func                (const char  *data, int *const len);
+static bool         lex_dbl                 (const char **data, double *const val, const char **err);
+static void         lex_skip                (const char **data);
+static bool         lex_is_blank            (const char  *data, const char *end);
+static bool         lex_is_space            (const char   c);
 //--------------------------------------------------------------------------------------------------------------------------
 static void         Tree_optimize_execute   (Tree_node **node);
 static bool         Tree_optimize_numbers   (Tree_node *node);
@@ -42,17 +426,86 @@ static bool         Tree_optimize_div_main  (Tree_node **node);
 static bool         Tree_optimize_pow_main  (Tree_node **node);
 static void         Tree_optimize_all       (Tree_node **node, Tree_node **null_son, Tree_node **good_son);
 //--------------------------------------------------------------------------------------------------------------------------
-static double       Tree_counter            (const double left, const double right, TYPE_OP op);
-static bool         is_char_var             (const char c);
 static VAR          get_diff_var            (VAR var);
 //--------------------------------------------------------------------------------------------------------------------------
-static Tree_node   *diff_execute            (Tree_node *const node, Tree_node *system_vars[], VAR var, bool d_mode);
+static Task_pool   *diff_pool               (int threads);
+static void         diff_pools_delete       ();
+static Tree_node   *diff_general            (Tree_node **root,      Tree_node *system_vars[], const char *vars,
+                                                                                              const Diff_context *ctx);
+static Tree_node   *diff_execute            (Tree_node *const node, Tree_node *system_vars[], VAR var, bool d_mode,
+                                                                                              const Diff_context *ctx);
 static Tree_node   *diff_var_case           (Tree_node *const node,                           VAR var, bool d_mode);
-static Tree_node   *diff_sys_case           (Tree_node *const node, Tree_node *system_vars[], VAR var, bool d_mode);
-static Tree_node   *diff_op_case            (Tree_node *const node, Tree_node *system_vars[], VAR var, bool d_mode);
-static Tree_node   *diff_op_pow             (Tree_node *const node, Tree_node *system_vars[], VAR var, bool d_mode);
+static Tree_node   *diff_sys_case           (Tree_node *const node, Tree_node *system_vars[], VAR var, bool d_mode,
+                                                                                              const Diff_context *ctx);
+static Tree_node   *diff_op_case            (Tree_node *const node, Tree_node *system_vars[], VAR var, bool d_mode,
+                                                                                              const Diff_context *ctx);
+static Tree_node   *diff_op_pow             (Tree_node *const node, Tree_node *system_vars[], VAR var, bool d_mode,
+                                                                                              const Diff_context *ctx);
+static void         diff_both               (Tree_node *const node, Tree_node *system_vars[], VAR var, bool d_mode,
+                                                                                              const Diff_context *ctx,
+                                                                                              Tree_node **dl,
+                                                                                              Tree_node **dr);
+static void         diff_spawn              (Diff_task *task,       Tree_node *const    node, Tree_node *system_vars[],
+                                                                    VAR var, bool d_mode,     const Diff_context *ctx);
+static void         diff_task_run           (void *task);
+static bool         diff_big_nodes          (Diff_context *ctx, const Tree_node *root, Tree_node *system_vars[]);
+static long long    diff_big_collect        (Diff_context *ctx, const Tree_node *node, Tree_node *system_vars[]);
+static bool         diff_is_big             (const Diff_context *ctx, const Tree_node *node);
+static int          cmp_node_ptr            (const void *a, const void *b);
 static Tree_node   *Tree_copy               (Tree_node *cp_from);
 //--------------------------------------------------------------------------------------------------------------------------
+static bool         metrics_begin           (Tree_metrics *metrics, const char *stage, const Tree_node *in,
+                                                                                           const bool all_threads = false);
+static void         metrics_end             (Tree_metrics *metrics,                    const Tree_node *out);
+static void         metrics_write           (const Tree_metrics *metrics);
+static long long    metrics_allocs          ();
+static void         walk_begin              (Node_walk *walk, const Tree_node *root);
+static const Tree_node *walk_next           (Node_walk *walk);
+static void         walk_end                (Node_walk *walk);
+static void         bin_write_tree          (Bin_writer *out, const Tree_node *root);
+static void         bin_write_node          (Bin_writer *out, const Tree_node *node);
+static void         bin_put                 (Bin_writer *out, const void *data, const size_t size);
+static void         bin_put_varint          (Bin_writer *out, unsigned long long val);
+static Tree_node   *bin_read_tree           (Bin_reader *in);
+static bool         bin_get                 (Bin_reader *in, void *data, const size_t size);
+static bool         bin_get_varint          (Bin_reader *in, unsigned long long *const val);
+static long long    bin_count_nodes         (const Tree_node *root);
+static long long    bin_count_trees         (const Tree_node *root, Tree_node *system_vars[], const int sys_size,
+                                                                                              int *const sys_num);
+static Tree_node   *bin_read_node           (Bin_reader *in, bool *const is_op, TYPE_OP *const op);
+static bool         bin_get_magic           (Bin_reader *in, const char *magic, const size_t size);
+static unsigned     image_write_tree        (Image_writer *out, const Tree_node *root);
+static bool         image_check             (const Image_header *header, const size_t size);
+static bool         image_check_refs        (const Image_node *nodes, const unsigned nodes_num);
+static double       image_value             (const Tree_image *image, const unsigned index, Eval_point *point);
+static size_t       image_nodes_offset      (const unsigned sys_num);
+static unsigned long long cache_hash        (const unsigned char *input, const size_t input_size, const char *vars);
+static Tree_node   *cache_load              (const char *path, const unsigned char *input, const size_t input_size,
+                                                               const char *vars,  Tree_node **root, const int sys_size);
+static bool         cache_store             (const Tree_cache *cache, const char *path,
+                                                                      const unsigned char *input, const size_t input_size,
+                                                                      const char *vars, const Tree_node *root,
+                                                                      const Tree_node *diff,
+                                                                      Tree_node *system_vars[], const int sys_size);
+static Tree_node   *cache_read_tree         (Bin_reader *in, const int sys_size);
+static void         cache_put_blob          (Bin_writer *out, const void *data, const size_t size);
+static bool         cache_get_blob          (Bin_reader *in, const unsigned char **data, size_t *const size);
+static void         cache_evict             (const Tree_cache *cache);
+static int          cache_file_cmp          (void *first, void *second);
+//--------------------------------------------------------------------------------------------------------------------------
+static unsigned long long tree_hash_dfs     (const Tree_node *node, unsigned long long hash);
+static unsigned long long eval_key_hash     (const unsigned long long expr, const double x_val, const double y_val,
+                                                                                                const double z_val);
+static int          eval_find               (Eval_shard *shard, const int bucket, const Eval_key *key);
+static void         eval_insert             (Eval_shard *shard, const int bucket, const Eval_key *key,
+                                                                                  const double value);
+static void         eval_lru_unlink         (Eval_shard *shard, const int index);
+static void         eval_lru_push           (Eval_shard *shard, const int index);
+static void         eval_chain_unlink       (Eval_shard *shard, const int index);
+static void         stats_write             (const Tree_stats   *stats, FILE *const stream);
+static void         Tree_get_stats_dfs      (const Tree_node *node, Tree_stats *stats, const int depth);
+static double       metrics_time            ();
+//--------------------------------------------------------------------------------------------------------------------------
 static void Tree_optimize_var_execute(Tree_node *node, Tree_node *system_vars[], int *const vars_index   ,
                                                                                  int *const tree_num_node,
                                                                                  int *const tree_num_div ,
@@ -76,12 +529,12 @@ static bool Tree_node_cmp            (Tree_node *first, Tree_node *second);
 static bool edge_cmp                 (Tree_node *first, Tree_node *second);
 static bool value_cmp                (Tree_node *first, Tree_node *second);
 //--------------------------------------------------------------------------------------------------------------------------
-static double Tree_get_value_in_var  (Tree_node *node, Tree_node *system_vars[],    const double x_val,
-                                                                                    const double y_val,
-                                                                                    const double z_val);
-static double Tree_get_value_in_sys  (Tree_node *node, Tree_node *system_vars[],    const double x_val,
-                                                                                    const double y_val,
-                                                                                    const double z_val);
+static double Tree_get_value_dfs     (Tree_node *node, Eval_point *point);
+static double Tree_get_value_in_var  (Tree_node *node, Eval_point *point);
+static double Tree_get_value_in_sys  (Tree_node *node, Eval_point *point);
+static void   sys_memo_ctor          (Sys_memo *memo);
+static void   sys_memo_dtor          (Sys_memo *memo);
+static bool   sys_memo_reserve       (Sys_memo *memo, const int index);
 //--------------------------------------------------------------------------------------------------------------------------
 static void         Tree_dump_graphviz_dfs  (Tree_node *node, int *const node_number, FILE *const stream);
 static void         Tree_node_describe      (Tree_node *node, int *const node_number, FILE *const stream);
@@ -219,6 +672,80 @@ const char *plot_names[] =
     "atan"  ,
 };
 
+static constexpr Parse_func parse_funcs[] =
+{
+    #define UNARY(str, n, op_val) {str, n, op_val},
+
+    #include "diff_gen.h"
+
+    #undef UNARY
+};
+
+static constexpr int PARSE_FUNCS_NUM = (int) (sizeof(parse_funcs) / sizeof(parse_funcs[0]));
+
+/**
+*   @brief Seeded FNV-1a of the function name without the bracket.
+*/
+
+static constexpr int func_hash(const char *name, const int len, const unsigned seed)
+{
+    unsigned hash = seed;
+    for (int i = 0; i < len; ++i) hash = (hash ^ (unsigned char) name[i]) * 16777619u;
+
+    return (int) ((hash ^ (hash >> 15)) & (FUNC_HASH_SIZE - 1));
+}
+
+/**
+*   @brief Looks for the seed without collisions of the names of parse_funcs[] at compile time.
+*/
+
+static constexpr Func_hash func_hash_build()
+{
+    for (unsigned seed = 2166136261u; seed != 2166136261u + 100000u; ++seed)
+    {
+        Func_hash table = {true, seed, {}};
+        for (int i = 0; i < FUNC_HASH_SIZE; ++i) table.index[i] = -1;
+
+        for (int i = 0; i < PARSE_FUNCS_NUM && table.found; ++i)
+        {
+            int hash = func_hash(parse_funcs[i].name, parse_funcs[i].len - 1, seed);
+
+            if (table.index[hash] != -1) table.found = false;
+            else                         table.index[hash] = (signed char) i;
+        }
+        if (table.found) return table;
+    }
+    return {false, 0, {}};
+}
+
+static constexpr Func_hash func_table = func_hash_build();
+static_assert(func_table.found, "no perfect hash for the function names of diff_gen.h");
+
+static const double pow10_exact[] = // powers of ten which are exact in double
+{
+    1e0 , 1e1 , 1e2 , 1e3 , 1e4 , 1e5 , 1e6 , 1e7 , 1e8 , 1e9 , 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static const char *op_json_names[] =
+{
+    "add"   , // OP_ADD
+    "sub"   , // OP_SUB
+    "mul"   , // OP_MUL
+    "div"   , // OP_DIV
+    "sin"   , // OP_SIN
+    "cos"   , // OP_COS
+    "tan"   , // OP_TAN
+    "pow"   , // OP_POW
+    "log"   , // OP_LOG
+    "sqrt"  , // OP_SQRT
+    "sh"    , // OP_SH
+    "ch"    , // OP_CH
+    "asin"  , // OP_ASIN
+    "acos"  , // OP_ACOS
+    "atan"  , // OP_ATAN
+};
+
 static const char *var_names[] =
 {
     "x"             ,
@@ -311,8 +838,43 @@ const char *tex_header =
 
 //___________________
 
-static bool Tree_verify(Tree_node *const root)
+/**
+*   Debug builds verify the whole tree each time. Release builds keep the roots of the trees which were verified
+*   or made by the library with the generation of the trees at that time. Any change of the trees by the library,
+*   by the node constructors or by the destructors makes the next generation, so only the trees unchanged since
+*   their stamp skip the walk. The changes of the nodes by hand must be followed by Tree_changed().
+*
+*   The lowest bit of TREE_GEN tells that the generation is stamped. Only the first change after a stamp
+*   moves to the next generation, the others just load TREE_GEN, so the constructors stay cheap.
+*/
+
+const int VERIFY_STAMPS_NUM = 8;
+
+struct Verify_stamp
 {
+    const Tree_node    *root;
+    unsigned long long  gen;
+};
+
+static std::atomic<unsigned long long>  TREE_GEN            = 0;    // generation * 2 + is_stamped
+static thread_local Verify_stamp        VERIFY_STAMPS[VERIFY_STAMPS_NUM];
+static thread_local int                 VERIFY_STAMP_NEXT   = 0;
+
+void Tree_changed()
+{
+    unsigned long long gen = TREE_GEN.load(std::memory_order_relaxed);
+
+    while ((gen & 1) != 0 && !TREE_GEN.compare_exchange_weak(gen, gen + 1, std::memory_order_relaxed)) {}
+}
+
+bool Tree_verify(Tree_node *const root)
+{
+    bool is_stamped = verify_stamp_find(root);
+
+#ifdef NDEBUG
+    if (is_stamped) return true;
+#endif
+
     unsigned int err = 0;
 
     if (root == nullptr)  err = 1 << NULLPTR_ROOT;
@@ -320,9 +882,47 @@ static bool Tree_verify(Tree_node *const root)
     
     print_error_messages(err);
 
+    if (is_stamped && err != 0) log_error("The tree is changed by hand without Tree_changed().\n");
+
+    if (err == 0) verify_stamp(root);
     return err == 0;
 }
 
+/**
+*   @brief Remembers that the tree is valid in the current generation.
+*/
+
+static void verify_stamp(const Tree_node *root)
+{
+    assert(root != nullptr);
+
+    unsigned long long gen = TREE_GEN.load(std::memory_order_relaxed);
+    if ((gen & 1) == 0) gen = TREE_GEN.fetch_or(1, std::memory_order_relaxed);
+
+    gen >>= 1;
+
+    for (int i = 0; i < VERIFY_STAMPS_NUM; ++i)
+    {
+        if (VERIFY_STAMPS[i].root == root) { VERIFY_STAMPS[i].gen = gen; return; }
+    }
+
+    VERIFY_STAMPS[VERIFY_STAMP_NEXT] = {root, gen};
+    VERIFY_STAMP_NEXT                = (VERIFY_STAMP_NEXT + 1) % VERIFY_STAMPS_NUM;
+}
+
+static bool verify_stamp_find(const Tree_node *root)
+{
+    if (root == nullptr) return false;
+
+    unsigned long long gen = TREE_GEN.load(std::memory_order_relaxed) >> 1;
+
+    for (int i = 0; i < VERIFY_STAMPS_NUM; ++i)
+    {
+        if (VERIFY_STAMPS[i].root == root && VERIFY_STAMPS[i].gen == gen) return true;
+    }
+    return false;
+}
+
 static void Tree_verify_dfs(unsigned int *const err,    Tree_node *const root,
                                                         Tree_node *const node)
 {
@@ -392,6 +992,8 @@ void node_op_ctor(Tree_node *const node,    TYPE_OP             value,
         p(getL) = node;
         p(getR) = node;
     }
+
+    Tree_changed();
 }
 
 void node_num_ctor(Tree_node *const node,   const double    value,
@@ -405,6 +1007,8 @@ void node_num_ctor(Tree_node *const node,   const double    value,
     getR      =  nullptr;
     getP      =     prev;
     getDBL    =    value;
+
+    Tree_changed();
 }
 
 void node_var_ctor(Tree_node *const node,   VAR             value,
@@ -418,6 +1022,8 @@ void node_var_ctor(Tree_node *const node,   VAR             value,
     getR      =    nullptr;
     getP      =       prev;
     getVAR    =      value;
+
+    Tree_changed();
 }
 
 void node_sys_ctor(Tree_node *const node,   int             value,
@@ -431,6 +1037,8 @@ void node_sys_ctor(Tree_node *const node,   int             value,
     getR    = nullptr;
     getP    =    prev;
     getSYS  =   value;
+
+    Tree_changed();
 }
 
 void node_undef_ctor(Tree_node *const node, Tree_node *const prev)
@@ -439,6 +1047,8 @@ void node_undef_ctor(Tree_node *const node, Tree_node *const prev)
 
     *node  = default_node;
     getP   =         prev;
+
+    Tree_changed();
 }
 
 //___________________
@@ -549,6 +1159,7 @@ Tree_node *new_node_undef(Tree_node *const prev)
 
 void node_dtor(Tree_node *const node)
 {
+    Tree_changed();
     log_free(node);
 }
 
@@ -556,6 +1167,7 @@ void Tree_dtor(Tree_node *const root)
 {
     if (root == nullptr) return;
 
+    Tree_changed();
     dfs_dtor(root);
 }
 
@@ -566,7 +1178,7 @@ static void dfs_dtor(Tree_node *const node)
     if (getL != nullptr) dfs_dtor(getL);
     if (getR != nullptr) dfs_dtor(getR);
 
-    node_dtor(node);
+    log_free(node);
 }
 
 //___________________
@@ -583,11 +1195,26 @@ static void dfs_dtor(Tree_node *const node)
 
 /*_____________________________________________________________________*/
 
-static bool is_char_var(const char c)
+bool is_char_var(const char c)
 {
     return c == 'x' || c == 'y' || c == 'z';
 }
 
+/**
+*   @return the variable as "vars" of diff_main() and nullptr if it is not a variable
+*/
+
+const char *var_string(const char c)
+{
+    switch (c)
+    {
+        case 'x': return "x";
+        case 'y': return "y";
+        case 'z': return "z";
+        default : return nullptr;
+    }
+}
+
 static VAR get_diff_var(VAR var)
 {
     switch (var)
@@ -602,6 +1229,13 @@ static VAR get_diff_var(VAR var)
 
 /*_____________________________________________________________________*/
 
+//___________________
+
+#undef  LOG_CATEGORY
+#define LOG_CATEGORY LOG_CAT_PARSER
+
+//___________________
+
 Tree_node *Tree_parsing_buff(const char *buff)
 {
     log_header(__PRETTY_FUNCTION__);
@@ -616,7 +1250,8 @@ Tree_node *Tree_parsing_buff(const char *buff)
     //>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
     log_message("buff = %p.\n", buff);
     //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-    Tree_node *ret = parse_general(&buff);
+
+    Tree_node *ret = parse_line(buff, 1, nullptr);
     
     if (ret == nullptr)
     {
@@ -624,1069 +1259,3962 @@ Tree_node *Tree_parsing_buff(const char *buff)
         log_end_header();
         return nullptr;
     }
+    verify_stamp  (ret);
     log_message   (GREEN "Parsing successful.\n" CANCEL);
     log_end_header();
     return ret;
 }
 
+/**
+*   @brief Parses the expression at the beginning of the line and reports the syntax error by its position.
+*
+*   @param line [in]  - number of the line for the message
+*   @param col  [out] - column of the error from 1, 0 if there is no error
+*/
+
+static Tree_node *parse_line(const char *data, const int line, int *const col)
+{
+    assert(data != nullptr);
+
+    Tree_metrics metrics   = {};
+    bool         is_metric = metrics_begin(&metrics, "parse", nullptr);
+
+    const char *pos = data;
+    const char *err = nullptr;
+
+    Tree_node *ret = parse_general(&pos, &err);
+
+    if (ret == nullptr)
+    {   //>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+        log_error("line %d, col %d: %s.\n", line, (int) (pos - data) + 1, err);
+        //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+    }
+
+    if (is_metric) metrics_end(&metrics, ret);
+
+    if (col != nullptr) *col = (ret == nullptr) ? (int) (pos - data) + 1 : 0;
+    return ret;
+}
+
 Tree_node *Tree_parsing_main(const char *file)
 {
     log_header(__PRETTY_FUNCTION__);
 
     assert(file != nullptr);
 
-    int         data_size = 0;
-    const char *data      = (char *) read_file(file, &data_size);
-
-    if (data == nullptr)
+    Tree_stream *stream = Tree_stream_open(file);
+    if          (stream == nullptr)
     {
         log_error     ("Can't open the file\n");
         log_end_header();
         return nullptr;
     }
 
-    //>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
-    log_message("data = %p.\n", data);
-    //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-    const char *data_copy = data; //the original value of "data" pointer is needed to free the memory
-    Tree_node *ret = parse_general(&data_copy);
+    Tree_node *ret = nullptr;
+    if (!Tree_stream_next(stream, &ret)) log_error("The file is empty.\n");
+
+    Tree_stream_close(stream);
 
     if (ret == nullptr)
     {
-        log_error("Syntax_error in download file.\n");
-        
-        log_free      ((char *) data);
+        log_error     ("Syntax_error in download file.\n");
         log_end_header();
         return nullptr;
     }
-    log_free      ((char *) data);
     log_message   (GREEN "Parsing successful.\n" CANCEL);
     log_end_header();
     return ret;
 }
 
-#define descent_err_check(node) if (node == nullptr) { return nullptr; }
+//___________________
+
+/**
+*   @brief Opens the file with an expression in each line. The file is mapped in memory and parsed
+*          line by line without copying.
+*
+*   @return the stream and nullptr in case of error
+*/
 
-static Tree_node *parse_general(const char **data)
+Tree_stream *Tree_stream_open(const char *file)
 {
-    assert( data != nullptr);
-    assert(*data != nullptr);
+    if (file == nullptr)
+    {
+        log_error("The file is nullptr.\n");
+        return nullptr;
+    }
 
-    Tree_node *ret = parse_op_add_sub(data);
-    descent_err_check(ret);
+    Tree_stream *stream = (Tree_stream *) log_calloc(1, sizeof(Tree_stream));
+    if          (stream == nullptr) return nullptr;
 
-    if (**data == '\n') return ret;
-    //>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
-    log_error("general: last char != \'\\n\'.\n");
-    //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-    return nullptr;
+    if (!map_file(file, &stream->map))
+    {
+        log_error("Can't map the file \"%s\".\n", file);
+        log_free (stream);
+        return nullptr;
+    }
+
+    return stream;
 }
 
-static Tree_node *parse_op_add_sub(const char **data)
+/**
+*   @brief Parses the next line with an expression. The lines of blanks and comments are skipped.
+*
+*   @param root [out] - the tree, nullptr if the line has a syntax error. The caller owns the tree.
+*   @param line [out] - number of the line, from 1
+*   @param col  [out] - column of the syntax error from 1, 0 if there is no error
+*
+*   @return false if there are no more lines
+*/
+
+bool Tree_stream_next(Tree_stream *stream, Tree_node **root, int *const line, int *const col)
 {
-    assert( data != nullptr);
-    assert(*data != nullptr);
+    assert(stream != nullptr);
+    assert(root   != nullptr);
 
-    Tree_node *val = parse_op_mul_div(data);
-    descent_err_check(val);
+    *root = nullptr;
 
-    while (**data == '+' || **data == '-')
+    while (stream->pos < stream->map.size)
     {
-        TYPE_OP cur_op = (**data == '+') ? OP_ADD : OP_SUB;
-        *data += 1;
+        const char *begin = stream->map.data + stream->pos;
+        const char *end   = (const char *) memchr(begin, '\n', stream->map.size - stream->pos);
+        size_t      len   = (end == nullptr) ? stream->map.size - stream->pos : (size_t) (end - begin);
 
-        Tree_node *val2 = parse_op_mul_div(data);
-        if (val2 == nullptr) { Tree_dtor(val); return nullptr; }
+        stream->pos  += len + 1;
+        stream->line += 1;
 
-        val = new_node_op(cur_op, val, val2);
-    }
-    return val;
-}
+        if (lex_is_blank(begin, begin + len)) continue;
 
-static Tree_node *parse_op_mul_div(const char **data)
-{
-    assert( data != nullptr);
-    assert(*data != nullptr);
+        if (end == nullptr) // the last line doesn't end by '\n', the parser needs it
+        {
+            log_free(stream->tail);
 
-    Tree_node *val = parse_op_pow(data);
-    descent_err_check(val);
+            stream->tail = (char *) log_calloc(len + 2, sizeof(char));
+            if (stream->tail == nullptr) return false;
 
-    while (**data == '*' || **data == '/')
-    {
-        TYPE_OP cur_op = (**data == '*') ? OP_MUL : OP_DIV;
-        *data += 1;
+            memcpy(stream->tail, begin, len);
+            stream->tail[len] = '\n';
+
+            begin = stream->tail;
+        }
 
-        Tree_node *val2 = parse_op_pow(data);
-        if (val2 == nullptr) { Tree_dtor(val); return nullptr; }
+        *root = parse_line(begin, stream->line, col);
+        if (*root != nullptr) verify_stamp(*root);
+        if (line  != nullptr) *line = stream->line;
 
-        val = new_node_op(cur_op, val, val2);
+        if (stream->pos >= stream->map.released + STREAM_RELEASE_STEP) map_file_release(&stream->map, stream->pos);
+        return true;
     }
-    return val;
+
+    return false;
 }
 
-static Tree_node *parse_op_pow(const char **data)
+void Tree_stream_close(Tree_stream *stream)
 {
-    assert( data != nullptr);
-    assert(*data != nullptr);
+    if (stream == nullptr) return;
 
-    Tree_node *val = parse_expretion(data);
-    descent_err_check(val);
+    unmap_file(&stream->map);
+    log_free  ( stream->tail);
+    log_free  ( stream);
+}
 
-    if (**data == '^')
-    {
-        TYPE_OP cur_op = OP_POW;
-        *data += 1;
+/**
+*   @brief Parses the file line by line and gives each tree to the callback. The callback owns the tree,
+*          which is nullptr if the line has a syntax error. The parsing stops if the callback returns false.
+*
+*   @return number of the lines given to the callback and -1 if the file can't be opened
+*/
 
-        Tree_node *val2 = parse_expretion(data);
-        if (val2 == nullptr) { Tree_dtor(val); return nullptr; }
+long long Tree_parsing_stream(const char *file, bool (*callback)(Tree_node *root, int line, void *arg), void *arg)
+{
+    log_header(__PRETTY_FUNCTION__);
 
-        val = new_node_op(cur_op, val, val2);
+    if (callback == nullptr)
+    {
+        log_error     ("The callback is nullptr.\n");
+        log_end_header();
+        return -1;
     }
-    return val;
-}
 
-//___________________
+    Tree_stream *stream = Tree_stream_open(file);
+    if          (stream == nullptr)
+    {
+        log_end_header();
+        return -1;
+    }
 
-#define UNARY(str, n, op_val)                                   \
-    if (!strncmp(*data, str, n))                                \
-    {                                                           \
-        *data += n;                                             \
-                                                                \
-        val = parse_op_add_sub(data);                           \
-        descent_err_check(val);                                 \
-                                                                \
-        if (**data != ')')                                      \
-        {/*>>>>>>>>>>>>>>>>>>>>>>>>>>>>>*/                      \
-            log_error("no closed bracket on %p.\n", *data);     \
-         /*<<<<<<<<<<<<<<<<<<<<<<<<<<<<<*/                      \
-            Tree_dtor(val);                                     \
-            return nullptr;                                     \
-        }                                                       \
-        *data += 1;                                             \
-                                                                \
-        return new_node_op(op_val, Nul, val);                   \
+    long long  lines = 0;
+    Tree_node *root  = nullptr;
+    int        line  = 0;
+
+    while (Tree_stream_next(stream, &root, &line))
+    {
+        lines += 1;
+        if (!callback(root, line, arg)) break;
     }
 
+    Tree_stream_close(stream);
+    log_end_header   ();
+    return lines;
+}
+
 //___________________
 
-static Tree_node *parse_expretion(const char **data)
+/**
+*   @brief Parses the file with an expression in each line on "threads" threads. The mapped file is cut
+*          in chunks at the line ends. The first pass counts the lines of each chunk, so that the second one
+*          parses the chunks right into their places of the result.
+*
+*   @param batch   [out] - the trees of the lines with expressions in the order of the file. Free it by Tree_batch_dtor().
+*   @param threads [in]  - hardware concurrency if it is not positive
+*
+*   @return false if the file can't be read
+*/
+
+bool Tree_parsing_batch(const char *file, Tree_batch *batch, const int threads)
 {
-    assert( data != nullptr);
-    assert(*data != nullptr);
+    log_header(__PRETTY_FUNCTION__);
 
-    Tree_node *val = nullptr;
+    if (file == nullptr || batch == nullptr)
+    {
+        log_error     ("The file or the batch is nullptr.\n");
+        log_end_header();
+        return false;
+    }
+    *batch = {};
 
-    if (**data == '(')
+    File_map map = {};
+    if (!map_file(file, &map))
     {
-       *data += 1;
-        val = parse_op_add_sub(data);
-        
-        if (**data != ')')
-        {
-            //>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
-            log_error("no closed bracket on %p.\n", *data);
-            //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-            Tree_dtor(val);
-            return nullptr;
-        }
-        *data += 1;
+        log_error     ("Can't map the file \"%s\".\n", file);
+        log_end_header();
+        return false;
+    }
 
-        return val;
+    if (map.size == 0)
+    {
+        unmap_file    (&map);
+        log_end_header();
+        return true;
     }
 
-    #include "diff_gen.h"
+    Task_pool   *pool   = task_pool_new(threads);
+    int          chunks = (pool == nullptr) ? 1 : task_pool_size(pool) * BATCH_CHUNKS_PER_THREAD;
+    Batch_chunk *chunk  = (Batch_chunk *) log_calloc((size_t) chunks, sizeof(Batch_chunk));
 
-    if (**data == 'x') { *data += 1; return new_node_var(X); }
-    if (**data == 'y') { *data += 1; return new_node_var(Y); }
-    if (**data == 'z') { *data += 1; return new_node_var(Z); }
-    if (**data == 'e') { *data += 1; return new_node_num(e); }
+    bool is_ok = chunk != nullptr;
 
-    return parse_dbl(data);
-}
+    if (is_ok)
+    {
+        batch_split(&map, chunk, chunks);
 
-//___________________
+        batch_run(pool, chunk, chunks, batch_count_task);
+        is_ok = batch_place(batch, chunk, chunks);
+    }
+    if (is_ok)
+    {
+        batch_run(pool, chunk, chunks, batch_parse_task);
 
-#undef UNARY
+        for (int i = 0; i < chunks; ++i) is_ok = is_ok && chunk[i].is_ok;
+        if (!is_ok) Tree_batch_dtor(batch);
+    }
 
-//___________________
+    log_free        (chunk);
+    task_pool_delete(pool);
+    unmap_file      (&map);
 
-static Tree_node *parse_dbl(const char **data)
-{
-    assert( data != nullptr);
-    assert(*data != nullptr);
+    if (!is_ok) log_error("Can't parse the file \"%s\" in batch.\n", file);
+    else        log_message("lines = %lld, chunks = %d.\n", batch->size, chunks);
 
-    double val = 0;
-    const char *s_before = *data;
+    log_end_header();
+    return is_ok;
+}
 
-    val = strtod(*data, (char **) data);
-    if (val == HUGE_VAL || s_before == *data)
-    {   //>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
-        log_error("wrong double on %p.\n", *data);
-        //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-        return nullptr;
+void Tree_batch_dtor(Tree_batch *batch)
+{
+    if (batch == nullptr) return;
+
+    for (long long i = 0; i < batch->size; ++i)
+    {
+        if (batch->lines[i].root != nullptr) Tree_dtor(batch->lines[i].root);
     }
+    log_free(batch->lines);
 
-    return new_node_num(val);
+    *batch = {};
 }
 
-/*_____________________________________________________________________*/
+/**
+*   @brief Cuts the mapped file in "chunks" parts of about the same size, each of them begins at a line.
+*/
 
-void Tree_optimize_main(Tree_node **root)
+static void batch_split(const File_map *map, Batch_chunk *chunk, const int chunks)
 {
-    log_header(__PRETTY_FUNCTION__);
+    assert(map   != nullptr);
+    assert(chunk != nullptr);
 
-    if (root == nullptr)
+    const char *file_end = map->data + map->size;
+    const char *begin    = map->data;
+
+    for (int i = 0; i < chunks; ++i)
     {
-        log_error     ("Nullptr-pointer to the tree to optimize.\n");
-        log_end_header();
-        return;
+        const char *end = (i == chunks - 1) ? file_end : map->data + map->size / (size_t) chunks * (size_t) (i + 1);
+
+        if (end < begin) end = begin;
+        if (end < file_end && end != begin)
+        {
+            end = (const char *) memchr(end - 1, '\n', (size_t) (file_end - end + 1));
+            end = (end == nullptr) ? file_end : end + 1;
+        }
+
+        chunk[i].begin = begin;
+        chunk[i].end   = end;
+        begin          = end;
     }
-    if (Tree_verify(*root) == false)
+}
+
+static void batch_run(Task_pool *pool, Batch_chunk *chunk, const int chunks, void (*func)(void *chunk))
+{
+    assert(chunk != nullptr);
+    assert(func  != nullptr);
+
+    if (pool == nullptr)
     {
-        log_error     ("Can't optimize the tree, because it is invalid.\n");
-        log_end_header();
+        for (int i = 0; i < chunks; ++i) func(chunk + i);
         return;
     }
 
-    Tree_optimize_execute( root);
-    Tree_verify          (*root);
-    log_end_header       (     );
+    for (int i = 0; i < chunks; ++i) task_spawn(pool, &chunk[i].task, func, chunk + i);
+    for (int i = 0; i < chunks; ++i) task_wait (pool, &chunk[i].task);
 }
 
-static void Tree_optimize_execute(Tree_node **node)
+/**
+*   @brief Gives each chunk its place in the result and the number of its first line.
+*/
+
+static bool batch_place(Tree_batch *batch, Batch_chunk *chunk, const int chunks)
 {
-    assert( node != nullptr);
-    assert(*node != nullptr);
+    assert(batch != nullptr);
+    assert(chunk != nullptr);
 
-    if ((*node)->type != NODE_OP) return;
+    long long size = 0;
+    int       line = 1;
 
-    Tree_optimize_execute(&(l(*node)));
-    Tree_optimize_execute(&(r(*node)));
+    for (int i = 0; i < chunks; ++i)
+    {
+        chunk[i].first_line = line;
+        line += chunk[i].newlines;
 
-    if (Tree_optimize_numbers(*node)) return;
-    if (Tree_optimize_add_main(node)) return;
-    if (Tree_optimize_sub_main(node)) return;
-    if (Tree_optimize_mul_main(node)) return;
-    if (Tree_optimize_div_main(node)) return;
-    if (Tree_optimize_pow_main(node)) return;
-}
+        size += chunk[i].size;
+    }
 
-/*_____________________________________________________________________*/
+    batch->lines = (Tree_batch_line *) log_calloc((size_t) size + 1, sizeof(Tree_batch_line));
+    if (batch->lines == nullptr) return false;
 
-//___________________
+    batch->size = size;
 
-#define getL     l(node)
-#define getR     r(node)
-#define getP     p(node)
-#define getOP   op(node)
-#define getDBL dbl(node)
-#define getVAR var(node)
-#define getSYS sys(node)
+    Tree_batch_line *place = batch->lines;
+    for (int i = 0; i < chunks; ++i)
+    {
+        chunk[i].lines = place;
+        place         += chunk[i].size;
+    }
 
-//___________________
+    return true;
+}
 
-static bool Tree_optimize_numbers(Tree_node *node)
+static void batch_count_task(void *arg)
 {
-    assert(node       != nullptr);
-    assert(node->type == NODE_OP);
+    assert(arg != nullptr);
 
-    if (getL->type == NODE_NUM &&
-        getR->type == NODE_NUM)
-    {
-        double val_left   = dbl(getL);
-        double val_right  = dbl(getR);
-        double val_result = Tree_counter(val_left, val_right, getOP);
+    Batch_chunk *chunk = (Batch_chunk *) arg;
 
-        node_dtor(getL);
-        node_dtor(getR);
+    for (const char *cur = chunk->begin; cur < chunk->end; )
+    {
+        const char *end = (const char *) memchr(cur, '\n', (size_t) (chunk->end - cur));
+        if (end == nullptr) end = chunk->end;
+        else                chunk->newlines += 1;
 
-        num_ctor(node, val_result);
-        return true;
+        if (!lex_is_blank(cur, end)) chunk->size += 1;
+        cur = end + 1;
     }
-    return false;
 }
 
-//___________________
+static void batch_parse_task(void *arg)
+{
+    assert(arg != nullptr);
 
-#undef getL
-#undef getR
-#undef getP
-#undef getOP
-#undef getDBL
-#undef getVAR
-#undef getSYS
+    Batch_chunk *chunk = (Batch_chunk *) arg;
+    long long    index = 0;
+    int          line  = chunk->first_line;
 
-//___________________
+    chunk->is_ok = true;
 
-static double Tree_counter(const double left, const double right, TYPE_OP op)
-{
-    switch (op)
+    for (const char *cur = chunk->begin; cur < chunk->end; ++line)
     {
-        case OP_ADD : return left + right;
-        case OP_SUB : return left - right;
-        case OP_MUL : return left * right;
-        case OP_DIV : return left / right;
-        case OP_SIN : return sin   (right);
-        case OP_COS : return cos   (right);
-        case OP_TAN : return tan   (right);
-        case OP_POW : return pow   (left, right);
-        case OP_LOG : return log   (right);
-        case OP_SQRT: return sqrt  (right);
-        case OP_SH  : return sinh  (right);
-        case OP_CH  : return cosh  (right);
-        case OP_ASIN: return asin  (right);
-        case OP_ACOS: return acos  (right);
-        case OP_ATAN: return atan  (right);
+        const char *end = (const char *) memchr(cur, '\n', (size_t) (chunk->end - cur));
+        size_t      len = (end == nullptr) ? (size_t) (chunk->end - cur) : (size_t) (end - cur);
 
-        default     : log_error      ("default case in Tree_counter() op-switch: op = %d.\n", op);
-                      assert(false && "default case in Tree_counter() op-switch");
-                      break;
-    }
-    return 0;
-}
+        if (!lex_is_blank(cur, cur + len))
+        {
+            char       *tail = nullptr; // the last line of the file without '\n'
+            const char *data = cur;
 
-/*_____________________________________________________________________*/
+            if (end == nullptr)
+            {
+                tail = (char *) log_calloc(len + 2, sizeof(char));
+                if (tail == nullptr) { chunk->is_ok = false; return; }
 
-//___________________
+                memcpy(tail, cur, len);
+                tail[len] = '\n';
+                data      = tail;
+            }
 
-#define getL     l(*node)
-#define getR     r(*node)
-#define getP     p(*node)
-#define getOP   op(*node)
-#define getDBL dbl(*node)
-#define getVAR var(*node)
-#define getSYS sys(*node)
+            Tree_batch_line *res = chunk->lines + index++;
 
-//___________________
+            res->root = parse_line(data, line, &res->col);
+            res->line = line;
 
-static bool Tree_optimize_add_main(Tree_node **node)
+            log_free(tail);
+        }
+
+        cur += len + 1;
+    }
+}
+
+/**
+*   The parser is table-driven precedence climbing with explicit stacks of operands and operators,
+*   so the depth of the input doesn't grow the call stack. The grammar is:
+*
+*   General ::= Add_sub ['#' comment] '\n'
+*   Add_sub ::= Mul_div {['+' '-'] Mul_div}*
+*   Mul_div ::= Pow     {['*' '/'] Pow    }*
+*   Pow     ::= Primary ['^' Primary]
+*   Primary ::= '(' Add_sub ')' | FUNC Add_sub ')' | 'x' | 'y' | 'z' | 'e' | double
+*
+*   where FUNC is one of diff_gen.h names with the opening bracket. So "a^b^c" is a syntax error,
+*   the right operand of '^' is a primary and the function "f(a)" becomes the node "f" with children "0" and "a".
+*   Blanks (spaces, tabs, '\r' of CRLF) may stand between the tokens, '#' comments the rest of the line.
+*
+*   In case of error "data" points to the token where the error is found and "err" is the message.
+*/
+
+static Tree_node *parse_general(const char **data, const char **err)
 {
-    assert(  node        != nullptr);
-    assert( *node        != nullptr);
-    assert((*node)->type == NODE_OP);
+    assert( data != nullptr);
+    assert(*data != nullptr);
 
-    if (getOP != OP_ADD) return false;
+    Parse_stack stk = {};
+    stk.vals        = stk.vals_inline;
+    stk.vals_cap    = PARSE_INLINE;
+    stk.ops         = stk.ops_inline;
+    stk.ops_cap     = PARSE_INLINE;
 
-    if (getL->type == NODE_NUM && approx_equal(0, dbl(getL)))
+    bool expect_operand = true;
+    bool after_pow      = false; // the last operand is "a^b", so one more '^' is an error
+    bool is_end         = false;
+    bool is_ok          = true;
+
+    const char *tok_begin = *data;
+
+    while (is_ok && !is_end)
     {
-        Tree_optimize_all(node, &(getL), &(getR));
-        return true;
+        lex_skip(data);
+        tok_begin = *data;
+
+        if (expect_operand) is_ok = parse_operand (data, &stk, &after_pow, &expect_operand);
+        else                is_ok = parse_operator(data, &stk, &after_pow, &expect_operand, &is_end);
     }
-    if (getR->type == NODE_NUM && approx_equal(0, dbl(getR)))
+
+    Tree_node *ret = nullptr;
+    if (is_ok) ret = stk.vals[--stk.vals_size];
+    else
     {
-        Tree_optimize_all(node, &(getR), &(getL));
-        return true;
+        *data = tok_begin; // the error is reported at the beginning of the token
+        if (err != nullptr) *err = (stk.err == nullptr) ? "can't allocate memory" : stk.err;
     }
 
-    return false;
+    parse_stack_dtor(&stk);
+    return ret;
 }
 
-static bool Tree_optimize_sub_main(Tree_node **node)
+static bool parse_operand(const char **data, Parse_stack *stk, bool *const after_pow, bool *const expect_operand)
 {
-    assert(  node        != nullptr);
-    assert( *node        != nullptr);
-    assert((*node)->type == NODE_OP);
+    assert( data          != nullptr);
+    assert(*data          != nullptr);
+    assert(stk            != nullptr);
+    assert(after_pow      != nullptr);
+    assert(expect_operand != nullptr);
 
-    if (getOP != OP_SUB) return false;
+    Token tok = {};
+    if (!lex_operand(data, &tok)) { stk->err = tok.err; return false; }
 
-    if (getR->type == NODE_NUM && approx_equal(0, dbl(getR)))
+    Tree_node *val = nullptr;
+
+    switch (tok.type)
     {
-        Tree_optimize_all(node, &(getR), &(getL));
-        return true;
+        case TOKEN_OPEN : return parse_push_op(stk, PARSE_GROUP, OP_ADD);
+        case TOKEN_FUNC : return parse_push_op(stk, PARSE_FUNC , tok.value.op);
+
+        case TOKEN_VAR  : val = new_node_var(tok.value.var);    break;
+        case TOKEN_NUM  : val = new_node_num(tok.value.dbl);    break;
+
+        case TOKEN_CLOSE:
+        case TOKEN_OP   :
+        case TOKEN_END  :
+        default         : assert(false && "lex_operand() gives operator");
+                          return false;
     }
-    return false;
+    if (val == nullptr) return false;
+
+    *expect_operand = false;
+    return parse_push_primary(stk, val, after_pow);
 }
 
-static bool Tree_optimize_mul_main(Tree_node **node)
+static bool parse_operator(const char **data, Parse_stack *stk, bool *const after_pow, bool *const expect_operand,
+                                                                                     bool *const is_end)
 {
-    assert(  node        != nullptr);
-    assert( *node        != nullptr);
-    assert((*node)->type == NODE_OP);
-
-    if (getOP != OP_MUL) return false;
-
-    if ((getR->type == NODE_NUM && approx_equal(0, dbl(getR))) ||
-        (getL->type == NODE_NUM && approx_equal(0, dbl(getL))))
+    assert( data          != nullptr);
+    assert(*data          != nullptr);
+    assert(stk            != nullptr);
+    assert(after_pow      != nullptr);
+    assert(expect_operand != nullptr);
+    assert(is_end         != nullptr);
+
+    Token tok = {};
+    if (!lex_operator(data, &tok)) { stk->err = tok.err; return false; }
+
+    if (tok.type == TOKEN_CLOSE) return parse_close(stk, after_pow);
+    if (tok.type == TOKEN_END)
     {
-        Tree_dtor(getL);
-        Tree_dtor(getR);
-
-        num_ctor(*node, 0);
-        return true;
+        *is_end = true;
+        return parse_end(stk);
     }
 
-    if (getR->type == NODE_NUM && approx_equal(1, dbl(getR)))
+    TYPE_OP op = tok.value.op;
+
+    if (op == OP_POW && *after_pow)
     {
-        Tree_optimize_all(node, &(getR), &(getL));
-        return true;
+        stk->err = "\'^\' after \"a^b\", use brackets";
+        return false;
     }
-    if (getL->type == NODE_NUM && approx_equal(1, dbl(getL)))
+
+    while (stk->ops_size > 0 && stk->ops[stk->ops_size - 1].item == PARSE_BIN                           &&
+           op_priority[stk->ops[stk->ops_size - 1].op] >= op_priority[op])
     {
-        Tree_optimize_all(node, &(getL), &(getR));
-        return true;
+        if (!parse_reduce(stk)) return false;
     }
-    return false;
+
+    *expect_operand = true;
+    return parse_push_op(stk, PARSE_BIN, op);
 }
 
-static bool Tree_optimize_div_main(Tree_node **node)
+/**
+*   @brief Closes the innermost bracket or function.
+*/
+
+static bool parse_close(Parse_stack *stk, bool *const after_pow)
 {
-    assert(  node        != nullptr);
-    assert( *node        != nullptr);
-    assert((*node)->type == NODE_OP);
+    assert(stk       != nullptr);
+    assert(after_pow != nullptr);
 
-    if (getOP != OP_DIV) return false;
-
-    if (getL->type == NODE_NUM && approx_equal(0, dbl(getL)))
+    while (stk->ops_size > 0 && stk->ops[stk->ops_size - 1].item == PARSE_BIN)
     {
-        Tree_dtor(getL);
-        Tree_dtor(getR);
-
-        num_ctor(*node, 0);
-        return true;
+        if (!parse_reduce(stk)) return false;
+    }
+    if (stk->ops_size == 0)
+    {
+        stk->err = "no opened bracket for \')\'";
+        return false;
     }
 
-    if (getR->type == NODE_NUM && approx_equal(1, dbl(getR)))
+    Parse_op   bracket = stk->ops [--stk->ops_size];
+    Tree_node *val     = stk->vals[--stk->vals_size];
+
+    if (bracket.item == PARSE_FUNC)
     {
-        Tree_optimize_all(node, &(getR), &(getL));
-        return true;
+        val = new_node_op(bracket.op, Nul, val);
+        if (val == nullptr) return false;
     }
-    return false;
+
+    return parse_push_primary(stk, val, after_pow);
 }
 
-static bool Tree_optimize_pow_main(Tree_node **node)
+static bool parse_end(Parse_stack *stk)
 {
-    assert(  node        != nullptr);
-    assert( *node        != nullptr);
-    assert((*node)->type == NODE_OP);
-
-    if (getOP != OP_POW) return false;
+    assert(stk != nullptr);
 
-    if (getL->type == NODE_NUM && approx_equal(1, dbl(getL)))
+    while (stk->ops_size > 0 && stk->ops[stk->ops_size - 1].item == PARSE_BIN)
     {
-        Tree_dtor(getL);
-        Tree_dtor(getR);
-
-        num_ctor(*node, 1);
-        return true;
+        if (!parse_reduce(stk)) return false;
     }
-
-    if (getR->type == NODE_NUM && approx_equal(0, dbl(getR)))
+    if (stk->ops_size != 0)
     {
-        Tree_dtor(getL);
-        Tree_dtor(getR);
-
-        num_ctor(*node, 1);
-        return true;
+        stk->err = "no closed bracket";
+        return false;
     }
 
-    if (getR->type == NODE_NUM && approx_equal(1, dbl(getR)))
-    {
-        Tree_optimize_all(node, &(getR), &(getL));
-        return true;
-    }
-    return false;
+    assert(stk->vals_size == 1);
+    return true;
 }
 
-/*_____________________________________________________________________*/
+/**
+*   @brief Pushes the primary in the stack. It is the right operand of '^' if the operator is on the top,
+*          so "a^b" is built at once.
+*/
 
-static void Tree_optimize_all(Tree_node **node, Tree_node **null_son, Tree_node **good_son)
+static bool parse_push_primary(Parse_stack *stk, Tree_node *val, bool *const after_pow)
 {
-    assert( node     != nullptr);
-    assert(*node     != nullptr);
-    assert( null_son != nullptr);
-    assert(*null_son != nullptr);
-    assert( good_son != nullptr);
-    assert(*good_son != nullptr);
+    assert(stk       != nullptr);
+    assert(val       != nullptr);
+    assert(after_pow != nullptr);
 
-    node_dtor(*null_son);
+    if (!parse_push_val(stk, val)) return false;
 
-    if (getP == nullptr) // change the root of the tree
-    {
-        (*node) = *good_son;
-        node_dtor(getP);
-        getP = nullptr;
+    *after_pow = stk->ops_size > 0 && stk->ops[stk->ops_size - 1].item == PARSE_BIN &&
+                                      stk->ops[stk->ops_size - 1].op   == OP_POW;
 
-        return;
-    }
+    if (*after_pow) return parse_reduce(stk);
+    return true;
+}
 
-    //create copies to avoid loss of old values
+static bool parse_reduce(Parse_stack *stk)
+{
+    assert(stk            != nullptr);
+    assert(stk->ops_size  >= 1);
+    assert(stk->vals_size >= 2);
 
-    Tree_node *link_node     = &(**node);
-    Tree_node *link_null_son = &(**null_son);
-    Tree_node *link_good_son = &(**good_son);
+    TYPE_OP    op    = stk->ops [--stk->ops_size].op;
+    Tree_node *right = stk->vals[--stk->vals_size];
+    Tree_node *left  = stk->vals[  stk->vals_size - 1];
 
-    node     = &link_node;
-    null_son = &link_null_son;
-    good_son = &link_good_son;
-    
-    //delete the "node" from the tree and rehang the "good_son"
+    Tree_node *val = new_node_op(op, left, right);
+    if        (val == nullptr) { Tree_dtor(right); return false; }
 
-    if (getP->left == (*node))
-    {
-        l(p(*node   )) =   *good_son;
-        p  (*good_son) = p(*node   );
-    }
-    else
-    {
-        r(p(*node   )) =   *good_son;
-        p  (*good_son) = p(*node   );
-    }
-    
-    node_dtor(*node);
+    stk->vals[stk->vals_size - 1] = val;
+    return true;
 }
 
 //___________________
 
-#undef getL
-#undef getR
-#undef getP
-#undef getOP
-#undef getDBL
-#undef getVAR
-#undef getSYS
-
-//___________________
-
-Tree_node *tree_copy(const Tree_node *tree)
+static bool parse_push_val(Parse_stack *stk, Tree_node *val)
 {
-    switch(tree->type)
+    assert(stk != nullptr);
+    assert(val != nullptr);
+
+    if (stk->vals_size == stk->vals_cap)
     {
-        case NODE_NUM: return new_node_num(tree->value.dbl);
-        case NODE_OP : return new_node_op (tree->value.op , tree_copy(tree->left), tree_copy(tree->right));
-        case NODE_VAR: return new_node_var(tree->value.var);
-        
-        case NODE_UNDEF :
-        case NODE_SYS   :
-        default         : assert(false && "tree_copy bad cases");
+        Tree_node **vals = (Tree_node **) stack_grow(stk->vals, &stk->vals_cap, sizeof(Tree_node *), stk->vals_inline);
+        if         (vals == nullptr) { Tree_dtor(val); return false; }
+
+        stk->vals = vals;
     }
 
-    return nullptr;
+    stk->vals[stk->vals_size++] = val;
+    return true;
 }
 
-/*_____________________________________________________________________*/
-
-
-Tree_node *diff_main(Tree_node **root, Tree_node *system_vars[], const char *vars)
+static bool parse_push_op(Parse_stack *stk, PARSE_ITEM item, TYPE_OP op)
 {
-    log_header(__PRETTY_FUNCTION__);
+    assert(stk != nullptr);
 
-    if (root == nullptr)
-    {
-        log_error     ("Nullptr-pointer to the tree to differentiate.\n");
-        log_end_header();
-        return nullptr;
-    }
-    if (Tree_verify(*root) == false)
+    if (stk->ops_size == stk->ops_cap)
     {
-        log_error     ("Can't differentiate the function, because tree is invalid.\n");
-        log_end_header();
-        return nullptr;
-    }
-    if (!(strlen(vars) == 1 && (is_char_var(vars[0]) || vars[0] == 'a')))
-    {
-        log_error     ("Undefined value of vars: \"%s\".\n", vars);
-        log_end_header();
-        return nullptr;
-    }
-
-    Tree_optimize_main(root);
-    Tree_node *diff_root = nullptr;
+        Parse_op *ops = (Parse_op *) stack_grow(stk->ops, &stk->ops_cap, sizeof(Parse_op), stk->ops_inline);
+        if       (ops == nullptr) return false;
 
-    switch (vars[0])
-    {
-        case 'x': diff_root = diff_execute(*root, system_vars, X, false);
-                  break;
-        case 'y': diff_root = diff_execute(*root, system_vars, Y, false);
-                  break;
-        case 'z': diff_root = diff_execute(*root, system_vars, Z, false);
-                  break;
-        default : diff_root = Add(diff_execute(*root, system_vars, X, true),
-                              Add(diff_execute(*root, system_vars, Y, true),
-                                  diff_execute(*root, system_vars, Z, true)));
-                  break;
+        stk->ops = ops;
     }
-    return diff_root;
-}
-
-//_____________________________
 
-#define DL dL(node, system_vars, var, d_mode)
-#define DR dR(node, system_vars, var, d_mode)
-#define CL cL(node)
-#define CR cR(node)
+    stk->ops[stk->ops_size++] = {item, op};
+    return true;
+}
 
-//_____________________________
+/**
+*   @brief Doubles the capacity of the stack. The inline buffer of the stack is not freed.
+*
+*   @return the new buffer and nullptr in case of error
+*/
 
-static Tree_node *diff_execute(Tree_node *const node, Tree_node *system_vars[], VAR var, bool d_mode)
+static void *stack_grow(void *data, int *const cap, const size_t elem_size, const void *inline_data)
 {
-    assert(node != nullptr);
+    assert(data != nullptr);
+    assert(cap  != nullptr);
 
-    switch(node->type)
+    void *grown = log_calloc((size_t) *cap * 2, elem_size);
+    if   (grown == nullptr)
     {
-        case NODE_NUM  : return Nul;
-        
-        case NODE_VAR  : return diff_var_case(node,              var, d_mode);        
-        case NODE_OP   : return diff_op_case (node, system_vars, var, d_mode);
-        case NODE_SYS  : return diff_sys_case(node, system_vars, var, d_mode);
-        
-        case NODE_UNDEF:
-        default        : log_error      ("default case in diff_execute() in TYPE-NODE-switch: node_type = %d.\n", node->type);
-                         Tree_dump_graphviz(node);
-                         assert(false && "default case in TYPE_NODE-switch");
-                         return nullptr;
+        log_error("Can't grow the stack of %d elements.\n", *cap);
+        return nullptr;
     }
 
-    return nullptr;
+    memcpy(grown, data, (size_t) *cap * elem_size);
+    if (data != inline_data) log_free(data);
+
+    *cap *= 2;
+    return grown;
 }
 
-static Tree_node *diff_sys_case(Tree_node *const node, Tree_node *system_vars[], VAR var, bool d_mode)
+static void parse_stack_dtor(Parse_stack *stk)
 {
-    assert(node        !=  nullptr);
-    assert(node->type  == NODE_SYS);
+    assert(stk != nullptr);
 
-    assert(system_vars            != nullptr);
-    assert(system_vars[sys(node)] != nullptr);
+    for (int i = 0; i < stk->vals_size; ++i) Tree_dtor(stk->vals[i]);
 
-    return diff_execute(system_vars[sys(node)], system_vars, var, d_mode);
+    if (stk->vals != stk->vals_inline) log_free(stk->vals);
+    if (stk->ops  != stk->ops_inline ) log_free(stk->ops );
 }
 
-static Tree_node *diff_var_case(Tree_node *const node, VAR var, bool d_mode)
+//___________________
+
+/**
+*   The lexer gives one token at a time. It depends on the parser state, because "-1" is a number in place
+*   of an operand and '-' with "1" after an operand. The parser skips the blanks and the comment before
+*   each token by lex_skip(), so the input needs no separate pass to strip them.
+*/
+
+static bool lex_operand(const char **data, Token *const tok)
 {
-    assert(node       != nullptr);
-    assert(node->type == NODE_VAR);
+    assert( data != nullptr);
+    assert(*data != nullptr);
+    assert(tok   != nullptr);
 
-    if (var(node) == var)
+    const char *cur = *data;
+    tok->pos        =  cur;
+
+    if (*cur == '(')
     {
-        if (d_mode) return new_node_var(get_diff_var(var));
-        return Num(1);
+        tok->type = TOKEN_OPEN;
+        *data    += 1;
+        return true;
     }
-    return Num(0);
+
+    int func_len = 0;
+    int func     = lex_func(cur, &func_len);
+    if (func != -1)
+    {
+        tok->type     = TOKEN_FUNC;
+        tok->value.op = parse_funcs[func].op;
+        *data        += func_len;
+        return true;
+    }
+
+    switch (*cur)
+    {
+        case 'x': tok->type = TOKEN_VAR; tok->value.var = X; *data += 1; return true;
+        case 'y': tok->type = TOKEN_VAR; tok->value.var = Y; *data += 1; return true;
+        case 'z': tok->type = TOKEN_VAR; tok->value.var = Z; *data += 1; return true;
+        case 'e': tok->type = TOKEN_NUM; tok->value.dbl = e; *data += 1; return true;
+        default : break;
+    }
+
+    tok->type = TOKEN_NUM;
+    return lex_dbl(data, &tok->value.dbl, &tok->err);
 }
 
-static Tree_node *diff_op_case(Tree_node *const node, Tree_node *system_vars[], VAR var, bool d_mode)
+static bool lex_operator(const char **data, Token *const tok)
 {
-    assert(node       != nullptr);
-    assert(node->type == NODE_OP);
+    assert( data != nullptr);
+    assert(*data != nullptr);
+    assert(tok   != nullptr);
 
-    switch(op(node))
-    {
-        case OP_ADD : return Add(DL, DR);
-        case OP_SUB : return Sub(DL, DR);
+    tok->pos  = *data;
+    tok->type = TOKEN_OP;
 
-        case OP_MUL : return Add(Mul(DL, CR), Mul(CL, DR));
-        case OP_DIV : return Div(Sub(Mul(DL, CR), Mul(CL, DR)), Pow(CR, Num(2)));
+    switch (**data)
+    {
+        case '+' : tok->value.op = OP_ADD;    break;
+        case '-' : tok->value.op = OP_SUB;    break;
+        case '*' : tok->value.op = OP_MUL;    break;
+        case '/' : tok->value.op = OP_DIV;    break;
+        case '^' : tok->value.op = OP_POW;    break;
+        case ')' : tok->type     = TOKEN_CLOSE; break;
+        case '\n': tok->type     = TOKEN_END;  return true; // the line ends here
+
+        default  : tok->err = "unexpected char, an operator or the end of the line is expected";
+                   return false;
+    }
 
-        case OP_SIN : return Mul(Cos(CL, CR), DR);
-        case OP_COS : return Mul(Sub(Nul, Sin(CL, CR)), DR);
-        case OP_TAN : return Div(DR, Pow(Cos(CL, CR), Num(2)));
+    *data += 1;
+    return true;
+}
 
-        case OP_LOG : return Div(DR, CR);
+/**
+*   @brief Finds the function "name(" at the beginning of the data by the perfect hash of the name. The blanks
+*          between the name and the bracket are skipped: "sin (x)".
+*
+*   @param len [out] - length of the name with the blanks and the bracket
+*
+*   @return index in parse_funcs[] and -1 if there is no function
+*/
 
-        case OP_POW : return diff_op_pow(node, system_vars, var, d_mode);
+static int lex_func(const char *data, int *const len)
+{
+    assert(data != nullptr);
+    assert(len  != nullptr);
 
-        case OP_SQRT: return Div(DR, Mul(Num(2), Sqrt(CL, CR)));
+    int name_len = 0;
+    while ('a' <= data[name_len] && data[name_len] <= 'z') ++name_len;
 
-        case OP_SH  : return Mul(Ch(CL, CR), DR);
-        case OP_CH  : return Mul(Sh(CL, CR), DR);
+    int bracket = name_len;
+    while (lex_is_space(data[bracket])) ++bracket;
 
-        case OP_ASIN: return         Div(DR, Sqrt(Nul, Sub(Num(1), Pow(CR, Num(2)))));
-        case OP_ACOS: return Sub(0 , Div(DR, Sqrt(Nul, Sub(Num(1), Pow(CR, Num(2))))));
-        case OP_ATAN: return Div(DR,                   Add(Num(1), Pow(CR, Num(2))));
+    if (name_len < 2 || data[bracket] != '(') return -1;
 
-        default     : log_error      ("default case in diff_execute() in TYPE-OP-switch: op_type = %d.\n", op(node));
-                      Tree_dump_graphviz(node);
-                      assert(false && "default case in diff_execute() in TYPE_OP-switch");
-                      return nullptr;
-    }
-    return nullptr;
-}
+    int index = func_table.index[func_hash(data, name_len, func_table.seed)];
+    if (index == -1) return -1;
 
-static Tree_node *diff_op_pow(Tree_node *const node, Tree_node *system_vars[], VAR var, bool d_mode)
-{
-    assert(node       != nullptr);
-    assert(node->type == NODE_OP);
-    assert(op(node)   ==  OP_POW);
+    const Parse_func *func = parse_funcs + index;
+    if (func->len != name_len + 1 || strncmp(data, func->name, (size_t) name_len) != 0) return -1;
 
-    if (l(node)->type == NODE_NUM) return Mul(Pow(CL, CR), Mul(Log(Nul, CL), DR));
-    if (r(node)->type == NODE_NUM) return Mul(Pow(CL, Num(dbl(r(node))-1)), Mul(CR, DL));
-    
-    return Mul(Pow(CL, CR), Add(Div(Mul(CR, DL), CL), Mul(DR, Log(Nul, CL))));
+    *len = bracket + 1;
+    return index;
 }
 
-//_____________________________
+/**
+*   @brief Scans the double. Plain decimals of at most 19 significant digits with the exponent in [-22, 22] are
+*          converted exactly by one multiplication or division (Clinger's fast path). Others, hexadecimal numbers,
+*          signs, "inf" and "nan" go to strtod(), so the result is always the same as of strtod().
+*/
 
-#undef DL
-#undef DR
-#undef CL
-#undef CR
+static bool lex_dbl(const char **data, double *const val, const char **err)
+{
+    assert( data != nullptr);
+    assert(*data != nullptr);
+    assert(val   != nullptr);
+    assert(err   != nullptr);
 
-//_____________________________
+    const char *cur        = *data;
+    bool        is_decimal = isdigit((unsigned char) cur[0]) || (cur[0] == '.' && isdigit((unsigned char) cur[1]));
 
-static Tree_node *Tree_copy(Tree_node *cp_from)
-{
-    assert(cp_from != nullptr);
+    if (cur[0] == '0' && (cur[1] == 'x' || cur[1] == 'X')) is_decimal = false;
 
-    switch (cp_from->type)
+    if (is_decimal)
     {
-        case NODE_NUM   : return Num(dbl(cp_from));
+        unsigned long long mant   = 0;
+        int                digits = 0;     // significant ones
+        int                exp10  = 0;
 
-        case NODE_VAR   : return new_node_var(var(cp_from));
-        case NODE_SYS   : return new_node_sys(sys(cp_from));
-        case NODE_OP    : return new_node_op (op (cp_from), cL(cp_from), cR(cp_from));
+        for (; isdigit((unsigned char) *cur); ++cur)
+        {
+            if (mant != 0 || *cur != '0') ++digits;
+            mant = mant * 10 + (unsigned long long) (*cur - '0');
+        }
+        if (*cur == '.')
+        {
+            for (++cur; isdigit((unsigned char) *cur); ++cur)
+            {
+                if (mant != 0 || *cur != '0') ++digits;
+                mant = mant * 10 + (unsigned long long) (*cur - '0');
+                --exp10;
+            }
+        }
+        if (*cur == 'e' || *cur == 'E')
+        {
+            const char *exp_pos = cur++;
+            int         sign    = 1;
 
-        case NODE_UNDEF :
-        default         : log_error      ("default case in Tree_copy() in TYPE-NODE-switch: node_type = %d.\n", cp_from->type);
-                          Tree_dump_graphviz(cp_from);
-                          assert(false && "default case in Tree_copy() in TYPE-NODE-switch");
-                          break;
-    }
-    return nullptr;
-}
+            if      (*cur == '+')   ++cur;
+            else if (*cur == '-') { ++cur; sign = -1; }
 
-/*_____________________________________________________________________*/
+            if (isdigit((unsigned char) *cur))
+            {
+                int exp = 0;
+                for (; isdigit((unsigned char) *cur); ++cur) if (exp < 100000) exp = exp * 10 + (*cur - '0');
 
-//___________________
+                exp10 += sign * exp;
+            }
+            else cur = exp_pos; // "1e" is the number "1" and 'e' after it
+        }
+
+        if (digits <= 19 && mant <= (1ULL << 53) && -22 <= exp10 && exp10 <= 22)
+        {
+            *val  = (exp10 < 0) ? (double) mant / pow10_exact[-exp10] : (double) mant * pow10_exact[exp10];
+            *data = cur;
+            return true;
+        }
+    }
+
+    for (cur = *data; isspace((unsigned char) *cur); ++cur) // strtod() skips spaces, but not the end of the line
+    {
+        if (*cur == '\n')
+        {
+            *err = "the line ends instead of an operand";
+            return false;
+        }
+    }
+
+    const char *s_before = *data;
+
+    *val = strtod(*data, (char **) data);
+    if (*val == HUGE_VAL || s_before == *data)
+    {
+        *err = "wrong operand, a number, a variable, a function or \'(\' is expected";
+        return false;
+    }
+
+    return true;
+}
+
+/**
+*   @brief Skips the blanks and the comment up to the end of the line. '\r' is a blank, so CRLF ends
+*          the line as well as LF.
+*/
+
+static void lex_skip(const char **data)
+{
+    assert( data != nullptr);
+    assert(*data != nullptr);
+
+    const char *cur = *data;
+
+    while (lex_is_space(*cur)) ++cur;
+
+    if (*cur == '#')
+    {
+        while (*cur != '\n' && *cur != '\0') ++cur;
+    }
+
+    *data = cur;
+}
+
+/**
+*   @brief Checks if the line [data, end) has no expression: only blanks and maybe a comment.
+*/
+
+static bool lex_is_blank(const char *data, const char *end)
+{
+    assert(data != nullptr);
+    assert(end  != nullptr);
+
+    while (data < end && lex_is_space(*data)) ++data;
+
+    return data == end || *data == '#';
+}
+
+static bool lex_is_space(const char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/*_____________________________________________________________________*/
+
+//___________________
+
+#undef  LOG_CATEGORY
+#define LOG_CATEGORY LOG_CAT_OPTIMIZER
+
+//___________________
+
+void Tree_optimize_main(Tree_node **root)
+{
+    log_header(__PRETTY_FUNCTION__);
+
+    if (root == nullptr)
+    {
+        log_error     ("Nullptr-pointer to the tree to optimize.\n");
+        log_end_header();
+        return;
+    }
+    if (Tree_verify(*root) == false)
+    {
+        log_error     ("Can't optimize the tree, because it is invalid.\n");
+        log_end_header();
+        return;
+    }
+
+    Tree_metrics metrics   = {};
+    bool         is_metric = metrics_begin(&metrics, "optimize", *root);
+
+    Tree_changed         (     );
+    Tree_optimize_execute( root);
+    if (is_metric) metrics_end(&metrics, *root);
+
+#ifndef NDEBUG
+    Tree_verify          (*root);
+#else
+    verify_stamp         (*root);
+#endif
+    log_end_header       (     );
+}
+
+static void Tree_optimize_execute(Tree_node **node)
+{
+    assert( node != nullptr);
+    assert(*node != nullptr);
+
+    if ((*node)->type != NODE_OP) return;
+
+    Tree_optimize_execute(&(l(*node)));
+    Tree_optimize_execute(&(r(*node)));
+
+    if (Tree_optimize_numbers(*node)) return;
+    if (Tree_optimize_add_main(node)) return;
+    if (Tree_optimize_sub_main(node)) return;
+    if (Tree_optimize_mul_main(node)) return;
+    if (Tree_optimize_div_main(node)) return;
+    if (Tree_optimize_pow_main(node)) return;
+}
+
+/*_____________________________________________________________________*/
+
+//___________________
+
+#define getL     l(node)
+#define getR     r(node)
+#define getP     p(node)
+#define getOP   op(node)
+#define getDBL dbl(node)
+#define getVAR var(node)
+#define getSYS sys(node)
+
+//___________________
+
+static bool Tree_optimize_numbers(Tree_node *node)
+{
+    assert(node       != nullptr);
+    assert(node->type == NODE_OP);
+
+    if (getL->type == NODE_NUM &&
+        getR->type == NODE_NUM)
+    {
+        double val_left   = dbl(getL);
+        double val_right  = dbl(getR);
+        double val_result = Tree_counter(val_left, val_right, getOP);
+
+        node_dtor(getL);
+        node_dtor(getR);
+
+        num_ctor(node, val_result);
+        return true;
+    }
+    return false;
+}
+
+//___________________
+
+#undef getL
+#undef getR
+#undef getP
+#undef getOP
+#undef getDBL
+#undef getVAR
+#undef getSYS
+
+//___________________
+
+double Tree_counter(const double left, const double right, TYPE_OP op)
+{
+    switch (op)
+    {
+        case OP_ADD : return left + right;
+        case OP_SUB : return left - right;
+        case OP_MUL : return left * right;
+        case OP_DIV : return left / right;
+        case OP_SIN : return sin   (right);
+        case OP_COS : return cos   (right);
+        case OP_TAN : return tan   (right);
+        case OP_POW : return pow   (left, right);
+        case OP_LOG : return log   (right);
+        case OP_SQRT: return sqrt  (right);
+        case OP_SH  : return sinh  (right);
+        case OP_CH  : return cosh  (right);
+        case OP_ASIN: return asin  (right);
+        case OP_ACOS: return acos  (right);
+        case OP_ATAN: return atan  (right);
+
+        default     : log_error      ("default case in Tree_counter() op-switch: op = %d.\n", op);
+                      assert(false && "default case in Tree_counter() op-switch");
+                      break;
+    }
+    return 0;
+}
+
+/*_____________________________________________________________________*/
+
+//___________________
+
+#define getL     l(*node)
+#define getR     r(*node)
+#define getP     p(*node)
+#define getOP   op(*node)
+#define getDBL dbl(*node)
+#define getVAR var(*node)
+#define getSYS sys(*node)
+
+//___________________
+
+static bool Tree_optimize_add_main(Tree_node **node)
+{
+    assert(  node        != nullptr);
+    assert( *node        != nullptr);
+    assert((*node)->type == NODE_OP);
+
+    if (getOP != OP_ADD) return false;
+
+    if (getL->type == NODE_NUM && approx_equal(0, dbl(getL)))
+    {
+        Tree_optimize_all(node, &(getL), &(getR));
+        return true;
+    }
+    if (getR->type == NODE_NUM && approx_equal(0, dbl(getR)))
+    {
+        Tree_optimize_all(node, &(getR), &(getL));
+        return true;
+    }
+
+    return false;
+}
+
+static bool Tree_optimize_sub_main(Tree_node **node)
+{
+    assert(  node        != nullptr);
+    assert( *node        != nullptr);
+    assert((*node)->type == NODE_OP);
+
+    if (getOP != OP_SUB) return false;
+
+    if (getR->type == NODE_NUM && approx_equal(0, dbl(getR)))
+    {
+        Tree_optimize_all(node, &(getR), &(getL));
+        return true;
+    }
+    return false;
+}
+
+static bool Tree_optimize_mul_main(Tree_node **node)
+{
+    assert(  node        != nullptr);
+    assert( *node        != nullptr);
+    assert((*node)->type == NODE_OP);
+
+    if (getOP != OP_MUL) return false;
+
+    if ((getR->type == NODE_NUM && approx_equal(0, dbl(getR))) ||
+        (getL->type == NODE_NUM && approx_equal(0, dbl(getL))))
+    {
+        Tree_dtor(getL);
+        Tree_dtor(getR);
+
+        num_ctor(*node, 0);
+        return true;
+    }
+
+    if (getR->type == NODE_NUM && approx_equal(1, dbl(getR)))
+    {
+        Tree_optimize_all(node, &(getR), &(getL));
+        return true;
+    }
+    if (getL->type == NODE_NUM && approx_equal(1, dbl(getL)))
+    {
+        Tree_optimize_all(node, &(getL), &(getR));
+        return true;
+    }
+    return false;
+}
+
+static bool Tree_optimize_div_main(Tree_node **node)
+{
+    assert(  node        != nullptr);
+    assert( *node        != nullptr);
+    assert((*node)->type == NODE_OP);
+
+    if (getOP != OP_DIV) return false;
+
+    if (getL->type == NODE_NUM && approx_equal(0, dbl(getL)))
+    {
+        Tree_dtor(getL);
+        Tree_dtor(getR);
+
+        num_ctor(*node, 0);
+        return true;
+    }
+
+    if (getR->type == NODE_NUM && approx_equal(1, dbl(getR)))
+    {
+        Tree_optimize_all(node, &(getR), &(getL));
+        return true;
+    }
+    return false;
+}
+
+static bool Tree_optimize_pow_main(Tree_node **node)
+{
+    assert(  node        != nullptr);
+    assert( *node        != nullptr);
+    assert((*node)->type == NODE_OP);
+
+    if (getOP != OP_POW) return false;
+
+    if (getL->type == NODE_NUM && approx_equal(1, dbl(getL)))
+    {
+        Tree_dtor(getL);
+        Tree_dtor(getR);
+
+        num_ctor(*node, 1);
+        return true;
+    }
+
+    if (getR->type == NODE_NUM && approx_equal(0, dbl(getR)))
+    {
+        Tree_dtor(getL);
+        Tree_dtor(getR);
+
+        num_ctor(*node, 1);
+        return true;
+    }
+
+    if (getR->type == NODE_NUM && approx_equal(1, dbl(getR)))
+    {
+        Tree_optimize_all(node, &(getR), &(getL));
+        return true;
+    }
+    return false;
+}
+
+/*_____________________________________________________________________*/
+
+static void Tree_optimize_all(Tree_node **node, Tree_node **null_son, Tree_node **good_son)
+{
+    assert( node     != nullptr);
+    assert(*node     != nullptr);
+    assert( null_son != nullptr);
+    assert(*null_son != nullptr);
+    assert( good_son != nullptr);
+    assert(*good_son != nullptr);
+
+    node_dtor(*null_son);
+
+    if (getP == nullptr) // change the root of the tree
+    {
+        (*node) = *good_son;
+        node_dtor(getP);
+        getP = nullptr;
+
+        return;
+    }
+
+    //create copies to avoid loss of old values
+
+    Tree_node *link_node     = &(**node);
+    Tree_node *link_null_son = &(**null_son);
+    Tree_node *link_good_son = &(**good_son);
+
+    node     = &link_node;
+    null_son = &link_null_son;
+    good_son = &link_good_son;
+    
+    //delete the "node" from the tree and rehang the "good_son"
+
+    if (getP->left == (*node))
+    {
+        l(p(*node   )) =   *good_son;
+        p  (*good_son) = p(*node   );
+    }
+    else
+    {
+        r(p(*node   )) =   *good_son;
+        p  (*good_son) = p(*node   );
+    }
+    
+    node_dtor(*node);
+}
+
+//___________________
+
+#undef getL
+#undef getR
+#undef getP
+#undef getOP
+#undef getDBL
+#undef getVAR
+#undef getSYS
+
+//___________________
+
+Tree_node *tree_copy(const Tree_node *tree)
+{
+    switch(tree->type)
+    {
+        case NODE_NUM: return new_node_num(tree->value.dbl);
+        case NODE_OP : return new_node_op (tree->value.op , tree_copy(tree->left), tree_copy(tree->right));
+        case NODE_VAR: return new_node_var(tree->value.var);
+        
+        case NODE_UNDEF :
+        case NODE_SYS   :
+        default         : assert(false && "tree_copy bad cases");
+    }
+
+    return nullptr;
+}
+
+/*_____________________________________________________________________*/
+
+
+//___________________
+
+#undef  LOG_CATEGORY
+#define LOG_CATEGORY LOG_CAT_DIFF
+
+//___________________
+
+Tree_node *diff_main(Tree_node **root, Tree_node *system_vars[], const char *vars)
+{
+    log_header(__PRETTY_FUNCTION__);
+
+    Tree_metrics metrics   = {};
+    bool         is_metric = metrics_begin(&metrics, "diff", (root == nullptr) ? nullptr : *root);
+
+    Tree_node *diff_root = diff_general(root, system_vars, vars, nullptr);
+    if (is_metric) metrics_end(&metrics, diff_root);
+
+    log_end_header();
+    return diff_root;
+}
+
+Tree_node *diff_main_parallel(Tree_node **root, Tree_node *system_vars[], const char *vars, const int threads,
+                                                                                            const int threshold)
+{
+    log_header(__PRETTY_FUNCTION__);
+
+    Diff_context ctx = {diff_pool(threads), threshold, nullptr, 0, 0};
+    if (ctx.pool == nullptr)
+    {
+        log_warning("Can't create task pool. Differentiate in one thread.\n");
+    }
+    else log_message("threads = %d, threshold = %d.\n", task_pool_size(ctx.pool), threshold);
+
+    Tree_metrics metrics   = {};
+    bool         is_metric = metrics_begin(&metrics, "diff_parallel", (root == nullptr) ? nullptr : *root, true);
+
+    Tree_node *diff_root = diff_general(root, system_vars, vars, (ctx.pool == nullptr) ? nullptr : &ctx);
+    if (is_metric) metrics_end(&metrics, diff_root);
+
+    log_end_header();
+    return diff_root;
+}
+
+static Diff_pool  DIFF_POOL_LIST[DIFF_POOLS] = {};
+static int        DIFF_POOL_NUM              = 0;
+static std::mutex DIFF_POOL_LOCK;
+
+/**
+*   @brief The pool of "threads" threads shared by the calls of diff_main_parallel(). It is created by the first
+*          call and lives until the exit, so a call doesn't start and join the threads. The calls of several
+*          threads may share the pool.
+*
+*   @return the pool and nullptr if it can't be created or DIFF_POOLS pools of other sizes exist
+*/
+
+static Task_pool *diff_pool(int threads)
+{
+    if (threads < 0) threads = 0;
+
+    std::lock_guard<std::mutex> guard(DIFF_POOL_LOCK);
+
+    for (int i = 0; i < DIFF_POOL_NUM; ++i)
+    {
+        if (DIFF_POOL_LIST[i].threads == threads) return DIFF_POOL_LIST[i].pool;
+    }
+    if (DIFF_POOL_NUM == DIFF_POOLS) return nullptr;
+
+    Task_pool *pool = task_pool_new(threads);
+    if        (pool == nullptr) return nullptr;
+
+    if (DIFF_POOL_NUM == 0) atexit(diff_pools_delete);
+
+    DIFF_POOL_LIST[DIFF_POOL_NUM++] = {threads, pool};
+    return pool;
+}
+
+static void diff_pools_delete()
+{
+    std::lock_guard<std::mutex> guard(DIFF_POOL_LOCK);
+
+    for (int i = 0; i < DIFF_POOL_NUM; ++i) task_pool_delete(DIFF_POOL_LIST[i].pool);
+    DIFF_POOL_NUM = 0;
+}
+
+static Tree_node *diff_general(Tree_node **root, Tree_node *system_vars[], const char *vars, const Diff_context *ctx)
+{
+    if (root == nullptr)
+    {
+        log_error     ("Nullptr-pointer to the tree to differentiate.\n");
+        return nullptr;
+    }
+    if (Tree_verify(*root) == false)
+    {
+        log_error     ("Can't differentiate the function, because tree is invalid.\n");
+        return nullptr;
+    }
+    if (!(strlen(vars) == 1 && (is_char_var(vars[0]) || vars[0] == 'a')))
+    {
+        log_error     ("Undefined value of vars: \"%s\".\n", vars);
+        return nullptr;
+    }
+
+    Tree_optimize_main(root);
+    Tree_node *diff_root = nullptr;
+
+    Diff_context big_ctx = {};
+    if (ctx != nullptr)
+    {
+        big_ctx = *ctx;
+        ctx     = diff_big_nodes(&big_ctx, *root, system_vars) ? &big_ctx : nullptr;
+    }
+
+    switch (vars[0])
+    {
+        case 'x': diff_root = diff_execute(*root, system_vars, X, false, ctx);
+                  break;
+        case 'y': diff_root = diff_execute(*root, system_vars, Y, false, ctx);
+                  break;
+        case 'z': diff_root = diff_execute(*root, system_vars, Z, false, ctx);
+                  break;
+        default : if (ctx == nullptr)
+                  {
+                      diff_root = Add(diff_execute(*root, system_vars, X, true, ctx),
+                                  Add(diff_execute(*root, system_vars, Y, true, ctx),
+                                      diff_execute(*root, system_vars, Z, true, ctx)));
+                      break;
+                  }
+                  {
+                      Diff_task task_x = {};
+                      Diff_task task_y = {};
+
+                      diff_spawn(&task_x, *root, system_vars, X, true, ctx);
+                      diff_spawn(&task_y, *root, system_vars, Y, true, ctx);
+
+                      Tree_node *diff_z = diff_execute(*root, system_vars, Z, true, ctx);
+
+                      task_wait(ctx->pool, &task_y.task);
+                      task_wait(ctx->pool, &task_x.task);
+
+                      diff_root = Add(task_x.result, Add(task_y.result, diff_z));
+                  }
+                  break;
+    }
+
+    log_free(big_ctx.big);
+
+    if (diff_root != nullptr) verify_stamp(diff_root);
+    return diff_root;
+}
+
+//_____________________________
+
+#define DL dL(node, system_vars, var, d_mode, ctx)
+#define DR dR(node, system_vars, var, d_mode, ctx)
+#define CL cL(node)
+#define CR cR(node)
+
+#define DLR diff_both(node, system_vars, var, d_mode, ctx, &dl, &dr)
+
+//_____________________________
+
+static Tree_node *diff_execute(Tree_node *const node, Tree_node *system_vars[], VAR var, bool d_mode,
+                                                                                const Diff_context *ctx)
+{
+    assert(node != nullptr);
+
+    switch(node->type)
+    {
+        case NODE_NUM  : return Nul;
+        
+        case NODE_VAR  : return diff_var_case(node,              var, d_mode     );
+        case NODE_OP   : return diff_op_case (node, system_vars, var, d_mode, ctx);
+        case NODE_SYS  : return diff_sys_case(node, system_vars, var, d_mode, ctx);
+        
+        case NODE_UNDEF:
+        default        : log_error      ("default case in diff_execute() in TYPE-NODE-switch: node_type = %d.\n", node->type);
+                         Tree_dump_graphviz(node);
+                         assert(false && "default case in TYPE_NODE-switch");
+                         return nullptr;
+    }
+
+    return nullptr;
+}
+
+static Tree_node *diff_sys_case(Tree_node *const node, Tree_node *system_vars[], VAR var, bool d_mode,
+                                                                                 const Diff_context *ctx)
+{
+    assert(node        !=  nullptr);
+    assert(node->type  == NODE_SYS);
+
+    assert(system_vars            != nullptr);
+    assert(system_vars[sys(node)] != nullptr);
+
+    return diff_execute(system_vars[sys(node)], system_vars, var, d_mode, ctx);
+}
+
+static Tree_node *diff_var_case(Tree_node *const node, VAR var, bool d_mode)
+{
+    assert(node       != nullptr);
+    assert(node->type == NODE_VAR);
+
+    if (var(node) == var)
+    {
+        if (d_mode) return new_node_var(get_diff_var(var));
+        return Num(1);
+    }
+    return Num(0);
+}
+
+static Tree_node *diff_op_case(Tree_node *const node, Tree_node *system_vars[], VAR var, bool d_mode,
+                                                                                const Diff_context *ctx)
+{
+    assert(node       != nullptr);
+    assert(node->type == NODE_OP);
+
+    Tree_node *dl = nullptr;
+    Tree_node *dr = nullptr;
+
+    switch(op(node))
+    {
+        case OP_ADD : DLR; return Add(dl, dr);
+        case OP_SUB : DLR; return Sub(dl, dr);
+
+        case OP_MUL : DLR; return Add(Mul(dl, CR), Mul(CL, dr));
+        case OP_DIV : DLR; return Div(Sub(Mul(dl, CR), Mul(CL, dr)), Pow(CR, Num(2)));
+
+        case OP_SIN : return Mul(Cos(CL, CR), DR);
+        case OP_COS : return Mul(Sub(Nul, Sin(CL, CR)), DR);
+        case OP_TAN : return Div(DR, Pow(Cos(CL, CR), Num(2)));
+
+        case OP_LOG : return Div(DR, CR);
+
+        case OP_POW : return diff_op_pow(node, system_vars, var, d_mode, ctx);
+
+        case OP_SQRT: return Div(DR, Mul(Num(2), Sqrt(CL, CR)));
+
+        case OP_SH  : return Mul(Ch(CL, CR), DR);
+        case OP_CH  : return Mul(Sh(CL, CR), DR);
+
+        case OP_ASIN: return         Div(DR, Sqrt(Nul, Sub(Num(1), Pow(CR, Num(2)))));
+        case OP_ACOS: return Sub(Nul, Div(DR, Sqrt(Nul, Sub(Num(1), Pow(CR, Num(2))))));
+        case OP_ATAN: return Div(DR,                   Add(Num(1), Pow(CR, Num(2))));
+
+        default     : log_error      ("default case in diff_execute() in TYPE-OP-switch: op_type = %d.\n", op(node));
+                      Tree_dump_graphviz(node);
+                      assert(false && "default case in diff_execute() in TYPE_OP-switch");
+                      return nullptr;
+    }
+    return nullptr;
+}
+
+static Tree_node *diff_op_pow(Tree_node *const node, Tree_node *system_vars[], VAR var, bool d_mode,
+                                                                               const Diff_context *ctx)
+{
+    assert(node       != nullptr);
+    assert(node->type == NODE_OP);
+    assert(op(node)   ==  OP_POW);
+
+    if (l(node)->type == NODE_NUM) return Mul(Pow(CL, CR), Mul(Log(Nul, CL), DR));
+    if (r(node)->type == NODE_NUM) return Mul(Pow(CL, Num(dbl(r(node))-1)), Mul(CR, DL));
+
+    Tree_node *dl = nullptr;
+    Tree_node *dr = nullptr;
+
+    DLR;
+    return Mul(Pow(CL, CR), Add(Div(Mul(CR, dl), CL), Mul(dr, Log(Nul, CL))));
+}
+
+//_____________________________
+
+#undef DL
+#undef DR
+#undef CL
+#undef CR
+#undef DLR
+
+//_____________________________
+
+/**
+*   Differentiates both subtrees of the node. If the node is large enough, the left subtree is differentiated
+*   as a task of the pool while the current thread differentiates the right one. Smaller subtrees are processed
+*   without any task-checks at all.
+*/
+
+static void diff_both(Tree_node *const node, Tree_node *system_vars[], VAR var, bool d_mode,
+                                                                       const Diff_context *ctx,
+                                                                       Tree_node **dl,
+                                                                       Tree_node **dr)
+{
+    assert(node != nullptr);
+    assert(dl   != nullptr);
+    assert(dr   != nullptr);
+
+    if (ctx != nullptr && !diff_is_big(ctx, node)) ctx = nullptr;
+
+    if (ctx == nullptr)
+    {
+        *dl = diff_execute(l(node), system_vars, var, d_mode, nullptr);
+        *dr = diff_execute(r(node), system_vars, var, d_mode, nullptr);
+        return;
+    }
+
+    Diff_task task_left = {};
+    diff_spawn(&task_left, l(node), system_vars, var, d_mode, ctx);
+
+    *dr = diff_execute(r(node), system_vars, var, d_mode, ctx);
+
+    task_wait(ctx->pool, &task_left.task);
+    *dl = task_left.result;
+}
+
+static void diff_spawn(Diff_task *task, Tree_node *const node, Tree_node *system_vars[], VAR var, bool d_mode,
+                                                                                                 const Diff_context *ctx)
+{
+    assert(task != nullptr);
+    assert(ctx  != nullptr);
+
+    task->node        = node;
+    task->system_vars = system_vars;
+    task->var         = var;
+    task->d_mode      = d_mode;
+    task->ctx         = ctx;
+    task->result      = nullptr;
+
+    task_spawn(ctx->pool, &task->task, diff_task_run, task);
+}
+
+static void diff_task_run(void *task)
+{
+    assert(task != nullptr);
+
+    Diff_task *diff_task = (Diff_task *) task;
+    diff_task->result    = diff_execute(diff_task->node, diff_task->system_vars, diff_task->var,
+                                                                                  diff_task->d_mode,
+                                                                                  diff_task->ctx);
+}
+
+/**
+*   @brief Finds the nodes of at least ctx->threshold nodes once before the differentiation, so diff_both() looks
+*          a node up instead of counting its subtree. A system variable counts as one node, its own tree is
+*          searched as well.
+*
+*   @return false in case of allocation error, the tree is differentiated in one thread then
+*/
+
+static bool diff_big_nodes(Diff_context *ctx, const Tree_node *root, Tree_node *system_vars[])
+{
+    assert(ctx  != nullptr);
+    assert(root != nullptr);
+
+    ctx->big     = nullptr;
+    ctx->big_num = 0;
+    ctx->big_cap = 0;
+
+    if (diff_big_collect(ctx, root, system_vars) < 0)
+    {
+        log_warning("Can't allocate the list of large subtrees. Differentiate in one thread.\n");
+
+        log_free(ctx->big);
+        ctx->big = nullptr;
+        return false;
+    }
+
+    if (ctx->big_num > 0) qsort(ctx->big, (size_t) ctx->big_num, sizeof(const Tree_node *), cmp_node_ptr);
+    return true;
+}
+
+/**
+*   @return number of nodes in the subtree and -1 in case of allocation error
+*/
+
+static long long diff_big_collect(Diff_context *ctx, const Tree_node *node, Tree_node *system_vars[])
+{
+    assert(ctx  != nullptr);
+    assert(node != nullptr);
+
+    if (node->type == NODE_SYS)
+    {
+        assert(system_vars            != nullptr);
+        assert(system_vars[sys(node)] != nullptr);
+
+        return (diff_big_collect(ctx, system_vars[sys(node)], system_vars) < 0) ? -1 : 1;
+    }
+    if (node->type != NODE_OP) return 1;
+
+    long long left  = diff_big_collect(ctx, l(node), system_vars);
+    long long right = diff_big_collect(ctx, r(node), system_vars);
+    if (left < 0 || right < 0) return -1;
+
+    long long size = 1 + left + right;
+    if (size < ctx->threshold) return size;
+
+    if (ctx->big_num == ctx->big_cap)
+    {
+        long long          cap = (ctx->big_cap == 0) ? 64 : 2 * ctx->big_cap;
+        const Tree_node **big  = (const Tree_node **) log_calloc((size_t) cap, sizeof(const Tree_node *));
+        if (big == nullptr) return -1;
+
+        if (ctx->big_num > 0) memcpy(big, ctx->big, (size_t) ctx->big_num * sizeof(const Tree_node *));
+        log_free(ctx->big);
+
+        ctx->big     = big;
+        ctx->big_cap = cap;
+    }
+
+    ctx->big[ctx->big_num++] = node;
+    return size;
+}
+
+static bool diff_is_big(const Diff_context *ctx, const Tree_node *node)
+{
+    assert(ctx  != nullptr);
+    assert(node != nullptr);
+
+    if (ctx->big_num == 0) return false;
+
+    return bsearch(&node, ctx->big, (size_t) ctx->big_num, sizeof(const Tree_node *), cmp_node_ptr) != nullptr;
+}
+
+static int cmp_node_ptr(const void *a, const void *b)
+{
+    uintptr_t node_a = (uintptr_t) *(const Tree_node *const *) a;
+    uintptr_t node_b = (uintptr_t) *(const Tree_node *const *) b;
+
+    return (node_a > node_b) - (node_a < node_b);
+}
+
+static Tree_node *Tree_copy(Tree_node *cp_from)
+{
+    assert(cp_from != nullptr);
+
+    switch (cp_from->type)
+    {
+        case NODE_NUM   : return Num(dbl(cp_from));
+
+        case NODE_VAR   : return new_node_var(var(cp_from));
+        case NODE_SYS   : return new_node_sys(sys(cp_from));
+        case NODE_OP    : return new_node_op (op (cp_from), cL(cp_from), cR(cp_from));
+
+        case NODE_UNDEF :
+        default         : log_error      ("default case in Tree_copy() in TYPE-NODE-switch: node_type = %d.\n", cp_from->type);
+                          Tree_dump_graphviz(cp_from);
+                          assert(false && "default case in Tree_copy() in TYPE-NODE-switch");
+                          break;
+    }
+    return nullptr;
+}
+
+/*_____________________________________________________________________*/
+
+//___________________
+
+#undef  LOG_CATEGORY
+#define LOG_CATEGORY LOG_CAT_OPTIMIZER
+
+#define getL     l(node)
+#define getR     r(node)
+#define getP     p(node)
+#define getOP   op(node)
+#define getDBL dbl(node)
+#define getVAR var(node)
+#define getSYS sys(node)
+
+const int MAX_NODE = 25;
+const int MAX_DIV  =  1;
+const int MAX_POW  =  1;
+const int MAX_SQRT =  2;
+
+//___________________
+
+void Tree_optimize_var_main(Tree_node **root, Tree_node *system_vars[], const int sys_size)
+{
+    log_header(__PRETTY_FUNCTION__);
+
+
+    if (Tree_verify(*root) == false)
+    {
+        log_error("Can't do optimize_var, because the tree is invalid.\n");
+        return;
+    }
+    if (system_vars == nullptr)
+    {
+        log_error("system_vars is nullptr.\n");
+        return;
+    }
+
+    int    vars_index = 0;
+    while (vars_index < sys_size && system_vars[vars_index] != nullptr) ++vars_index;
+
+    int num_node   =     0;
+    int num_div    =     0;
+    int num_pow    =     0;
+    int num_sqrt   =     0;
+
+    Tree_metrics metrics   = {};
+    bool         is_metric = metrics_begin(&metrics, "optimize_var", *root);
+
+    Tree_optimize_main(root);
+
+    Tree_changed();
+    Tree_optimize_var_execute(*root, system_vars, &vars_index, &num_node, &num_div, &num_pow, &num_sqrt, sys_size);
+    verify_stamp(*root);
+
+    if (is_metric) metrics_end(&metrics, *root);
+
+    log_end_header();
+}
+
+static void Tree_optimize_var_execute(Tree_node *node, Tree_node *system_vars[], int *const vars_index   ,
+                                                                                 int *const tree_num_node,
+                                                                                 int *const tree_num_div ,
+                                                                                 int *const tree_num_pow ,
+                                                                                 int *const tree_num_sqrt, const int sys_size)
+{
+    assert(node        != nullptr);
+    assert(system_vars != nullptr);
+    assert(vars_index  != nullptr);
+
+    assert(tree_num_node != nullptr);
+    assert(tree_num_div  != nullptr);
+    assert(tree_num_pow  != nullptr);
+    assert(tree_num_sqrt != nullptr);
+
+    if (node->type == NODE_OP)
+    {
+        int subtree_num_node = 0;
+        int subtree_num_div  = 0;
+        int subtree_num_pow  = 0;
+        int subtree_num_sqrt = 0;
+        Tree_optimize_var_execute(getL, system_vars, vars_index, tree_num_node,
+                                                                 tree_num_div ,
+                                                                 tree_num_pow ,
+                                                                 tree_num_sqrt, sys_size);
+
+        Tree_optimize_var_execute(getR, system_vars, vars_index, &subtree_num_node,
+                                                                 &subtree_num_div ,
+                                                                 &subtree_num_pow ,
+                                                                 &subtree_num_sqrt, sys_size);
+        switch (getOP)
+        {
+            case OP_DIV : Tree_optimize_var_div        (   tree_num_node,    tree_num_div,    tree_num_pow,    tree_num_sqrt,
+                                                        subtree_num_node, subtree_num_div, subtree_num_pow, subtree_num_sqrt);
+                          break;
+            case OP_POW : Tree_optimize_var_pow        (   tree_num_node,    tree_num_div,    tree_num_pow,    tree_num_sqrt,
+                                                        subtree_num_node, subtree_num_div, subtree_num_pow, subtree_num_sqrt);
+                          break;
+            case OP_SQRT: Tree_optimize_var_sqrt       (   tree_num_node,    tree_num_div,    tree_num_pow,    tree_num_sqrt,
+                                                        subtree_num_node, subtree_num_div, subtree_num_pow, subtree_num_sqrt);
+                          break;
+            default     : Tree_optimize_var_default    (   tree_num_node,    tree_num_div,    tree_num_pow,    tree_num_sqrt,
+                                                        subtree_num_node, subtree_num_div, subtree_num_pow, subtree_num_sqrt);
+                          break;
+        }
+
+        if (*tree_num_node > MAX_NODE ||
+            *tree_num_div  > MAX_DIV  ||
+            *tree_num_pow  > MAX_POW  ||
+            *tree_num_sqrt > MAX_SQRT   )
+        {
+            make_var_change(node, system_vars, vars_index, sys_size);
+            *tree_num_node = 1; //if there no the replacement of node, this parametres become useless
+            *tree_num_div  = 0;
+            *tree_num_pow  = 0;
+            *tree_num_sqrt = 0;
+        }
+    }
+    else *tree_num_node = 1; //node->type != NODE_OP
+}
+
+static void make_var_change(Tree_node *node, Tree_node *system_vars[], int *const vars_index, const int sys_size)
+{
+    assert(node        != nullptr);
+    assert(system_vars != nullptr);
+    assert(vars_index  != nullptr);
+
+    if (*vars_index == sys_size) return;
+    if (getP        ==  nullptr) return;
+
+    int system_var_ind = 0;
+    bool is_new_var    = get_system_var(node, system_vars, vars_index, &system_var_ind, sys_size);
+
+    if (r(getP) == node)
+    {
+        r(getP) = new_node_sys(system_var_ind, getP);
+        
+        if (!is_new_var) Tree_dtor(node); // delete the node, because there was the duplicate of it before
+    }
+    else
+    {
+        l(getP) = new_node_sys(system_var_ind, getP);
+
+        if (!is_new_var) Tree_dtor(node); // delete the node, because there was the duplicate of it before
+    }
+}
+
+static bool get_system_var(Tree_node *node, Tree_node *system_vars[], int *const vars_index, int *const needed_ind,
+                                                                                             const int  sys_size  )
+{
+    assert(needed_ind  != nullptr);
+    assert( vars_index != nullptr);
+    assert(*vars_index < sys_size);
+
+    for (int cnt = 0; cnt < *vars_index; ++cnt)
+    {
+        if (Tree_cmp(node, system_vars[cnt]))
+        {
+            *needed_ind = cnt;
+            return false;
+        }
+    }
+
+    system_vars  [*vars_index] = node;
+    *needed_ind = *vars_index;
+    *vars_index += 1;
+
+    return true;
+}
+
+static void Tree_optimize_var_default(int *const num_node , int *const num_div , int *const num_pow , int *const num_sqrt ,
+                                      const int  num_node2, const int  num_div2, const int  num_pow2,  const int num_sqrt2)
+{
+    assert(num_node != nullptr);
+    assert(num_div  != nullptr);
+    assert(num_pow  != nullptr);
+    assert(num_sqrt != nullptr);
+
+    *num_node += num_node2 + 1;
+    *num_div   = get_max(*num_div , num_div2 );
+    *num_pow   = 0;
+    *num_sqrt  = get_max(*num_sqrt, num_sqrt2);
+}
+
+static void Tree_optimize_var_div(int *const num_node , int *const num_div , int *const num_pow , int *const num_sqrt ,
+                                  const int  num_node2, const int  num_div2, const int  num_pow2,  const int num_sqrt2)
+{
+    assert(num_node != nullptr);
+    assert(num_div  != nullptr);
+    assert(num_pow  != nullptr);
+    assert(num_sqrt != nullptr);
+
+    *num_node = get_max(*num_node, num_node2);
+    *num_div += num_div2 + 1;
+    *num_pow  = 0;
+    *num_sqrt = get_max(*num_sqrt, num_sqrt2);
+}
+
+static void Tree_optimize_var_pow(int *const num_node , int *const num_div , int *const num_pow , int *const num_sqrt ,
+                                  const int  num_node2, const int  num_div2, const int  num_pow2,  const int num_sqrt2)
+{
+    assert(num_node != nullptr);
+    assert(num_div  != nullptr);
+    assert(num_pow  != nullptr);
+    assert(num_sqrt != nullptr);
+
+    *num_node += num_node2 + 1;
+    *num_div   = get_max(*num_div, num_div2);
+    *num_pow  += num_pow2 + 1;
+    *num_sqrt += num_sqrt2;
+}
+
+static void Tree_optimize_var_sqrt(int *const num_node , int *const num_div , int *const num_pow , int *const num_sqrt ,
+                                   const int  num_node2, const int  num_div2, const int  num_pow2,  const int num_sqrt2)
+{
+    assert(num_node != nullptr);
+    assert(num_div  != nullptr);
+    assert(num_pow  != nullptr);
+    assert(num_sqrt != nullptr);
+
+    *num_node += num_node2 + 1;
+    *num_div   = get_max(*num_div, num_div2);
+    *num_pow   = get_max(*num_pow, num_pow2);
+    *num_sqrt += num_sqrt2 + 1;
+}
+
+static bool Tree_cmp(Tree_node *first, Tree_node *second)
+{
+    assert(first  != nullptr);
+    assert(second != nullptr);
+    
+    if (Tree_node_cmp(first, second))
+    {
+        if (first->type == NODE_OP)
+        {
+            if (op(first) == OP_ADD || op(first) == OP_MUL)
+            {
+                if (l(first) != nullptr)
+                {
+                    return  (Tree_cmp(l(first), l(second)) && Tree_cmp(r(first), r(second))) ||
+                            (Tree_cmp(l(first), r(second)) && Tree_cmp(r(first), l(second)));
+                }
+                return true;
+            }
+            return l(first) == nullptr || (Tree_cmp(l(first), l(second)) && Tree_cmp(r(first), r(second)));
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool Tree_node_cmp(Tree_node *first, Tree_node *second)
+{
+    assert(first  != nullptr);
+    assert(second != nullptr);
+
+    if (value_cmp(first, second)              &&
+        edge_cmp(l(first), l(second))         &&
+        edge_cmp(r(first), r(second))
+        ) 
+        return true;
+
+    return false;
+}
+
+static bool edge_cmp(Tree_node *first, Tree_node *second)
+{
+    if (first == nullptr && second == nullptr) return true;
+    if (first != nullptr && second != nullptr) return true;
+    return false;
+}
+
+static bool value_cmp(Tree_node *first, Tree_node *second)
+{
+    assert(first  != nullptr);
+    assert(second != nullptr);
+
+    if (first->type != second->type) return false;
+
+    switch (first->type)
+    {
+        case NODE_OP : return  op(first) ==  op(second);
+        case NODE_NUM: return approx_equal(dbl(first), dbl(second));
+        case NODE_VAR: return var(first) == var(second);
+        case NODE_SYS: return sys(first) == sys(second);
+
+        default      : assert(false && "default case in value_cmp()\n");
+    }
+    return false;
+}
+
+/*_____________________________________________________________________*/
+
+//___________________
+
+#undef  LOG_CATEGORY
+#define LOG_CATEGORY LOG_CAT_GENERAL
+
+//___________________
+
+/**
+*   @brief Evaluates the tree in the point. Each system variable is evaluated once in the point, when it is
+*          reached first, so the shared subexpressions made by Tree_optimize_var_main() are not evaluated again.
+*/
+
+double Tree_get_value_in_point(Tree_node *node, Tree_node *system_vars[],   const double x_val,
+                                                                            const double y_val,
+                                                                            const double z_val)
+{
+    assert(node != nullptr);
+
+    Eval_point point;
+    point.system_vars = system_vars;
+    point.x_val       = x_val;
+    point.y_val       = y_val;
+    point.z_val       = z_val;
+
+    sys_memo_ctor(&point.memo);
+
+    double val = Tree_get_value_dfs(node, &point);
+
+    sys_memo_dtor(&point.memo);
+    return val;
+}
+
+static double Tree_get_value_dfs(Tree_node *node, Eval_point *point)
+{
+    assert(node  != nullptr);
+    assert(point != nullptr);
+
+    switch (node->type)
+    {
+        case NODE_NUM: return getDBL;
+        case NODE_VAR: return Tree_get_value_in_var(node, point);
+        case NODE_SYS: return Tree_get_value_in_sys(node, point);
+
+        case NODE_OP :  {
+                            double left  = Tree_get_value_dfs(getL, point);
+                            double right = Tree_get_value_dfs(getR, point);
+
+                            return Tree_counter(left, right, getOP);
+                        }
+    }
+    return 0;
+}
+
+static double Tree_get_value_in_var(Tree_node *node, Eval_point *point)
+{
+    assert(node       !=  nullptr);
+    assert(node->type == NODE_VAR);
+    assert(point      !=  nullptr);
+
+    switch (getVAR)
+    {
+        case X : return point->x_val;
+        case Y : return point->y_val;
+        case Z : return point->z_val;
+
+        case DX:
+        case DY:
+        case DZ: log_error("Can't get value in diff_node.\n");
+                 return 0;
+
+        default: log_error      ("default case in Tree_get_value_in_var(): gatVar = %d.\n", getVAR);
+                 assert(false && "default case in Tree_get_value_in_var()");
+                 break;
+    }
+    return 0;
+}
+
+static double Tree_get_value_in_sys(Tree_node *node, Eval_point *point)
+{
+    assert(node != nullptr);
+    assert(node->type == NODE_SYS);
+    assert(point      != nullptr);
+
+    assert(point->system_vars         != nullptr);
+    assert(point->system_vars[getSYS] != nullptr);
+
+    Sys_memo *memo = &point->memo;
+
+    if (!sys_memo_reserve(memo, getSYS)) return Tree_get_value_dfs(point->system_vars[getSYS], point);
+
+    if (!memo->done[getSYS])
+    {
+        double val = Tree_get_value_dfs(point->system_vars[getSYS], point);
+
+        memo->vals[getSYS] = val; // the memo may be grown by the evaluation, so it is taken again
+        memo->done[getSYS] = true;
+    }
+
+    return memo->vals[getSYS];
+}
+
+//___________________
+
+static void sys_memo_ctor(Sys_memo *memo)
+{
+    assert(memo != nullptr);
+
+    memo->vals = memo->vals_inline;
+    memo->done = memo->done_inline;
+    memo->cap  = SYS_MEMO_INLINE;
+
+    memset(memo->done_inline, 0, sizeof(memo->done_inline));
+}
+
+static void sys_memo_dtor(Sys_memo *memo)
+{
+    assert(memo != nullptr);
+
+    if (memo->vals != memo->vals_inline) log_free(memo->vals);
+    if (memo->done != memo->done_inline) log_free(memo->done);
+}
+
+/**
+*   @brief Grows the memo to keep the value of the system variable "index".
+*
+*   @return false if there is no memory, then the variable is evaluated without the memo
+*/
+
+static bool sys_memo_reserve(Sys_memo *memo, const int index)
+{
+    assert(memo  != nullptr);
+    assert(index >= 0);
+
+    if (index < memo->cap) return true;
+
+    int cap = memo->cap;
+    while (cap <= index) cap *= 2;
+
+    double *vals = (double *) log_calloc((size_t) cap, sizeof(double));
+    bool   *done = (bool   *) log_calloc((size_t) cap, sizeof(bool  ));
+
+    if (vals == nullptr || done == nullptr)
+    {
+        log_free(vals);
+        log_free(done);
+        return false;
+    }
+
+    memcpy(vals, memo->vals, (size_t) memo->cap * sizeof(double));
+    memcpy(done, memo->done, (size_t) memo->cap * sizeof(bool  ));
+
+    sys_memo_dtor(memo);
+
+    memo->vals = vals;
+    memo->done = done;
+    memo->cap  = cap;
+
+    return true;
+}
+
+//___________________
+
+/**
+*   @brief Structural hash of the tree with its system_vars. Equal trees have equal hashes,
+*          whatever their addresses are. The system_vars are hashed up to the first nullptr or "sys_size",
+*          which has no default, so the trees of different system_vars don't get equal hashes by mistake.
+*/
+
+unsigned long long Tree_hash(const Tree_node *root, Tree_node *system_vars[], const int sys_size)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+
+    for (int i = 0; system_vars != nullptr && i < sys_size && system_vars[i] != nullptr; ++i)
+    {
+        hash = tree_hash_dfs(system_vars[i], hash);
+    }
+
+    return tree_hash_dfs(root, hash);
+}
+
+static unsigned long long tree_hash_dfs(const Tree_node *node, unsigned long long hash)
+{
+    const unsigned long long prime = 1099511628211ULL;
+
+    if (node == nullptr) return (hash ^ 0xFF) * prime;
+
+    unsigned long long val = 0;
+
+    switch (node->type)
+    {
+        case NODE_NUM   : memcpy(&val, &node->value.dbl, sizeof(val)); break;
+        case NODE_OP    : val = (unsigned long long) node->value.op;   break;
+        case NODE_VAR   : val = (unsigned long long) node->value.var;  break;
+        case NODE_SYS   : val = (unsigned long long) node->value.sys;  break;
+        case NODE_UNDEF :
+        default         : break;
+    }
+
+    hash = (hash ^ (unsigned long long) node->type) * prime;
+    hash = (hash ^ val)                             * prime;
+
+    if (node->type != NODE_OP) return hash;
+
+    hash = tree_hash_dfs(node->left , hash);
+    return tree_hash_dfs(node->right, hash);
+}
+
+//___________________
+
+/**
+*   The cache of values keeps the last used (expression, x, y, z) in shards, each of them is an LRU list
+*   with a chained hash table under its own lock. The expression is its Tree_hash(), computed once by the caller,
+*   so a cached value is found without walking the tree. The entry keeps the tree and its system_vars too
+*   and a value is found only for the same ones, so the collision of two hashes never gives another tree's value.
+*
+*   @param capacity   [in] - number of the values in all shards
+*   @param shards_num [in] - rounded up to a power of 2
+*/
+
+Tree_eval_cache *Tree_eval_cache_new(const int capacity, const int shards_num)
+{
+    int shards = 1;
+    while (shards < shards_num) shards *= 2;
+
+    int shard_cap = (capacity + shards - 1) / shards;
+    if (shard_cap < 1) shard_cap = 1;
+
+    int buckets = 1;
+    while (buckets < 2 * shard_cap) buckets *= 2;
+
+    Tree_eval_cache *cache = (Tree_eval_cache *) log_calloc(1, sizeof(Tree_eval_cache));
+    if              (cache == nullptr) return nullptr;
+
+    cache->shards     = new (std::nothrow) Eval_shard[shards]();
+    cache->shards_num = shards;
+
+    bool is_ok = cache->shards != nullptr;
+
+    for (int i = 0; is_ok && i < shards; ++i)
+    {
+        Eval_shard *shard = cache->shards + i;
+
+        shard->entries     = (Eval_entry *) log_calloc((size_t) shard_cap, sizeof(Eval_entry));
+        shard->buckets     = (int        *) log_calloc((size_t) buckets  , sizeof(int));
+        shard->cap         = shard_cap;
+        shard->bucket_mask = buckets - 1;
+
+        is_ok = shard->entries != nullptr && shard->buckets != nullptr;
+        if (is_ok) for (int j = 0; j < buckets; ++j) shard->buckets[j] = -1;
+    }
+
+    if (!is_ok)
+    {
+        log_error("Can't allocate the value cache of %d values.\n", capacity);
+        Tree_eval_cache_delete(cache);
+        return nullptr;
+    }
+
+    return cache;
+}
+
+void Tree_eval_cache_delete(Tree_eval_cache *cache)
+{
+    if (cache == nullptr) return;
+
+    for (int i = 0; cache->shards != nullptr && i < cache->shards_num; ++i)
+    {
+        log_free(cache->shards[i].entries);
+        log_free(cache->shards[i].buckets);
+    }
+
+    delete [] cache->shards;
+    log_free (cache);
+}
+
+/**
+*   @brief Tree_get_value_in_point() with the cache. The tree is evaluated only if the value of the expression
+*          in the point is not in the cache, and then the value is put in the cache.
+*
+*   @param expr [in] - Tree_hash() of the tree with its system_vars, it must be computed again if the tree is changed
+*/
+
+double Tree_get_value_cached(Tree_eval_cache *cache, const unsigned long long expr, Tree_node *node,
+                                                                                    Tree_node *system_vars[],
+                             const double x_val, const double y_val, const double z_val)
+{
+    assert(cache != nullptr);
+    assert(node  != nullptr);
+
+    Eval_key           key    = {expr, node, system_vars, x_val, y_val, z_val};
+    unsigned long long hash   = eval_key_hash(expr, x_val, y_val, z_val);
+    Eval_shard        *shard  = cache->shards + (hash >> 32) % (unsigned long long) cache->shards_num;
+    int                bucket = (int) (hash & (unsigned long long) shard->bucket_mask);
+
+    {
+        std::lock_guard<std::mutex> guard(shard->lock);
+
+        int index = eval_find(shard, bucket, &key);
+        if (index != -1)
+        {
+            shard->hits++;
+
+            eval_lru_unlink(shard, index);
+            eval_lru_push  (shard, index);
+
+            return shard->entries[index].value;
+        }
+        shard->misses++;
+    }
+
+    double value = Tree_get_value_in_point(node, system_vars, x_val, y_val, z_val);
+
+    std::lock_guard<std::mutex> guard(shard->lock);
+
+    if (eval_find(shard, bucket, &key) == -1) // another thread may have put it
+    {
+        eval_insert(shard, bucket, &key, value);
+    }
+
+    return value;
+}
+
+void Tree_eval_cache_stats(Tree_eval_cache *cache, long long *const hits, long long *const misses)
+{
+    assert(cache  != nullptr);
+    assert(hits   != nullptr);
+    assert(misses != nullptr);
+
+    *hits   = 0;
+    *misses = 0;
+
+    for (int i = 0; i < cache->shards_num; ++i)
+    {
+        std::lock_guard<std::mutex> guard(cache->shards[i].lock);
+
+        *hits   += cache->shards[i].hits;
+        *misses += cache->shards[i].misses;
+    }
+}
+
+//___________________
+
+static unsigned long long eval_key_hash(const unsigned long long expr, const double x_val, const double y_val,
+                                                                                           const double z_val)
+{
+    unsigned long long bits[3] = {};
+
+    memcpy(bits + 0, &x_val, sizeof(double));
+    memcpy(bits + 1, &y_val, sizeof(double));
+    memcpy(bits + 2, &z_val, sizeof(double));
+
+    unsigned long long hash = expr;
+    for (int i = 0; i < 3; ++i)
+    {
+        hash ^= bits[i] + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2);
+    }
+
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL; // splitmix64 finalizer, so all bits are mixed
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+
+    return hash ^ (hash >> 31);
+}
+
+/**
+*   @brief Finds the entry of the key. The points are compared bitwise, so -0 and 0 are different points.
+*
+*   @return index of the entry and -1 if there is no one
+*/
+
+static int eval_find(Eval_shard *shard, const int bucket, const Eval_key *key)
+{
+    assert(shard != nullptr);
+    assert(key   != nullptr);
+
+    for (int index = shard->buckets[bucket]; index != -1; index = shard->entries[index].chain)
+    {
+        const Eval_entry *entry = shard->entries + index;
+
+        if (entry->expr        == key->expr                          &&
+            entry->node        == key->node                          &&
+            entry->system_vars == key->system_vars                   &&
+            memcmp(&entry->x_val, &key->x_val, sizeof(double)) == 0 &&
+            memcmp(&entry->y_val, &key->y_val, sizeof(double)) == 0 &&
+            memcmp(&entry->z_val, &key->z_val, sizeof(double)) == 0) return index;
+    }
+
+    return -1;
+}
+
+/**
+*   @brief Puts the value in a free entry or in place of the least recently used one.
+*/
+
+static void eval_insert(Eval_shard *shard, const int bucket, const Eval_key *key, const double value)
+{
+    assert(shard != nullptr);
+    assert(key   != nullptr);
+
+    int index = 0;
+
+    if (shard->size < shard->cap) index = shard->size++;
+    else
+    {
+        index = shard->lru_tail;
+
+        eval_lru_unlink  (shard, index);
+        eval_chain_unlink(shard, index);
+    }
+
+    Eval_entry *entry = shard->entries + index;
+
+    entry->expr        = key->expr;
+    entry->node        = key->node;
+    entry->system_vars = key->system_vars;
+    entry->x_val       = key->x_val;
+    entry->y_val       = key->y_val;
+    entry->z_val       = key->z_val;
+    entry->value       = value;
+
+    entry->chain           = shard->buckets[bucket];
+    shard->buckets[bucket] = index;
+
+    eval_lru_push(shard, index);
+}
+
+static void eval_lru_unlink(Eval_shard *shard, const int index)
+{
+    assert(shard != nullptr);
+
+    Eval_entry *entry = shard->entries + index;
+
+    if (entry->lru_prev != -1) shard->entries[entry->lru_prev].lru_next = entry->lru_next;
+    else                       shard->lru_head                          = entry->lru_next;
+
+    if (entry->lru_next != -1) shard->entries[entry->lru_next].lru_prev = entry->lru_prev;
+    else                       shard->lru_tail                          = entry->lru_prev;
+}
+
+static void eval_lru_push(Eval_shard *shard, const int index)
+{
+    assert(shard != nullptr);
+
+    Eval_entry *entry = shard->entries + index;
+
+    entry->lru_prev = -1;
+    entry->lru_next = shard->lru_head;
+
+    if (shard->lru_head != -1) shard->entries[shard->lru_head].lru_prev = index;
+    else                       shard->lru_tail                          = index;
+
+    shard->lru_head = index;
+}
+
+static void eval_chain_unlink(Eval_shard *shard, const int index)
+{
+    assert(shard != nullptr);
+
+    const Eval_entry *entry  = shard->entries + index;
+    int               bucket = (int) (eval_key_hash(entry->expr, entry->x_val, entry->y_val, entry->z_val) &
+                                      (unsigned long long) shard->bucket_mask);
+
+    int *link = shard->buckets + bucket;
+    while (*link != index) link = &shard->entries[*link].chain;
+
+    *link = entry->chain;
+}
+
+/*_____________________________________________________________________*/
+
+static std::atomic<bool>         METRICS_ON         = false;
+static FILE                     *METRICS_SINK       = nullptr;
+static std::mutex                METRICS_LOCK;
+
+static thread_local Tree_metrics METRICS_LAST       = {};
+static thread_local bool         METRICS_LAST_VALID = false;
+static thread_local bool         METRICS_OPEN       = false;    // a call of the thread is being recorded
+static thread_local bool         METRICS_ALL        = false;    // its allocs are counted in all threads
+
+/**
+*   @brief Starts recording the metrics of parsing, optimization and differentiation calls.
+*
+*   @param jsonl_file [in] - file to append a JSON line per call to, nothing is written if it is nullptr
+*
+*   @return false if the file can't be opened
+*/
+
+bool Tree_metrics_enable(const char *jsonl_file)
+{
+    std::lock_guard<std::mutex> guard(METRICS_LOCK);
+
+    if (METRICS_SINK != nullptr) fclose(METRICS_SINK);
+    METRICS_SINK = nullptr;
+
+    if (jsonl_file != nullptr)
+    {
+        METRICS_SINK = fopen(jsonl_file, "a");
+        if (METRICS_SINK == nullptr)
+        {
+            log_error("Can't open metrics file \"%s\".\n", jsonl_file);
+            return false;
+        }
+    }
+
+    METRICS_ON.store(true, std::memory_order_release);
+    return true;
+}
+
+void Tree_metrics_disable()
+{
+    std::lock_guard<std::mutex> guard(METRICS_LOCK);
+
+    METRICS_ON.store(false, std::memory_order_release);
+
+    if (METRICS_SINK != nullptr) fclose(METRICS_SINK);
+    METRICS_SINK = nullptr;
+}
+
+/**
+*   @brief Gives the metrics of the last recorded call made by the current thread.
+*
+*   @return false if there was no such call
+*/
+
+bool Tree_metrics_last(Tree_metrics *metrics)
+{
+    if (metrics == nullptr || !METRICS_LAST_VALID) return false;
+
+    *metrics = METRICS_LAST;
+    return true;
+}
+
+void Tree_get_stats(const Tree_node *root, Tree_stats *stats)
+{
+    if (stats == nullptr) return;
+
+    *stats = {};
+    if (root != nullptr) Tree_get_stats_dfs(root, stats, 1);
+}
+
+static void Tree_get_stats_dfs(const Tree_node *node, Tree_stats *stats, const int depth)
+{
+    assert(node  != nullptr);
+    assert(stats != nullptr);
+
+    stats->nodes += 1;
+    if (depth > stats->depth) stats->depth = depth;
+
+    if (node->type == NODE_OP && (unsigned) op(node) < (unsigned) OP_NUM) stats->ops[op(node)] += 1;
+
+    if (node->left  != nullptr) Tree_get_stats_dfs(node->left , stats, depth + 1);
+    if (node->right != nullptr) Tree_get_stats_dfs(node->right, stats, depth + 1);
+}
+
+/*_____________________________________________________________________*/
+
+/**
+*   @brief Begins to record the call if the metrics are enabled. A call inside a recorded one (the optimization
+*          inside diff_main() or Tree_optimize_var_main()) is not recorded, it is a part of the outer call.
+*
+*   @param all_threads [in] - count the allocations of all threads, for the calls which use a task pool
+*
+*   @return true if the call is recorded, metrics_end() must be called then
+*/
+
+static bool metrics_begin(Tree_metrics *metrics, const char *stage, const Tree_node *in, const bool all_threads)
+{
+    assert(metrics != nullptr);
+    assert(stage   != nullptr);
+
+    if (!METRICS_ON.load(std::memory_order_relaxed) || METRICS_OPEN) return false;
+
+    METRICS_OPEN = true;
+    METRICS_ALL  = all_threads;
+
+    *metrics       = {};
+    metrics->stage = stage;
+
+    Tree_get_stats(in, &metrics->in);
+
+    metrics->allocs = metrics_allocs();
+    metrics->time   = metrics_time();
+
+    return true;
+}
+
+/**
+*   @brief Ends the call begun by metrics_begin(). A failed call ("out" is nullptr) is not recorded.
+*/
+
+static void metrics_end(Tree_metrics *metrics, const Tree_node *out)
+{
+    assert(metrics != nullptr);
+
+    METRICS_OPEN = false;
+    if (out == nullptr) return;
+
+    metrics->time   = metrics_time()   - metrics->time;
+    metrics->allocs = metrics_allocs() - metrics->allocs;
+
+    Tree_get_stats(out, &metrics->out);
+
+    METRICS_LAST       = *metrics;
+    METRICS_LAST_VALID =    true;
+
+    metrics_write(metrics);
+}
+
+static long long metrics_allocs()
+{
+    if (!METRICS_ALL) return log_memory_thread_calls();
+
+    Log_memory_stats stats = {};
+    log_memory_stats(&stats);
+
+    return stats.alloc_calls;
+}
+
+static void metrics_write(const Tree_metrics *metrics)
+{
+    assert(metrics != nullptr);
+
+    std::lock_guard<std::mutex> guard(METRICS_LOCK);
+
+    if (METRICS_SINK == nullptr) return;
+
+    fprintf(METRICS_SINK, "{\"stage\":\"%s\",\"time\":%.9lf,\"allocs\":%lld,\"in\":", metrics->stage ,
+                                                                                     metrics->time  ,
+                                                                                     metrics->allocs);
+    stats_write(&metrics->in , METRICS_SINK);
+    fprintf    (METRICS_SINK, ",\"out\":");
+    stats_write(&metrics->out, METRICS_SINK);
+    fprintf    (METRICS_SINK, "}\n");
+    fflush     (METRICS_SINK);
+}
+
+static void stats_write(const Tree_stats *stats, FILE *const stream)
+{
+    assert(stats  != nullptr);
+    assert(stream != nullptr);
+
+    fprintf(stream, "{\"nodes\":%lld,\"depth\":%d,\"ops\":{", stats->nodes, stats->depth);
+
+    for (int i = 0; i < OP_NUM; ++i)
+    {
+        fprintf(stream, "%s\"%s\":%lld", (i == 0) ? "" : ",", op_json_names[i], stats->ops[i]);
+    }
+    fprintf(stream, "}}");
+}
+
+static double metrics_time()
+{
+    timespec cur = {};
+    clock_gettime(CLOCK_MONOTONIC, &cur);
+
+    return (double) cur.tv_sec + (double) cur.tv_nsec * 1e-9;
+}
+
+/*_____________________________________________________________________*/
+
+/**
+*   The binary format of the tree with its system_vars:
+*
+*   "DTRE" varint(version) varint(sys_num) varint(nodes) tree(system_vars[0]) ... tree(system_vars[sys_num - 1]) tree(root)
+*
+*   where "nodes" is the number of the nodes in all the trees and each tree is a pre-order stream of the nodes.
+*   A node is a BIN_TAG byte with the value after it: raw double of NODE_NUM or varint index of NODE_SYS.
+*   A varint is 7 bits in a byte, the least significant first, the high bit is set in all bytes but the last.
+*/
+
+/**
+*   @brief Writes the tree and the system_vars before the first nullptr in the buffer.
+*
+*   @param size [out] - size of the buffer
+*
+*   @return the buffer, free it by log_free(), and nullptr in case of error
+*/
+
+unsigned char *Tree_serialize(const Tree_node *root, Tree_node *system_vars[], const int sys_size, size_t *const size)
+{
+    assert(size != nullptr);
+
+    if (root == nullptr)
+    {
+        log_error("Can't serialize nullptr-tree.\n");
+        return nullptr;
+    }
+
+    int       sys_num = 0;
+    long long nodes   = bin_count_trees(root, system_vars, sys_size, &sys_num);
+    if       (nodes < 0) return nullptr;
+
+    Bin_writer out = {};
+    out.cap        = 32 + (size_t) nodes * (1 + sizeof(double));
+    out.data       = (unsigned char *) log_calloc(out.cap, sizeof(unsigned char));
+    out.is_ok      = out.data != nullptr;
+
+    bin_put       (&out, BIN_MAGIC, sizeof(BIN_MAGIC));
+    bin_put_varint(&out, BIN_VERSION);
+    bin_put_varint(&out, (unsigned long long) sys_num);
+    bin_put_varint(&out, (unsigned long long) nodes);
+
+    for (int i = 0; i < sys_num; ++i) bin_write_tree(&out, system_vars[i]);
+    bin_write_tree(&out, root);
+
+    if (!out.is_ok)
+    {
+        log_error("Can't serialize the tree of %lld nodes.\n", nodes);
+        log_free (out.data);
+        return nullptr;
+    }
+
+    *size = out.size;
+    return out.data;
+}
+
+/**
+*   @brief Reads the tree written by Tree_serialize(). The system_vars are put in system_vars[] from 0,
+*          the element after the last one is set to nullptr if there is a place for it.
+*
+*   @return the tree and nullptr if the data is wrong or doesn't fit in sys_size
+*/
+
+Tree_node *Tree_deserialize(const void *data, const size_t size, Tree_node *system_vars[], const int sys_size)
+{
+    assert(data != nullptr);
+
+    Bin_reader in = {};
+    in.data       = (const unsigned char *) data;
+    in.size       = size;
+
+    unsigned long long version = 0;
+    unsigned long long sys_num = 0;
+    unsigned long long nodes   = 0;
+
+    if (!bin_get_magic (&in, BIN_MAGIC, sizeof(BIN_MAGIC))                                            ||
+        !bin_get_varint(&in, &version)                || version != BIN_VERSION                       ||
+        !bin_get_varint(&in, &sys_num)                || sys_num > (unsigned long long) sys_size      ||
+        !bin_get_varint(&in, &nodes)                  || nodes   > size                                )
+    {
+        log_error("Wrong header of the binary tree or too small system_vars[%d].\n", sys_size);
+        return nullptr;
+    }
+    if (sys_num != 0) assert(system_vars != nullptr);
+
+    in.nodes = (long long) nodes;
+
+    int i = 0;
+    for (; i < (int) sys_num; ++i)
+    {
+        in.sys_num     = i; // a system variable refers only to the ones before it
+        system_vars[i] = bin_read_tree(&in);
+        if (system_vars[i] == nullptr) break;
+    }
+
+    in.sys_num      = (int) sys_num;
+    Tree_node *root = (i == in.sys_num) ? bin_read_tree(&in) : nullptr;
+
+    if (root != nullptr && (in.nodes != 0 || in.pos != in.size))
+    {
+        Tree_dtor(root);
+        root = nullptr;
+    }
+    if (root == nullptr)
+    {
+        log_error("Wrong binary tree at byte %zu.\n", in.pos);
+
+        for (int j = 0; j < i; ++j) { Tree_dtor(system_vars[j]); system_vars[j] = nullptr; }
+        return nullptr;
+    }
+
+    if (in.sys_num < sys_size) system_vars[in.sys_num] = nullptr;
+    return root;
+}
+
+bool Tree_save(const char *file, const Tree_node *root, Tree_node *system_vars[], const int sys_size)
+{
+    assert(file != nullptr);
+
+    size_t         size = 0;
+    unsigned char *data = Tree_serialize(root, system_vars, sys_size, &size);
+    if            (data == nullptr) return false;
+
+    FILE *stream = fopen(file, "wb");
+    bool  is_ok  = stream != nullptr && fwrite(data, sizeof(unsigned char), size, stream) == size;
+
+    if (stream != nullptr) is_ok = (fclose(stream) == 0) && is_ok;
+    if (!is_ok) log_error("Can't write the tree in \"%s\".\n", file);
+
+    log_free(data);
+    return is_ok;
+}
+
+Tree_node *Tree_load(const char *file, Tree_node *system_vars[], const int sys_size)
+{
+    assert(file != nullptr);
+
+    File_map map = {};
+    if (!map_file(file, &map))
+    {
+        log_error("Can't map the file \"%s\".\n", file);
+        return nullptr;
+    }
+
+    Tree_node *root = (map.size == 0) ? nullptr : Tree_deserialize(map.data, map.size, system_vars, sys_size);
+
+    unmap_file(&map);
+    return root;
+}
+
+//___________________
+
+/**
+*   @brief Writes the tree in pre-order.
+*/
+
+static void bin_write_tree(Bin_writer *out, const Tree_node *root)
+{
+    assert(out  != nullptr);
+    assert(root != nullptr);
+
+    Node_walk walk = {};
+    walk_begin(&walk, root);
+
+    for (const Tree_node *node = walk_next(&walk); node != nullptr; node = walk_next(&walk)) bin_write_node(out, node);
+
+    if (!walk.is_ok) out->is_ok = false;
+    walk_end(&walk);
+}
+
+static void bin_write_node(Bin_writer *out, const Tree_node *node)
+{
+    assert(out  != nullptr);
+    assert(node != nullptr);
+
+    switch (node->type)
+    {
+        case NODE_NUM   : {
+                              unsigned char      tag  = BIN_NUM;
+                              unsigned long long bits = 0;
+                              memcpy(&bits, &node->value.dbl, sizeof(bits));
+
+                              unsigned char le[sizeof(bits)] = {};
+                              for (size_t i = 0; i < sizeof(bits); ++i) le[i] = (unsigned char) (bits >> (8 * i));
+
+                              bin_put(out, &tag, 1);
+                              bin_put(out, le, sizeof(le));
+                              return;
+                          }
+        case NODE_SYS   : {
+                              unsigned char tag = BIN_SYS;
+
+                              bin_put       (out, &tag, 1);
+                              bin_put_varint(out, (unsigned long long) node->value.sys);
+                              return;
+                          }
+        case NODE_VAR   : {
+                              unsigned char tag = (unsigned char) (BIN_VAR + (int) node->value.var);
+                              bin_put(out, &tag, 1);
+                              return;
+                          }
+        case NODE_OP    : {
+                              unsigned char tag = (unsigned char) (BIN_OP + (int) node->value.op);
+                              bin_put(out, &tag, 1);
+                              return;
+                          }
+        case NODE_UNDEF :
+        default         : {
+                              unsigned char tag = BIN_UNDEF;
+                              bin_put(out, &tag, 1);
+                              return;
+                          }
+    }
+}
+
+static void bin_put(Bin_writer *out, const void *data, const size_t size)
+{
+    assert(out  != nullptr);
+    assert(data != nullptr);
+
+    if (!out->is_ok) return;
+
+    if (out->size + size > out->cap)
+    {
+        size_t         cap   = 2 * out->cap + size;
+        unsigned char *grown = (unsigned char *) log_calloc(cap, sizeof(unsigned char));
+        if            (grown == nullptr) { out->is_ok = false; return; }
+
+        if (out->data != nullptr) memcpy(grown, out->data, out->size);
+        log_free(out->data);
+
+        out->data = grown;
+        out->cap  = cap;
+    }
+
+    memcpy(out->data + out->size, data, size);
+    out->size += size;
+}
+
+static void bin_put_varint(Bin_writer *out, unsigned long long val)
+{
+    assert(out != nullptr);
+
+    unsigned char buff[10] = {};
+    size_t        len      =  0;
+
+    do
+    {
+        buff[len] = (unsigned char) (val & 0x7F);
+        val     >>= 7;
+
+        if (val != 0) buff[len] |= 0x80;
+        ++len;
+    }
+    while (val != 0);
+
+    bin_put(out, buff, len);
+}
 
-#define getL     l(node)
-#define getR     r(node)
-#define getP     p(node)
-#define getOP   op(node)
-#define getDBL dbl(node)
-#define getVAR var(node)
-#define getSYS sys(node)
+/**
+*   @return number of the nodes and -1 in case of allocation error
+*/
 
-const int MAX_NODE = 25;
-const int MAX_DIV  =  1;
-const int MAX_POW  =  1;
-const int MAX_SQRT =  2;
+static long long bin_count_nodes(const Tree_node *root)
+{
+    Node_walk walk = {};
+    walk_begin(&walk, root);
+
+    long long nodes = 0;
+    while (walk_next(&walk) != nullptr) ++nodes;
+
+    if (!walk.is_ok) nodes = -1;
+    walk_end(&walk);
+
+    return nodes;
+}
+
+/**
+*   @brief Counts the nodes of the tree and of the system_vars before the first nullptr.
+*
+*   @param sys_num [out] - number of the system_vars
+*
+*   @return number of the nodes and -1 in case of allocation error
+*/
+
+static long long bin_count_trees(const Tree_node *root, Tree_node *system_vars[], const int sys_size,
+                                                                                  int *const sys_num)
+{
+    assert(sys_num != nullptr);
+
+    long long nodes = bin_count_nodes(root);
+    *sys_num        = 0;
+
+    while (nodes >= 0 && system_vars != nullptr && *sys_num < sys_size && system_vars[*sys_num] != nullptr)
+    {
+        long long sys_nodes = bin_count_nodes(system_vars[(*sys_num)++]);
+        nodes               = (sys_nodes < 0) ? -1 : nodes + sys_nodes;
+    }
+
+    if (nodes < 0) log_error("Can't count the nodes of the tree.\n");
+    return nodes;
+}
 
 //___________________
 
-void Tree_optimize_var_main(Tree_node **root, Tree_node *system_vars[], const int sys_size)
+/**
+*   @brief Starts the pre-order walk of the tree, nullptr children are skipped.
+*/
+
+static void walk_begin(Node_walk *walk, const Tree_node *root)
 {
-    log_header(__PRETTY_FUNCTION__);
+    assert(walk != nullptr);
 
+    walk->stk   = walk->stk_inline;
+    walk->cap   = WALK_INLINE;
+    walk->size  = 0;
+    walk->is_ok = true;
 
-    if (Tree_verify(*root) == false)
+    if (root != nullptr) walk->stk[walk->size++] = root;
+}
+
+/**
+*   @return the next node and nullptr at the end or in case of allocation error (walk->is_ok is false then)
+*/
+
+static const Tree_node *walk_next(Node_walk *walk)
+{
+    assert(walk != nullptr);
+
+    if (walk->size == 0) return nullptr;
+
+    const Tree_node *node = walk->stk[--walk->size];
+    if (node->type != NODE_OP) return node;
+
+    if (walk->size + 2 > walk->cap)
     {
-        log_error("Can't do optimize_var, because the tree is invalid.\n");
-        return;
+        const Tree_node **stk = (const Tree_node **) stack_grow(walk->stk, &walk->cap, sizeof(const Tree_node *),
+                                                                                        walk->stk_inline);
+        if (stk == nullptr)
+        {
+            walk->is_ok = false;
+            walk->size  = 0;
+            return nullptr;
+        }
+        walk->stk = stk;
     }
-    if (system_vars == nullptr)
+
+    if (node->right != nullptr) walk->stk[walk->size++] = node->right;
+    if (node->left  != nullptr) walk->stk[walk->size++] = node->left;
+
+    return node;
+}
+
+static void walk_end(Node_walk *walk)
+{
+    assert(walk != nullptr);
+
+    if (walk->stk != walk->stk_inline) log_free(walk->stk);
+    walk->stk = nullptr;
+}
+
+//___________________
+
+/**
+*   @brief Reads the tree in pre-order. Each node is checked by the header, so the wrong data
+*          can't make more nodes than the header says. The operators waiting for their subtrees are kept
+*          in an explicit stack, so a deep tree doesn't overflow the call stack.
+*
+*   @return the tree and nullptr in case of error
+*/
+
+static Tree_node *bin_read_tree(Bin_reader *in)
+{
+    assert(in != nullptr);
+
+    Bin_frame   stk_inline[WALK_INLINE] = {};
+    Bin_frame  *stk      = stk_inline;
+    int         stk_cap  = WALK_INLINE;
+    int         stk_size = 0;
+
+    Tree_node  *ret      = nullptr;
+    bool        is_ok    = true;
+
+    while (is_ok && ret == nullptr)
     {
-        log_error("system_vars is nullptr.\n");
-        return;
+        bool       is_op = false;
+        TYPE_OP    op    = OP_ADD;
+        Tree_node *done  = bin_read_node(in, &is_op, &op);
+
+        if (is_op)
+        {
+            if (stk_size == stk_cap)
+            {
+                Bin_frame *grown = (Bin_frame *) stack_grow(stk, &stk_cap, sizeof(Bin_frame), stk_inline);
+                if        (grown == nullptr) { is_ok = false; break; }
+
+                stk = grown;
+            }
+            stk[stk_size++] = {op, nullptr};
+            continue;
+        }
+        if (done == nullptr) { is_ok = false; break; }
+
+        // the subtree is complete: it is the left one of the top operator or completes the top operator
+
+        while (done != nullptr && stk_size > 0 && stk[stk_size - 1].left != nullptr)
+        {
+            Bin_frame *top  = &stk[--stk_size];
+            Tree_node *node = new_node_op(top->op, top->left, done);
+            if        (node == nullptr) { Tree_dtor(top->left); Tree_dtor(done); }
+
+            done = node;
+        }
+
+        if      (done     == nullptr) is_ok = false;
+        else if (stk_size ==       0) ret   = done;
+        else                          stk[stk_size - 1].left = done;
     }
 
-    int    vars_index = 0;
-    while (vars_index < sys_size && system_vars[vars_index] != nullptr) ++vars_index;
+    for (int i = 0; i < stk_size; ++i) Tree_dtor(stk[i].left);
+    if (stk != stk_inline) log_free(stk);
 
-    int num_node   =     0;
-    int num_div    =     0;
-    int num_pow    =     0;
-    int num_sqrt   =     0;
+    return ret;
+}
 
-    Tree_optimize_main(root);
-    Tree_optimize_var_execute(*root, system_vars, &vars_index, &num_node, &num_div, &num_pow, &num_sqrt, sys_size);
+/**
+*   @brief Reads one node. An operator is not created, its tag is given by "is_op" and "op".
+*
+*   @return the leaf and nullptr for an operator or in case of error
+*/
 
-    log_end_header();
+static Tree_node *bin_read_node(Bin_reader *in, bool *const is_op, TYPE_OP *const op)
+{
+    assert(in    != nullptr);
+    assert(is_op != nullptr);
+    assert(op    != nullptr);
+
+    *is_op = false;
+
+    unsigned char tag = 0;
+    if (in->nodes-- <= 0 || !bin_get(in, &tag, 1)) return nullptr;
+
+    if (tag == BIN_NUM)
+    {
+        unsigned char le[sizeof(unsigned long long)] = {};
+        if (!bin_get(in, le, sizeof(le))) return nullptr;
+
+        unsigned long long bits = 0;
+        for (size_t i = 0; i < sizeof(bits); ++i) bits |= (unsigned long long) le[i] << (8 * i);
+
+        double val = 0;
+        memcpy(&val, &bits, sizeof(val));
+
+        return new_node_num(val);
+    }
+    if (tag == BIN_SYS)
+    {
+        unsigned long long index = 0;
+        if (!bin_get_varint(in, &index) || index >= (unsigned long long) in->sys_num) return nullptr;
+
+        return new_node_sys((int) index);
+    }
+    if (tag == BIN_UNDEF) return new_node_undef();
+
+    if (BIN_VAR <= tag && tag <= BIN_VAR + (int) DZ) return new_node_var((VAR) (tag - BIN_VAR));
+
+    if (BIN_OP <= tag && tag < BIN_OP + OP_NUM)
+    {
+        *is_op = true;
+        *op    = (TYPE_OP) (tag - BIN_OP);
+    }
+
+    return nullptr;
 }
 
-static void Tree_optimize_var_execute(Tree_node *node, Tree_node *system_vars[], int *const vars_index   ,
-                                                                                 int *const tree_num_node,
-                                                                                 int *const tree_num_div ,
-                                                                                 int *const tree_num_pow ,
-                                                                                 int *const tree_num_sqrt, const int sys_size)
+/**
+*   @brief Checks the magic at the current position and skips it.
+*/
+
+static bool bin_get_magic(Bin_reader *in, const char *magic, const size_t size)
 {
-    assert(node        != nullptr);
-    assert(system_vars != nullptr);
-    assert(vars_index  != nullptr);
+    assert(in    != nullptr);
+    assert(magic != nullptr);
 
-    assert(tree_num_node != nullptr);
-    assert(tree_num_div  != nullptr);
-    assert(tree_num_pow  != nullptr);
-    assert(tree_num_sqrt != nullptr);
+    if (in->size - in->pos < size || memcmp(in->data + in->pos, magic, size) != 0) return false;
 
-    if (node->type == NODE_OP)
+    in->pos += size;
+    return true;
+}
+
+static bool bin_get(Bin_reader *in, void *data, const size_t size)
+{
+    assert(in   != nullptr);
+    assert(data != nullptr);
+
+    if (in->size - in->pos < size) return false;
+
+    memcpy(data, in->data + in->pos, size);
+    in->pos += size;
+
+    return true;
+}
+
+static bool bin_get_varint(Bin_reader *in, unsigned long long *const val)
+{
+    assert(in  != nullptr);
+    assert(val != nullptr);
+
+    *val = 0;
+
+    for (int shift = 0; shift < 64; shift += 7)
     {
-        int subtree_num_node = 0;
-        int subtree_num_div  = 0;
-        int subtree_num_pow  = 0;
-        int subtree_num_sqrt = 0;
-        Tree_optimize_var_execute(getL, system_vars, vars_index, tree_num_node,
-                                                                 tree_num_div ,
-                                                                 tree_num_pow ,
-                                                                 tree_num_sqrt, sys_size);
+        unsigned char byte = 0;
+        if (!bin_get(in, &byte, 1)) return false;
 
-        Tree_optimize_var_execute(getR, system_vars, vars_index, &subtree_num_node,
-                                                                 &subtree_num_div ,
-                                                                 &subtree_num_pow ,
-                                                                 &subtree_num_sqrt, sys_size);
-        switch (getOP)
+        *val |= (unsigned long long) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+
+    return false;
+}
+
+//___________________
+
+/**
+*   The image of the tree is the relocatable layout of the tree with its system_vars for mapping:
+*
+*   Image_header, the roots of system_vars (unsigned[sys_num] aligned to 8 bytes), Image_node[nodes]
+*
+*   The nodes of each tree are in pre-order, so a child is always after its parent and the image has no cycles.
+*   Any number of processes may map the same file and share its pages.
+*/
+
+bool Tree_image_save(const char *file, const Tree_node *root, Tree_node *system_vars[], const int sys_size)
+{
+    assert(file != nullptr);
+
+    if (root == nullptr)
+    {
+        log_error("Can't save the image of nullptr-tree.\n");
+        return false;
+    }
+
+    int       sys_count = 0;
+    long long nodes     = bin_count_trees(root, system_vars, sys_size, &sys_count);
+    unsigned  sys_num   = (unsigned) sys_count;
+
+    if (nodes < 0) return false;
+    if (nodes >= (long long) UINT_MAX)
+    {
+        log_error("The tree of %lld nodes is too big for the image.\n", nodes);
+        return false;
+    }
+
+    size_t         offset = image_nodes_offset(sys_num);
+    size_t         size   = offset + (size_t) nodes * sizeof(Image_node);
+    unsigned char *data   = (unsigned char *) log_calloc(size, sizeof(unsigned char));
+    if            (data == nullptr) return false;
+
+    Image_header *header    = (Image_header *) data;
+    unsigned     *sys_roots = (unsigned     *) (data + sizeof(Image_header));
+    Image_writer  out       = {(Image_node  *) (data + offset), 0, true};
+
+    for (unsigned i = 0; i < sys_num; ++i) sys_roots[i] = image_write_tree(&out, system_vars[i]);
+
+    memcpy(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    header->version = IMAGE_VERSION;
+    header->order   = IMAGE_ORDER;
+    header->nodes   = (unsigned) nodes;
+    header->sys_num = sys_num;
+    header->root    = image_write_tree(&out, root);
+
+    if (!out.is_ok)
+    {
+        log_free(data);
+        return false;
+    }
+
+    FILE *stream = fopen(file, "wb");
+    bool  is_ok  = stream != nullptr && fwrite(data, sizeof(unsigned char), size, stream) == size;
+
+    if (stream != nullptr) is_ok = (fclose(stream) == 0) && is_ok;
+    if (!is_ok) log_error("Can't write the image in \"%s\".\n", file);
+
+    log_free(data);
+    return is_ok;
+}
+
+/**
+*   @brief Maps the image. The image is checked once, so the evaluation doesn't check it again.
+*
+*   @return the image and nullptr if the file can't be mapped or it is not a right image
+*/
+
+Tree_image *Tree_image_open(const char *file)
+{
+    assert(file != nullptr);
+
+    Tree_image *image = (Tree_image *) log_calloc(1, sizeof(Tree_image));
+    if         (image == nullptr) return nullptr;
+
+    if (!map_file(file, &image->map, false))
+    {
+        log_error("Can't map the file \"%s\".\n", file);
+        log_free (image);
+        return nullptr;
+    }
+
+    const Image_header *header = (const Image_header *) image->map.data;
+
+    if (!image_check(header, image->map.size))
+    {
+        log_error ("\"%s\" is not a tree image.\n", file);
+        unmap_file(&image->map);
+        log_free  (image);
+        return nullptr;
+    }
+
+    image->nodes     = (const Image_node *) (image->map.data + image_nodes_offset(header->sys_num));
+    image->sys_roots = (const unsigned   *) (image->map.data + sizeof(Image_header));
+    image->root      = header->root;
+
+    return image;
+}
+
+double Tree_image_value(const Tree_image *image, const double x_val, const double y_val, const double z_val)
+{
+    assert(image != nullptr);
+
+    Eval_point point;
+    point.system_vars = nullptr;
+    point.x_val       = x_val;
+    point.y_val       = y_val;
+    point.z_val       = z_val;
+
+    sys_memo_ctor(&point.memo);
+
+    double val = image_value(image, image->root, &point);
+
+    sys_memo_dtor(&point.memo);
+    return val;
+}
+
+void Tree_image_close(Tree_image *image)
+{
+    if (image == nullptr) return;
+
+    unmap_file(&image->map);
+    log_free  ( image);
+}
+
+//___________________
+
+/**
+*   @brief Writes the tree in pre-order. The nodes waiting for their place are kept in an explicit stack
+*          with the places of their indexes in the parents, so a deep tree doesn't overflow the call stack.
+*
+*   @return index of the root, out->is_ok is false in case of allocation error
+*/
+
+static unsigned image_write_tree(Image_writer *out, const Tree_node *root)
+{
+    assert(out  != nullptr);
+    assert(root != nullptr);
+
+    Image_slot  stk_inline[WALK_INLINE] = {};
+    Image_slot *stk      = stk_inline;
+    int         stk_cap  = WALK_INLINE;
+    int         stk_size = 0;
+
+    unsigned    ret      = 0;
+    stk[stk_size++]      = {root, &ret};
+
+    while (stk_size > 0)
+    {
+        Image_slot  slot  = stk[--stk_size];
+        unsigned    index = out->size++;
+        Image_node *cur   = out->nodes + index;
+
+        *slot.index = index;
+        cur->type   = (unsigned char) slot.node->type;
+
+        switch (slot.node->type)
         {
-            case OP_DIV : Tree_optimize_var_div        (   tree_num_node,    tree_num_div,    tree_num_pow,    tree_num_sqrt,
-                                                        subtree_num_node, subtree_num_div, subtree_num_pow, subtree_num_sqrt);
-                          break;
-            case OP_POW : Tree_optimize_var_pow        (   tree_num_node,    tree_num_div,    tree_num_pow,    tree_num_sqrt,
-                                                        subtree_num_node, subtree_num_div, subtree_num_pow, subtree_num_sqrt);
-                          break;
-            case OP_SQRT: Tree_optimize_var_sqrt       (   tree_num_node,    tree_num_div,    tree_num_pow,    tree_num_sqrt,
-                                                        subtree_num_node, subtree_num_div, subtree_num_pow, subtree_num_sqrt);
-                          break;
-            default     : Tree_optimize_var_default    (   tree_num_node,    tree_num_div,    tree_num_pow,    tree_num_sqrt,
-                                                        subtree_num_node, subtree_num_div, subtree_num_pow, subtree_num_sqrt);
-                          break;
+            case NODE_NUM   : cur->value.dbl = slot.node->value.dbl;                  break;
+            case NODE_SYS   : cur->value.sys = (unsigned) slot.node->value.sys;       break;
+            case NODE_VAR   : cur->op        = (unsigned char) slot.node->value.var;  break;
+            case NODE_OP    : cur->op        = (unsigned char) slot.node->value.op;
+                              break;
+            case NODE_UNDEF :
+            default         : cur->type = NODE_UNDEF;                                 break;
         }
+        if (slot.node->type != NODE_OP) continue;
 
-        if (*tree_num_node > MAX_NODE ||
-            *tree_num_div  > MAX_DIV  ||
-            *tree_num_pow  > MAX_POW  ||
-            *tree_num_sqrt > MAX_SQRT   )
+        if (stk_size + 2 > stk_cap)
         {
-            make_var_change(node, system_vars, vars_index, sys_size);
-            *tree_num_node = 1; //if there no the replacement of node, this parametres become useless
-            *tree_num_div  = 0;
-            *tree_num_pow  = 0;
-            *tree_num_sqrt = 0;
+            Image_slot *grown = (Image_slot *) stack_grow(stk, &stk_cap, sizeof(Image_slot), stk_inline);
+            if         (grown == nullptr) { out->is_ok = false; break; }
+
+            stk = grown;
         }
+
+        stk[stk_size++] = {slot.node->right, &cur->value.right};
+        stk[stk_size++] = {slot.node->left , &cur->left       };
     }
-    else *tree_num_node = 1; //node->type != NODE_OP
+
+    if (stk != stk_inline) log_free(stk);
+    return ret;
 }
 
-static void make_var_change(Tree_node *node, Tree_node *system_vars[], int *const vars_index, const int sys_size)
+/**
+*   @brief Checks the header and each node. The trees lie one after another in the order of the header,
+*          the children of a node are after it in the same tree, no node is a child twice and a system variable
+*          refers only to the trees before its own one, so the evaluation of the checked image always stops
+*          and visits each node of a tree once.
+*/
+
+static bool image_check(const Image_header *header, const size_t size)
 {
-    assert(node        != nullptr);
-    assert(system_vars != nullptr);
-    assert(vars_index  != nullptr);
+    if (header == nullptr || size < sizeof(Image_header))                           return false;
+    if (memcmp(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0)               return false;
+    if (header->version != IMAGE_VERSION || header->order != IMAGE_ORDER)          return false;
+    if (header->sys_num >= header->nodes || header->root >= header->nodes)          return false;
+
+    size_t offset = image_nodes_offset(header->sys_num);
+    if    (offset > size || (size - offset) / sizeof(Image_node) != header->nodes) return false;
+
+    const unsigned   *sys_roots = (const unsigned   *) ((const char *) header + sizeof(Image_header));
+    const Image_node *nodes     = (const Image_node *) ((const char *) header + offset);
+
+    for (unsigned tree = 0; tree <= header->sys_num; ++tree)
+    {
+        unsigned begin = (tree     == header->sys_num) ? header->root :     sys_roots[tree    ];
+        unsigned end   = (tree + 1 == header->sys_num) ? header->root :
+                         (tree     == header->sys_num) ? header->nodes : sys_roots[tree + 1];
+
+        if (tree == 0 && begin != 0) return false;
+        if (end <= begin)            return false;
+
+        for (unsigned i = begin; i < end; ++i)
+        {
+            const Image_node *node = nodes + i;
+
+            switch (node->type)
+            {
+                case NODE_NUM   :
+                case NODE_UNDEF : break;
+                case NODE_SYS   : if (node->value.sys >= tree)                               return false;
+                                  break;
+                case NODE_VAR   : if (node->op > DZ)                                         return false;
+                                  break;
+                case NODE_OP    : if (node->op >= OP_NUM)                                    return false;
+                                  if (node->left        <= i || node->left        >= end)    return false;
+                                  if (node->value.right <= i || node->value.right >= end)    return false;
+                                  break;
+                default         : return false;
+            }
+        }
+    }
 
-    if (*vars_index == sys_size) return;
-    if (getP        ==  nullptr) return;
+    return image_check_refs(nodes, header->nodes);
+}
 
-    int system_var_ind = 0;
-    bool is_new_var    = get_system_var(node, system_vars, vars_index, &system_var_ind, sys_size);
+/**
+*   @brief Checks that no node is referenced by the operators twice, so the image is a forest, not a DAG
+*          which evaluation may take the exponential time.
+*/
 
-    if (r(getP) == node)
+static bool image_check_refs(const Image_node *nodes, const unsigned nodes_num)
+{
+    assert(nodes != nullptr);
+
+    unsigned char *refs = (unsigned char *) log_calloc((size_t) nodes_num / 8 + 1, sizeof(unsigned char));
+    if (refs == nullptr)
     {
-        r(getP) = new_node_sys(system_var_ind, getP);
-        
-        if (!is_new_var) Tree_dtor(node); // delete the node, because there was the duplicate of it before
+        log_error("Can't check the references of the image nodes.\n");
+        return false;
     }
-    else
+
+    bool is_ok = true;
+
+    for (unsigned i = 0; i < nodes_num && is_ok; ++i)
     {
-        l(getP) = new_node_sys(system_var_ind, getP);
+        if (nodes[i].type != NODE_OP) continue;
 
-        if (!is_new_var) Tree_dtor(node); // delete the node, because there was the duplicate of it before
+        unsigned children[] = {nodes[i].left, nodes[i].value.right};
+        for (unsigned child : children)
+        {
+            unsigned char bit = (unsigned char) (1u << (child % 8));
+
+            if (refs[child / 8] & bit) is_ok = false;
+            refs[child / 8] |= bit;
+        }
     }
+
+    log_free(refs);
+    return is_ok;
 }
 
-static bool get_system_var(Tree_node *node, Tree_node *system_vars[], int *const vars_index, int *const needed_ind,
-                                                                                             const int  sys_size  )
+/**
+*   @brief Evaluates the node of the image as Tree_get_value_dfs() does, with the same memo of the system variables.
+*          The steps and the values are kept in explicit stacks, so a deep tree doesn't overflow the call stack.
+*
+*   @return value of the node and NAN in case of allocation error
+*/
+
+static double image_value(const Tree_image *image, const unsigned index, Eval_point *point)
 {
-    assert(needed_ind  != nullptr);
-    assert( vars_index != nullptr);
-    assert(*vars_index < sys_size);
+    assert(image != nullptr);
+    assert(point != nullptr);
 
-    for (int cnt = 0; cnt < *vars_index; ++cnt)
+    Sys_memo    *memo = &point->memo;
+
+    Image_frame  stk_inline[WALK_INLINE] = {};
+    Image_frame *stk      = stk_inline;
+    int          stk_cap  = WALK_INLINE;
+    int          stk_size = 0;
+
+    double       vals_inline[WALK_INLINE] = {};
+    double      *vals      = vals_inline;
+    int          vals_cap  = WALK_INLINE;
+    int          vals_size = 0;
+
+    bool         is_ok     = true;
+    stk[stk_size++]        = {index, IMAGE_VISIT};
+
+    while (stk_size > 0)
     {
-        if (Tree_cmp(node, system_vars[cnt]))
+        if (stk_size + 3 > stk_cap)
         {
-            *needed_ind = cnt;
-            return false;
+            Image_frame *grown = (Image_frame *) stack_grow(stk, &stk_cap, sizeof(Image_frame), stk_inline);
+            if          (grown == nullptr) { is_ok = false; break; }
+
+            stk = grown;
+        }
+        if (vals_size + 1 > vals_cap)
+        {
+            double *grown = (double *) stack_grow(vals, &vals_cap, sizeof(double), vals_inline);
+            if     (grown == nullptr) { is_ok = false; break; }
+
+            vals = grown;
+        }
+
+        Image_frame       frame = stk[--stk_size];
+        const Image_node *node  = image->nodes + frame.index;
+
+        if (frame.step == IMAGE_STORE)
+        {
+            memo->vals[frame.index] = vals[vals_size - 1];
+            memo->done[frame.index] = true;
+            continue;
+        }
+        if (frame.step == IMAGE_APPLY)
+        {
+            vals_size -= 1;
+            vals[vals_size - 1] = Tree_counter(vals[vals_size - 1], vals[vals_size], (TYPE_OP) node->op);
+            continue;
+        }
+
+        switch (node->type)
+        {
+            case NODE_NUM : vals[vals_size++] = node->value.dbl;
+                            break;
+            case NODE_SYS : {
+                                int sys = (int) node->value.sys;
+
+                                if (!sys_memo_reserve(memo, sys))
+                                {
+                                    stk[stk_size++] = {image->sys_roots[sys], IMAGE_VISIT};
+                                }
+                                else if (!memo->done[sys])
+                                {
+                                    stk[stk_size++] = {(unsigned) sys,        IMAGE_STORE};
+                                    stk[stk_size++] = {image->sys_roots[sys], IMAGE_VISIT};
+                                }
+                                else vals[vals_size++] = memo->vals[sys];
+                                break;
+                            }
+            case NODE_VAR : switch (node->op)
+                            {
+                                case X : vals[vals_size++] = point->x_val; break;
+                                case Y : vals[vals_size++] = point->y_val; break;
+                                case Z : vals[vals_size++] = point->z_val; break;
+                                default: log_error("Can't get value in diff_node.\n");
+                                         vals[vals_size++] = 0;
+                                         break;
+                            }
+                            break;
+            case NODE_OP  : stk[stk_size++] = {frame.index      , IMAGE_APPLY};
+                            stk[stk_size++] = {node->value.right, IMAGE_VISIT};
+                            stk[stk_size++] = {node->left       , IMAGE_VISIT};
+                            break;
+            default       : vals[vals_size++] = 0;
+                            break;
         }
     }
 
-    system_vars  [*vars_index] = node;
-    *needed_ind = *vars_index;
-    *vars_index += 1;
+    double val = (is_ok) ? vals[0] : NAN;
+    if    (!is_ok) log_error("Can't evaluate the image.\n");
 
-    return true;
+    if (stk  != stk_inline ) log_free(stk );
+    if (vals != vals_inline) log_free(vals);
+
+    return val;
 }
 
-static void Tree_optimize_var_default(int *const num_node , int *const num_div , int *const num_pow , int *const num_sqrt ,
-                                      const int  num_node2, const int  num_div2, const int  num_pow2,  const int num_sqrt2)
+static size_t image_nodes_offset(const unsigned sys_num)
 {
-    assert(num_node != nullptr);
-    assert(num_div  != nullptr);
-    assert(num_pow  != nullptr);
-    assert(num_sqrt != nullptr);
+    size_t offset = sizeof(Image_header) + sys_num * sizeof(unsigned);
 
-    *num_node += num_node2 + 1;
-    *num_div   = get_max(*num_div , num_div2 );
-    *num_pow   = 0;
-    *num_sqrt  = get_max(*num_sqrt, num_sqrt2);
+    return (offset + alignof(Image_node) - 1) / alignof(Image_node) * alignof(Image_node);
 }
 
-static void Tree_optimize_var_div(int *const num_node , int *const num_div , int *const num_pow , int *const num_sqrt ,
-                                  const int  num_node2, const int  num_div2, const int  num_pow2,  const int num_sqrt2)
+//___________________
+
+/**
+*   The cache of derivatives keeps a file for each input of Tree_cache_diff() in its directory:
+*
+*   "DTCE" varint(version) blob(vars) blob(input) blob(optimized input) blob(derivative)
+*
+*   where blob is the varint size and the bytes, and the trees are in the format of Tree_serialize().
+*   The file name is the hash of the input tree with its system_vars and "vars". The input is kept
+*   in the file too, so the files of equal hashes are never confused.
+*
+*   The files are replaced atomically by rename(), so the parallel jobs may share the directory.
+*   The last use of a file is its mtime, the least recently used files are deleted when the size of the
+*   directory is more than the limit.
+*/
+
+Tree_cache *Tree_cache_open(const char *dir, const long long max_bytes)
 {
-    assert(num_node != nullptr);
-    assert(num_div  != nullptr);
-    assert(num_pow  != nullptr);
-    assert(num_sqrt != nullptr);
+    assert(dir != nullptr);
 
-    *num_node = get_max(*num_node, num_node2);
-    *num_div += num_div2 + 1;
-    *num_pow  = 0;
-    *num_sqrt = get_max(*num_sqrt, num_sqrt2);
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST)
+    {
+        log_error("Can't create the cache directory \"%s\".\n", dir);
+        return nullptr;
+    }
+
+    Tree_cache *cache = (Tree_cache *) log_calloc(1, sizeof(Tree_cache));
+    if         (cache == nullptr) return nullptr;
+
+    cache->dir = (char *) log_calloc(strlen(dir) + 1, sizeof(char));
+    if (cache->dir == nullptr)
+    {
+        log_free(cache);
+        return nullptr;
+    }
+
+    strcpy(cache->dir, dir);
+    cache->max_bytes = max_bytes;
+
+    return cache;
 }
 
-static void Tree_optimize_var_pow(int *const num_node , int *const num_div , int *const num_pow , int *const num_sqrt ,
-                                  const int  num_node2, const int  num_div2, const int  num_pow2,  const int num_sqrt2)
+void Tree_cache_close(Tree_cache *cache)
 {
-    assert(num_node != nullptr);
-    assert(num_div  != nullptr);
-    assert(num_pow  != nullptr);
-    assert(num_sqrt != nullptr);
+    if (cache == nullptr) return;
 
-    *num_node += num_node2 + 1;
-    *num_div   = get_max(*num_div, num_div2);
-    *num_pow  += num_pow2 + 1;
-    *num_sqrt += num_sqrt2;
+    log_free(cache->dir);
+    log_free(cache);
 }
 
-static void Tree_optimize_var_sqrt(int *const num_node , int *const num_div , int *const num_pow , int *const num_sqrt ,
-                                   const int  num_node2, const int  num_div2, const int  num_pow2,  const int num_sqrt2)
+/**
+*   @brief Differentiates the tree as diff_main() and optimizes the derivative by Tree_optimize_main().
+*          If the same tree with the same system_vars and "vars" is in the cache, both the optimized
+*          input and the derivative are read from it instead.
+*
+*   @param root   [in, out] - the tree is optimized as in diff_main()
+*   @param is_hit [out]     - true if the result is from the cache
+*
+*   @return the derivative and nullptr in case of error
+*/
+
+Tree_node *Tree_cache_diff(Tree_cache *cache, Tree_node **root, Tree_node *system_vars[], const int sys_size,
+                                                                const char *vars, bool *const is_hit)
 {
-    assert(num_node != nullptr);
-    assert(num_div  != nullptr);
-    assert(num_pow  != nullptr);
-    assert(num_sqrt != nullptr);
+    assert(cache != nullptr);
+    assert(root  != nullptr);
+    assert(vars  != nullptr);
 
-    *num_node += num_node2 + 1;
-    *num_div   = get_max(*num_div, num_div2);
-    *num_pow   = get_max(*num_pow, num_pow2);
-    *num_sqrt += num_sqrt2 + 1;
+    if (is_hit != nullptr) *is_hit = false;
+
+    size_t         input_size = 0;
+    unsigned char *input      = Tree_serialize(*root, system_vars, sys_size, &input_size);
+    if            (input == nullptr) return nullptr;
+
+    char path[PATH_MAX] = {};
+    snprintf(path, sizeof(path), "%s/%016llx.dtc", cache->dir, cache_hash(input, input_size, vars));
+
+    Tree_node *diff = cache_load(path, input, input_size, vars, root, sys_size);
+
+    if (diff != nullptr)
+    {
+        utimensat(AT_FDCWD, path, nullptr, 0); // the file is used now
+
+        if (is_hit != nullptr) *is_hit = true;
+        log_free(input);
+        return diff;
+    }
+
+    diff = diff_main(root, system_vars, vars);
+    if (diff != nullptr)
+    {
+        Tree_optimize_main(&diff);
+
+        if (cache_store(cache, path, input, input_size, vars, *root, diff, system_vars, sys_size)) cache_evict(cache);
+    }
+
+    log_free(input);
+    return diff;
 }
 
-static bool Tree_cmp(Tree_node *first, Tree_node *second)
+//___________________
+
+/**
+*   @brief FNV-1a of the input and "vars".
+*/
+
+static unsigned long long cache_hash(const unsigned char *input, const size_t input_size, const char *vars)
 {
-    assert(first  != nullptr);
-    assert(second != nullptr);
-    
-    if (Tree_node_cmp(first, second))
+    assert(input != nullptr);
+    assert(vars  != nullptr);
+
+    unsigned long long hash = 14695981039346656037ULL ^ CACHE_VERSION;
+
+    for (size_t i = 0; i < input_size; ++i) hash = (hash ^ input[i])                  * 1099511628211ULL;
+    for (size_t i = 0; vars[i] != '\0'; ++i) hash = (hash ^ (unsigned char) vars[i]) * 1099511628211ULL;
+
+    return hash;
+}
+
+/**
+*   @brief Reads the file of the cache if it is of the same input. The optimized input replaces the tree in "root".
+*
+*   @return the derivative and nullptr if there is no right file
+*/
+
+static Tree_node *cache_load(const char *path, const unsigned char *input, const size_t input_size,
+                                               const char *vars,  Tree_node **root, const int sys_size)
+{
+    assert(path  != nullptr);
+    assert(input != nullptr);
+    assert(vars  != nullptr);
+    assert(root  != nullptr);
+
+    File_map map = {};
+    if (!map_file(path, &map)) return nullptr;
+
+    Bin_reader in = {};
+    in.data       = (const unsigned char *) map.data;
+    in.size       = map.size;
+
+    unsigned long long   version  =  0;
+    const unsigned char *key      = nullptr;
+    size_t               key_size =  0;
+
+    bool is_ok = map.size != 0                                                                                  &&
+                 bin_get_magic (&in, CACHE_MAGIC, sizeof(CACHE_MAGIC))                                          &&
+                 bin_get_varint(&in, &version)             && version == CACHE_VERSION                          &&
+                 cache_get_blob(&in, &key, &key_size)      && key_size == strlen(vars)                          &&
+                                                              memcmp(key, vars, key_size)               == 0    &&
+                 cache_get_blob(&in, &key, &key_size)      && key_size == input_size                            &&
+                                                              memcmp(key, input, input_size)            == 0;
+
+    Tree_node *opt_root = is_ok ? cache_read_tree(&in, sys_size) : nullptr;
+    Tree_node *diff     = (opt_root != nullptr) ? cache_read_tree(&in, sys_size) : nullptr;
+
+    unmap_file(&map);
+
+    if (diff == nullptr)
     {
-        if (first->type == NODE_OP)
-        {
-            if (op(first) == OP_ADD || op(first) == OP_MUL)
-            {
-                if (l(first) != nullptr)
-                {
-                    return  (Tree_cmp(l(first), l(second)) && Tree_cmp(r(first), r(second))) ||
-                            (Tree_cmp(l(first), r(second)) && Tree_cmp(r(first), l(second)));
-                }
-                return true;
-            }
-            return l(first) == nullptr || (Tree_cmp(l(first), l(second)) && Tree_cmp(r(first), r(second)));
-        }
-        return true;
+        if (opt_root != nullptr) Tree_dtor(opt_root);
+        return nullptr;
     }
-    return false;
+
+    Tree_dtor(*root);
+    *root = opt_root;
+
+    return diff;
 }
 
-static bool Tree_node_cmp(Tree_node *first, Tree_node *second)
+/**
+*   @brief Reads the tree of the blob. Its system_vars are the same as the ones of the input,
+*          which are kept by the caller, so only the tree is returned.
+*/
+
+static Tree_node *cache_read_tree(Bin_reader *in, const int sys_size)
 {
-    assert(first  != nullptr);
-    assert(second != nullptr);
+    assert(in != nullptr);
 
-    if (value_cmp(first, second)              &&
-        edge_cmp(l(first), l(second))         &&
-        edge_cmp(r(first), r(second))
-        ) 
-        return true;
+    const unsigned char *data = nullptr;
+    size_t               size = 0;
 
-    return false;
+    if (!cache_get_blob(in, &data, &size)) return nullptr;
+
+    Tree_node **system_vars = (sys_size <= 0) ? nullptr : (Tree_node **) log_calloc((size_t) sys_size, sizeof(Tree_node *));
+    if (sys_size > 0 && system_vars == nullptr) return nullptr;
+
+    Tree_node *root = Tree_deserialize(data, size, system_vars, sys_size);
+
+    for (int i = 0; i < sys_size && system_vars[i] != nullptr; ++i) Tree_dtor(system_vars[i]);
+    log_free(system_vars);
+
+    return root;
 }
 
-static bool edge_cmp(Tree_node *first, Tree_node *second)
+/**
+*   @brief Writes the file of the cache to the temporary file and renames it, so the readers see
+*          either the old file or the whole new one.
+*/
+
+static bool cache_store(const Tree_cache *cache, const char *path,
+                                                 const unsigned char *input, const size_t input_size,
+                                                 const char *vars, const Tree_node *root,
+                                                 const Tree_node *diff,
+                                                 Tree_node *system_vars[], const int sys_size)
 {
-    if (first == nullptr && second == nullptr) return true;
-    if (first != nullptr && second != nullptr) return true;
-    return false;
+    assert(cache != nullptr);
+    assert(path  != nullptr);
+    assert(input != nullptr);
+    assert(vars  != nullptr);
+    assert(root  != nullptr);
+    assert(diff  != nullptr);
+
+    static std::atomic<unsigned> tmp_counter = 0;
+
+    size_t         root_size = 0;
+    size_t         diff_size = 0;
+    unsigned char *root_data = Tree_serialize(root, system_vars, sys_size, &root_size);
+    unsigned char *diff_data = Tree_serialize(diff, system_vars, sys_size, &diff_size);
+
+    Bin_writer out = {};
+    out.is_ok      = root_data != nullptr && diff_data != nullptr;
+
+    bin_put       (&out, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    bin_put_varint(&out, CACHE_VERSION);
+    cache_put_blob(&out, vars     , strlen(vars));
+    cache_put_blob(&out, input    , input_size  );
+    cache_put_blob(&out, root_data, root_size   );
+    cache_put_blob(&out, diff_data, diff_size   );
+
+    log_free(root_data);
+    log_free(diff_data);
+
+    char tmp[PATH_MAX] = {};
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%d.%u", path, getpid(), tmp_counter.fetch_add(1));
+
+    FILE *stream = out.is_ok ? fopen(tmp, "wb") : nullptr;
+    bool  is_ok  = stream != nullptr && fwrite(out.data, sizeof(unsigned char), out.size, stream) == out.size;
+
+    if (stream != nullptr)     is_ok = (fclose(stream) == 0) && is_ok;
+    if (is_ok)                 is_ok = rename(tmp, path) == 0;
+    if (!is_ok && out.is_ok) { unlink(tmp); log_error("Can't write the cache file \"%s\".\n", path); }
+
+    log_free(out.data);
+    return is_ok;
 }
 
-static bool value_cmp(Tree_node *first, Tree_node *second)
+static void cache_put_blob(Bin_writer *out, const void *data, const size_t size)
 {
-    assert(first  != nullptr);
-    assert(second != nullptr);
+    assert(out != nullptr);
 
-    if (first->type != second->type) return false;
+    bin_put_varint(out, size);
+    if (data != nullptr) bin_put(out, data, size);
+}
 
-    switch (first->type)
-    {
-        case NODE_OP : return  op(first) ==  op(second);
-        case NODE_NUM: return approx_equal(dbl(first), dbl(second));
-        case NODE_VAR: return var(first) == var(second);
-        case NODE_SYS: return sys(first) == sys(second);
+static bool cache_get_blob(Bin_reader *in, const unsigned char **data, size_t *const size)
+{
+    assert(in   != nullptr);
+    assert(data != nullptr);
+    assert(size != nullptr);
 
-        default      : assert(false && "default case in value_cmp()\n");
-    }
-    return false;
+    unsigned long long blob_size = 0;
+    if (!bin_get_varint(in, &blob_size) || blob_size > in->size - in->pos) return false;
+
+    *data    = in->data + in->pos;
+    *size    = (size_t) blob_size;
+    in->pos += *size;
+
+    return true;
 }
 
-/*_____________________________________________________________________*/
+/**
+*   @brief Deletes the least recently used files of the cache while the cache is bigger than its limit.
+*/
 
-double Tree_get_value_in_point(Tree_node *node, Tree_node *system_vars[],   const double x_val,
-                                                                            const double y_val,
-                                                                            const double z_val)
+static void cache_evict(const Tree_cache *cache)
 {
-    assert(node != nullptr);
+    assert(cache != nullptr);
 
-    switch (node->type)
+    DIR *dir = opendir(cache->dir);
+    if  (dir == nullptr) return;
+
+    Cache_file *files = nullptr;
+    int         size  = 0;
+    int         cap   = 0;
+    long long   total = 0;
+
+    char path[PATH_MAX] = {};
+
+    for (dirent *cur = readdir(dir); cur != nullptr; cur = readdir(dir))
     {
-        case NODE_NUM: return getDBL;
-        case NODE_VAR: return Tree_get_value_in_var(node, system_vars, x_val, y_val, z_val);
-        case NODE_SYS: return Tree_get_value_in_sys(node, system_vars, x_val, y_val, z_val);
+        size_t len = strlen(cur->d_name);
+        if (len <= 4 || len >= sizeof(files->name) || strcmp(cur->d_name + len - 4, ".dtc") != 0) continue;
 
-        case NODE_OP :  {
-                            double left  = Tree_get_value_in_point(getL, system_vars, x_val, y_val, z_val);
-                            double right = Tree_get_value_in_point(getR, system_vars, x_val, y_val, z_val);
+        struct stat file_stat = {};
 
-                            return Tree_counter(left, right, getOP);
-                        }
-    }
-    return 0;
-}
+        snprintf(path, sizeof(path), "%s/%s", cache->dir, cur->d_name);
+        if (stat(path, &file_stat) == -1) continue;
 
-static double Tree_get_value_in_var(Tree_node *node, Tree_node *system_vars[],  const double x_val,
-                                                                                const double y_val,
-                                                                                const double z_val)
-{
-    assert(node       !=  nullptr);
-    assert(node->type == NODE_VAR);
+        if (size == cap)
+        {
+            cap = (cap == 0) ? 64 : 2 * cap;
 
-    switch (getVAR)
+            Cache_file *grown = (Cache_file *) log_calloc((size_t) cap, sizeof(Cache_file));
+            if         (grown == nullptr) break;
+
+            if (files != nullptr) memcpy(grown, files, (size_t) size * sizeof(Cache_file));
+            log_free(files);
+            files = grown;
+        }
+
+        strcpy(files[size].name, cur->d_name);
+        files[size].mtime = (long long) file_stat.st_mtim.tv_sec * 1000000000LL + file_stat.st_mtim.tv_nsec;
+        files[size].size  = (long long) file_stat.st_size;
+
+        total += files[size++].size;
+    }
+    closedir(dir);
+
+    if (total > cache->max_bytes)
     {
-        case X : return x_val;
-        case Y : return y_val;
-        case Z : return z_val;
+        my_quick_sort(files, sizeof(Cache_file), 0, size - 1, cache_file_cmp);
 
-        case DX:
-        case DY:
-        case DZ: log_error("Can't get value in diff_node.\n");
-                 return 0;
+        for (int i = 0; i < size && total > cache->max_bytes; ++i)
+        {
+            snprintf(path, sizeof(path), "%s/%s", cache->dir, files[i].name);
 
-        default: log_error      ("default case in Tree_get_value_in_var(): gatVar = %d.\n", getVAR);
-                 assert(false && "default case in Tree_get_value_in_var()");
-                 break;
+            if (unlink(path) == 0) total -= files[i].size;
+        }
     }
-    return 0;
+
+    log_free(files);
 }
 
-static double Tree_get_value_in_sys(Tree_node *node, Tree_node *system_vars[],  const double x_val,
-                                                                                const double y_val,
-                                                                                const double z_val)
+static int cache_file_cmp(void *first, void *second)
 {
-    assert(node != nullptr);
-    assert(node->type == NODE_SYS);
+    assert(first  != nullptr);
+    assert(second != nullptr);
 
-    assert(system_vars         != nullptr);
-    assert(system_vars[getSYS] != nullptr);
+    long long first_mtime  = ((Cache_file *) first )->mtime;
+    long long second_mtime = ((Cache_file *) second)->mtime;
 
-    return Tree_get_value_in_point(system_vars[getSYS], system_vars, x_val, y_val, z_val);
+    return (first_mtime > second_mtime) - (first_mtime < second_mtime);
 }
 
 /*_____________________________________________________________________*/
 
+//___________________
+
+#undef  LOG_CATEGORY
+#define LOG_CATEGORY LOG_CAT_DUMP
+
+//___________________
+
 void Tree_dump_graphviz(Tree_node *root)
 {
     log_header  (__PRETTY_FUNCTION__);
@@ -1,6 +1,8 @@
 #ifndef DIFF_H
 #define DIFF_H
 
+#include <stddef.h>
+
 enum TYPE_NODE
 {
     NODE_UNDEF  ,
@@ -29,6 +31,8 @@ enum TYPE_OP
     OP_ATAN     ,
 };
 
+const int OP_NUM = OP_ATAN + 1;
+
 enum VAR
 {
     X       ,
@@ -57,8 +61,66 @@ struct Tree_node
     value;
 };
 
+struct Tree_stats
+{
+    long long   nodes;
+    int         depth;
+    long long   ops[OP_NUM];    // number of nodes of each TYPE_OP
+};
+
+struct Tree_metrics
+{
+    const char *stage;          // "parse", "optimize", "optimize_var", "diff" or "diff_parallel"
+
+    Tree_stats  in;             // zeros for "parse"
+    Tree_stats  out;
+
+    long long   allocs;         // log_calloc() calls of the calling thread, of all threads for "diff_parallel"
+    double      time;           // seconds
+};
+
+struct Tree_stream;             // lazy reader of a file with an expression in each line
+struct Tree_image;              // mapped tree for evaluation without loading
+struct Tree_cache;              // directory of the derivatives computed before
+struct Tree_eval_cache;         // values of the expressions in the points computed before
+struct Tree_tape;               // trees compiled for evaluation without walking the nodes
+struct Tree_solver;             // roots of a function of one variable
+struct Tree_minimizer;          // local minima of a function of x, y and z
+
+struct Tree_batch_line
+{
+    Tree_node  *root;           // nullptr if the line has a syntax error
+    int         line;           // from 1
+    int         col;            // column of the syntax error from 1, 0 if there is no error
+};
+
+struct Tree_batch
+{
+    Tree_batch_line *lines;
+    long long        size;
+};
+
 const double POISON = (double) 0xDEADBEEF;
 
+const int DIFF_PAR_THRESHOLD = 2000; // subtrees of fewer nodes are differentiated without spawning tasks
+
+const long long TREE_CACHE_MAX_BYTES = 1LL << 30; // default limit of the derivative cache directory
+
+const int EVAL_CACHE_CAPACITY = 1 << 16;
+const int EVAL_CACHE_SHARDS   = 16;
+
+const long long ROOT_PARTS = 1024;  // subintervals of Tree_solver_roots()
+
+enum MIN_METHOD
+{
+    MIN_GRADIENT    ,   // gradient descent
+    MIN_LBFGS       ,
+};
+
+const int MIN_MAX_ITER = 1000;
+
+const double QUAD_TOLERANCE = 1e-10; // error of Tree_integrate() relative to the integral of |f|
+
 /*______________________________________FUNCTIONS_______________________________________*/
 
 void        node_op_ctor            (Tree_node *const node, TYPE_OP             value          ,
@@ -86,18 +148,105 @@ Tree_node  *new_node_undef          (                    Tree_node *const prev =
 //--------------------------------------------------------------------------------------------------------------------------
 void        node_dtor               (Tree_node *const node);
 void        Tree_dtor               (Tree_node *const root);
+void        Tree_changed            ();     // call it after changing the nodes by hand, see Tree_verify()
 Tree_node  *tree_copy               (const Tree_node *tree);
 //--------------------------------------------------------------------------------------------------------------------------
 Tree_node  *Tree_parsing_buff       (const char *buff);
 Tree_node  *Tree_parsing_main       (const char *file);
+Tree_stream*Tree_stream_open        (const char *file);
+bool        Tree_stream_next        (Tree_stream *stream, Tree_node **root, int *const line = nullptr,
+                                                                            int *const col  = nullptr);
+void        Tree_stream_close       (Tree_stream *stream);
+long long   Tree_parsing_stream     (const char *file, bool (*callback)(Tree_node *root, int line, void *arg),
+                                                       void  *arg);
+bool        Tree_parsing_batch      (const char *file, Tree_batch *batch, const int threads = 0);
+void        Tree_batch_dtor         (Tree_batch *batch);
 void        Tree_optimize_main      (Tree_node **     root);
 void        Tree_optimize_var_main  (Tree_node **     root, Tree_node *system_vars[], const int sys_size);
 //--------------------------------------------------------------------------------------------------------------------------
 Tree_node  *diff_main               (Tree_node **root, Tree_node *system_vars[], const char *vars = "a");
+Tree_node  *diff_main_parallel      (Tree_node **root, Tree_node *system_vars[], const char *vars      = "a",
+                                                                                 const int   threads   =   0,
+                                                                                 const int   threshold = DIFF_PAR_THRESHOLD);
 bool        Tree_get_bracket_fmt    (Tree_node * root, Tree_node *system_vars[], char *const buff);
 double      Tree_get_value_in_point (Tree_node * node, Tree_node *system_vars[],    const double x_val = 0,
                                                                                     const double y_val = 0,
                                                                                     const double z_val = 0);
+unsigned long long Tree_hash        (const Tree_node *root, Tree_node *system_vars[], const int sys_size);
+Tree_eval_cache   *Tree_eval_cache_new   (const int capacity   = EVAL_CACHE_CAPACITY,
+                                          const int shards_num = EVAL_CACHE_SHARDS);
+void               Tree_eval_cache_delete(Tree_eval_cache *cache);
+double             Tree_get_value_cached (Tree_eval_cache *cache, const unsigned long long expr, Tree_node *node,
+                                                                                                 Tree_node *system_vars[],
+                                          const double x_val = 0, const double y_val = 0, const double z_val = 0);
+void               Tree_eval_cache_stats (Tree_eval_cache *cache, long long *const hits, long long *const misses);
+Tree_tape  *Tree_tape_compile       (Tree_node *roots[], const int roots_num, Tree_node *system_vars[] = nullptr,
+                                                                          const int  sys_size      = 0);
+void        Tree_tape_value         (const Tree_tape *tape, double *const values,   const double x_val = 0,
+                                                                                const double y_val = 0,
+                                                                                const double z_val = 0);
+bool        Tree_tape_values        (const Tree_tape *tape, double *const values, const double *x_vals,
+                                                                              const double *y_vals,
+                                                                              const double *z_vals,
+                                                                              const long long count);
+bool        Tree_tape_values        (const Tree_tape *tape, float  *const values, const float  *x_vals,
+                                                                              const float  *y_vals,
+                                                                              const float  *z_vals,
+                                                                              const long long count);
+bool        Tree_tape_values        (const Tree_tape *tape, long double *const values, const long double *x_vals,
+                                                                                   const long double *y_vals,
+                                                                                   const long double *z_vals,
+                                                                                   const long long   count);
+bool        Tree_tape_range         (const Tree_tape *tape, double *const lo, double *const hi,
+                                                                const double vars_lo[3],
+                                                                const double vars_hi[3]);
+void        Tree_tape_delete        (Tree_tape *tape);
+Tree_solver*Tree_solver_new         (Tree_node **root, Tree_node *system_vars[], const int sys_size,
+                                                       const char   var   = 'x',
+                                                       const double x_val = 0, const double y_val = 0, const double z_val = 0);
+void        Tree_solver_delete      (Tree_solver *solver);
+bool        Tree_solver_root        (const Tree_solver *solver, const double lo, const double hi, double *const root);
+long long   Tree_solver_roots       (const Tree_solver *solver, const double lo, const double hi, double *const roots,
+                                                                const long long roots_size,
+                                                                const long long parts   = ROOT_PARTS,
+                                                                const int       threads = 0);
+Tree_minimizer *Tree_minimizer_new   (Tree_node **root, Tree_node *system_vars[], const int sys_size,
+                                                       const char *vars = "xyz");
+void        Tree_minimizer_delete   (Tree_minimizer *min);
+void        Tree_minimizer_value    (const Tree_minimizer *min, const double point[3], double *const value, double grad[3]);
+bool        Tree_minimize           (const Tree_minimizer *min, double point[3], double *const value,
+                                                                const MIN_METHOD method   = MIN_LBFGS,
+                                                                const int        max_iter = MIN_MAX_ITER);
+bool        Tree_integrate          (Tree_node *root, Tree_node *system_vars[], const int sys_size, const char *vars,
+                                     const double lo[3], const double hi[3], double *const value,
+                                                                             double *const error     = nullptr,
+                                                                             const double  tolerance = QUAD_TOLERANCE,
+                                                                             const int     threads   = 0);
+//--------------------------------------------------------------------------------------------------------------------------
+void        Tree_get_stats          (const Tree_node *root, Tree_stats *stats);
+bool        Tree_metrics_enable     (const char *jsonl_file = nullptr);
+void        Tree_metrics_disable    ();
+bool        Tree_metrics_last       (Tree_metrics *metrics);
+//--------------------------------------------------------------------------------------------------------------------------
+unsigned char *Tree_serialize       (const Tree_node *root, Tree_node *system_vars[], const int sys_size,
+                                                                                      size_t *const size);
+Tree_node  *Tree_deserialize        (const void *data, const size_t size, Tree_node *system_vars[] = nullptr,
+                                                                          const int  sys_size      = 0);
+bool        Tree_save               (const char *file, const Tree_node *root, Tree_node *system_vars[] = nullptr,
+                                                                              const int  sys_size      = 0);
+Tree_node  *Tree_load               (const char *file, Tree_node *system_vars[] = nullptr, const int sys_size = 0);
+bool        Tree_image_save         (const char *file, const Tree_node *root, Tree_node *system_vars[] = nullptr,
+                                                                              const int  sys_size      = 0);
+Tree_image *Tree_image_open         (const char *file);
+double      Tree_image_value        (const Tree_image *image,   const double x_val = 0,
+                                                                const double y_val = 0,
+                                                                const double z_val = 0);
+void        Tree_image_close        (Tree_image *image);
+Tree_cache *Tree_cache_open         (const char *dir, const long long max_bytes = TREE_CACHE_MAX_BYTES);
+void        Tree_cache_close        (Tree_cache *cache);
+Tree_node  *Tree_cache_diff         (Tree_cache *cache, Tree_node **root, Tree_node *system_vars[], const int sys_size,
+                                                                          const char *vars   = "a",
+                                                                          bool *const is_hit = nullptr);
 //--------------------------------------------------------------------------------------------------------------------------
 void        Tree_dump_graphviz      (Tree_node *root);
 void        Tree_dump_txt           (Tree_node *root);
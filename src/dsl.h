@@ -16,8 +16,8 @@
 #define is_left_subtree(node)  node->prev->left  == node
 #define is_right_subtree(node) node->prev->right == node
 
-#define dL(node, system_vars, var, d_mode) diff_execute((node)->left , system_vars, var, d_mode)
-#define dR(node, system_vars, var, d_mode) diff_execute((node)->right, system_vars, var, d_mode)
+#define dL(node, system_vars, var, d_mode, ctx) diff_execute((node)->left , system_vars, var, d_mode, ctx)
+#define dR(node, system_vars, var, d_mode, ctx) diff_execute((node)->right, system_vars, var, d_mode, ctx)
 
 #define cL(node) Tree_copy((node)->left )
 #define cR(node) Tree_copy((node)->right)
@@ -0,0 +1,1240 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "tape.h"
+
+#include "../lib/logs/log.h"
+#include "../lib/task_pool/task_pool.h"
+
+#include "dsl.h"
+
+/*___________________________STATIC_STRUCT_____________________________*/
+
+struct Tree_solver
+{
+    Tree_tape  *tape;       // f, f' and f'' of the variable
+    VAR         var;
+    double      point[3];   // values of x, y and z, the value of the variable itself is not used
+};
+
+const int       ROOT_CHUNKS_PER_THREAD = 4;
+const int       ROOT_MAX_ITER          = 100;
+const double    ROOT_TOLERANCE         = 1e-14;  // relative, the step of the solver is stopped after it
+const long long ROOT_SCAN_PARTS        = 8;      // blocks of so many subintervals are scanned without bounding f
+
+struct Root_chunk
+{
+    Task                task;
+
+    const Tree_solver  *solver;
+    double              lo;
+    double              hi;
+    long long           parts;
+    long long           first;      // subintervals of the chunk
+    long long           last;
+
+    double             *roots;
+    long long           size;
+    long long           cap;
+
+    long long           pruned;     // subintervals where f can't be zero
+    bool                is_ok;
+};
+
+struct Tree_minimizer
+{
+    Tree_tape  *tape;       // f and its derivatives by the variables
+    VAR         vars[3];
+    int         vars_num;
+};
+
+const int    MIN_HISTORY    = 8;        // pairs (s, y) of L-BFGS
+const int    MIN_BACKTRACK  = 60;       // halvings of the step in the line search
+const double MIN_TOLERANCE  = 1e-10;    // the gradient is about zero if its norm is less than it times max(1, |grad|)
+                                        // in the start point, f itself is not used, so a constant in f changes nothing
+const double MIN_ARMIJO     = 1e-4;     // sufficient decrease of f in the line search
+
+struct Min_history  // the last steps s and the changes of the gradient y, the oldest is replaced by the new one
+{
+    double      s  [MIN_HISTORY][3];
+    double      y  [MIN_HISTORY][3];
+    double      rho[MIN_HISTORY];       // 1 / (s, y)
+    int         size;
+    int         next;
+};
+
+const int QUAD_NODES             =   15; // Gauss-Kronrod nodes in each dimension of a box
+const int QUAD_MAX_BOXES         = 4096;
+const int QUAD_SPLITS_PER_THREAD =    2;
+
+struct Quad_box
+{
+    double      lo[3];      // bounds in the integrated variables
+    double      hi[3];
+
+    double      value;
+    double      error;
+    double      abs_value;  // integral of |f|, the tolerance is relative to it
+    int         split;      // the dimension of the largest error, the box is cut in it
+};
+
+struct Quad
+{
+    Tree_tape  *tape;
+    VAR         vars[3];
+    int         dims;
+    double      point[3];   // values of the variables which are not integrated
+};
+
+struct Quad_task
+{
+    Task        task;
+
+    const Quad *quad;
+    Quad_box    parent;
+    Quad_box    children[2];
+
+    Tape_regs   regs;
+    bool        is_ok;
+};
+
+/**
+*   Nodes of the 15-point Kronrod rule on [-1, 1] with the weights of it and of the 7-point Gauss rule,
+*   whose nodes are the odd ones (QUADPACK qk15).
+*/
+
+static const double QUAD_NODE[QUAD_NODES] =
+{
+    -0.991455371120812639206854697526329, -0.949107912342758524526189684047851, -0.864864423359769072789712788640926,
+    -0.741531185599394439863864773280788, -0.586087235467691130294144845693013, -0.405845151377397166906606412076961,
+    -0.207784955007898467600689403773245,  0                                 ,  0.207784955007898467600689403773245,
+     0.405845151377397166906606412076961,  0.586087235467691130294144845693013,  0.741531185599394439863864773280788,
+     0.864864423359769072789712788640926,  0.949107912342758524526189684047851,  0.991455371120812639206854697526329,
+};
+
+static const double QUAD_KRONROD[QUAD_NODES] =
+{
+     0.022935322010529224963732008058970,  0.063092092629978553290700663189204,  0.104790010322250183839876322541518,
+     0.140653259715525918745189590510238,  0.169004726639267902826583426598550,  0.190350578064785409913256402421014,
+     0.204432940075298892414161999234649,  0.209482141084727828012999174891714,  0.204432940075298892414161999234649,
+     0.190350578064785409913256402421014,  0.169004726639267902826583426598550,  0.140653259715525918745189590510238,
+     0.104790010322250183839876322541518,  0.063092092629978553290700663189204,  0.022935322010529224963732008058970,
+};
+
+static const double QUAD_GAUSS[QUAD_NODES] =
+{
+     0,  0.129484966168869693270611432679082,  0,  0.279705391489276667901467771423780,  0,
+         0.381830050505118944950369775488975,  0,  0.417959183673469387755102040816327,  0,
+         0.381830050505118944950369775488975,  0,  0.279705391489276667901467771423780,  0,
+         0.129484966168869693270611432679082,  0,
+};
+
+/*___________________________STATIC_FUNCTION___________________________*/
+
+static void         solver_eval             (const Tree_solver *solver, double *regs, const double t, double *values,
+                                                                                                     const int outs_num);
+static void         solver_range            (const Tree_solver *solver, double *regs, const double t0, const double t1,
+                                                                                      double *range);
+static bool         solver_bracket          (const Tree_solver *solver, double *regs, const int out, double a, double b,
+                                                                                      double fa, const double fb,
+                                                                                      double *const root);
+static void         roots_task              (void *arg);
+static bool         roots_search            (Root_chunk *chunk, double *regs, const long long first, const long long last);
+static bool         roots_scan              (Root_chunk *chunk, double *regs, const long long first, const long long last);
+static bool         roots_push              (Root_chunk *chunk, const double root);
+static double       roots_grid              (const Root_chunk *chunk, const long long index);
+static bool         min_eval                (const Tree_minimizer *min, double *regs, double *point, const double *args,
+                                                                                         double *const f, double *grad);
+static void         min_direction           (const Min_history *history, const double *grad, double *dir, const int n);
+static void         min_history_push        (Min_history *history, const double *s, const double *y, const int n);
+static double       min_backtrack           (const double f, const double slope, const double step, const double f_step);
+static double       min_dot                 (const double *first, const double *second, const int n);
+static bool         quad_rule               (const Quad *quad, double *regs, Quad_box *box);
+static void         quad_split_task         (void *arg);
+static void         quad_heap_push          (Quad_box *heap, int *const size, const Quad_box *box);
+static Quad_box     quad_heap_pop           (Quad_box *heap, int *const size);
+
+/*_____________________________________________________________________*/
+
+/**
+*   The solver finds the roots of f(t), where t is one of x, y and z and the others are fixed. It derives
+*   f' and f'' once and compiles f, f' and f'' in one tape, so a step costs about one evaluation of f.
+*   A step is Halley's one, it is replaced by bisection if it leaves the bracket or doesn't halve the step
+*   before the last one, so the root is never lost. The sign of f changes in a pole too, so the point
+*   where the bracket converges is a root only if |f| in it is less than in the ends of the bracket.
+*/
+
+/**
+*   @brief Differentiates the tree twice by "var" and compiles it with the derivatives.
+*
+*   @param root [in, out] - the tree is optimized as in diff_main()
+*
+*   @return the solver, free it by Tree_solver_delete(), and nullptr in case of error
+*/
+
+Tree_solver *Tree_solver_new(Tree_node **root, Tree_node *system_vars[], const int sys_size, const char var,
+                             const double x_val, const double y_val, const double z_val)
+{
+    assert(root != nullptr);
+
+    const char *vars = var_string(var);
+    if         (vars == nullptr)
+    {
+        log_error("Undefined variable of the solver: \'%c\'.\n", var);
+        return nullptr;
+    }
+
+    Tree_node *diff_1 = diff_main(root, system_vars, vars);
+    if (diff_1 != nullptr) Tree_optimize_main(&diff_1);
+
+    Tree_node *diff_2 = (diff_1 == nullptr) ? nullptr : diff_main(&diff_1, system_vars, vars);
+    if (diff_2 == nullptr)
+    {
+        if (diff_1 != nullptr) Tree_dtor(diff_1);
+        return nullptr;
+    }
+    Tree_optimize_main(&diff_2);
+
+    Tree_node *funcs[3] = {*root, diff_1, diff_2};
+
+    Tree_solver *solver = (Tree_solver *) log_calloc(1, sizeof(Tree_solver));
+    Tree_tape   *tape   = Tree_tape_compile(funcs, 3, system_vars, sys_size);
+
+    Tree_dtor(diff_1);
+    Tree_dtor(diff_2);
+
+    if (solver == nullptr || tape == nullptr)
+    {
+        log_free        (solver);
+        Tree_tape_delete(tape);
+        return nullptr;
+    }
+
+    solver->tape     = tape;
+    solver->var      = (VAR) (var - 'x');
+    solver->point[0] = x_val;
+    solver->point[1] = y_val;
+    solver->point[2] = z_val;
+
+    return solver;
+}
+
+void Tree_solver_delete(Tree_solver *solver)
+{
+    if (solver == nullptr) return;
+
+    Tree_tape_delete(solver->tape);
+    log_free        (solver);
+}
+
+/**
+*   @brief Finds a root in [lo, hi], the values of f in the ends must be of different signs or zero.
+*
+*   @return false if the root is not bracketed, f is not finite in the ends or the bracket contains a pole
+*/
+
+bool Tree_solver_root(const Tree_solver *solver, const double lo, const double hi, double *const root)
+{
+    assert(solver != nullptr);
+    assert(root   != nullptr);
+
+    Tape_regs regs = {};
+    if (!tape_regs_ctor(&regs, solver->tape, 1)) return false;
+
+    double f_lo = 0;
+    double f_hi = 0;
+
+    solver_eval(solver, regs.data, lo, &f_lo, 1);
+    solver_eval(solver, regs.data, hi, &f_hi, 1);
+
+    bool is_ok = true;
+
+    if      (fpclassify(f_lo) == FP_ZERO) *root = lo;
+    else if (fpclassify(f_hi) == FP_ZERO) *root = hi;
+    else if (!isfinite(f_lo) || !isfinite(f_hi) || signbit(f_lo) == signbit(f_hi)) is_ok = false;
+    else is_ok = solver_bracket(solver, regs.data, 0, lo, hi, f_lo, f_hi, root);
+
+    tape_regs_dtor(&regs);
+    return is_ok;
+}
+
+/**
+*   @brief Finds the roots in [lo, hi]. The interval is cut in "parts" subintervals, which are searched in
+*          parallel. A subinterval gives a root if f changes its sign in it, or if f' changes its sign and
+*          f is about zero in the extremum (the roots of even multiplicity). Two roots closer than a
+*          subinterval may be missed. The blocks of the subintervals where the range of f by Tree_tape_range()
+*          doesn't contain zero are skipped without evaluating f in them.
+*
+*   @param roots [out] - the roots in ascending order, not more than "roots_size" of them
+*
+*   @return number of the roots, it may be more than "roots_size", and -1 in case of error
+*/
+
+long long Tree_solver_roots(const Tree_solver *solver, const double lo, const double hi, double *const roots,
+                            const long long roots_size, const long long parts, const int threads)
+{
+    assert(solver != nullptr);
+    assert(roots  != nullptr || roots_size == 0);
+
+    log_header(__PRETTY_FUNCTION__);
+
+    if (!(lo <= hi) || parts <= 0)
+    {
+        log_error     ("Wrong interval [%lg, %lg] or parts = %lld.\n", lo, hi, parts);
+        log_end_header();
+        return -1;
+    }
+
+    if (!(lo < hi))
+    {
+        double root = lo;
+        bool   is_root = Tree_solver_root(solver, lo, hi, &root);
+
+        if (is_root && roots_size > 0) roots[0] = root;
+
+        log_end_header();
+        return is_root ? 1 : 0;
+    }
+
+    Task_pool  *pool   = (parts == 1) ? nullptr : task_pool_new(threads);
+    long long   chunks = (pool  == nullptr) ? 1 : task_pool_size(pool) * ROOT_CHUNKS_PER_THREAD;
+    if (chunks > parts) chunks = parts;
+
+    Root_chunk *chunk  = (Root_chunk *) log_calloc((size_t) chunks, sizeof(Root_chunk));
+    long long   found  = (chunk == nullptr) ? -1 : 0;
+
+    for (long long i = 0; found == 0 && i < chunks; ++i)
+    {
+        chunk[i].solver = solver;
+        chunk[i].lo     = lo;
+        chunk[i].hi     = hi;
+        chunk[i].parts  = parts;
+        chunk[i].first  = parts *  i      / chunks;
+        chunk[i].last   = parts * (i + 1) / chunks;
+
+        if (pool == nullptr) roots_task(chunk + i);
+        else                 task_spawn(pool, &chunk[i].task, roots_task, chunk + i);
+    }
+
+    for (long long i = 0; found >= 0 && i < chunks; ++i)
+    {
+        if (pool != nullptr) task_wait(pool, &chunk[i].task);
+
+        if (!chunk[i].is_ok) found = -1;
+    }
+
+    long long pruned = 0;
+
+    for (long long i = 0; found >= 0 && i < chunks; ++i)
+    {
+        pruned += chunk[i].pruned;
+
+        for (long long j = 0; j < chunk[i].size; ++j, ++found)
+        {
+            if (found < roots_size) roots[found] = chunk[i].roots[j];
+        }
+    }
+
+    for (long long i = 0; chunk != nullptr && i < chunks; ++i) log_free(chunk[i].roots);
+
+    log_free        (chunk);
+    task_pool_delete(pool);
+
+    if (found < 0) log_error  ("Can't find the roots.\n");
+    else           log_message("roots = %lld, parts = %lld, chunks = %lld, pruned = %lld.\n", found, parts, chunks,
+                                                                                                   pruned);
+
+    log_end_header();
+    return found;
+}
+
+//___________________
+
+/**
+*   @brief Evaluates f, f', ... in the point of the solver with the variable equal to "t".
+*/
+
+static void solver_eval(const Tree_solver *solver, double *regs, const double t, double *values, const int outs_num)
+{
+    assert(solver != nullptr);
+
+    double point[3] = {solver->point[0], solver->point[1], solver->point[2]};
+    point[solver->var] = t;
+
+    tape_run(solver->tape, regs, values, outs_num, point[0], point[1], point[2]);
+}
+
+/**
+*   @brief Bounds f in the point of the solver with the variable in [t0, t1], see Tree_tape_range().
+*
+*   @param regs  [in]  - registers of the tape of the width 2
+*   @param range [out] - the lower and the upper bounds
+*/
+
+static void solver_range(const Tree_solver *solver, double *regs, const double t0, const double t1, double *range)
+{
+    assert(solver != nullptr);
+    assert(range  != nullptr);
+
+    double lo[3] = {solver->point[0], solver->point[1], solver->point[2]};
+    double hi[3] = {solver->point[0], solver->point[1], solver->point[2]};
+
+    lo[solver->var] = t0;
+    hi[solver->var] = t1;
+
+    tape_run_range(solver->tape, regs, range, range + 1, 1, lo, hi);
+}
+
+/**
+*   @brief Finds the root of the output "out" of the tape in [a, b], where the output is not zero and of
+*          different signs in the ends. The next outputs are its derivatives: Halley's step is used if there
+*          are two of them and Newton's one if there is one.
+*
+*   @return false if the output is not finite or doesn't decrease in the point where the bracket converges,
+*           so it is a pole, not a root
+*/
+
+static bool solver_bracket(const Tree_solver *solver, double *regs, const int out, double a, double b,
+                                                                                   double fa, const double fb,
+                                                                                   double *const root)
+{
+    assert(solver != nullptr);
+    assert(root   != nullptr);
+    assert(out + 1 < solver->tape->outs_num);
+
+    int    outs_num = (out + 3 < solver->tape->outs_num) ? out + 3 : solver->tape->outs_num;
+    double f_max    = fmin(fabs(fa), fabs(fb)); // |f| in the root must not be more than in the ends
+
+    double x        = a + (b - a) / 2;
+    double step     = b - a;
+    double step_old = step;
+
+    for (int iter = 0; iter < ROOT_MAX_ITER; ++iter)
+    {
+        double values[3] = {};
+        solver_eval(solver, regs, x, values, outs_num);
+
+        double f  = values[out];
+        double f1 = values[out + 1];
+
+        if (fpclassify(f) == FP_ZERO)
+        {
+            *root = x;
+            return true;
+        }
+        if (!isfinite(f)) return false;
+
+        if (signbit(f) == signbit(fa))
+        {
+            a  = x;
+            fa = f;
+        }
+        else b = x;
+
+        double next_step = NAN; // bisection
+        double denom     = (out + 2 < outs_num) ? 2 * f1 * f1 - f * values[out + 2] : 0;
+
+        if      (fpclassify(denom) != FP_ZERO && isfinite(denom)) next_step = 2 * f * f1 / denom;
+        else if (fpclassify(f1   ) != FP_ZERO)                    next_step = f / f1;
+
+        double next = x - next_step;
+        if (fabs(next_step) <= ROOT_TOLERANCE * fabs(x)) // the step may be less than the distance to the next double
+        {
+            if (next >= a && next <= b) x = next;
+            break;
+        }
+        if (!(next > a && next < b) || fabs(next_step) * 2 > fabs(step_old))
+        {
+            next      = a + (b - a) / 2;
+            next_step = x - next;
+        }
+
+        step_old = step;
+        step     = next_step;
+        x        = next;
+    }
+
+    double values[3] = {};
+    solver_eval(solver, regs, x, values, out + 1);
+
+    if (!(fabs(values[out]) <= f_max)) return false;
+
+    *root = x;
+    return true;
+}
+
+static void roots_task(void *arg)
+{
+    assert(arg != nullptr);
+
+    Root_chunk *chunk = (Root_chunk *) arg;
+
+    Tape_regs regs = {};
+    if (!tape_regs_ctor(&regs, chunk->solver->tape, 2)) return; // for the ranges and the points
+
+    chunk->is_ok = roots_search(chunk, regs.data, chunk->first, chunk->last);
+
+    tape_regs_dtor(&regs);
+}
+
+/**
+*   @brief Finds the roots in the subintervals [first, last) of the grid. The block is skipped if the range
+*          of f in it shows that f is not about zero there, otherwise it is halved until it is small enough
+*          to be scanned.
+*/
+
+static bool roots_search(Root_chunk *chunk, double *regs, const long long first, const long long last)
+{
+    assert(chunk != nullptr);
+    assert(regs  != nullptr);
+
+    if (last - first <= ROOT_SCAN_PARTS) return roots_scan(chunk, regs, first, last);
+
+    double range[2] = {};
+    solver_range(chunk->solver, regs, roots_grid(chunk, first), roots_grid(chunk, last), range);
+
+    // roots_scan() takes the root of even multiplicity, where |f| <= ROOT_TOLERANCE * (|f(t0)| + |f(t1)|)
+    bool is_nan      = isnan(range[0]);
+    bool is_positive =  range[0] > 2 * ROOT_TOLERANCE *   range[1];
+    bool is_negative = -range[1] > 2 * ROOT_TOLERANCE * (-range[0]);
+
+    if (is_nan || is_positive || is_negative)
+    {
+        chunk->pruned += last - first;
+        return true;
+    }
+
+    long long middle = first + (last - first) / 2;
+
+    return roots_search(chunk, regs, first, middle) && roots_search(chunk, regs, middle, last);
+}
+
+/**
+*   @brief Finds the roots in the subintervals [first, last) of the grid by the signs of f and f' in their ends.
+*/
+
+static bool roots_scan(Root_chunk *chunk, double *regs, const long long first, const long long last)
+{
+    assert(chunk != nullptr);
+    assert(regs  != nullptr);
+
+    const Tree_solver *solver = chunk->solver;
+
+    bool is_ok = true;
+
+    double t0     = roots_grid(chunk, first);
+    double f0[2]  = {};
+    solver_eval(solver, regs, t0, f0, 2);
+
+    for (long long i = first; is_ok && i < last; ++i)
+    {
+        double t1     = roots_grid(chunk, i + 1);
+        double f1[2]  = {};
+        solver_eval(solver, regs, t1, f1, 2);
+
+        double root       = 0;
+        bool   is_nonzero = isfinite(f0[0]) && isfinite(f1[0]) && fpclassify(f1[0]) != FP_ZERO; // f0 is checked first
+        bool   is_extreme = isfinite(f0[1]) && isfinite(f1[1]) && fpclassify(f0[1]) != FP_ZERO &&
+                                                                  fpclassify(f1[1]) != FP_ZERO &&
+                                                                  signbit(f0[1]) != signbit(f1[1]);
+
+        if (fpclassify(f0[0]) == FP_ZERO) is_ok = roots_push(chunk, t0);
+
+        else if (is_nonzero && signbit(f0[0]) != signbit(f1[0]))
+        {
+            if (solver_bracket(solver, regs, 0, t0, t1, f0[0], f1[0], &root)) is_ok = roots_push(chunk, root);
+        }
+        else if (is_nonzero && is_extreme)
+        {
+            double f_root = 0;
+            if (solver_bracket(solver, regs, 1, t0, t1, f0[1], f1[1], &root))
+            {
+                solver_eval(solver, regs, root, &f_root, 1);
+
+                if (fabs(f_root) <= ROOT_TOLERANCE * (fabs(f0[0]) + fabs(f1[0]))) is_ok = roots_push(chunk, root);
+            }
+        }
+
+        t0    = t1;
+        f0[0] = f1[0];
+        f0[1] = f1[1];
+    }
+
+    if (is_ok && last == chunk->parts && fpclassify(f0[0]) == FP_ZERO) is_ok = roots_push(chunk, t0);
+
+    return is_ok;
+}
+
+static bool roots_push(Root_chunk *chunk, const double root)
+{
+    assert(chunk != nullptr);
+
+    if (chunk->size == chunk->cap)
+    {
+        long long cap   = (chunk->cap == 0) ? 16 : chunk->cap * 2;
+        double   *roots = (double *) log_calloc((size_t) cap, sizeof(double));
+        if       (roots == nullptr) return false;
+
+        if (chunk->size != 0) memcpy(roots, chunk->roots, (size_t) chunk->size * sizeof(double));
+        log_free(chunk->roots);
+
+        chunk->roots = roots;
+        chunk->cap   = cap;
+    }
+
+    chunk->roots[chunk->size++] = root;
+    return true;
+}
+
+/**
+*   @brief The end of the subintervals "index - 1" and the beginning of "index". It is computed in the same
+*          way by both chunks, which share it.
+*/
+
+static double roots_grid(const Root_chunk *chunk, const long long index)
+{
+    assert(chunk != nullptr);
+
+    if (index == chunk->parts) return chunk->hi;
+
+    return chunk->lo + (chunk->hi - chunk->lo) * ((double) index / (double) chunk->parts);
+}
+
+/*_____________________________________________________________________*/
+
+/**
+*   The minimizer finds a local minimum of f by some of x, y and z, the others are fixed. It derives f by each
+*   variable once and compiles f with its gradient in one tape, so f and the gradient in a point are one run
+*   of the tape instead of the walks of four trees.
+*
+*   Each iteration goes along the antigradient (MIN_GRADIENT) or the L-BFGS direction (MIN_LBFGS) with the
+*   backtracking line search, which halves the step until f decreases enough (the Armijo condition).
+*/
+
+/**
+*   @brief Differentiates the tree by the variables and compiles it with the derivatives.
+*
+*   @param root [in, out] - the tree is optimized as in diff_main()
+*   @param vars [in]      - the variables of the minimum, some of "xyz" without repetitions
+*
+*   @return the minimizer, free it by Tree_minimizer_delete(), and nullptr in case of error
+*/
+
+Tree_minimizer *Tree_minimizer_new(Tree_node **root, Tree_node *system_vars[], const int sys_size, const char *vars)
+{
+    assert(root != nullptr);
+    assert(vars != nullptr);
+
+    int vars_num = (int) strlen(vars);
+
+    bool is_ok = vars_num >= 1 && vars_num <= 3;
+    for (int i = 0; is_ok && i < vars_num; ++i)
+    {
+        is_ok = is_char_var(vars[i]) && strchr(vars + i + 1, vars[i]) == nullptr;
+    }
+    if (!is_ok)
+    {
+        log_error("Undefined variables of the minimizer: \"%s\".\n", vars);
+        return nullptr;
+    }
+
+    Tree_node *funcs[4] = {};
+
+    for (int i = 0; is_ok && i < vars_num; ++i)
+    {
+        funcs[i + 1] = diff_main(root, system_vars, var_string(vars[i]));
+        is_ok        = funcs[i + 1] != nullptr;
+
+        if (is_ok) Tree_optimize_main(funcs + i + 1);
+    }
+
+    funcs[0] = *root;
+
+    Tree_minimizer *min  = (Tree_minimizer *) log_calloc(1, sizeof(Tree_minimizer));
+    Tree_tape      *tape = is_ok ? Tree_tape_compile(funcs, vars_num + 1, system_vars, sys_size) : nullptr;
+
+    for (int i = 1; i <= vars_num; ++i)
+    {
+        if (funcs[i] != nullptr) Tree_dtor(funcs[i]);
+    }
+
+    if (min == nullptr || tape == nullptr)
+    {
+        log_free        (min);
+        Tree_tape_delete(tape);
+        return nullptr;
+    }
+
+    min->tape     = tape;
+    min->vars_num = vars_num;
+    for (int i = 0; i < vars_num; ++i) min->vars[i] = (VAR) (vars[i] - 'x');
+
+    return min;
+}
+
+void Tree_minimizer_delete(Tree_minimizer *min)
+{
+    if (min == nullptr) return;
+
+    Tree_tape_delete(min->tape);
+    log_free        (min);
+}
+
+/**
+*   @brief Evaluates f and its gradient in the point by one run of the tape.
+*
+*   @param point [in]  - values of x, y and z
+*   @param grad  [out] - derivatives by x, y and z, zeros for the variables which are not minimized
+*/
+
+void Tree_minimizer_value(const Tree_minimizer *min, const double point[3], double *const value, double grad[3])
+{
+    assert(min   != nullptr);
+    assert(point != nullptr);
+    assert(value != nullptr);
+    assert(grad  != nullptr);
+
+    double values[4] = {NAN, NAN, NAN, NAN};
+
+    Tape_regs regs = {};
+    if (tape_regs_ctor(&regs, min->tape, 1))
+    {
+        tape_run      (min->tape, regs.data, values, min->tape->outs_num, point[0], point[1], point[2]);
+        tape_regs_dtor(&regs);
+    }
+
+    *value  = values[0];
+    grad[0] = grad[1] = grad[2] = 0;
+
+    for (int i = 0; i < min->vars_num; ++i) grad[min->vars[i]] = values[i + 1];
+}
+
+/**
+*   @brief Goes from the point to a local minimum.
+*
+*   @param point [in, out] - values of x, y and z, the last point is written even if the minimum is not reached
+*   @param value [out]     - f in the point
+*
+*   @return true if the gradient is about zero in the point, false if the minimum is not reached in "max_iter"
+*           iterations, f is not finite or f doesn't decrease along the direction
+*/
+
+bool Tree_minimize(const Tree_minimizer *min, double point[3], double *const value, const MIN_METHOD method,
+                                                                                    const int        max_iter)
+{
+    assert(min   != nullptr);
+    assert(point != nullptr);
+    assert(value != nullptr);
+
+    log_header(__PRETTY_FUNCTION__);
+
+    Tape_regs regs = {};
+    if (!tape_regs_ctor(&regs, min->tape, 1))
+    {
+        log_end_header();
+        return false;
+    }
+
+    int n = min->vars_num;
+
+    double args[3] = {};
+    double grad[3] = {};
+    double f       = 0;
+
+    for (int i = 0; i < n; ++i) args[i] = point[min->vars[i]];
+
+    Min_history history = {};
+
+    bool   is_min = false;
+    bool   is_ok  = min_eval(min, regs.data, point, args, &f, grad);
+    double step   = 1;
+    int    iter   = 0;
+
+    double grad_max = is_ok ? fmax(1, sqrt(min_dot(grad, grad, n))) : 1;
+
+    for (; is_ok && iter < max_iter; ++iter)
+    {
+        double grad_norm = sqrt(min_dot(grad, grad, n));
+        if (grad_norm <= MIN_TOLERANCE * grad_max)
+        {
+            is_min = true;
+            break;
+        }
+
+        double dir[3] = {};
+        if (method == MIN_LBFGS) min_direction(&history, grad, dir, n);
+        else for (int i = 0; i < n; ++i) dir[i] = -grad[i];
+
+        double slope = min_dot(grad, dir, n);
+        if (!(slope < 0))           // the history doesn't give a descent direction
+        {
+            history.size = 0;
+            for (int i = 0; i < n; ++i) dir[i] = -grad[i];
+            slope = -grad_norm * grad_norm;
+        }
+
+        if (method == MIN_LBFGS && history.size > 0) step = 1;  // the direction is scaled by the history
+        else if (iter == 0)                          step = 1 / grad_norm;
+
+        double args_new[3] = {};
+        double grad_new[3] = {};
+        double f_new       = 0;
+        bool   is_descent  = false;
+
+        for (int k = 0; !is_descent && k < MIN_BACKTRACK; ++k)
+        {
+            for (int i = 0; i < n; ++i) args_new[i] = args[i] + step * dir[i];
+
+            bool is_finite = min_eval(min, regs.data, point, args_new, &f_new, grad_new);
+            is_descent     = is_finite && f_new <= f + MIN_ARMIJO * step * slope;
+
+            if (!is_descent) step = is_finite ? min_backtrack(f, slope, step, f_new) : step / 2;
+        }
+        if (!is_descent) break;
+
+        double s[3] = {};
+        double y[3] = {};
+
+        for (int i = 0; i < n; ++i)
+        {
+            s[i] = args_new[i] - args[i];
+            y[i] = grad_new[i] - grad[i];
+
+            args[i] = args_new[i];
+            grad[i] = grad_new[i];
+        }
+
+        if (method == MIN_LBFGS) min_history_push(&history, s, y, n);
+        else                     step *= 2;     // the next step may be longer than the accepted one
+
+        f = f_new;
+    }
+
+    for (int i = 0; i < n; ++i) point[min->vars[i]] = args[i];
+    *value = f;
+
+    tape_regs_dtor(&regs);
+
+    log_message("iterations = %d, f = %lg, is_min = %d.\n", iter, f, is_min);
+    log_end_header();
+
+    return is_min;
+}
+
+//___________________
+
+/**
+*   @brief Evaluates f and the gradient by the minimized variables, the others are taken from "point".
+*
+*   @return false if f is not finite
+*/
+
+static bool min_eval(const Tree_minimizer *min, double *regs, double *point, const double *args,
+                                                                  double *const f, double *grad)
+{
+    assert(min   != nullptr);
+    assert(point != nullptr);
+    assert(args  != nullptr);
+    assert(f     != nullptr);
+    assert(grad  != nullptr);
+
+    double values[4] = {};
+    double vars  [3] = {point[0], point[1], point[2]};
+
+    for (int i = 0; i < min->vars_num; ++i) vars[min->vars[i]] = args[i];
+
+    tape_run(min->tape, regs, values, min->tape->outs_num, vars[0], vars[1], vars[2]);
+
+    *f = values[0];
+    for (int i = 0; i < min->vars_num; ++i) grad[i] = values[i + 1];
+
+    return isfinite(*f);
+}
+
+/**
+*   @brief L-BFGS direction -H * grad by the two-loop recursion, where H is the inverse Hessian approximated
+*          by the history. It is the antigradient if the history is empty.
+*/
+
+static void min_direction(const Min_history *history, const double *grad, double *dir, const int n)
+{
+    assert(history != nullptr);
+    assert(grad    != nullptr);
+    assert(dir     != nullptr);
+
+    double alpha[MIN_HISTORY] = {};
+
+    for (int i = 0; i < n; ++i) dir[i] = grad[i];
+
+    for (int j = 0; j < history->size; ++j)     // from the newest pair
+    {
+        int k    = (history->next - 1 - j + MIN_HISTORY) % MIN_HISTORY;
+        alpha[j] = history->rho[k] * min_dot(history->s[k], dir, n);
+
+        for (int i = 0; i < n; ++i) dir[i] -= alpha[j] * history->y[k][i];
+    }
+
+    if (history->size > 0)
+    {
+        int    k     = (history->next - 1 + MIN_HISTORY) % MIN_HISTORY;
+        double gamma = 1 / (history->rho[k] * min_dot(history->y[k], history->y[k], n));
+
+        for (int i = 0; i < n; ++i) dir[i] *= gamma;
+    }
+
+    for (int j = history->size - 1; j >= 0; --j) // from the oldest pair
+    {
+        int    k    = (history->next - 1 - j + MIN_HISTORY) % MIN_HISTORY;
+        double beta = history->rho[k] * min_dot(history->y[k], dir, n);
+
+        for (int i = 0; i < n; ++i) dir[i] += (alpha[j] - beta) * history->s[k][i];
+    }
+
+    for (int i = 0; i < n; ++i) dir[i] = -dir[i];
+}
+
+/**
+*   @brief Keeps the pair if (s, y) > 0, otherwise the approximation of the Hessian would not be positive.
+*/
+
+static void min_history_push(Min_history *history, const double *s, const double *y, const int n)
+{
+    assert(history != nullptr);
+    assert(s       != nullptr);
+    assert(y       != nullptr);
+
+    double sy = min_dot(s, y, n);
+    if (!(sy > 0) || !isfinite(sy)) return;
+
+    int k = history->next;
+    for (int i = 0; i < n; ++i)
+    {
+        history->s[k][i] = s[i];
+        history->y[k][i] = y[i];
+    }
+    history->rho[k] = 1 / sy;
+
+    history->next = (k + 1) % MIN_HISTORY;
+    if (history->size < MIN_HISTORY) history->size += 1;
+}
+
+/**
+*   @brief The next step of the line search: the minimum of the parabola by f and the slope in 0 and f in "step",
+*          but not less than a tenth and not more than a half of the step. Halving alone lets the descent
+*          jump over the minimum from one side of it to the other, because such steps decrease f enough.
+*/
+
+static double min_backtrack(const double f, const double slope, const double step, const double f_step)
+{
+    double curv = 2 * (f_step - f - slope * step); // positive, because f_step is greater than f + slope * step
+    double next = (curv > 0) ? -slope * step * step / curv : step / 2;
+
+    return fmin(fmax(next, step / 10), step / 2);
+}
+
+static double min_dot(const double *first, const double *second, const int n)
+{
+    assert(first  != nullptr);
+    assert(second != nullptr);
+
+    double dot = 0;
+    for (int i = 0; i < n; ++i) dot += first[i] * second[i];
+
+    return dot;
+}
+
+/*_____________________________________________________________________*/
+
+/**
+*   The integral over a box of one, two or three of x, y and z is computed by the tensor product of the
+*   Gauss-Kronrod rule: 15 nodes in each dimension. The Gauss rule is nested in it, and the difference
+*   of the rules estimates the error. The box of the largest error is cut in two in the dimension where
+*   the Gauss rule alone differs the most, until the error is less than the tolerance.
+*
+*   The nodes of a box are evaluated by tape_run_batch(). Each round cuts the boxes of the largest errors
+*   in parallel, one box for a task of the pool.
+*/
+
+/**
+*   @brief Integrates the tree over the box.
+*
+*   @param vars      [in]  - the variables of the integral, some of "xyz" without repetitions
+*   @param lo        [in]  - lower bounds of x, y and z, the values of the variables which are not integrated
+*   @param hi        [in]  - upper bounds of x, y and z
+*   @param error     [out] - estimate of the absolute error
+*   @param tolerance [in]  - of the error relative to the integral of |f|
+*
+*   @return false if the tolerance is not reached in QUAD_MAX_BOXES boxes or f is not finite in a node
+*/
+
+bool Tree_integrate(Tree_node *root, Tree_node *system_vars[], const int sys_size, const char *vars,
+                    const double lo[3], const double hi[3], double *const value, double *const error,
+                    const double tolerance, const int threads)
+{
+    assert(root  != nullptr);
+    assert(vars  != nullptr);
+    assert(lo    != nullptr);
+    assert(hi    != nullptr);
+    assert(value != nullptr);
+
+    log_header(__PRETTY_FUNCTION__);
+
+    Quad quad = {};
+    quad.dims = (int) strlen(vars);
+
+    bool is_ok = quad.dims >= 1 && quad.dims <= 3;
+    for (int i = 0; is_ok && i < quad.dims; ++i)
+    {
+        is_ok = is_char_var(vars[i]) && strchr(vars + i + 1, vars[i]) == nullptr;
+    }
+    if (!is_ok)
+    {
+        log_error     ("Undefined variables of the integral: \"%s\".\n", vars);
+        log_end_header();
+        return false;
+    }
+
+    for (int i = 0; i < 3;         ++i) quad.point[i] = lo[i];
+    for (int i = 0; i < quad.dims; ++i) quad.vars [i] = (VAR) (vars[i] - 'x');
+
+    quad.tape = Tree_tape_compile(&root, 1, system_vars, sys_size);
+
+    Task_pool *pool   = (quad.tape == nullptr) ? nullptr : task_pool_new(threads);
+    int        splits = (pool == nullptr) ? 1 : task_pool_size(pool) * QUAD_SPLITS_PER_THREAD;
+
+    Quad_task *task   = (Quad_task *) log_calloc((size_t) splits   , sizeof(Quad_task));
+    Quad_box  *heap   = (Quad_box  *) log_calloc(QUAD_MAX_BOXES    , sizeof(Quad_box ));
+    int        size   = 0;
+
+    is_ok = quad.tape != nullptr && task != nullptr && heap != nullptr;
+
+    for (int i = 0; is_ok && i < splits; ++i)
+    {
+        task[i].quad = &quad;
+        is_ok        = tape_regs_ctor(&task[i].regs, quad.tape, TAPE_BATCH);
+    }
+
+    Quad_box box = {};
+    for (int i = 0; i < quad.dims; ++i)
+    {
+        box.lo[i] = lo[quad.vars[i]];
+        box.hi[i] = hi[quad.vars[i]];
+    }
+
+    if (is_ok) is_ok = quad_rule(&quad, task[0].regs.data, &box);
+    if (is_ok) quad_heap_push(heap, &size, &box);
+
+    bool   is_done   = false;
+    double sum       = 0;
+    double sum_error = 0;
+
+    while (is_ok)
+    {
+        double sum_abs = 0;
+
+        sum       = 0;
+        sum_error = 0;
+
+        for (int i = 0; i < size; ++i)
+        {
+            sum       += heap[i].value;
+            sum_error += heap[i].error;
+            sum_abs   += heap[i].abs_value;
+        }
+
+        is_done = sum_error <= tolerance * sum_abs;
+        if (is_done || size + splits > QUAD_MAX_BOXES) break;
+
+        int cut = (splits < size) ? splits : size;
+        for (int i = 0; i < cut; ++i) task[i].parent = quad_heap_pop(heap, &size);
+
+        if (pool == nullptr) quad_split_task(task);
+        else
+        {
+            for (int i = 0; i < cut; ++i) task_spawn(pool, &task[i].task, quad_split_task, task + i);
+            for (int i = 0; i < cut; ++i) task_wait (pool, &task[i].task);
+        }
+
+        for (int i = 0; is_ok && i < cut; ++i)
+        {
+            is_ok = task[i].is_ok;
+
+            quad_heap_push(heap, &size, task[i].children    );
+            quad_heap_push(heap, &size, task[i].children + 1);
+        }
+    }
+
+    *value = is_ok ? sum : NAN;
+    if (error != nullptr) *error = is_ok ? sum_error : NAN;
+
+    for (int i = 0; task != nullptr && i < splits; ++i)
+    {
+        if (task[i].regs.data != nullptr) tape_regs_dtor(&task[i].regs);
+    }
+
+    log_free        (heap);
+    log_free        (task);
+    task_pool_delete(pool);
+    Tree_tape_delete(quad.tape);
+
+    if (!is_ok) log_error  ("Can't integrate the function.\n");
+    else        log_message("boxes = %d, value = %lg, error = %lg, is_done = %d.\n", size, sum, sum_error, is_done);
+
+    log_end_header();
+    return is_ok && is_done;
+}
+
+//___________________
+
+/**
+*   @brief Applies the Gauss-Kronrod rule to the box, its bounds are given.
+*
+*   @return false if f is not finite in a node
+*/
+
+static bool quad_rule(const Quad *quad, double *regs, Quad_box *box)
+{
+    assert(quad != nullptr);
+    assert(regs != nullptr);
+    assert(box  != nullptr);
+
+    int points = 1;
+    for (int i = 0; i < quad->dims; ++i) points *= QUAD_NODES;
+
+    double mid [3] = {};
+    double half[3] = {};
+    double vol     = 1;
+
+    for (int i = 0; i < quad->dims; ++i)
+    {
+        mid [i] = (box->lo[i] + box->hi[i]) / 2;
+        half[i] = (box->hi[i] - box->lo[i]) / 2;
+        vol    *= half[i];
+    }
+
+    double coords[3][TAPE_BATCH] = {};
+    double vals     [TAPE_BATCH] = {};
+    int    nodes [TAPE_BATCH][3] = {};
+
+    double sum_kronrod   = 0;
+    double sum_gauss     = 0;
+    double sum_abs       = 0;
+    double sum_split [3] = {};  // the Gauss rule in the dimension and the Kronrod one in the others
+
+    for (int first = 0; first < points; first += TAPE_BATCH)
+    {
+        int count = (points - first < TAPE_BATCH) ? points - first : TAPE_BATCH;
+
+        for (int j = 0; j < count; ++j)
+        {
+            for (int v = 0; v < 3; ++v) coords[v][j] = quad->point[v];
+
+            for (int i = 0, index = first + j; i < quad->dims; ++i, index /= QUAD_NODES)
+            {
+                nodes[j][i] = index % QUAD_NODES;
+                coords[quad->vars[i]][j] = mid[i] + half[i] * QUAD_NODE[nodes[j][i]];
+            }
+        }
+
+        tape_run_batch(quad->tape, regs, vals, 1, coords[0], coords[1], coords[2], count);
+
+        for (int j = 0; j < count; ++j)
+        {
+            if (!isfinite(vals[j])) return false;
+
+            double kronrod = 1;
+            double gauss   = 1;
+
+            for (int i = 0; i < quad->dims; ++i)
+            {
+                kronrod *= QUAD_KRONROD[nodes[j][i]];
+                gauss   *= QUAD_GAUSS  [nodes[j][i]];
+            }
+
+            sum_kronrod += kronrod * vals[j];
+            sum_gauss   += gauss   * vals[j];
+            sum_abs     += kronrod * fabs(vals[j]);
+
+            for (int i = 0; i < quad->dims; ++i)
+            {
+                sum_split[i] += kronrod / QUAD_KRONROD[nodes[j][i]] * QUAD_GAUSS[nodes[j][i]] * vals[j];
+            }
+        }
+    }
+
+    box->value     = vol * sum_kronrod;
+    box->error     = fabs(vol * (sum_kronrod - sum_gauss));
+    box->abs_value = fabs(vol) * sum_abs;
+    box->split     = 0;
+
+    for (int i = 1; i < quad->dims; ++i)
+    {
+        if (fabs(sum_kronrod - sum_split[i]) > fabs(sum_kronrod - sum_split[box->split])) box->split = i;
+    }
+
+    return true;
+}
+
+static void quad_split_task(void *arg)
+{
+    assert(arg != nullptr);
+
+    Quad_task *task  = (Quad_task *) arg;
+    int        split = task->parent.split;
+    double     mid   = (task->parent.lo[split] + task->parent.hi[split]) / 2;
+
+    task->children[0] = task->parent;
+    task->children[1] = task->parent;
+
+    task->children[0].hi[split] = mid;
+    task->children[1].lo[split] = mid;
+
+    task->is_ok = quad_rule(task->quad, task->regs.data, task->children    ) &&
+                  quad_rule(task->quad, task->regs.data, task->children + 1);
+}
+
+/**
+*   @brief The boxes are in a binary heap by their errors, the largest one is the first.
+*/
+
+static void quad_heap_push(Quad_box *heap, int *const size, const Quad_box *box)
+{
+    assert(heap != nullptr);
+    assert(size != nullptr);
+    assert(box  != nullptr);
+    assert(*size < QUAD_MAX_BOXES);
+
+    int index = (*size)++;
+
+    while (index > 0 && heap[(index - 1) / 2].error < box->error)
+    {
+        heap[index] = heap[(index - 1) / 2];
+        index       = (index - 1) / 2;
+    }
+    heap[index] = *box;
+}
+
+static Quad_box quad_heap_pop(Quad_box *heap, int *const size)
+{
+    assert(heap  != nullptr);
+    assert(size  != nullptr);
+    assert(*size >  0);
+
+    Quad_box top  = heap[0];
+    Quad_box last = heap[--(*size)];
+
+    int index = 0;
+    for (int child = 1; child < *size; child = 2 * index + 1)
+    {
+        if (child + 1 < *size && heap[child + 1].error > heap[child].error) child += 1;
+        if (heap[child].error <= last.error) break;
+
+        heap[index] = heap[child];
+        index       = child;
+    }
+    if (*size > 0) heap[index] = last;
+
+    return top;
+}
@@ -0,0 +1,1137 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include <type_traits>
+
+#include "tape.h"
+
+#include "../lib/logs/log.h"
+#include "../lib/vec_math/vec_math.h"
+
+#include "dsl.h"
+
+/*___________________________STATIC_STRUCT_____________________________*/
+
+struct Tape_class   // equal subtrees of the compiled trees and of their system variables are one class
+{
+    Tape_ins    ins;
+    int         left;       // classes of the operands, -1 if there is no operand
+    int         right;
+    int         refs;       // the value is kept in a slot if it is used more than once
+    int         slot;       // -1 until the value is kept
+};
+
+struct Tape_builder
+{
+    Tape_class *classes;
+    int         classes_num;
+    int         classes_cap;
+
+    int        *table;      // classes by their hashes, -1 for the empty cells
+    int         table_mask;
+
+    Tree_node **system_vars;
+    int         sys_size;
+    int        *sys_class;  // -1 if the system variable is not reached yet, -2 while it is compiled
+
+    Tape_ins   *code;
+    int         code_size;
+    int         code_cap;
+
+    int         depth;
+    int         depth_max;
+    int         slots_num;
+};
+
+const int    RANGE_ULPS         =   4;   // the ranges of the functions of libm are widened by it, see range_widen()
+const double RANGE_SLACK        = 1e-6;  // periods, see range_has_point()
+const double RANGE_PERIODIC_MAX = 1e8;   // sin, cos and tg of larger arguments are bounded by their periods only
+
+/*___________________________STATIC_FUNCTION___________________________*/
+
+static int          tape_class_of           (Tape_builder *builder, const Tree_node *node);
+static int          tape_class_find         (Tape_builder *builder, const Tape_ins *ins, const int left, const int right);
+static bool         tape_table_grow         (Tape_builder *builder);
+static unsigned     tape_class_hash         (const Tape_ins *ins, const int left, const int right);
+static bool         tape_emit_class         (Tape_builder *builder, const int index);
+static bool         tape_emit               (Tape_builder *builder, const int code, const int arg, const double num,
+                                                                    const int depth_change);
+static void         tape_builder_dtor       (Tape_builder *builder);
+template <typename T>
+static bool         tape_values             (const Tree_tape *tape, T *values, const T *x_vals, const T *y_vals,
+                                                                               const T *z_vals, const long long count);
+template <typename T>
+static void         tape_batch_unary        (TYPE_OP op, T *vals,                   const int count);
+template <typename T>
+static bool         tape_batch_vec          (TYPE_OP op, T *vals,                   const int count);
+template <typename T>
+static void         tape_batch_bin          (TYPE_OP op, T *left, const T *right,   const int count);
+static void         range_unary             (TYPE_OP op, double *val);
+static void         range_bin               (TYPE_OP op, double *left, const double *right);
+static void         range_pow               (double *left, const double *right);
+static void         range_periodic          (double *val, double (*func)(double), const double max_at);
+static bool         range_has_point         (const double a, const double b, const double at, const double period);
+static double       range_product           (const double a, const double b);
+static void         range_set               (double *val, const double lo, const double hi);
+static void         range_widen             (double *val);
+
+/*_____________________________________________________________________*/
+
+//___________________
+
+#undef  LOG_CATEGORY
+#define LOG_CATEGORY LOG_CAT_GENERAL
+
+//___________________
+
+/**
+*   The tape is the trees compiled to the code of a stack machine, which is run in a loop without walking
+*   the nodes. Equal subtrees of all the trees get one class by their hashes, so a subexpression shared
+*   by the trees or repeated in them (the derivatives copy the operands many times) is computed once
+*   and kept in a slot. A system variable is the class of its tree, so it is compiled once too.
+*
+*   The code of the outputs follows each other, the first outputs are computed by a prefix of the code.
+*   The operations are done by Tree_counter() in the order of Tree_get_value_in_point(), so the values
+*   are the same.
+*/
+
+/**
+*   @brief Compiles the trees with their system_vars.
+*
+*   @return the tape, free it by Tree_tape_delete(), and nullptr in case of error
+*/
+
+Tree_tape *Tree_tape_compile(Tree_node *roots[], const int roots_num, Tree_node *system_vars[], const int sys_size)
+{
+    assert(roots != nullptr);
+
+    for (int i = 0; i < roots_num; ++i)
+    {
+        if (Tree_verify(roots[i]) == false)
+        {
+            log_error("Can't compile the tree %d, because it is invalid.\n", i);
+            return nullptr;
+        }
+    }
+
+    Tape_builder builder = {};
+    builder.system_vars  = system_vars;
+    builder.sys_size     = (system_vars == nullptr) ? 0 : sys_size;
+
+    Tree_tape *tape     = (Tree_tape *) log_calloc(1                 , sizeof(Tree_tape));
+    int       *classes  = (int       *) log_calloc((size_t) roots_num, sizeof(int      ));
+    builder.sys_class   = (int       *) log_calloc((size_t) builder.sys_size + 1, sizeof(int));
+
+    bool is_ok = tape != nullptr && classes != nullptr && builder.sys_class != nullptr && tape_table_grow(&builder);
+
+    if (is_ok)
+    {
+        for (int i = 0; i < builder.sys_size; ++i) builder.sys_class[i] = -1;
+
+        tape->outs_num = roots_num;
+        tape->outs_end = (int *) log_calloc((size_t) roots_num + 1, sizeof(int));
+        is_ok          = tape->outs_end != nullptr;
+    }
+
+    for (int i = 0; is_ok && i < roots_num; ++i)
+    {
+        classes[i] = tape_class_of(&builder, roots[i]);
+        is_ok      = classes[i] >= 0;
+
+        if (is_ok) builder.classes[classes[i]].refs += 1;
+    }
+
+    for (int i = 0; is_ok && i < roots_num; ++i)
+    {
+        is_ok = tape_emit_class(&builder, classes[i]) &&
+                tape_emit      (&builder, TAPE_OUT, i, 0, -1);
+
+        tape->outs_end[i] = builder.code_size;
+    }
+
+    if (is_ok)
+    {
+        tape->code      = builder.code;
+        tape->size      = builder.code_size;
+        tape->slots_num = builder.slots_num;
+        tape->regs_num  = builder.slots_num + builder.depth_max;
+
+        builder.code    = nullptr;
+        log_message("trees = %d, classes = %d, code = %d, slots = %d, stack = %d.\n", roots_num, builder.classes_num,
+                                                   tape->size, tape->slots_num, builder.depth_max);
+    }
+    else
+    {
+        log_error("Can't compile the trees.\n");
+
+        Tree_tape_delete(tape);
+        tape = nullptr;
+    }
+
+    tape_builder_dtor(&builder);
+    log_free         (classes);
+
+    return tape;
+}
+
+/**
+*   @brief Evaluates all the trees of the tape in the point.
+*
+*   @param values [out] - values of the trees in the order of Tree_tape_compile()
+*/
+
+void Tree_tape_value(const Tree_tape *tape, double *const values, const double x_val, const double y_val,
+                                                                  const double z_val)
+{
+    assert(tape   != nullptr);
+    assert(values != nullptr);
+
+    if (tape->outs_num == 0) return;
+
+    Tape_regs regs = {};
+    if (!tape_regs_ctor(&regs, tape, 1))
+    {
+        for (int i = 0; i < tape->outs_num; ++i) values[i] = NAN;
+        return;
+    }
+
+    tape_run(tape, regs.data, values, tape->outs_num, x_val, y_val, z_val);
+    tape_regs_dtor(&regs);
+}
+
+/**
+*   @brief Evaluates all the trees of the tape in "count" points by the batches of TAPE_BATCH points.
+*          The values are computed in the precision of the arrays: float is enough for the plots, where a value
+*          is drawn to a pixel, and halves the memory of the points and of the values, long double is for checking
+*          the error of the others. The functions of double and float are the SIMD kernels of double, so float
+*          is about as fast as double. They may differ from Tree_tape_value() in the last bits, see tape_batch_vec().
+*
+*   @param values [out] - the tree "i" in the point "j" is values[i * count + j]
+*   @param x_vals [in]  - values of x in the points, nullptr for zeros, and so are y_vals and z_vals
+*
+*   @return false in case of error
+*/
+
+bool Tree_tape_values(const Tree_tape *tape, double *const values, const double *x_vals, const double *y_vals,
+                                                                   const double *z_vals, const long long count)
+{
+    return tape_values(tape, values, x_vals, y_vals, z_vals, count);
+}
+
+bool Tree_tape_values(const Tree_tape *tape, float *const values, const float *x_vals, const float *y_vals,
+                                                                  const float *z_vals, const long long count)
+{
+    return tape_values(tape, values, x_vals, y_vals, z_vals, count);
+}
+
+bool Tree_tape_values(const Tree_tape *tape, long double *const values, const long double *x_vals,
+                                                                        const long double *y_vals,
+                                                                        const long double *z_vals, const long long count)
+{
+    return tape_values(tape, values, x_vals, y_vals, z_vals, count);
+}
+
+/**
+*   @brief Bounds the values of the trees of the tape in the box of the points by interval arithmetic: each
+*          register is a range [lo, hi] and each operation gives a range of its results on the ranges of
+*          the operands. The range contains the value of Tree_tape_value() in any point of the box where
+*          it is not NAN, but it may be much wider than the set of the values, because the operands are
+*          bounded independently (x - x is bounded by [x_lo - x_hi, x_hi - x_lo]).
+*
+*   @param lo      [out] - lower bounds of the trees in the order of Tree_tape_compile(), NAN if the value is NAN
+*                          in all the points, and so is hi
+*   @param vars_lo [in]  - lower bounds of x, y and z, a variable is fixed if its bounds are equal
+*
+*   @return false in case of error
+*/
+
+bool Tree_tape_range(const Tree_tape *tape, double *const lo, double *const hi, const double vars_lo[3],
+                                                                                const double vars_hi[3])
+{
+    assert(tape    != nullptr);
+    assert(lo      != nullptr);
+    assert(hi      != nullptr);
+    assert(vars_lo != nullptr);
+    assert(vars_hi != nullptr);
+
+    if (tape->outs_num == 0) return true;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        if (!(vars_lo[i] <= vars_hi[i]))
+        {
+            log_error("Wrong range of the variable %d: [%lg, %lg].\n", i, vars_lo[i], vars_hi[i]);
+            return false;
+        }
+    }
+
+    Tape_regs regs = {};
+    if (!tape_regs_ctor(&regs, tape, 2)) return false;
+
+    tape_run_range(tape, regs.data, lo, hi, tape->outs_num, vars_lo, vars_hi);
+    tape_regs_dtor(&regs);
+
+    return true;
+}
+
+void Tree_tape_delete(Tree_tape *tape)
+{
+    if (tape == nullptr) return;
+
+    log_free(tape->code);
+    log_free(tape->outs_end);
+    log_free(tape);
+}
+
+//___________________
+
+/**
+*   @brief Gives the node its class, the classes of its operands are found before.
+*
+*   @return the class and -1 in case of error
+*/
+
+static int tape_class_of(Tape_builder *builder, const Tree_node *node)
+{
+    assert(builder != nullptr);
+    assert(node    != nullptr);
+
+    Tape_ins ins = {};
+
+    switch (node->type)
+    {
+        case NODE_NUM:  ins = {TAPE_NUM, 0, dbl(node)};
+                        return tape_class_find(builder, &ins, -1, -1);
+
+        case NODE_VAR:  if (var(node) != X && var(node) != Y && var(node) != Z)
+                        {
+                            log_error("Can't compile the diff variable %d.\n", var(node));
+                            return -1;
+                        }
+                        ins = {TAPE_VAR, var(node), 0};
+                        return tape_class_find(builder, &ins, -1, -1);
+
+        case NODE_SYS:  {
+                            int index = sys(node);
+                            if (index < 0 || index >= builder->sys_size || builder->system_vars[index] == nullptr)
+                            {
+                                log_error("Undefined system variable %d.\n", index);
+                                return -1;
+                            }
+                            if (builder->sys_class[index] == -2)
+                            {
+                                log_error("The system variable %d depends on itself.\n", index);
+                                return -1;
+                            }
+                            if (builder->sys_class[index] == -1)
+                            {
+                                builder->sys_class[index] = -2;
+                                builder->sys_class[index] = tape_class_of(builder, builder->system_vars[index]);
+                            }
+                            return builder->sys_class[index];
+                        }
+
+        case NODE_OP :  {
+                            bool is_bin = op(node) == OP_ADD || op(node) == OP_SUB || op(node) == OP_MUL ||
+                                          op(node) == OP_DIV || op(node) == OP_POW;
+
+                            int left  = is_bin ? tape_class_of(builder, l(node)) : -1; // unary ones don't use it
+                            int right =          tape_class_of(builder, r(node));
+
+                            if ((is_bin && left < 0) || right < 0) return -1;
+
+                            ins = {is_bin ? TAPE_BIN : TAPE_UNARY, op(node), 0};
+                            return tape_class_find(builder, &ins, left, right);
+                        }
+
+        case NODE_UNDEF:
+        default      :  log_error("Can't compile the node of type %d.\n", node->type);
+                        return -1;
+    }
+}
+
+/**
+*   @brief Finds the class of the instruction with the operands of the classes "left" and "right"
+*          or makes the new one. The numbers are equal if their bits are equal.
+*
+*   @return the class and -1 in case of error
+*/
+
+static int tape_class_find(Tape_builder *builder, const Tape_ins *ins, const int left, const int right)
+{
+    assert(builder != nullptr);
+    assert(ins     != nullptr);
+
+    unsigned cell = tape_class_hash(ins, left, right) & (unsigned) builder->table_mask;
+
+    for (; builder->table[cell] != -1; cell = (cell + 1) & (unsigned) builder->table_mask)
+    {
+        const Tape_class *cls = builder->classes + builder->table[cell];
+
+        if (cls->ins.code == ins->code && cls->ins.arg == ins->arg && cls->left == left && cls->right == right &&
+            memcmp(&cls->ins.num, &ins->num, sizeof(double)) == 0) return builder->table[cell];
+    }
+
+    if (builder->classes_num == builder->classes_cap) // the table is twice as large as the classes
+    {
+        if (!tape_table_grow(builder)) return -1;
+        return tape_class_find(builder, ins, left, right);
+    }
+
+    int index = builder->classes_num++;
+
+    builder->classes[index] = {*ins, left, right, 0, -1};
+    builder->table  [cell ] = index;
+
+    if (left  >= 0) builder->classes[left ].refs += 1;
+    if (right >= 0) builder->classes[right].refs += 1;
+
+    return index;
+}
+
+static bool tape_table_grow(Tape_builder *builder)
+{
+    assert(builder != nullptr);
+
+    int         cap     = (builder->classes_cap == 0) ? 64 : builder->classes_cap * 2;
+    Tape_class *classes = (Tape_class *) log_calloc((size_t) cap    , sizeof(Tape_class));
+    int        *table   = (int        *) log_calloc((size_t) cap * 2, sizeof(int       ));
+
+    if (classes == nullptr || table == nullptr)
+    {
+        log_free(classes);
+        log_free(table);
+        return false;
+    }
+
+    for (int i = 0; i < cap * 2; ++i) table[i] = -1;
+
+    int mask = cap * 2 - 1;
+    for (int i = 0; i < builder->classes_num; ++i)
+    {
+        const Tape_class *cls  = builder->classes + i;
+        unsigned          cell = tape_class_hash(&cls->ins, cls->left, cls->right) & (unsigned) mask;
+
+        while (table[cell] != -1) cell = (cell + 1) & (unsigned) mask;
+        table[cell] = i;
+    }
+
+    if (builder->classes_num != 0) memcpy(classes, builder->classes, (size_t) builder->classes_num * sizeof(Tape_class));
+
+    log_free(builder->classes);
+    log_free(builder->table);
+
+    builder->classes     = classes;
+    builder->classes_cap = cap;
+    builder->table       = table;
+    builder->table_mask  = mask;
+
+    return true;
+}
+
+static unsigned tape_class_hash(const Tape_ins *ins, const int left, const int right)
+{
+    assert(ins != nullptr);
+
+    unsigned long long bits = 0;
+    memcpy(&bits, &ins->num, sizeof(double));
+
+    unsigned long long hash = bits ^ ((unsigned long long) (unsigned) ins->code << 56) ^
+                                     ((unsigned long long) (unsigned) ins->arg  << 48);
+
+    hash = (hash ^ (unsigned) left ) * 0x9E3779B97F4A7C15ULL;
+    hash = (hash ^ (unsigned) right) * 0xBF58476D1CE4E5B9ULL;
+
+    return (unsigned) (hash >> 32);
+}
+
+/**
+*   @brief Writes the code of the class. The operations used more than once are kept in the slots
+*          at their first computing and loaded after it.
+*/
+
+static bool tape_emit_class(Tape_builder *builder, const int index)
+{
+    assert(builder != nullptr);
+    assert(index   >= 0);
+
+    Tape_class cls = builder->classes[index];
+
+    if (cls.slot >= 0) return tape_emit(builder, TAPE_LOAD, cls.slot, 0, 1);
+
+    if (cls.left  >= 0 && !tape_emit_class(builder, cls.left )) return false;
+    if (cls.right >= 0 && !tape_emit_class(builder, cls.right)) return false;
+
+    int depth_change = 1;
+    if (cls.ins.code == TAPE_UNARY) depth_change =  0;
+    if (cls.ins.code == TAPE_BIN  ) depth_change = -1;
+
+    if (!tape_emit(builder, cls.ins.code, cls.ins.arg, cls.ins.num, depth_change)) return false;
+
+    if (cls.refs > 1 && (cls.ins.code == TAPE_UNARY || cls.ins.code == TAPE_BIN))
+    {
+        builder->classes[index].slot = builder->slots_num++;
+        return tape_emit(builder, TAPE_STORE, builder->classes[index].slot, 0, 0);
+    }
+    return true;
+}
+
+static bool tape_emit(Tape_builder *builder, const int code, const int arg, const double num, const int depth_change)
+{
+    assert(builder != nullptr);
+
+    if (builder->code_size == builder->code_cap)
+    {
+        int       cap  = (builder->code_cap == 0) ? 64 : builder->code_cap * 2;
+        Tape_ins *data = (Tape_ins *) log_calloc((size_t) cap, sizeof(Tape_ins));
+        if       (data == nullptr) return false;
+
+        if (builder->code_size != 0) memcpy(data, builder->code, (size_t) builder->code_size * sizeof(Tape_ins));
+        log_free(builder->code);
+
+        builder->code     = data;
+        builder->code_cap = cap;
+    }
+
+    builder->code[builder->code_size++] = {code, arg, num};
+
+    builder->depth += depth_change;
+    if (builder->depth > builder->depth_max) builder->depth_max = builder->depth;
+
+    return true;
+}
+
+static void tape_builder_dtor(Tape_builder *builder)
+{
+    assert(builder != nullptr);
+
+    log_free(builder->classes);
+    log_free(builder->table);
+    log_free(builder->sys_class);
+    log_free(builder->code);
+}
+
+//___________________
+
+/**
+*   @brief Runs the code of the first "outs_num" outputs.
+*
+*   @param regs [in] - registers of the tape, see tape_regs_ctor()
+*/
+
+void tape_run(const Tree_tape *tape, double *regs, double *values, const int outs_num,
+                     const double x_val, const double y_val, const double z_val)
+{
+    assert(tape     != nullptr);
+    assert(regs     != nullptr);
+    assert(values   != nullptr);
+    assert(outs_num >  0 && outs_num <= tape->outs_num);
+
+    const double vars[3] = {x_val, y_val, z_val};
+
+    double *slot = regs;
+    double *top  = regs + tape->slots_num;  // the next free register of the stack
+
+    const Tape_ins *end = tape->code + tape->outs_end[outs_num - 1];
+
+    for (const Tape_ins *ins = tape->code; ins < end; ++ins)
+    {
+        switch (ins->code)
+        {
+            case TAPE_NUM  : *top++  = ins->num;
+                             break;
+            case TAPE_VAR  : *top++  = vars[ins->arg];
+                             break;
+            case TAPE_UNARY: top[-1] = Tree_counter(0, top[-1], (TYPE_OP) ins->arg);
+                             break;
+            case TAPE_BIN  : top[-2] = Tree_counter(top[-2], top[-1], (TYPE_OP) ins->arg);
+                             --top;
+                             break;
+            case TAPE_LOAD : *top++  = slot[ins->arg];
+                             break;
+            case TAPE_STORE: slot[ins->arg] = top[-1];
+                             break;
+            case TAPE_OUT  : values[ins->arg] = *--top;
+                             break;
+
+            default        : assert(false && "default case in tape_run()");
+                             break;
+        }
+    }
+}
+
+/**
+*   @brief Tree_tape_values() in the type T: the constants of the tape are rounded to T and each operation
+*          is done in T by the overload of libm for it. The functions of double and float are the vector kernels
+*          of vec_math, see tape_batch_vec().
+*/
+
+template <typename T>
+static bool tape_values(const Tree_tape *tape, T *values, const T *x_vals, const T *y_vals, const T *z_vals,
+                                                                                            const long long count)
+{
+    assert(tape   != nullptr);
+    assert(values != nullptr || count == 0);
+
+    if (tape->outs_num == 0 || count <= 0) return true;
+
+    size_t regs_size = (size_t) tape->regs_num * TAPE_BATCH;
+
+    T *regs  = (T *) log_calloc(regs_size + (size_t) tape->outs_num * TAPE_BATCH, sizeof(T));
+    if (regs == nullptr) return false;
+
+    T *batch = regs + regs_size;
+
+    for (long long first = 0; first < count; first += TAPE_BATCH)
+    {
+        int size = (count - first < TAPE_BATCH) ? (int) (count - first) : TAPE_BATCH;
+
+        tape_run_batch(tape, regs, batch, tape->outs_num, (x_vals == nullptr) ? nullptr : x_vals + first,
+                                                          (y_vals == nullptr) ? nullptr : y_vals + first,
+                                                          (z_vals == nullptr) ? nullptr : z_vals + first, size);
+
+        for (int i = 0; i < tape->outs_num; ++i)
+        {
+            memcpy(values + i * count + first, batch + i * TAPE_BATCH, (size_t) size * sizeof(T));
+        }
+    }
+
+    log_free(regs);
+    return true;
+}
+
+/**
+*   @brief Runs the code of the first "outs_num" outputs in "count" points at once. Each register is TAPE_BATCH
+*          values, so an instruction is a loop over the points, which the compiler vectorizes.
+*
+*   @param regs   [in]  - registers of the tape of the width TAPE_BATCH, see tape_regs_ctor()
+*   @param values [out] - the output "i" in the point "j" is values[i * TAPE_BATCH + j]
+*   @param x_vals [in]  - values of x in the points, nullptr for zeros, and so are y_vals and z_vals
+*/
+
+template <typename T>
+void tape_run_batch(const Tree_tape *tape, T *regs, T *values, const int outs_num,
+                    const T *x_vals, const T *y_vals, const T *z_vals, const int count)
+{
+    assert(tape     != nullptr);
+    assert(regs     != nullptr);
+    assert(values   != nullptr);
+    assert(outs_num >  0 && outs_num <= tape->outs_num);
+    assert(count    >  0 && count    <= TAPE_BATCH);
+
+    const T      *vars[3] = {x_vals, y_vals, z_vals};
+    const size_t  size    = (size_t) count * sizeof(T);
+
+    T *slot = regs;
+    T *top  = regs + tape->slots_num * TAPE_BATCH; // the next free register of the stack
+
+    const Tape_ins *end = tape->code + tape->outs_end[outs_num - 1];
+
+    for (const Tape_ins *ins = tape->code; ins < end; ++ins)
+    {
+        switch (ins->code)
+        {
+            case TAPE_NUM  : for (int i = 0; i < count; ++i) top[i] = (T) ins->num;
+                             top += TAPE_BATCH;
+                             break;
+            case TAPE_VAR  : if (vars[ins->arg] == nullptr) memset(top, 0, size);
+                             else                           memcpy(top, vars[ins->arg], size);
+                             top += TAPE_BATCH;
+                             break;
+            case TAPE_UNARY: tape_batch_unary((TYPE_OP) ins->arg, top - TAPE_BATCH, count);
+                             break;
+            case TAPE_BIN  : top -= TAPE_BATCH;
+                             tape_batch_bin  ((TYPE_OP) ins->arg, top - TAPE_BATCH, top, count);
+                             break;
+            case TAPE_LOAD : memcpy(top, slot + ins->arg * TAPE_BATCH, size);
+                             top += TAPE_BATCH;
+                             break;
+            case TAPE_STORE: memcpy(slot + ins->arg * TAPE_BATCH, top - TAPE_BATCH, size);
+                             break;
+            case TAPE_OUT  : top -= TAPE_BATCH;
+                             memcpy(values + ins->arg * TAPE_BATCH, top, size);
+                             break;
+
+            default        : assert(false && "default case in tape_run_batch()");
+                             break;
+        }
+    }
+}
+
+template void tape_run_batch<double>(const Tree_tape *tape, double *regs, double *values, const int outs_num,
+                                     const double *x_vals, const double *y_vals, const double *z_vals, const int count);
+
+/**
+*   @brief The operation of Tree_counter() on the values of the points, the result is in "vals".
+*/
+
+template <typename T>
+static void tape_batch_unary(TYPE_OP op, T *vals, const int count)
+{
+    assert(vals != nullptr);
+
+    if constexpr (std::is_same<T, double>::value || std::is_same<T, float>::value)
+    {
+        if (tape_batch_vec(op, vals, count)) return;
+    }
+
+    switch (op)
+    {
+        case OP_SIN : for (int i = 0; i < count; ++i) vals[i] = sin (vals[i]); break;
+        case OP_COS : for (int i = 0; i < count; ++i) vals[i] = cos (vals[i]); break;
+        case OP_TAN : for (int i = 0; i < count; ++i) vals[i] = tan (vals[i]); break;
+        case OP_LOG : for (int i = 0; i < count; ++i) vals[i] = log (vals[i]); break;
+        case OP_SQRT: for (int i = 0; i < count; ++i) vals[i] = sqrt(vals[i]); break;
+        case OP_SH  : for (int i = 0; i < count; ++i) vals[i] = sinh(vals[i]); break;
+        case OP_CH  : for (int i = 0; i < count; ++i) vals[i] = cosh(vals[i]); break;
+        case OP_ASIN: for (int i = 0; i < count; ++i) vals[i] = asin(vals[i]); break;
+        case OP_ACOS: for (int i = 0; i < count; ++i) vals[i] = acos(vals[i]); break;
+        case OP_ATAN: for (int i = 0; i < count; ++i) vals[i] = atan(vals[i]); break;
+
+        case OP_ADD :
+        case OP_SUB :
+        case OP_MUL :
+        case OP_DIV :
+        case OP_POW :
+        default     : for (int i = 0; i < count; ++i) vals[i] = (T) Tree_counter(0, (double) vals[i], op);
+                      break;
+    }
+}
+
+/**
+*   @brief The functions of tape_batch_unary() in double and float by the SIMD kernels of vec_math. The error
+*          of a kernel of double is up to 2.3 ulps instead of 0.5 of libm, float is computed in double and rounded
+*          (see vec_math.cpp). vec_level_set(VEC_SCALAR) gives the values of Tree_tape_value() for double.
+*
+*   @return false if "op" is not a function
+*/
+
+template <typename T>
+static bool tape_batch_vec(TYPE_OP op, T *vals, const int count)
+{
+    assert(vals != nullptr);
+
+    switch (op)
+    {
+        case OP_SIN : vec_sin (vals, count); return true;
+        case OP_COS : vec_cos (vals, count); return true;
+        case OP_TAN : vec_tan (vals, count); return true;
+        case OP_LOG : vec_log (vals, count); return true;
+        case OP_SQRT: vec_sqrt(vals, count); return true;
+        case OP_SH  : vec_sinh(vals, count); return true;
+        case OP_CH  : vec_cosh(vals, count); return true;
+        case OP_ASIN: vec_asin(vals, count); return true;
+        case OP_ACOS: vec_acos(vals, count); return true;
+        case OP_ATAN: vec_atan(vals, count); return true;
+
+        case OP_ADD :
+        case OP_SUB :
+        case OP_MUL :
+        case OP_DIV :
+        case OP_POW :
+        default     : return false;
+    }
+}
+
+/**
+*   @brief The operation of Tree_counter() on the values of the points, the result is in "left".
+*/
+
+template <typename T>
+static void tape_batch_bin(TYPE_OP op, T *left, const T *right, const int count)
+{
+    assert(left  != nullptr);
+    assert(right != nullptr);
+
+    switch (op)
+    {
+        case OP_ADD : for (int i = 0; i < count; ++i) left[i] += right[i];               break;
+        case OP_SUB : for (int i = 0; i < count; ++i) left[i] -= right[i];               break;
+        case OP_MUL : for (int i = 0; i < count; ++i) left[i] *= right[i];               break;
+        case OP_DIV : for (int i = 0; i < count; ++i) left[i] /= right[i];               break;
+        case OP_POW : if constexpr (!std::is_same<T, long double>::value) vec_pow(left, right, count);
+                      else for (int i = 0; i < count; ++i) left[i] = pow(left[i], right[i]);
+                      break;
+
+        case OP_SIN :
+        case OP_COS :
+        case OP_TAN :
+        case OP_LOG :
+        case OP_SQRT:
+        case OP_SH  :
+        case OP_CH  :
+        case OP_ASIN:
+        case OP_ACOS:
+        case OP_ATAN:
+        default     : for (int i = 0; i < count; ++i) left[i] = (T) Tree_counter((double) left[i], (double) right[i], op);
+                      break;
+    }
+}
+
+/**
+*   @brief Runs the code of the first "outs_num" outputs on the ranges, see Tree_tape_range(). Each register is
+*          two values: the lower and the upper bounds, both of them are NAN if the value is NAN in all the points.
+*
+*   @param regs [in] - registers of the tape of the width 2, see tape_regs_ctor()
+*/
+
+void tape_run_range(const Tree_tape *tape, double *regs, double *lo, double *hi, const int outs_num,
+                           const double *vars_lo, const double *vars_hi)
+{
+    assert(tape     != nullptr);
+    assert(regs     != nullptr);
+    assert(lo       != nullptr);
+    assert(hi       != nullptr);
+    assert(vars_lo  != nullptr);
+    assert(vars_hi  != nullptr);
+    assert(outs_num >  0 && outs_num <= tape->outs_num);
+
+    double *slot = regs;
+    double *top  = regs + tape->slots_num * 2;  // the next free register of the stack
+
+    const Tape_ins *end = tape->code + tape->outs_end[outs_num - 1];
+
+    for (const Tape_ins *ins = tape->code; ins < end; ++ins)
+    {
+        switch (ins->code)
+        {
+            case TAPE_NUM  : top[0] = ins->num;
+                             top[1] = ins->num;
+                             top   += 2;
+                             break;
+            case TAPE_VAR  : top[0] = vars_lo[ins->arg];
+                             top[1] = vars_hi[ins->arg];
+                             top   += 2;
+                             break;
+            case TAPE_UNARY: range_unary((TYPE_OP) ins->arg, top - 2);
+                             break;
+            case TAPE_BIN  : top -= 2;
+                             range_bin  ((TYPE_OP) ins->arg, top - 2, top);
+                             break;
+            case TAPE_LOAD : top[0] = slot[ins->arg * 2];
+                             top[1] = slot[ins->arg * 2 + 1];
+                             top   += 2;
+                             break;
+            case TAPE_STORE: slot[ins->arg * 2]     = top[-2];
+                             slot[ins->arg * 2 + 1] = top[-1];
+                             break;
+            case TAPE_OUT  : top -= 2;
+                             lo[ins->arg] = top[0];
+                             hi[ins->arg] = top[1];
+                             break;
+
+            default        : assert(false && "default case in tape_run_range()");
+                             break;
+        }
+    }
+}
+
+/**
+*   @brief The range of Tree_counter(0, x, op) for x in the range "val", the result is in "val". The monotonic
+*          functions are bounded by their values in the ends, sin, cos and ch by their extrema inside too,
+*          and the ends are cut by the domain of the function.
+*/
+
+static void range_unary(TYPE_OP op, double *val)
+{
+    assert(val != nullptr);
+
+    double a = val[0];
+    double b = val[1];
+
+    if (isnan(a)) return; // no values
+
+    switch (op)
+    {
+        case OP_SIN : range_periodic(val, sin, M_PI / 2);
+                      return;
+        case OP_COS : range_periodic(val, cos, 0);
+                      return;
+        case OP_TAN : if (range_has_point(a, b, M_PI / 2, M_PI)) range_set(val, -INFINITY, INFINITY);
+                      else                                       range_set(val, tan(a), tan(b));
+                      break;
+        case OP_LOG : if (b < 0) range_set(val, NAN, NAN);
+                      else       range_set(val, log(fmax(a, 0)), log(b));
+                      break;
+        case OP_SQRT: if (b < 0) range_set(val, NAN, NAN);
+                      else       range_set(val, sqrt(fmax(a, 0)), sqrt(b)); // rounded correctly
+                      return;
+        case OP_SH  : range_set(val, sinh(a), sinh(b));
+                      break;
+        case OP_CH  : range_set(val, cosh((a <= 0 && b >= 0) ? 0 : fmin(fabs(a), fabs(b))),
+                                     cosh(fmax(fabs(a), fabs(b))));
+                      range_widen(val);
+                      val[0] = fmax(val[0], 1);
+                      return;
+        case OP_ASIN: if (a > 1 || b < -1) range_set(val, NAN, NAN);
+                      else                 range_set(val, asin(fmax(a, -1)), asin(fmin(b, 1)));
+                      break;
+        case OP_ACOS: if (a > 1 || b < -1)
+                      {
+                          range_set(val, NAN, NAN);
+                          return;
+                      }
+                      range_set  (val, acos(fmin(b, 1)), acos(fmax(a, -1)));
+                      range_widen(val);
+                      val[0] = fmax(val[0], 0);
+                      return;
+        case OP_ATAN: range_set(val, atan(a), atan(b));
+                      break;
+
+        case OP_ADD :
+        case OP_SUB :
+        case OP_MUL :
+        case OP_DIV :
+        case OP_POW :
+        default     :
+        {
+            double left[2] = {};
+
+            range_bin(op, left, val);
+            val[0] = left[0];
+            val[1] = left[1];
+            return;
+        }
+    }
+
+    range_widen(val);
+}
+
+/**
+*   @brief The range of Tree_counter(x, y, op) for x in the range "left" and y in the range "right", the result
+*          is in "left". The operations + - * / are rounded correctly and monotonically, so the results in the
+*          ends of the ranges bound the results inside exactly.
+*/
+
+static void range_bin(TYPE_OP op, double *left, const double *right)
+{
+    assert(left  != nullptr);
+    assert(right != nullptr);
+
+    double a = left [0];
+    double b = left [1];
+    double c = right[0];
+    double d = right[1];
+
+    switch (op)
+    {
+        case OP_ADD : range_set(left, a + c, b + d);
+                      break;
+        case OP_SUB : range_set(left, a - d, b - c);
+                      break;
+        case OP_MUL :
+        {
+            double ac = range_product(a, c);
+            double ad = range_product(a, d);
+            double bc = range_product(b, c);
+            double bd = range_product(b, d);
+
+            range_set(left, fmin(fmin(ac, ad), fmin(bc, bd)), fmax(fmax(ac, ad), fmax(bc, bd)));
+            break;
+        }
+        case OP_DIV : if (c <= 0 && d >= 0) range_set(left, -INFINITY, INFINITY);   // x / 0 is infinite
+                      else range_set(left, fmin(fmin(a / c, a / d), fmin(b / c, b / d)),  // inf / inf is skipped
+                                           fmax(fmax(a / c, a / d), fmax(b / c, b / d)));
+                      break;
+        case OP_POW : range_pow(left, right);
+                      break;
+
+        case OP_SIN :
+        case OP_COS :
+        case OP_TAN :
+        case OP_LOG :
+        case OP_SQRT:
+        case OP_SH  :
+        case OP_CH  :
+        case OP_ASIN:
+        case OP_ACOS:
+        case OP_ATAN:
+        default     : left[0] = c;
+                      left[1] = d;
+                      range_unary(op, left);
+                      break;
+    }
+}
+
+/**
+*   @brief The range of pow(x, y). An integer power is defined for any x and is even or odd, another one is
+*          defined for x >= 0 only and is monotonic by x and by y, so it is bounded by the corners.
+*/
+
+static void range_pow(double *left, const double *right)
+{
+    assert(left  != nullptr);
+    assert(right != nullptr);
+
+    double a = left [0];
+    double b = left [1];
+    double c = right[0];
+    double d = right[1];
+
+    if (isnan(a) || isnan(c)) // pow(x, 0) and pow(1, y) are 1 even for NAN
+    {
+        bool is_one = isnan(a) ? (c <= 0 && d >= 0) : (a <= 1 && b >= 1);
+
+        range_set(left, is_one ? 1 : NAN, is_one ? 1 : NAN);
+        return;
+    }
+
+    bool is_int  = !(c < d) && fpclassify(c - trunc(c)) == FP_ZERO;
+    bool is_odd  = is_int   && fpclassify(fmod (c, 2)) != FP_ZERO;
+    bool is_even = (is_int  && !is_odd) || (!(c < d) && isinf(c)); // pow(x, inf) is pow(|x|, inf)
+
+    double min_abs = (a <= 0 && b >= 0) ? 0 : fmin(fabs(a), fabs(b));
+    double max_abs = fmax(fabs(a), fabs(b));
+
+    if (is_int && fpclassify(c) == FP_ZERO)
+    {
+        range_set(left, 1, 1);
+        return;
+    }
+    if (is_even)
+    {
+        if (c > 0) range_set(left, pow(min_abs, c), pow(max_abs, c));
+        else       range_set(left, pow(max_abs, c), pow(min_abs, c));
+
+        range_widen(left);
+        left[0] = fmax(left[0], 0);
+        return;
+    }
+
+    if      (is_odd && c > 0)              range_set(left, pow(a, c), pow(b, c));
+    else if (is_odd && a <= 0 && b >= 0)   range_set(left, -INFINITY, INFINITY);
+    else if (is_odd)                       range_set(left, pow(b, c), pow(a, c));
+    else if (a < 0 && c < d)               range_set(left, -INFINITY, INFINITY); // integer y in the range
+    else
+    {
+        double lo = NAN; // pow(x, y) is NAN for x < 0, except pow(-inf, y)
+        double hi = NAN;
+
+        if (b >= 0)
+        {
+            double ac = pow(fmax(a, 0), c);
+            double ad = pow(fmax(a, 0), d);
+            double bc = pow(b, c);
+            double bd = pow(b, d);
+
+            lo = fmin(fmin(ac, ad), fmin(bc, bd));
+            hi = fmax(fmax(ac, ad), fmax(bc, bd));
+        }
+        if (isinf(a) && a < 0)
+        {
+            lo = fmin(lo, pow(a, c));
+            hi = fmax(hi, pow(a, c));
+        }
+
+        range_set(left, lo, hi);
+    }
+
+    range_widen(left);
+}
+
+/**
+*   @brief The range of sin or cos, which have the maximum 1 in max_at + 2 pi k and the minimum -1 in
+*          max_at + pi + 2 pi k, and are monotonic between them.
+*/
+
+static void range_periodic(double *val, double (*func)(double), const double max_at)
+{
+    assert(val  != nullptr);
+    assert(func != nullptr);
+
+    double a = val[0];
+    double b = val[1];
+
+    double fa = func(a);
+    double fb = func(b);
+
+    range_set  (val, fmin(fa, fb), fmax(fa, fb));
+    range_widen(val);
+
+    if (range_has_point(a, b, max_at       , 2 * M_PI)) val[1] =  1;
+    if (range_has_point(a, b, max_at + M_PI, 2 * M_PI)) val[0] = -1;
+
+    val[0] = fmax(val[0], -1);
+    val[1] = fmin(val[1],  1);
+}
+
+/**
+*   @brief Checks if [a, b] contains at + period * k for an integer k. The point is taken in if it is about
+*          an end, and any point is taken in if the ends are too large to find k accurately, so the range is
+*          never narrower than the values.
+*/
+
+static bool range_has_point(const double a, const double b, const double at, const double period)
+{
+    if (!(b - a < period) || !(fabs(a) < RANGE_PERIODIC_MAX && fabs(b) < RANGE_PERIODIC_MAX)) return true;
+
+    return floor((b - at) / period + RANGE_SLACK) >= ceil((a - at) / period - RANGE_SLACK);
+}
+
+/**
+*   @brief The product of the ends of the ranges, 0 * inf is 0, because the points near this end give any
+*          product from 0 to inf of this sign.
+*/
+
+static double range_product(const double a, const double b)
+{
+    double product = a * b;
+
+    return (isnan(product) && !isnan(a) && !isnan(b)) ? 0 : product;
+}
+
+/**
+*   @brief Sets the range. A NAN bound is a bound of the points where the operation is undefined (inf - inf),
+*          so it is replaced by the infinity, unless both of them are NAN.
+*/
+
+static void range_set(double *val, const double lo, const double hi)
+{
+    assert(val != nullptr);
+
+    bool is_empty = isnan(lo) && isnan(hi);
+
+    val[0] = (isnan(lo) && !is_empty) ? -INFINITY : lo;
+    val[1] = (isnan(hi) && !is_empty) ?  INFINITY : hi;
+}
+
+/**
+*   @brief The functions of libm are not rounded correctly, so they may be not monotonic by a few ulps,
+*          and the range given by the ends is widened by RANGE_ULPS.
+*/
+
+static void range_widen(double *val)
+{
+    assert(val != nullptr);
+
+    for (int i = 0; i < RANGE_ULPS; ++i)
+    {
+        val[0] = nextafter(val[0], -INFINITY);
+        val[1] = nextafter(val[1],  INFINITY);
+    }
+}
+
+/**
+*   @param width [in] - 1 for tape_run(), 2 for tape_run_range() and TAPE_BATCH for tape_run_batch()
+*/
+
+bool tape_regs_ctor(Tape_regs *regs, const Tree_tape *tape, const int width)
+{
+    assert(regs != nullptr);
+    assert(tape != nullptr);
+
+    regs->data = regs->data_inline;
+    if (tape->regs_num * width <= TAPE_REGS_INLINE) return true;
+
+    regs->data = (double *) log_calloc((size_t) tape->regs_num * (size_t) width, sizeof(double));
+    return regs->data != nullptr;
+}
+
+void tape_regs_dtor(Tape_regs *regs)
+{
+    assert(regs != nullptr);
+
+    if (regs->data != regs->data_inline) log_free(regs->data);
+}
@@ -0,0 +1,68 @@
+#ifndef TAPE_H
+#define TAPE_H
+
+#include "diff.h"
+
+// The tape is internal to src/, diff.cpp, tape.cpp and numeric.cpp share it. The users include diff.h only.
+
+/*___________________________STRUCT_DEFINITIONS________________________*/
+
+enum TAPE_CODE
+{
+    TAPE_NUM    ,
+    TAPE_VAR    ,   // arg is X, Y or Z
+    TAPE_UNARY  ,   // arg is TYPE_OP, the operand is the top of the stack
+    TAPE_BIN    ,   // arg is TYPE_OP, the operands are the two tops of the stack
+    TAPE_LOAD   ,   // arg is the slot
+    TAPE_STORE  ,   // arg is the slot, the top of the stack is kept
+    TAPE_OUT    ,   // arg is the output, the top of the stack is popped
+};
+
+struct Tape_ins
+{
+    int         code;       // TAPE_CODE
+    int         arg;
+    double      num;
+};
+
+struct Tree_tape
+{
+    Tape_ins   *code;
+    int         size;
+
+    int        *outs_end;   // the code before outs_end[i] computes the outputs 0, ..., i
+    int         outs_num;
+
+    int         slots_num;  // the slots are before the stack in the registers
+    int         regs_num;
+};
+
+const int TAPE_REGS_INLINE = 256; // registers of most tapes are on the stack of the thread
+const int TAPE_BATCH       =  32; // points of one run of tape_run_batch()
+
+struct Tape_regs
+{
+    double     *data;
+    double      data_inline[TAPE_REGS_INLINE];
+};
+
+/*___________________________FUNCTION_DECLARATIONS_____________________*/
+
+// tape.cpp
+void                tape_run                (const Tree_tape *tape, double *regs, double *values, const int outs_num,
+                                             const double x_val, const double y_val, const double z_val);
+template <typename T>
+void                tape_run_batch          (const Tree_tape *tape, T *regs, T *values, const int outs_num,
+                                             const T *x_vals, const T *y_vals, const T *z_vals, const int count);
+void                tape_run_range          (const Tree_tape *tape, double *regs, double *lo, double *hi,
+                                             const int outs_num, const double *vars_lo, const double *vars_hi);
+bool                tape_regs_ctor          (Tape_regs *regs, const Tree_tape *tape, const int width);
+void                tape_regs_dtor          (Tape_regs *regs);
+
+// diff.cpp
+bool                Tree_verify             (                           Tree_node *const root);
+double              Tree_counter            (const double left, const double right, TYPE_OP op);
+bool                is_char_var             (const char c);
+const char         *var_string              (const char c);
+
+#endif //TAPE_H
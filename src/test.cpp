@@ -0,0 +1,1570 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <float.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "diff.h"
+
+#include "../lib/logs/log.h"
+#include "../lib/read_write/read_write.h"
+#include "../lib/vec_math/vec_math.h"
+
+static const double ROOTS_LO   = -50;
+static const double ROOTS_HI   =  50;
+static const int    ROOTS_SIZE = 128;
+
+static const int    PATH_SIZE  = 64;
+static const int    SYS_SIZE   = 8;
+
+static const int    IMAGE_HEADER_SIZE = 24;    // magic, version, order, nodes, sys_num, root
+static const int    IMAGE_NODE_SIZE   = 16;    // type, op, reserved, left, right or the value
+
+static const char  *CORPUS      = "base/corpus.txt";
+static const int    RANGE_BOXES  = 24;     // random boxes of a function of the corpus
+static const int    RANGE_POINTS = 64;     // random points of a box besides its corners
+
+static const int    VEC_POINTS   = 8191;   // odd, so the last values are computed by the scalar tail
+static const double FLOAT_ULPS   = 0.5 + 0x1p-20;  // rounding of double to float, see vec_math.cpp
+
+static const double VEC_SPECIALS[] =
+{
+    NAN, -NAN, INFINITY, -INFINITY, 0.0, -0.0, DBL_TRUE_MIN, -DBL_TRUE_MIN, DBL_MIN / 3, -DBL_MIN / 3, DBL_MIN,
+    FLT_TRUE_MIN, -FLT_MIN / 3, 1, -1, 0x1.0000000000001p0, -0x1.0000000000001p0, 0x1.fffffffffffffp-1,
+    0x1.000002p0, -0x1.000002p0, 0.5, M_PI_2, -M_PI, 0x1p20, 0x1p21, 1e300, -1e300, DBL_MAX, -DBL_MAX, FLT_MAX,
+    89, -89, 90, 708, -708, 710, -710, 0x1p-30, -0x1p-30,
+};
+
+static const double POW_SPECIALS[] =
+{
+    NAN, INFINITY, -INFINITY, 0.0, -0.0, DBL_TRUE_MIN, -DBL_TRUE_MIN, 1, -1, 2, -2, 0.5, -0.5, 3, -3, 1.5, -1.5,
+    1e300, -1e300, 1100, -1100, 0x1p53, -0x1p53 - 2,
+};
+
+static const char  *DIFF_FUNC   = "sin(x*y)^2+ln(x^2+z)*cos(y*z)-x/(y+1)+tg(x*z)^3*(x+y+z)^(x-1)\n";
+
+/*___________________________STRUCT_DEFINITIONS________________________*/
+
+struct Test_case
+{
+    const char *name;
+    bool      (*run)();
+};
+
+struct Range_case               // range of a function of x, y = z = 0
+{
+    const char *func;
+    double      x_lo, x_hi;
+    double      lo  , hi;       // range of the values exactly, NAN if there are no values
+};
+
+struct Vec_case
+{
+    const char   *name;
+    void        (*vec_double)(double *vals, const int count);
+    void        (*vec_float )(float  *vals, const int count);
+    double      (*libm      )(double);
+    long double (*exact     )(long double);
+    double      (*point     )(const bool is_float);  // random argument in the range of the kernel
+    double        ulps;                                  // max error of the kernel, see vec_math.cpp
+};
+
+struct Line_ref                 // tree of a line parsed alone by Tree_parsing_buff()
+{
+    Tree_node  *root;
+    int         line;
+};
+
+struct Stream_ref
+{
+    const Line_ref *refs;
+    int             refs_num;
+    int             index;
+    bool            is_ok;
+};
+
+/*___________________________STATIC_FUNCTION___________________________*/
+
+static long long    roots_count         (const char *func, double *const roots);
+static bool         test_roots_pole     ();
+static bool         test_roots_tan      ();
+static bool         test_root_pole      ();
+static bool         minimize            (const char *func, const double start, const MIN_METHOD method,
+                                                                               double *const x);
+static bool         test_min_constant   ();
+static bool         test_min_unbounded  ();
+static bool         tree_equal          (const Tree_node *first, const Tree_node *second);
+static bool         test_diff_parallel  ();
+static bool         temp_file           (char *const path, const char *text);
+static bool         parse_equal         (const char *buff, Tree_node *expected);
+static bool         parse_num_exact     (const char *num);
+static bool         test_parse_baseline ();
+static bool         test_parse_numbers  ();
+static bool         test_parse_lines    ();
+static bool         line_is_blank       (const char *begin, const char *end);
+static bool         stream_check        (Tree_node *root, int line, void *arg);
+static bool         batch_equal         (const char *text, const int threads);
+static bool         test_batch_stream   ();
+static Tree_node   *sys_tree            (Tree_node *system_vars[]);
+static void         sys_dtor            (Tree_node *system_vars[]);
+static bool         values_equal        (Tree_node *first,  Tree_node *first_sys[],
+                                         Tree_node *second, Tree_node *second_sys[]);
+static bool         test_bin_round_trip ();
+static bool         test_bin_corrupted  ();
+static bool         image_values_equal  (Tree_node *root, Tree_node *system_vars[]);
+static bool         test_image_values   ();
+static bool         test_image_rejected ();
+static long long    dir_bytes           (const char *dir, const bool is_clean);
+static Tree_node   *cache_diff          (Tree_cache *cache, const int func, bool *const is_hit);
+static bool         test_cache_hit      ();
+static bool         test_cache_evict    ();
+static bool         test_eval_cache     ();
+static bool         diff_fails          (Tree_node *root);
+static bool         test_verify_stamp   ();
+static bool         integrate           (const char *func, const char *vars, const double lo[3], const double hi[3],
+                                                                             double *const value);
+static bool         test_integrate      ();
+static bool         test_integrate_fail ();
+static double       random_in           (const double lo, const double hi);
+static bool         range_encloses      (const Tree_tape *tape, const int outs_num, const double vars_lo[3],
+                                                                                const double vars_hi[3]);
+static bool         test_range_corpus   ();
+static bool         range_bound_equal   (const double bound, const double expected);
+static bool         test_range_edges    ();
+static double       point_trig          (const bool is_float);
+static double       point_log           (const bool is_float);
+static double       point_hyper         (const bool is_float);
+static double       point_unit          (const bool is_float);
+static double       point_any           (const bool is_float);
+static double       vec_ulps            (const double value, const long double exact, const bool is_float);
+static bool         vec_value_ok        (const double value, const double libm, const long double exact,
+                                                             const double ulps, const bool is_float,
+                                                                                const bool is_scalar);
+static bool         vec_unary_check     (const Vec_case *test, const bool is_float, const bool is_scalar);
+static bool         vec_pow_check       (const bool is_float, const bool is_scalar);
+static bool         test_vec_math       ();
+
+/*_____________________________________________________________________*/
+
+static const Test_case TESTS[] =
+{
+    {"roots of 1/(x-c) are not its pole", test_roots_pole   },
+    {"roots of tg(x) and tg(x)-1"       , test_roots_tan    },
+    {"root in the bracket of a pole"    , test_root_pole    },
+    {"minimum of f with a big constant" , test_min_constant },
+    {"no minimum of f = x"              , test_min_unbounded},
+    {"diff_main_parallel equals diff_main", test_diff_parallel},
+    {"parser: precedence, f(a), a^b^c"  , test_parse_baseline},
+    {"parser: numbers are the ones of strtod", test_parse_numbers},
+    {"parser: line:col, blanks, comments, CRLF", test_parse_lines},
+    {"batch and stream equal the lines parsed alone", test_batch_stream},
+    {"binary trees: round trip of the derivatives", test_bin_round_trip},
+    {"binary trees: corrupted and truncated", test_bin_corrupted},
+    {"images: values of the trees"      , test_image_values  },
+    {"images: bad magic and shared child", test_image_rejected},
+    {"derivative cache: miss, store, hit", test_cache_hit     },
+    {"derivative cache: eviction by max_bytes", test_cache_evict},
+    {"eval cache: hits, misses, no shared entries", test_eval_cache},
+    {"a stamped tree changed by hand is verified", test_verify_stamp},
+    {"integrals of the known functions" , test_integrate     },
+    {"integrals of 1/x and by \"xx\" fail", test_integrate_fail},
+    {"ranges of the corpus and the derivatives", test_range_corpus},
+    {"ranges: poles, powers, domain edges", test_range_edges   },
+    {"vec_math: each level against libm", test_vec_math      },
+};
+
+int main()
+{
+    int failed = 0;
+
+    for (const Test_case &test : TESTS)
+    {
+        bool is_ok = test.run();
+
+        printf("%-48s %s\n", test.name, is_ok ? "ok" : "FAILED");
+        if (!is_ok) ++failed;
+    }
+
+    printf("%d of %d tests failed\n", failed, (int) (sizeof(TESTS) / sizeof(TESTS[0])));
+    return (failed == 0) ? 0 : 1;
+}
+
+/*_____________________________________________________________________*/
+
+/**
+*   @brief Finds the roots of "func" in [ROOTS_LO, ROOTS_HI].
+*
+*   @return number of the roots and -1 in case of error
+*/
+
+static long long roots_count(const char *func, double *const roots)
+{
+    Tree_node *root = Tree_parsing_buff(func);
+    if        (root == nullptr) return -1;
+
+    Tree_solver *solver = Tree_solver_new(&root, nullptr, 0, 'x');
+    long long    found  = (solver == nullptr) ? -1 : Tree_solver_roots(solver, ROOTS_LO, ROOTS_HI, roots, ROOTS_SIZE);
+
+    Tree_solver_delete(solver);
+    Tree_dtor         (root);
+
+    return found;
+}
+
+static bool test_roots_pole()
+{
+    double roots[ROOTS_SIZE] = {};
+
+    return roots_count("1/(x-0.1)\n", roots) == 0 && roots_count("1/(x+3)-1\n", roots) == 1 && fabs(roots[0] + 2) < 1e-12;
+}
+
+static bool test_roots_tan()
+{
+    double roots[ROOTS_SIZE] = {};
+
+    long long found = roots_count("tg(x)\n", roots); // k * pi, |k| <= 15
+    if       (found != 31) return false;
+
+    for (long long i = 0; i < found; ++i)
+    {
+        if (fabs(roots[i] - M_PI * (double) (i - 15)) > 1e-12) return false;
+    }
+
+    found = roots_count("tg(x)-1\n", roots);          // pi / 4 + k * pi, -16 <= k <= 15
+    if (found != 32) return false;
+
+    for (long long i = 0; i < found; ++i)
+    {
+        if (fabs(roots[i] - M_PI / 4 - M_PI * (double) (i - 16)) > 1e-12) return false;
+    }
+
+    return true;
+}
+
+static bool test_root_pole()
+{
+    Tree_node   *root   = Tree_parsing_buff("1/(x-0.1)\n");
+    Tree_solver *solver = (root == nullptr) ? nullptr : Tree_solver_new(&root, nullptr, 0, 'x');
+
+    double value = 0;
+    bool   is_ok = solver != nullptr && !Tree_solver_root(solver, 0, 0.2, &value);
+
+    Tree_solver_delete(solver);
+    Tree_dtor         (root);
+
+    return is_ok;
+}
+
+/**
+*   @brief Minimizes "func" by x from "start".
+*
+*   @param x [out] - the last point
+*/
+
+static bool minimize(const char *func, const double start, const MIN_METHOD method, double *const x)
+{
+    Tree_node      *root = Tree_parsing_buff(func);
+    Tree_minimizer *min  = (root == nullptr) ? nullptr : Tree_minimizer_new(&root, nullptr, 0, "x");
+
+    double point[3] = {start, 0, 0};
+    double value    = 0;
+    bool   is_min   = min != nullptr && Tree_minimize(min, point, &value, method);
+
+    Tree_minimizer_delete(min);
+    Tree_dtor            (root);
+
+    *x = point[0];
+    return is_min;
+}
+
+static bool test_min_constant()
+{
+    double x = 0;
+
+    if (!minimize("(x-50)^2+1000000000000\n",   0, MIN_LBFGS, &x) || fabs(x - 50) > 1e-6) return false;
+    if (!minimize("x^2+100000000000000\n"   , 100, MIN_LBFGS, &x) || fabs(x)      > 1e-6) return false;
+
+    // the gradient descent may stop when f can't decrease in its precision, but not in the start point
+    minimize("x^2+100000000000000\n", 100, MIN_GRADIENT, &x);
+
+    return fabs(x) < 1;
+}
+
+static bool test_min_unbounded()
+{
+    double x = 0;
+
+    return !minimize("x\n", 0, MIN_LBFGS, &x) && !minimize("x\n", 0, MIN_GRADIENT, &x);
+}
+
+/**
+*   @brief Compares the trees node by node, the numbers by their bits.
+*/
+
+static bool tree_equal(const Tree_node *first, const Tree_node *second)
+{
+    if (first == nullptr || second == nullptr) return first == second;
+    if (first->type != second->type)           return false;
+
+    switch (first->type)
+    {
+        case NODE_NUM: if (memcmp(&first->value.dbl, &second->value.dbl, sizeof(double)) != 0) return false;
+                       break;
+        case NODE_OP : if (first->value.op  != second->value.op ) return false;
+                       break;
+        case NODE_VAR: if (first->value.var != second->value.var) return false;
+                       break;
+        case NODE_SYS: if (first->value.sys != second->value.sys) return false;
+                       break;
+        case NODE_UNDEF:
+        default      : break;
+    }
+
+    return tree_equal(first->left, second->left) && tree_equal(first->right, second->right);
+}
+
+static bool test_diff_parallel()
+{
+    const char *const VARS[] = {"x", "y", "z", "a"};
+
+    bool is_ok = true;
+
+    for (const char *vars : VARS)
+    {
+        for (int call = 0; call < 2; ++call)    // the second call runs in the pool of the first one
+        {
+            Tree_node *root     = Tree_parsing_buff(DIFF_FUNC);
+            Tree_node *root_par = Tree_parsing_buff(DIFF_FUNC);
+
+            Tree_node *diff     = (root     == nullptr) ? nullptr : diff_main         (&root    , nullptr, vars);
+            Tree_node *diff_par = (root_par == nullptr) ? nullptr : diff_main_parallel(&root_par, nullptr, vars, 4, 1);
+
+            is_ok = is_ok && diff != nullptr && tree_equal(diff, diff_par);
+
+            Tree_dtor(diff_par);
+            Tree_dtor(diff);
+            Tree_dtor(root_par);
+            Tree_dtor(root);
+        }
+    }
+
+    return is_ok;
+}
+
+/**
+*   @brief Creates a temporary file with "text", remove it by unlink(path).
+*
+*   @param path [out] - name of the file, PATH_SIZE chars
+*/
+
+static bool temp_file(char *const path, const char *text)
+{
+    snprintf(path, PATH_SIZE, "/tmp/diff_test_XXXXXX");
+
+    int fd = mkstemp(path);
+    if (fd == -1) return false;
+
+    size_t  size    = strlen(text);
+    ssize_t written = write(fd, text, size);
+
+    close(fd);
+    return written == (ssize_t) size;
+}
+
+/**
+*   @brief Parses "buff" and compares the tree with "expected", both trees are freed.
+*/
+
+static bool parse_equal(const char *buff, Tree_node *expected)
+{
+    Tree_node *root  = Tree_parsing_buff(buff);
+    bool       is_ok = root != nullptr && tree_equal(root, expected);
+
+    if (root     != nullptr) Tree_dtor(root);
+    if (expected != nullptr) Tree_dtor(expected);
+
+    return is_ok;
+}
+
+/**
+*   @brief Checks that the number is parsed to the same bits as by strtod().
+*/
+
+static bool parse_num_exact(const char *num)
+{
+    char buff[PATH_SIZE] = {};
+    snprintf(buff, sizeof(buff), "%s\n", num);
+
+    Tree_node *root  = Tree_parsing_buff(buff);
+    double     value = strtod(num, nullptr);
+    bool       is_ok = root != nullptr && root->type == NODE_NUM &&
+                       memcmp(&root->value.dbl, &value, sizeof(double)) == 0;
+
+    if (root != nullptr) Tree_dtor(root);
+    return is_ok;
+}
+
+static bool test_parse_baseline()
+{
+    // 1+2*x^3-y/z = (1 + 2 * (x^3)) - y / z
+    Tree_node *expected = new_node_op(OP_SUB, new_node_op(OP_ADD, new_node_num(1),
+                                                          new_node_op(OP_MUL, new_node_num(2),
+                                                                      new_node_op(OP_POW, new_node_var(X),
+                                                                                          new_node_num(3)))),
+                                              new_node_op(OP_DIV, new_node_var(Y), new_node_var(Z)));
+    if (!parse_equal("1+2*x^3-y/z\n", expected)) return false;
+
+    // the same operators are left-associative
+    expected = new_node_op(OP_SUB, new_node_op(OP_SUB, new_node_var(X), new_node_var(Y)), new_node_var(Z));
+    if (!parse_equal("x-y-z\n", expected)) return false;
+
+    expected = new_node_op(OP_DIV, new_node_op(OP_DIV, new_node_var(X), new_node_var(Y)), new_node_var(Z));
+    if (!parse_equal("x/y/z\n", expected)) return false;
+
+    // f(a) is the node f with the children 0 and a
+    expected = new_node_op(OP_SIN, new_node_num(0), new_node_op(OP_ADD, new_node_var(X), new_node_num(1)));
+    if (!parse_equal("sin (x+1)\n", expected)) return false;
+
+    expected = new_node_op(OP_POW, new_node_op(OP_LOG, new_node_num(0), new_node_var(X)), new_node_num(2));
+    if (!parse_equal("ln(x)^2\n", expected)) return false;
+
+    // a^b^c is an error, the brackets give both orders
+    if (Tree_parsing_buff("x^y^z\n") != nullptr) return false;
+
+    expected = new_node_op(OP_POW, new_node_op(OP_POW, new_node_var(X), new_node_var(Y)), new_node_var(Z));
+    if (!parse_equal("(x^y)^z\n", expected)) return false;
+
+    expected = new_node_op(OP_POW, new_node_var(X), new_node_op(OP_POW, new_node_var(Y), new_node_var(Z)));
+    return parse_equal("x^(y^z)\n", expected);
+}
+
+static bool test_parse_numbers()
+{
+    const char *const NUMS[] =
+    {
+        "0", "0.1", "123.456", ".5", "1e22", "1e23", "1e-22", "1e-23", "4.35e21",
+        "9007199254740992", "9007199254740993", "9007199254740991.5",          // 2^53, 2^53 + 1
+        "1234567890123456789", "12345678901234567890", "9999999999999999999",  // 19 and 20 digits
+        "0.0000000000000000000000123456789012345678", "1.7976931348623157e308", "4.9e-324",
+        "0x1.8p3", "2.2250738585072011e-308", "123456789e-22", "123456789e-23",
+    };
+
+    for (const char *num : NUMS)
+    {
+        if (!parse_num_exact(num)) return false;
+    }
+
+    return true;
+}
+
+static bool test_parse_lines()
+{
+    char path[PATH_SIZE] = {};
+    if (!temp_file(path, "x+1\n  \t\n# comment\nx+*2\nsin(x)   # tail\r\ny\r\n(x+1\n\r\n2 ^ x"))
+        return false;
+
+    Tree_stream *stream = Tree_stream_open(path);
+    if          (stream == nullptr) { unlink(path); return false; }
+
+    // the lines with expressions: number, column of the error (0 if there is none)
+    const int LINES[][2] = {{1, 0}, {4, 3}, {5, 0}, {6, 0}, {7, 5}, {9, 0}};
+    const int LINES_NUM  = (int) (sizeof(LINES) / sizeof(LINES[0]));
+
+    bool       is_ok = true;
+    int        index = 0;
+    Tree_node *root  = nullptr;
+    int        line  = 0;
+    int        col   = 0;
+
+    for (; Tree_stream_next(stream, &root, &line, &col); ++index)
+    {
+        is_ok = is_ok && index < LINES_NUM && line == LINES[index][0] && col == LINES[index][1] &&
+                (root == nullptr) == (col != 0);
+
+        if (root != nullptr) Tree_dtor(root);
+    }
+
+    Tree_stream_close(stream);
+    unlink(path);
+
+    is_ok = is_ok && index == LINES_NUM;
+
+    // CRLF and the comment end the line in the buffer too
+    is_ok = parse_equal("x * 2\r\n"   , new_node_op(OP_MUL, new_node_var(X), new_node_num(2))) && is_ok;
+    is_ok = parse_equal(" x*2 # x*3\n", new_node_op(OP_MUL, new_node_var(X), new_node_num(2))) && is_ok;
+
+    return is_ok;
+}
+
+/**
+*   @brief Checks if the line has no expression: only blanks and maybe a comment.
+*/
+
+static bool line_is_blank(const char *begin, const char *end)
+{
+    while (begin < end && (*begin == ' ' || *begin == '\t' || *begin == '\r')) ++begin;
+
+    return begin == end || *begin == '#';
+}
+
+static bool stream_check(Tree_node *root, int line, void *arg)
+{
+    Stream_ref     *stream = (Stream_ref *) arg;
+    const Line_ref *ref    = (stream->index < stream->refs_num) ? stream->refs + stream->index : nullptr;
+
+    stream->is_ok = stream->is_ok && ref != nullptr && ref->line == line && tree_equal(ref->root, root);
+    stream->index++;
+
+    if (root != nullptr) Tree_dtor(root);
+    return true;
+}
+
+/**
+*   @brief Parses "text" by Tree_parsing_batch() on "threads" threads and by Tree_parsing_stream(), and compares
+*          the trees and the line numbers with the ones of each line parsed alone.
+*/
+
+static bool batch_equal(const char *text, const int threads)
+{
+    char path[PATH_SIZE] = {};
+    if (!temp_file(path, text)) return false;
+
+    int lines_max = 1;
+    for (const char *cur = text; *cur != '\0'; ++cur) lines_max += (*cur == '\n');
+
+    Line_ref *refs     = (Line_ref *) calloc((size_t) lines_max, sizeof(Line_ref));
+    int       refs_num = 0;
+    char     *buff     = (char *) calloc(strlen(text) + 2, sizeof(char));
+
+    bool is_ok = refs != nullptr && buff != nullptr;
+    int  line  = 1;
+
+    for (const char *cur = text; is_ok && *cur != '\0'; ++line)
+    {
+        const char *end = strchr(cur, '\n');
+        size_t      len = (end == nullptr) ? strlen(cur) : (size_t) (end - cur);
+
+        if (!line_is_blank(cur, cur + len))
+        {
+            memcpy(buff, cur, len);
+            buff[len]     = '\n';
+            buff[len + 1] = '\0';
+
+            refs[refs_num++] = {Tree_parsing_buff(buff), line};
+        }
+
+        cur += (end == nullptr) ? len : len + 1;
+    }
+
+    Tree_batch batch = {};
+    is_ok = is_ok && Tree_parsing_batch(path, &batch, threads) && batch.size == refs_num;
+
+    for (long long i = 0; is_ok && i < batch.size; ++i)
+    {
+        is_ok = batch.lines[i].line == refs[i].line && tree_equal(batch.lines[i].root, refs[i].root) &&
+                (batch.lines[i].col == 0) == (refs[i].root != nullptr);
+    }
+    Tree_batch_dtor(&batch);
+
+    Stream_ref stream = {refs, refs_num, 0, true};
+    is_ok = is_ok && Tree_parsing_stream(path, stream_check, &stream) == refs_num && stream.is_ok;
+
+    for (int i = 0; refs != nullptr && i < refs_num; ++i)
+    {
+        if (refs[i].root != nullptr) Tree_dtor(refs[i].root);
+    }
+    free  (refs);
+    free  (buff);
+    unlink(path);
+
+    return is_ok;
+}
+
+static bool test_batch_stream()
+{
+    const char *const LINES[] =
+    {
+        "x+1", "", "  # comment", "sin(x*y)^2 - ln(z)", "x+*2", "\t(x+y)/(x-y)\r", "1e23*x", "(x", "   ",
+        "tg(x) # tail", "e^x^2", "2.5^(x+1)",
+    };
+    const int LINES_NUM = (int) (sizeof(LINES) / sizeof(LINES[0]));
+    const int TEXT_SIZE = 1 << 16;
+
+    char *text = (char *) calloc(TEXT_SIZE, sizeof(char));
+    if   (text == nullptr) return false;
+
+    // many lines, so the chunks of the batch begin in the middle of the file
+    int size = 0;
+    for (int i = 0; size + 64 < TEXT_SIZE; ++i)
+    {
+        size += snprintf(text + size, (size_t) (TEXT_SIZE - size), "%s\n", LINES[i % LINES_NUM]);
+    }
+
+    bool is_ok = true;
+
+    for (int threads = 1; is_ok && threads <= 8; threads *= 2)
+    {
+        is_ok = batch_equal(text, threads);
+
+        text[size - 1] = '\0';  // the last line without '\n'
+        is_ok = is_ok && batch_equal(text, threads);
+        text[size - 1] = '\n';
+    }
+    free(text);
+
+    // more chunks than lines, an empty file and a file without expressions
+    return is_ok && batch_equal("x\ny\nz", 8) && batch_equal("", 4) && batch_equal("\n# x\n  \n", 4);
+}
+
+/**
+*   @brief Creates a function with three system variables, the last one refers to the first one.
+*
+*   @param system_vars [out] - SYS_SIZE of them, free them by sys_dtor()
+*/
+
+static Tree_node *sys_tree(Tree_node *system_vars[])
+{
+    for (int i = 0; i < SYS_SIZE; ++i) system_vars[i] = nullptr;
+
+    system_vars[0] = Tree_parsing_buff("x*y+1\n");
+    system_vars[1] = Tree_parsing_buff("sin(x)*2\n");
+    system_vars[2] = new_node_op(OP_POW, new_node_sys(0), new_node_num(2));
+
+    Tree_node *root = Tree_parsing_buff("ln(x^2+z)-y/3\n");
+    if        (root == nullptr) return nullptr;
+
+    return new_node_op(OP_MUL, new_node_sys(2), new_node_op(OP_ADD, new_node_sys(1), root));
+}
+
+static void sys_dtor(Tree_node *system_vars[])
+{
+    for (int i = 0; i < SYS_SIZE && system_vars[i] != nullptr; ++i)
+    {
+        Tree_dtor(system_vars[i]);
+        system_vars[i] = nullptr;
+    }
+}
+
+/**
+*   @brief Compares the bits of the values of two trees in the points of a grid, nan is equal to nan.
+*/
+
+static bool values_equal(Tree_node *first, Tree_node *first_sys[], Tree_node *second, Tree_node *second_sys[])
+{
+    for (int i = 0; i < 27; ++i)
+    {
+        double x = 0.7 * (i % 3) - 0.3, y = 1.1 * (i / 3 % 3) + 0.2, z = 0.9 * (i / 9) - 0.5;
+
+        double first_val  = Tree_get_value_in_point(first , first_sys , x, y, z);
+        double second_val = Tree_get_value_in_point(second, second_sys, x, y, z);
+
+        if (isnan(first_val) && isnan(second_val)) continue;
+        if (memcmp(&first_val, &second_val, sizeof(double)) != 0) return false;
+    }
+
+    return true;
+}
+
+static bool test_bin_round_trip()
+{
+    const char *const VARS[] = {"x", "y", "z", "a"};
+
+    bool is_ok = true;
+
+    for (const char *vars : VARS)
+    {
+        Tree_node *sys [SYS_SIZE] = {};
+        Tree_node *sys2[SYS_SIZE] = {};
+        Tree_node *sys3[SYS_SIZE] = {};
+
+        Tree_node *root = sys_tree(sys);
+        Tree_node *diff = (root == nullptr) ? nullptr : diff_main(&root, sys, vars);
+
+        size_t         size  = 0;
+        size_t         size2 = 0;
+        unsigned char *data  = (diff == nullptr) ? nullptr : Tree_serialize(diff, sys, SYS_SIZE, &size);
+        Tree_node     *diff2 = (data == nullptr) ? nullptr : Tree_deserialize(data, size, sys2, SYS_SIZE);
+        unsigned char *data2 = (diff2 == nullptr) ? nullptr : Tree_serialize(diff2, sys2, SYS_SIZE, &size2);
+
+        is_ok = is_ok && diff2 != nullptr && values_equal(diff, sys, diff2, sys2) && values_equal(root, sys, root, sys2);
+        is_ok = is_ok && data2 != nullptr && size == size2 && memcmp(data, data2, size) == 0;
+
+        // the same through a file
+        char       path[PATH_SIZE] = {};
+        Tree_node *diff3           = nullptr;
+
+        if (is_ok && temp_file(path, "") && Tree_save(path, diff, sys, SYS_SIZE))
+        {
+            diff3 = Tree_load(path, sys3, SYS_SIZE);
+        }
+        if (path[0] != '\0') unlink(path);
+
+        is_ok = is_ok && diff3 != nullptr && values_equal(diff, sys, diff3, sys3);
+
+        log_free (data);
+        log_free (data2);
+        Tree_dtor(diff3);
+        Tree_dtor(diff2);
+        Tree_dtor(diff);
+        Tree_dtor(root);
+        sys_dtor (sys3);
+        sys_dtor (sys2);
+        sys_dtor (sys);
+    }
+
+    return is_ok;
+}
+
+static bool test_bin_corrupted()
+{
+    Tree_node *sys[SYS_SIZE] = {};
+    Tree_node *root          = sys_tree(sys);
+
+    size_t         size = 0;
+    unsigned char *data = (root == nullptr) ? nullptr : Tree_serialize(root, sys, SYS_SIZE, &size);
+    unsigned char *copy = (data == nullptr) ? nullptr : (unsigned char *) calloc(size + 1, 1);
+
+    bool is_ok = copy != nullptr;
+
+    // a flipped bit gives an error or some valid tree, the magic is always checked
+    for (size_t i = 0; is_ok && i < size; ++i)
+    {
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            Tree_node *sys_out[SYS_SIZE] = {};
+
+            memcpy(copy, data, size);
+            copy[i] ^= (unsigned char) (1 << bit);
+
+            Tree_node *out = Tree_deserialize(copy, size, sys_out, SYS_SIZE);
+            if (out == nullptr) continue;
+
+            is_ok = is_ok && i >= 4 && values_equal(out, sys_out, out, sys_out);
+
+            Tree_dtor(out);
+            sys_dtor (sys_out);
+        }
+    }
+
+    // a prefix of the data and the data with one more byte are errors
+    for (size_t cut = 0; is_ok && cut <= size + 1; ++cut)
+    {
+        if (cut == size) continue;
+
+        Tree_node *sys_out[SYS_SIZE] = {};
+
+        memcpy(copy, data, size);
+        Tree_node *out = Tree_deserialize(copy, cut, sys_out, SYS_SIZE);
+
+        is_ok = out == nullptr && sys_out[0] == nullptr;
+        if (out != nullptr) { Tree_dtor(out); sys_dtor(sys_out); }
+    }
+
+    free     (copy);
+    log_free (data);
+    Tree_dtor(root);
+    sys_dtor (sys);
+
+    return is_ok;
+}
+
+/**
+*   @brief Saves the image of the tree and compares its values with the ones of the tree bit by bit.
+*/
+
+static bool image_values_equal(Tree_node *root, Tree_node *system_vars[])
+{
+    char path[PATH_SIZE] = {};
+    if (!temp_file(path, "")) return false;
+
+    Tree_image *image = Tree_image_save(path, root, system_vars, SYS_SIZE) ? Tree_image_open(path) : nullptr;
+    bool        is_ok = image != nullptr;
+
+    for (int i = 0; is_ok && i < 27; ++i)
+    {
+        double x = 0.7 * (i % 3) - 0.3, y = 1.1 * (i / 3 % 3) + 0.2, z = 0.9 * (i / 9) - 0.5;
+
+        double image_val = Tree_image_value       (image, x, y, z);
+        double tree_val  = Tree_get_value_in_point(root, system_vars, x, y, z);
+
+        is_ok = (isnan(image_val) && isnan(tree_val)) || memcmp(&image_val, &tree_val, sizeof(double)) == 0;
+    }
+
+    Tree_image_close(image);
+    unlink(path);
+
+    return is_ok;
+}
+
+static bool test_image_values()
+{
+    const char *const VARS[] = {"x", "a"};
+
+    Tree_node *sys[SYS_SIZE] = {};
+    Tree_node *root          = sys_tree(sys);
+
+    bool is_ok = root != nullptr && image_values_equal(root, sys);
+
+    for (const char *vars : VARS)
+    {
+        Tree_node *diff = (root == nullptr) ? nullptr : diff_main(&root, sys, vars);
+
+        is_ok = is_ok && diff != nullptr && image_values_equal(diff, sys);
+        Tree_dtor(diff);
+    }
+
+    Tree_dtor(root);
+    sys_dtor (sys);
+
+    return is_ok;
+}
+
+static bool test_image_rejected()
+{
+    char path[PATH_SIZE] = {};
+    if (!temp_file(path, "")) return false;
+
+    Tree_node *root = Tree_parsing_buff("x+y\n");
+    bool       is_ok = root != nullptr && Tree_image_save(path, root);
+
+    int            size = 0;
+    unsigned char *data = is_ok ? (unsigned char *) read_file(path, &size) : nullptr;
+
+    Tree_image *image = Tree_image_open(path);
+    is_ok = is_ok && data != nullptr && image != nullptr;
+    Tree_image_close(image);
+
+    if (is_ok)
+    {
+        data[0] ^= 1;   // bad magic
+        is_ok = write_file(path, data, size) && Tree_image_open(path) == nullptr;
+        data[0] ^= 1;
+    }
+
+    // the right child of "+" is its left one: the image is a DAG, not a tree. There are no system variables,
+    // so the nodes follow the header.
+    unsigned nodes  = 0;
+    bool     is_dag = false;
+    if (is_ok) memcpy(&nodes, data + 12, sizeof(unsigned));
+
+    for (unsigned i = 0; is_ok && !is_dag && i < nodes; ++i)
+    {
+        unsigned char *node = data + IMAGE_HEADER_SIZE + i * IMAGE_NODE_SIZE;
+        if (node[0] != NODE_OP) continue;
+
+        memcpy(node + 8, node + 4, sizeof(unsigned));
+        is_ok  = write_file(path, data, size) && Tree_image_open(path) == nullptr;
+        is_dag = true;
+    }
+    is_ok = is_ok && is_dag;
+
+    log_free (data);
+    Tree_dtor(root);
+    unlink   (path);
+
+    return is_ok;
+}
+
+/**
+*   @brief Total size of the cache files in the directory.
+*
+*   @param is_clean [in] - remove the files and the directory
+*/
+
+static long long dir_bytes(const char *dir, const bool is_clean)
+{
+    DIR *stream = opendir(dir);
+    if  (stream == nullptr) return -1;
+
+    long long total = 0;
+    char      path[PATH_MAX] = {};
+
+    for (dirent *cur = readdir(stream); cur != nullptr; cur = readdir(stream))
+    {
+        if (strstr(cur->d_name, ".dtc") == nullptr) continue;
+
+        struct stat file_stat = {};
+        snprintf(path, sizeof(path), "%s/%s", dir, cur->d_name);
+
+        if (stat(path, &file_stat) == 0) total += (long long) file_stat.st_size;
+        if (is_clean) unlink(path);
+    }
+    closedir(stream);
+
+    if (is_clean) rmdir(dir);
+    return total;
+}
+
+/**
+*   @brief Differentiates the function number "func" by x through the cache.
+*
+*   @return the derivative, the function is freed
+*/
+
+static Tree_node *cache_diff(Tree_cache *cache, const int func, bool *const is_hit)
+{
+    char buff[PATH_SIZE] = {};
+    snprintf(buff, sizeof(buff), "sin(x*y)^%d+ln(x^2+z)*cos(y*z)\n", func + 2);
+
+    Tree_node *root = Tree_parsing_buff(buff);
+    Tree_node *diff = (root == nullptr) ? nullptr : Tree_cache_diff(cache, &root, nullptr, 0, "x", is_hit);
+
+    Tree_dtor(root);
+    return diff;
+}
+
+static bool test_cache_hit()
+{
+    char dir[PATH_SIZE] = "/tmp/diff_cache_XXXXXX";
+    if (mkdtemp(dir) == nullptr) return false;
+
+    Tree_cache *cache = Tree_cache_open(dir);
+    bool        is_ok = cache != nullptr;
+
+    Tree_node *sys [SYS_SIZE] = {};
+    Tree_node *sys2[SYS_SIZE] = {};
+    Tree_node *sys3[SYS_SIZE] = {};
+
+    Tree_node *root  = sys_tree(sys);
+    Tree_node *root2 = sys_tree(sys2);
+    Tree_node *root3 = sys_tree(sys3);
+
+    bool is_hit  = true;
+    bool is_hit2 = false;
+
+    Tree_node *diff  = is_ok ? Tree_cache_diff(cache, &root , sys , SYS_SIZE, "a", &is_hit ) : nullptr;
+    Tree_node *diff2 = is_ok ? Tree_cache_diff(cache, &root2, sys2, SYS_SIZE, "a", &is_hit2) : nullptr;
+
+    // the hit gives the derivative and the optimized input of the miss, which are the ones of diff_main()
+    Tree_node *diff3 = diff_main(&root3, sys3, "a");
+    if (diff3 != nullptr) Tree_optimize_main(&diff3);
+
+    is_ok = is_ok && diff != nullptr && !is_hit && is_hit2 && tree_equal(diff, diff2) && tree_equal(root, root2) &&
+                     tree_equal(diff, diff3) && tree_equal(root, root3);
+
+    // other vars are other entries
+    Tree_node *diff_x = is_ok ? Tree_cache_diff(cache, &root2, sys2, SYS_SIZE, "x", &is_hit2) : nullptr;
+    is_ok = is_ok && diff_x != nullptr && !is_hit2 && !tree_equal(diff_x, diff);
+
+    Tree_dtor(diff_x);
+    Tree_dtor(diff3);
+    Tree_dtor(diff2);
+    Tree_dtor(diff);
+    Tree_dtor(root3);
+    Tree_dtor(root2);
+    Tree_dtor(root);
+    sys_dtor (sys3);
+    sys_dtor (sys2);
+    sys_dtor (sys);
+
+    Tree_cache_close(cache);
+    dir_bytes(dir, true);
+
+    return is_ok;
+}
+
+static bool test_cache_evict()
+{
+    const int FUNCS = 5;
+
+    char dir[PATH_SIZE] = "/tmp/diff_cache_XXXXXX";
+    if (mkdtemp(dir) == nullptr) return false;
+
+    Tree_cache *cache  = Tree_cache_open(dir);
+    bool        is_ok  = cache != nullptr;
+    bool        is_hit = false;
+
+    for (int i = 0; is_ok && i < FUNCS; ++i)
+    {
+        Tree_node *diff = cache_diff(cache, i, &is_hit);
+        is_ok = diff != nullptr && !is_hit;
+
+        Tree_dtor(diff);
+        usleep(20000);  // the oldest file is evicted first, so the times must differ
+    }
+    Tree_cache_close(cache);
+
+    // one more derivative doesn't fit in the size of the five
+    long long max_bytes = dir_bytes(dir, false);
+
+    cache = is_ok ? Tree_cache_open(dir, max_bytes) : nullptr;
+    is_ok = cache != nullptr;
+
+    Tree_node *diff = is_ok ? cache_diff(cache, FUNCS, &is_hit) : nullptr;
+    is_ok = is_ok && diff != nullptr && !is_hit && dir_bytes(dir, false) <= max_bytes;
+    Tree_dtor(diff);
+
+    diff  = is_ok ? cache_diff(cache, FUNCS, &is_hit) : nullptr;    // the new one is kept
+    is_ok = is_ok && diff != nullptr && is_hit;
+    Tree_dtor(diff);
+
+    diff  = is_ok ? cache_diff(cache, 0, &is_hit) : nullptr;        // the oldest one is evicted
+    is_ok = is_ok && diff != nullptr && !is_hit && dir_bytes(dir, false) <= max_bytes;
+    Tree_dtor(diff);
+
+    Tree_cache_close(cache);
+    dir_bytes(dir, true);
+
+    return is_ok;
+}
+
+static bool test_eval_cache()
+{
+    const int POINTS = 10;
+
+    Tree_eval_cache *cache = Tree_eval_cache_new(64, 4);
+    if              (cache == nullptr) return false;
+
+    Tree_node *sys [SYS_SIZE] = {};
+    Tree_node *sys2[SYS_SIZE] = {};
+
+    // the same tree with other system variables
+    Tree_node *root  = sys_tree(sys);
+    Tree_node *root2 = sys_tree(sys2);
+
+    Tree_dtor(sys2[0]);
+    sys2[0] = Tree_parsing_buff("x*y+2\n");
+
+    bool is_ok = root != nullptr && root2 != nullptr && sys2[0] != nullptr &&
+                 Tree_hash(root, sys, SYS_SIZE) != Tree_hash(root2, sys2, SYS_SIZE);
+
+    unsigned long long expr = is_ok ? Tree_hash(root, sys, SYS_SIZE) : 0;
+
+    for (int pass = 0; is_ok && pass < 2; ++pass)   // misses, then hits
+    {
+        for (int i = 0; is_ok && i < POINTS; ++i)
+        {
+            double value  = Tree_get_value_cached  (cache, expr, root, sys, 0.1 * i, 2, 0.5);
+            double actual = Tree_get_value_in_point(root, sys, 0.1 * i, 2, 0.5);
+
+            is_ok = memcmp(&value, &actual, sizeof(double)) == 0;
+        }
+    }
+
+    long long hits   = 0;
+    long long misses = 0;
+    Tree_eval_cache_stats(cache, &hits, &misses);
+
+    is_ok = is_ok && hits == POINTS && misses == POINTS;
+
+    // even with the same key the trees don't share the entry
+    double value  = is_ok ? Tree_get_value_cached(cache, expr, root2, sys2, 0.3, 2, 0.5) : 0;
+    double actual = Tree_get_value_in_point(root2, sys2, 0.3, 2, 0.5);
+    double other  = Tree_get_value_in_point(root , sys , 0.3, 2, 0.5);
+
+    Tree_eval_cache_stats(cache, &hits, &misses);
+
+    is_ok = is_ok && memcmp(&value, &actual, sizeof(double)) == 0 && memcmp(&value, &other, sizeof(double)) != 0 &&
+                     hits == POINTS && misses == POINTS + 1;
+
+    value = is_ok ? Tree_get_value_cached(cache, expr, root, sys, 0.3, 2, 0.5) : 0;
+    is_ok = is_ok && memcmp(&value, &other, sizeof(double)) == 0;
+
+    Tree_dtor(root2);
+    Tree_dtor(root);
+    sys_dtor (sys2);
+    sys_dtor (sys);
+
+    Tree_eval_cache_delete(cache);
+    return is_ok;
+}
+
+static bool diff_fails(Tree_node *root)
+{
+    Tree_node *diff = diff_main(&root, nullptr, "x");
+    if        (diff == nullptr) return true;
+
+    Tree_dtor(diff);
+    return false;
+}
+
+/**
+*   In release the library skips the walk of Tree_verify() for the trees stamped in the current generation,
+*   so an invalid tree is found only if the change made a new generation.
+*/
+
+static bool test_verify_stamp()
+{
+    Tree_node *root = Tree_parsing_buff("x+y\n");   // stamped by the parser
+    if        (root == nullptr) return false;
+
+    Tree_node *leaf = root->left;
+
+    // "x" is an operator without operands now
+    leaf->type     = NODE_OP;
+    leaf->value.op = OP_ADD;
+    Tree_changed();
+
+    bool is_ok = diff_fails(root);
+
+    // the change isn't told, but a new node makes the next generation too
+    leaf->type      = NODE_VAR;
+    leaf->value.var = X;
+    Tree_changed();
+
+    is_ok = is_ok && !diff_fails(root);
+
+    leaf->type     = NODE_OP;
+    leaf->value.op = OP_ADD;
+
+    Tree_node *node = new_node_num(1);
+    is_ok = is_ok && diff_fails(root);
+
+    leaf->type      = NODE_VAR;
+    leaf->value.var = X;
+    Tree_changed();
+
+    Tree_dtor(node);
+    Tree_dtor(root);
+
+    return is_ok;
+}
+
+static bool integrate(const char *func, const char *vars, const double lo[3], const double hi[3], double *const value)
+{
+    Tree_node *root  = Tree_parsing_buff(func);
+    bool       is_ok = root != nullptr && Tree_integrate(root, nullptr, 0, vars, lo, hi, value);
+
+    Tree_dtor(root);
+    return is_ok;
+}
+
+static bool test_integrate()
+{
+    const double ZERO   [3] = {0   , 0, 0};
+    const double ONE    [3] = {1   , 1, 1};
+    const double PI     [3] = {M_PI, 0, 0};
+    const double BOX_LO [3] = {0   , 0, 0};
+    const double BOX_HI [3] = {M_PI, 1, 2};
+
+    double value = 0;
+
+    if (!integrate("sin(x)\n"   , "x", ZERO, PI , &value) || fabs(value - 2) > 1e-9) return false;
+    if (!integrate("sin(x)\n"   , "x", PI, ZERO , &value) || fabs(value + 2) > 1e-9) return false; // reversed
+
+    // the singularities at the ends are not in the nodes
+    if (!integrate("1/sqrt(x)\n", "x", ZERO, ONE, &value) || fabs(value - 2) > 1e-8) return false;
+    if (!integrate("ln(x)\n"    , "x", ZERO, ONE, &value) || fabs(value + 1) > 1e-8) return false;
+
+    // the product of the integrals 2, e - 1 and 8/3
+    if (!integrate("sin(x)*e^y*z^2\n", "zxy", BOX_LO, BOX_HI, &value)) return false;
+
+    return fabs(value - 2 * (M_E - 1) * 8 / 3) < 1e-8;
+}
+
+static bool test_integrate_fail()
+{
+    const double ZERO[3] = {0, 0, 0};
+    const double ONE [3] = {1, 1, 1};
+
+    double value = 0;
+
+    return !integrate("1/x\n", "x", ZERO, ONE, &value) && !integrate("x*y\n", "xx", ZERO, ONE, &value);
+}
+
+static double random_in(const double lo, const double hi)
+{
+    return lo + (hi - lo) * ((double) rand() / RAND_MAX);
+}
+
+/**
+*   @brief Checks that the range of each output of the tape contains its values in the corners of the box
+*          and in RANGE_POINTS random points inside, the points where the value is NAN are skipped.
+*/
+
+static bool range_encloses(const Tree_tape *tape, const int outs_num, const double vars_lo[3], const double vars_hi[3])
+{
+    double lo    [SYS_SIZE] = {};
+    double hi    [SYS_SIZE] = {};
+    double values[SYS_SIZE] = {};
+
+    if (outs_num > SYS_SIZE || !Tree_tape_range(tape, lo, hi, vars_lo, vars_hi)) return false;
+
+    for (int point = 0; point < 8 + RANGE_POINTS; ++point)
+    {
+        double vars[3] = {};
+
+        for (int i = 0; i < 3; ++i)
+        {
+            vars[i] = (point < 8) ? ((point >> i & 1) ? vars_hi[i] : vars_lo[i])
+                                  : random_in(vars_lo[i], vars_hi[i]);
+        }
+        Tree_tape_value(tape, values, vars[0], vars[1], vars[2]);
+
+        for (int out = 0; out < outs_num; ++out)
+        {
+            if (isnan(values[out])) continue;
+            if (!(lo[out] <= values[out] && values[out] <= hi[out]))
+            {
+                fprintf(stderr, "output %d = %lg in (%lg, %lg, %lg) is out of [%lg, %lg]\n",
+                                out, values[out], vars[0], vars[1], vars[2], lo[out], hi[out]);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+*   The functions of the corpus and their derivatives by x, y and z in random boxes: small and big ones,
+*   around 0, where many of them have poles and domain edges, and with some variables fixed.
+*/
+
+static bool test_range_corpus()
+{
+    Tree_batch batch = {};
+    if (!Tree_parsing_batch(CORPUS, &batch) || batch.size == 0) return false;
+
+    const char *const VARS[] = {"x", "y", "z"};
+
+    srand(48);
+    bool is_ok = true;
+
+    for (long long line = 0; is_ok && line < batch.size; ++line)
+    {
+        Tree_node *roots[4] = {batch.lines[line].root};
+        if        (roots[0] == nullptr) { is_ok = false; break; }
+
+        for (int i = 0; i < 3; ++i) roots[i + 1] = diff_main(&roots[0], nullptr, VARS[i]);
+
+        Tree_tape *tape = (roots[1] && roots[2] && roots[3]) ? Tree_tape_compile(roots, 4) : nullptr;
+        is_ok = tape != nullptr;
+
+        for (int box = 0; is_ok && box < RANGE_BOXES; ++box)
+        {
+            double vars_lo[3] = {};
+            double vars_hi[3] = {};
+
+            for (int i = 0; i < 3; ++i)
+            {
+                double width = (box % 3 == 0) ? 1e-3 : (box % 3 == 1) ? 0.5 : 4;
+
+                vars_lo[i] = random_in(-3, 3);
+                vars_hi[i] = (box % 5 == i) ? vars_lo[i] : vars_lo[i] + random_in(0, width);
+            }
+
+            is_ok = range_encloses(tape, 4, vars_lo, vars_hi);
+        }
+
+        Tree_tape_delete(tape);
+        for (int i = 1; i < 4; ++i) Tree_dtor(roots[i]);
+
+        batch.lines[line].root = roots[0];  // diff_main() may replace the root by the optimized one
+    }
+
+    Tree_batch_dtor(&batch);
+    return is_ok;
+}
+
+/**
+*   @brief The bound is the expected one up to the rounding of libm, the infinities and NAN exactly.
+*/
+
+static bool range_bound_equal(const double bound, const double expected)
+{
+    if (isnan(expected) || isinf(expected)) return memcmp(&bound, &expected, sizeof(double)) == 0 ||
+                                                   (isnan(bound) && isnan(expected));
+
+    return fabs(bound - expected) <= 1e-12 * fmax(1, fabs(expected));
+}
+
+static bool test_range_edges()
+{
+    const Range_case CASES[] =
+    {
+        {"tg(x)\n"      ,  1  , 2  , -INFINITY        , INFINITY        },  // pole in pi/2
+        {"tg(x)\n"      , -5  , -4.5, -INFINITY        , INFINITY        },  // pole in -3 pi/2
+        {"tg(x)\n"      , -1  , 1  , tan(-1)          , tan(1)          },
+        {"x^3\n"        , -2  , 1  , -8               , 1               },
+        {"x^2\n"        , -2  , 1  , 0                , 4               },
+        {"x^2\n"        , -3  , -2 , 4                , 9               },
+        {"x^(0-1)\n"    , -1  , 2  , -INFINITY        , INFINITY        },
+        {"x^(0-1)\n"    ,  0.5, 2  , 0.5              , 2               },
+        {"x^(0-2)\n"    , -1  , 2  , 0.25             , INFINITY        },
+        {"1/x\n"        , -1  , 2  , -INFINITY        , INFINITY        },
+        {"1/x\n"        ,  0  , 1  , -INFINITY        , INFINITY        },  // 0 in the end
+        {"1/(x-1)\n"    ,  2  , 3  , 0.5              , 1               },
+        {"ln(x)\n"      , -1  , 1  , -INFINITY        , 0               },
+        {"ln(x)\n"      , -2  , -1 , NAN              , NAN             },
+        {"sqrt(x)\n"    , -1  , 4  , 0                , 2               },
+        {"sqrt(x)\n"    , -2  , -1 , NAN              , NAN             },
+        {"arcsin(x)\n"  ,  0.5, 2  , asin(0.5)        , M_PI / 2        },
+        {"arcsin(x)\n"  , -3  , -1 , -M_PI / 2        , -M_PI / 2       },  // the edge only
+        {"arcsin(x)\n"  ,  1.5, 2  , NAN              , NAN             },
+    };
+
+    srand(48);
+
+    for (const Range_case &test : CASES)
+    {
+        Tree_node *root = Tree_parsing_buff(test.func);
+        Tree_tape *tape = (root == nullptr) ? nullptr : Tree_tape_compile(&root, 1);
+
+        const double vars_lo[3] = {test.x_lo, 0, 0};
+        const double vars_hi[3] = {test.x_hi, 0, 0};
+
+        double lo = 0;
+        double hi = 0;
+
+        bool is_ok = tape != nullptr && Tree_tape_range(tape, &lo, &hi, vars_lo, vars_hi) &&
+                     !(lo > test.lo) && !(hi < test.hi)                                     &&
+                     range_bound_equal(lo, test.lo) && range_bound_equal(hi, test.hi)       &&
+                     range_encloses(tape, 1, vars_lo, vars_hi);
+
+        if (tape != nullptr && !is_ok)
+        {
+            fprintf(stderr, "range of %.*s in [%lg, %lg] is [%lg, %lg]\n", (int) strlen(test.func) - 1, test.func,
+                                                                           test.x_lo, test.x_hi, lo, hi);
+        }
+
+        Tree_tape_delete(tape);
+        Tree_dtor(root);
+
+        if (!is_ok) return false;
+    }
+
+    return true;
+}
+
+static const Vec_case VEC_CASES[] =
+{
+    {"sin" , vec_sin , vec_sin , sin , sinl , point_trig , 0.8},
+    {"cos" , vec_cos , vec_cos , cos , cosl , point_trig , 0.8},
+    {"tan" , vec_tan , vec_tan , tan , tanl , point_trig , 2.3},
+    {"log" , vec_log , vec_log , log , logl , point_log  , 0.9},
+    {"sqrt", vec_sqrt, vec_sqrt, sqrt, sqrtl, point_log  , 0.5},
+    {"sinh", vec_sinh, vec_sinh, sinh, sinhl, point_hyper, 1.7},
+    {"cosh", vec_cosh, vec_cosh, cosh, coshl, point_hyper, 1.7},
+    {"asin", vec_asin, vec_asin, asin, asinl, point_unit , 0.9},
+    {"acos", vec_acos, vec_acos, acos, acosl, point_unit , 0.9},
+    {"atan", vec_atan, vec_atan, atan, atanl, point_any  , 0.9},
+};
+
+static const double POW_ULPS = 1.4;
+
+/**
+*   @brief |x| <= 2^20, a quarter of them near the multiples of pi/2.
+*/
+
+static double point_trig(const bool)
+{
+    if (rand() % 4 == 0) return round(random_in(-1000, 1000)) * M_PI_2 + random_in(-1e-6, 1e-6);
+
+    return ((rand() % 2) ? 1 : -1) * exp2(random_in(-30, 20));
+}
+
+/**
+*   @brief Normal positive numbers, a quarter of them near 1.
+*/
+
+static double point_log(const bool is_float)
+{
+    if (rand() % 4 == 0) return 1 + random_in(-1e-3, 1e-3);
+
+    return is_float ? exp2(random_in(FLT_MIN_EXP - 1, FLT_MAX_EXP - 0.1))
+                    : exp2(random_in(DBL_MIN_EXP - 1, DBL_MAX_EXP - 0.1));
+}
+
+static double point_hyper(const bool is_float)
+{
+    if (rand() % 2 == 0) return random_in(-1, 1);
+
+    return is_float ? random_in(-89, 89) : random_in(-708, 708);
+}
+
+static double point_unit(const bool)
+{
+    return random_in(-1, 1);
+}
+
+static double point_any(const bool)
+{
+    return ((rand() % 2) ? 1 : -1) * exp2(random_in(-60, 60));
+}
+
+/**
+*   @brief Error of the value in the ulps of double or float, the ulps of the subnormals are the ones of DBL_MIN
+*          or FLT_MIN.
+*/
+
+static double vec_ulps(const double value, const long double exact, const bool is_float)
+{
+    int exp  = is_float ? ilogbf((float) exact) : ilogb((double) exact);
+    int min  = is_float ? FLT_MIN_EXP - 1       : DBL_MIN_EXP - 1;
+    int mant = is_float ? FLT_MANT_DIG          : DBL_MANT_DIG;
+
+    if (exp < min) exp = min;
+
+    return (double) (fabsl((long double) value - exact) / ldexpl(1, exp - mant + 1));
+}
+
+/**
+*   @brief The scalar level and the special results (NAN, infinities and zeros) are the ones of libm bit by bit,
+*          the other values are within "ulps" of the exact one.
+*/
+
+static bool vec_value_ok(const double value, const double libm, const long double exact, const double ulps,
+                                                                const bool is_float,     const bool is_scalar)
+{
+    if (isnan(libm)) return isnan(value);
+
+    if (is_scalar || isinf(libm) || fpclassify(libm) == FP_ZERO) return memcmp(&value, &libm, sizeof(double)) == 0;
+
+    return vec_ulps(value, exact, is_float) <= ulps;
+}
+
+/**
+*   @brief Computes the function of VEC_SPECIALS and of random points of its range at once and checks the values.
+*/
+
+static bool vec_unary_check(const Vec_case *test, const bool is_float, const bool is_scalar)
+{
+    const int SPECIALS_NUM = (int) (sizeof(VEC_SPECIALS) / sizeof(VEC_SPECIALS[0]));
+
+    double *args    = (double *) calloc(VEC_POINTS, sizeof(double));
+    double *doubles = (double *) calloc(VEC_POINTS, sizeof(double));
+    float  *floats  = (float  *) calloc(VEC_POINTS, sizeof(float ));
+
+    bool is_ok = args != nullptr && doubles != nullptr && floats != nullptr;
+
+    for (int i = 0; is_ok && i < VEC_POINTS; ++i)
+    {
+        args[i] = (i < SPECIALS_NUM) ? VEC_SPECIALS[i] : test->point(is_float);
+        if (is_float) args[i] = (float) args[i];
+
+        doubles[i] = args[i];
+        floats [i] = (float) args[i];
+    }
+
+    if (is_ok &&  is_float) test->vec_float (floats , VEC_POINTS);
+    if (is_ok && !is_float) test->vec_double(doubles, VEC_POINTS);
+
+    for (int i = 0; is_ok && i < VEC_POINTS; ++i)
+    {
+        double value = is_float ? floats[i] : doubles[i];
+        double libm  = is_float ? (float) test->libm(args[i]) : test->libm(args[i]);
+
+        is_ok = vec_value_ok(value, libm, test->exact(args[i]), is_float ? FLOAT_ULPS : test->ulps, is_float,
+                                                                                                   is_scalar);
+        if (!is_ok)
+        {
+            fprintf(stderr, "vec_%s(%a) = %a, libm %a, level %d, %s\n", test->name, args[i], value, libm,
+                                                                       (int) vec_level(), is_float ? "float" : "double");
+        }
+    }
+
+    free(floats);
+    free(doubles);
+    free(args);
+
+    return is_ok;
+}
+
+/**
+*   @brief The same for pow() on all the pairs of POW_SPECIALS and random points, where |y ln|x|| <= 708 for
+*          double and the negative bases have integer exponents.
+*/
+
+static bool vec_pow_check(const bool is_float, const bool is_scalar)
+{
+    const int SPECIALS_NUM = (int) (sizeof(POW_SPECIALS) / sizeof(POW_SPECIALS[0]));
+
+    double *base       = (double *) calloc(VEC_POINTS, sizeof(double));
+    double *exp        = (double *) calloc(VEC_POINTS, sizeof(double));
+    double *doubles    = (double *) calloc(VEC_POINTS, sizeof(double));
+    float  *floats     = (float  *) calloc(VEC_POINTS, sizeof(float ));
+    float  *floats_exp = (float  *) calloc(VEC_POINTS, sizeof(float ));
+
+    bool is_ok = base != nullptr && exp != nullptr && doubles != nullptr && floats != nullptr && floats_exp != nullptr;
+
+    for (int i = 0; is_ok && i < VEC_POINTS; ++i)
+    {
+        if (i < SPECIALS_NUM * SPECIALS_NUM)
+        {
+            base[i] = POW_SPECIALS[i / SPECIALS_NUM];
+            exp [i] = POW_SPECIALS[i % SPECIALS_NUM];
+        }
+        else if (is_float)
+        {
+            base[i] = (float) exp2(random_in(-20, 20));
+            exp [i] = (float) random_in(-20, 20);
+        }
+        else
+        {
+            base[i] = (rand() % 4 == 0) ? 1 + random_in(-1e-6, 1e-6) : exp2(random_in(-60, 60));
+            exp [i] = random_in(-1, 1) * fmin(512, 1000 / fmax(fabs(log2(base[i])), 1));
+        }
+        if (i >= SPECIALS_NUM * SPECIALS_NUM && rand() % 4 == 0)
+        {
+            base[i] = -base[i];
+            exp [i] = round(exp[i]);
+        }
+        if (is_float)
+        {
+            base[i] = (float) base[i];
+            exp [i] = (float) exp [i];
+        }
+
+        doubles   [i] = base[i];
+        floats    [i] = (float) base[i];
+        floats_exp[i] = (float) exp [i];
+    }
+
+    if (is_ok &&  is_float) vec_pow(floats , floats_exp, VEC_POINTS);
+    if (is_ok && !is_float) vec_pow(doubles, exp       , VEC_POINTS);
+
+    for (int i = 0; is_ok && i < VEC_POINTS; ++i)
+    {
+        double value = is_float ? floats[i] : doubles[i];
+        double libm  = is_float ? (float) pow(base[i], exp[i]) : pow(base[i], exp[i]);
+
+        is_ok = vec_value_ok(value, libm, powl(base[i], exp[i]), is_float ? FLOAT_ULPS : POW_ULPS, is_float,
+                                                                                                 is_scalar);
+        if (!is_ok)
+        {
+            fprintf(stderr, "vec_pow(%a, %a) = %a, libm %a, level %d, %s\n", base[i], exp[i], value, libm,
+                                                                            (int) vec_level(), is_float ? "float" : "double");
+        }
+    }
+
+    free(floats_exp);
+    free(floats);
+    free(doubles);
+    free(exp);
+    free(base);
+
+    return is_ok;
+}
+
+/**
+*   Every level supported by the processor is forced by vec_level_set() and checked in double and in float, then
+*   the best level is restored.
+*/
+
+static bool test_vec_math()
+{
+    bool is_ok = true;
+
+    for (int level = VEC_SCALAR; is_ok && level <= VEC_AVX512; ++level)
+    {
+        if (vec_level_set((VEC_LEVEL) level) != level) continue;    // not supported by the processor
+
+        srand(50);
+        bool is_scalar = level == VEC_SCALAR;
+
+        for (const Vec_case &test : VEC_CASES)
+        {
+            is_ok = is_ok && vec_unary_check(&test, false, is_scalar) && vec_unary_check(&test, true, is_scalar);
+        }
+
+        is_ok = is_ok && vec_pow_check(false, is_scalar) && vec_pow_check(true, is_scalar);
+    }
+
+    vec_level_set(VEC_AVX512);
+    return is_ok;
+}
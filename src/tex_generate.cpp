@@ -31,13 +31,14 @@ const int HEIGHT = 450;
 
 int main(int argc, const char *argv[])
 {
-    if (argc != 1)
+    if (argc != 2)
     {
         fprintf(stderr, "you should give file to parse\n");
         return 0;
     }
 
-    int buff_size = 0;
-    const char *buff       = nullptr;
-    const char *buff_begin = buff = read_file();
+    int   buff_size  = 0;
+    char *buff_begin = (char *) read_file(argv[1], &buff_size);
+
+    log_free(buff_begin);
 }
\ No newline at end of file